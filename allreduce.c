@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "allreduce.h"
+#include "transport.h"
+#include "kernels.h"
+#include "utils.h"
+
+/* Number of bytes exchanged at a time by allreduce_sum() */
+#define ALLREDUCE_CHUNK (1 << 20)
+
+/* Milliseconds between two attempts to connect to the first process */
+#define ALLREDUCE_RETRY_MSEC 100
+
+void allreduce_reset(allreduce *ar)
+{
+	ar->rank = 0;
+	ar->num_processes = 1;
+	ar->listen_fd = -1;
+	ar->unix_path = NULL;
+	ar->fds = NULL;
+	ar->buffer = NULL;
+}
+
+/* Accepts the connections of the other processes */
+static
+int allreduce_accept(allreduce *ar)
+{
+	unsigned int i, hello[3];
+	int fd;
+
+	for (i = 1; i < ar->num_processes; i++) {
+		fd = accept(ar->listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR) {
+				i--;
+				continue;
+			}
+			error("could not accept connection: %s",
+			      strerror(errno));
+			return FALSE;
+		}
+
+		if (!transport_recv(fd, hello, sizeof(hello))) {
+			close(fd);
+			return FALSE;
+		}
+		if (hello[0] != ALLREDUCE_MAGIC
+		    || hello[1] != ar->num_processes
+		    || hello[2] == 0 || hello[2] >= ar->num_processes
+		    || ar->fds[hello[2]] >= 0) {
+			error("invalid process joining the group");
+			close(fd);
+			return FALSE;
+		}
+		ar->fds[hello[2]] = fd;
+	}
+	return TRUE;
+}
+
+/* Connects to the first process, waiting for it to start */
+static
+int allreduce_connect(allreduce *ar, const char *address)
+{
+	struct timespec delay;
+	unsigned int hello[3];
+	double start;
+	int fd;
+
+	delay.tv_sec = 0;
+	delay.tv_nsec = ALLREDUCE_RETRY_MSEC * 1000000L;
+	start = get_time();
+	while (TRUE) {
+		fd = transport_connect(address);
+		if (fd >= 0) break;
+		if (errno != ECONNREFUSED && errno != ENOENT) {
+			error("could not connect to `%s': %s", address,
+			      strerror(errno));
+			return FALSE;
+		}
+		if (get_time() - start > ALLREDUCE_CONNECT_TIMEOUT) {
+			error("timeout connecting to `%s'", address);
+			return FALSE;
+		}
+		nanosleep(&delay, NULL);
+	}
+	ar->fds[0] = fd;
+
+	hello[0] = ALLREDUCE_MAGIC;
+	hello[1] = ar->num_processes;
+	hello[2] = ar->rank;
+	return transport_send(fd, hello, sizeof(hello));
+}
+
+/* Joins the group of `num_processes' processes on `address' as the
+ * process `rank'. A group of one process needs no address.
+ */
+int allreduce_initialize(allreduce *ar, const char *address,
+                         unsigned int rank, unsigned int num_processes)
+{
+	unsigned int i;
+
+	allreduce_reset(ar);
+	if (num_processes == 0 || rank >= num_processes) {
+		error("invalid rank %u of %u processes", rank, num_processes);
+		return FALSE;
+	}
+	ar->rank = rank;
+	ar->num_processes = num_processes;
+
+	ar->fds = (int *) xmalloc(num_processes * sizeof(int));
+	if (!ar->fds) goto error_init;
+	for (i = 0; i < num_processes; i++)
+		ar->fds[i] = -1;
+
+	ar->buffer = xmalloc(ALLREDUCE_CHUNK);
+	if (!ar->buffer) goto error_init;
+
+	if (num_processes == 1)
+		return TRUE;
+
+	if (!address) {
+		error("several processes need an address");
+		goto error_init;
+	}
+
+	if (rank == 0) {
+		printf("Waiting for the other processes on `%s'...\n",
+		       address);
+		ar->listen_fd = transport_listen(address, &ar->unix_path);
+		if (ar->listen_fd < 0) goto error_init;
+		if (!allreduce_accept(ar)) goto error_init;
+	} else {
+		printf("Joining `%s' as process %u of %u...\n",
+		       address, rank, num_processes);
+		if (!allreduce_connect(ar, address)) goto error_init;
+	}
+	return TRUE;
+
+error_init:
+	allreduce_cleanup(ar);
+	return FALSE;
+}
+
+void allreduce_cleanup(allreduce *ar)
+{
+	unsigned int i;
+
+	if (ar->fds) {
+		for (i = 0; i < ar->num_processes; i++) {
+			if (ar->fds[i] >= 0) close(ar->fds[i]);
+		}
+		free(ar->fds);
+	}
+	if (ar->listen_fd >= 0) close(ar->listen_fd);
+	if (ar->unix_path) {
+		unlink(ar->unix_path);
+		free(ar->unix_path);
+	}
+	if (ar->buffer) free(ar->buffer);
+	allreduce_reset(ar);
+}
+
+/* Replaces the `n' elements of type `type' (KERNEL_DOUBLE or
+ * KERNEL_FLOAT) in `data' by their sum over all the processes.
+ * The data is exchanged in chunks, each of which is sent back
+ * before the next one is read, so no process blocks on a full
+ * socket.
+ */
+int allreduce_sum(allreduce *ar, int type, void *data, size_t n)
+{
+	unsigned int r;
+	size_t pos, count, size;
+	char *ptr;
+
+	if (ar->num_processes == 1)
+		return TRUE;
+
+	for (pos = 0; pos < n; pos += count) {
+		count = MIN(n - pos, ALLREDUCE_CHUNK / KERNEL_SIZE(type));
+		ptr = (char *) data + pos * KERNEL_SIZE(type);
+		size = count * KERNEL_SIZE(type);
+
+		if (ar->rank > 0) {
+			if (!transport_send(ar->fds[0], ptr, size))
+				return FALSE;
+			if (!transport_recv(ar->fds[0], ptr, size))
+				return FALSE;
+			continue;
+		}
+
+		for (r = 1; r < ar->num_processes; r++) {
+			if (!transport_recv(ar->fds[r], ar->buffer, size))
+				return FALSE;
+			kernels_add(type, ptr, ar->buffer, count);
+		}
+		for (r = 1; r < ar->num_processes; r++) {
+			if (!transport_send(ar->fds[r], ptr, size))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/* Copies the `size' bytes of `data' of the first process to the
+ * other processes.
+ */
+int allreduce_broadcast(allreduce *ar, void *data, size_t size)
+{
+	unsigned int r;
+
+	if (ar->num_processes == 1)
+		return TRUE;
+
+	if (ar->rank > 0)
+		return transport_recv(ar->fds[0], data, size);
+
+	for (r = 1; r < ar->num_processes; r++) {
+		if (!transport_send(ar->fds[r], data, size))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* Concatenates the data of all the processes, in the order of their
+ * ranks, in `out' of the first process, which has room for
+ * `capacity' bytes. The other processes ignore `out'.
+ */
+int allreduce_gather(allreduce *ar, const void *data, size_t size,
+                     void *out, size_t capacity)
+{
+	unsigned int r, header[2];
+	size_t offset, length;
+
+	if (ar->rank > 0) {
+		header[0] = (unsigned int) (size & 0xFFFFFFFFUL);
+		header[1] = (unsigned int) ((size >> 16) >> 16);
+		if (!transport_send(ar->fds[0], header, sizeof(header)))
+			return FALSE;
+		return transport_send(ar->fds[0], data, size);
+	}
+
+	if (size > capacity) goto error_gather;
+	memcpy(out, data, size);
+	offset = size;
+	for (r = 1; r < ar->num_processes; r++) {
+		if (!transport_recv(ar->fds[r], header, sizeof(header)))
+			return FALSE;
+		length = ((((size_t) header[1]) << 16) << 16)
+		         | (size_t) header[0];
+		if (length > capacity - offset) goto error_gather;
+		if (!transport_recv(ar->fds[r], (char *) out + offset, length))
+			return FALSE;
+		offset += length;
+	}
+	return TRUE;
+
+error_gather:
+	error("gathered data larger than expected");
+	return FALSE;
+}
+
+/* Waits until all the processes reach the barrier */
+int allreduce_barrier(allreduce *ar)
+{
+	double one = 1;
+
+	return allreduce_sum(ar, KERNEL_DOUBLE, &one, 1);
+}
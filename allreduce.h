@@ -0,0 +1,46 @@
+#ifndef __ALLREDUCE_H
+#define __ALLREDUCE_H
+
+#include <stddef.h>
+
+/* Constants */
+#define ALLREDUCE_MAGIC           0x52444C41 /* "ALDR" */
+
+/* Seconds that the other processes wait for the first one */
+#define ALLREDUCE_CONNECT_TIMEOUT 60
+
+/* Data structures and types */
+
+/* A group of `num_processes' processes that combine their data. The
+ * process of rank 0 listens on the address, and the others connect to
+ * it. The data goes through the first process: it adds the data of the
+ * others in the order of their ranks and sends the result back, so all
+ * the processes get exactly the same values.
+ */
+typedef
+struct allreduce_st {
+	unsigned int rank, num_processes;
+	int listen_fd;
+	char *unix_path;
+
+	/* In the first process, fds[rank] is the connection to the
+	 * process `rank'; in the others, fds[0] is the connection to
+	 * the first process.
+	 */
+	int *fds;
+	void *buffer;
+} allreduce;
+
+/* Functions */
+void allreduce_reset(allreduce *ar);
+int allreduce_initialize(allreduce *ar, const char *address,
+                         unsigned int rank, unsigned int num_processes);
+void allreduce_cleanup(allreduce *ar);
+
+int allreduce_sum(allreduce *ar, int type, void *data, size_t n);
+int allreduce_broadcast(allreduce *ar, void *data, size_t size);
+int allreduce_gather(allreduce *ar, const void *data, size_t size,
+                     void *out, size_t capacity);
+int allreduce_barrier(allreduce *ar);
+
+#endif /* __ALLREDUCE_H */
@@ -7,7 +7,7 @@
 #include "utils.h"
 
 static
-const char *argtype_names[] = { "", "file", "uint", "dbl" };
+const char *argtype_names[] = { "", "file", "uint", "dbl", "str" };
 
 void print_help(const char *prog_name, option *opts, unsigned int num_opts)
 {
@@ -55,6 +55,7 @@ int process_args(int argc, char **argv, option *opts, unsigned int num_opts)
 				}
 				switch(opts[j].argtype) {
 				case ARGTYPE_FILE:
+				case ARGTYPE_STR:
 					pstr = (char **) opts[j].ptr;
 					*pstr = argv[++i];
 					break;
@@ -7,6 +7,7 @@
 #define ARGTYPE_FILE   1
 #define ARGTYPE_UINT   2
 #define ARGTYPE_DBL    3
+#define ARGTYPE_STR    4
 
 /* Data structures and types */
 typedef
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "utils.h"
+
+static volatile sig_atomic_t checkpoint_signal;
+
+static
+void checkpoint_handler(int sig)
+{
+	checkpoint_signal = sig;
+}
+
+void checkpoint_reset(checkpoint *cp)
+{
+	cp->filename = NULL;
+	cp->interval = CHECKPOINT_INTERVAL;
+	cp->seconds = 0;
+	cp->last_iteration = 0;
+	cp->last_time = 0;
+	cp->save = NULL;
+	cp->discard = NULL;
+	cp->snapshot = NULL;
+	cp->started = FALSE;
+	cp->busy = FALSE;
+	cp->quit = FALSE;
+	cp->failed = FALSE;
+}
+
+/* Writes the snapshots handed by checkpoint_write(), one at a time */
+static
+void *checkpoint_thread(void *arg)
+{
+	checkpoint *cp = (checkpoint *) arg;
+	void *snapshot;
+	int ret;
+
+	pthread_mutex_lock(&cp->mutex);
+	while (TRUE) {
+		while (!cp->snapshot && !cp->quit)
+			pthread_cond_wait(&cp->cond, &cp->mutex);
+		if (!cp->snapshot) break;
+
+		snapshot = cp->snapshot;
+		cp->snapshot = NULL;
+		pthread_mutex_unlock(&cp->mutex);
+
+		ret = cp->save(snapshot, cp->filename);
+		cp->discard(snapshot);
+
+		pthread_mutex_lock(&cp->mutex);
+		if (!ret) cp->failed = TRUE;
+		cp->busy = FALSE;
+		pthread_cond_broadcast(&cp->cond);
+	}
+	pthread_mutex_unlock(&cp->mutex);
+	return NULL;
+}
+
+/* Starts writing checkpoints to `filename' every `interval'
+ * iterations and every `seconds' seconds (either one may be zero),
+ * and when the process receives SIGINT or SIGTERM. The handlers are
+ * reset by the first signal, so a second one ends the process.
+ */
+int checkpoint_initialize(checkpoint *cp, const char *filename,
+                          unsigned int interval, double seconds,
+                          checkpoint_save_fn save,
+                          checkpoint_free_fn discard)
+{
+	struct sigaction sa;
+
+	checkpoint_reset(cp);
+	cp->interval = interval;
+	cp->seconds = seconds;
+	cp->save = save;
+	cp->discard = discard;
+	cp->last_time = get_time();
+
+	cp->filename = xstrdup(filename);
+	if (!cp->filename) return FALSE;
+
+	if (pthread_mutex_init(&cp->mutex, NULL) != 0)
+		goto error_init;
+	if (pthread_cond_init(&cp->cond, NULL) != 0) {
+		pthread_mutex_destroy(&cp->mutex);
+		goto error_init;
+	}
+	if (pthread_create(&cp->thread, NULL, &checkpoint_thread, cp) != 0) {
+		pthread_cond_destroy(&cp->cond);
+		pthread_mutex_destroy(&cp->mutex);
+		goto error_init;
+	}
+	cp->started = TRUE;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = &checkpoint_handler;
+	sa.sa_flags = (int) (SA_RESETHAND | SA_RESTART);
+	sigemptyset(&sa.sa_mask);
+	checkpoint_signal = 0;
+	sigaction(SIGINT, &sa, &cp->old_int);
+	sigaction(SIGTERM, &sa, &cp->old_term);
+	return TRUE;
+
+error_init:
+	error("could not start the checkpoint thread");
+	free(cp->filename);
+	checkpoint_reset(cp);
+	return FALSE;
+}
+
+/* Waits for the last checkpoint to be written */
+void checkpoint_cleanup(checkpoint *cp)
+{
+	if (cp->started) {
+		pthread_mutex_lock(&cp->mutex);
+		cp->quit = TRUE;
+		pthread_cond_broadcast(&cp->cond);
+		pthread_mutex_unlock(&cp->mutex);
+		pthread_join(cp->thread, NULL);
+
+		pthread_cond_destroy(&cp->cond);
+		pthread_mutex_destroy(&cp->mutex);
+
+		sigaction(SIGINT, &cp->old_int, NULL);
+		sigaction(SIGTERM, &cp->old_term, NULL);
+	}
+	if (cp->filename) free(cp->filename);
+	checkpoint_reset(cp);
+}
+
+/* Checks whether the process received SIGINT or SIGTERM */
+int checkpoint_interrupted(void)
+{
+	return (checkpoint_signal != 0);
+}
+
+/* Checks whether a checkpoint should be written after the iteration
+ * `iteration' (counting from one). A checkpoint that falls due while
+ * the previous one is still being written is postponed, so the
+ * training never waits for the disk, except when interrupted.
+ */
+int checkpoint_due(checkpoint *cp, unsigned int iteration)
+{
+	int busy;
+
+	if (!cp->started) return FALSE;
+	if (checkpoint_interrupted()) return TRUE;
+
+	pthread_mutex_lock(&cp->mutex);
+	busy = cp->busy;
+	pthread_mutex_unlock(&cp->mutex);
+	if (busy) return FALSE;
+
+	if (cp->interval > 0
+	    && iteration >= cp->last_iteration + cp->interval)
+		return TRUE;
+	if (cp->seconds > 0 && get_time() - cp->last_time >= cp->seconds)
+		return TRUE;
+	return FALSE;
+}
+
+/* Hands `snapshot', taken after the iteration `iteration', to the
+ * background thread, which writes and frees it. Returns FALSE if a
+ * previous checkpoint could not be written.
+ */
+int checkpoint_write(checkpoint *cp, void *snapshot, unsigned int iteration)
+{
+	int ret;
+
+	pthread_mutex_lock(&cp->mutex);
+	while (cp->busy)
+		pthread_cond_wait(&cp->cond, &cp->mutex);
+	ret = !cp->failed;
+	if (ret) {
+		cp->snapshot = snapshot;
+		cp->busy = TRUE;
+		pthread_cond_broadcast(&cp->cond);
+	}
+	pthread_mutex_unlock(&cp->mutex);
+
+	if (!ret) {
+		cp->discard(snapshot);
+		return FALSE;
+	}
+	printf("Saving checkpoint `%s' in the background...\n",
+	       cp->filename);
+	cp->last_iteration = iteration;
+	cp->last_time = get_time();
+	return TRUE;
+}
+
+/* Waits until the pending checkpoint is written. Returns FALSE if a
+ * checkpoint could not be written.
+ */
+int checkpoint_wait(checkpoint *cp)
+{
+	int ret;
+
+	if (!cp->started) return TRUE;
+
+	pthread_mutex_lock(&cp->mutex);
+	while (cp->busy)
+		pthread_cond_wait(&cp->cond, &cp->mutex);
+	ret = !cp->failed;
+	pthread_mutex_unlock(&cp->mutex);
+	return ret;
+}
@@ -0,0 +1,56 @@
+#ifndef __CHECKPOINT_H
+#define __CHECKPOINT_H
+
+#include <signal.h>
+#include <pthread.h>
+
+/* Constants */
+
+/* Default number of iterations between two checkpoints */
+#define CHECKPOINT_INTERVAL       10
+
+/* Data structures and types */
+
+/* Writes a snapshot to `filename', and frees a snapshot */
+typedef int (*checkpoint_save_fn)(void *snapshot, const char *filename);
+typedef void (*checkpoint_free_fn)(void *snapshot);
+
+/* The checkpoints of a training. A snapshot of the model is taken
+ * in the training thread and handed to a background thread, which
+ * writes it while the training goes on.
+ */
+typedef
+struct checkpoint_st {
+	char *filename;
+	unsigned int interval; /* in iterations, or 0 */
+	double seconds; /* in wall-clock seconds, or 0 */
+	unsigned int last_iteration;
+	double last_time;
+
+	checkpoint_save_fn save;
+	checkpoint_free_fn discard;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	void *snapshot; /* waiting to be written */
+	int started, busy, quit, failed;
+
+	/* The signal handlers replaced during the training */
+	struct sigaction old_int, old_term;
+} checkpoint;
+
+/* Functions */
+void checkpoint_reset(checkpoint *cp);
+int checkpoint_initialize(checkpoint *cp, const char *filename,
+                          unsigned int interval, double seconds,
+                          checkpoint_save_fn save,
+                          checkpoint_free_fn discard);
+void checkpoint_cleanup(checkpoint *cp);
+
+int checkpoint_due(checkpoint *cp, unsigned int iteration);
+int checkpoint_interrupted(void);
+int checkpoint_write(checkpoint *cp, void *snapshot, unsigned int iteration);
+int checkpoint_wait(checkpoint *cp);
+
+#endif /* __CHECKPOINT_H */
@@ -2,15 +2,45 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 
 #include "docinfo.h"
 #include "hashtable.h"
+#include "parallel.h"
+#include "topk.h"
 #include "utils.h"
+#include "vocab.h"
 
 #define INITIAL_WORDSTATS_CAPACITY  8192
 #define INITIAL_DOCUMENTS_CAPACITY  1024
 #define INITIAL_WORDS_CAPACITY      8192
 
+/* Smallest part of a file read by a thread of its own */
+#define MIN_PART_SIZE               (1 << 20)
+
+/* A part of the file, read by one thread into a DOCINFO of its own.
+ * The words of the part have their index in the whole vocabulary in
+ * `map', and the last wordstats of the parts before in `prev'. Their
+ * ranks in the vocabulary follow `first_rank'.
+ */
+typedef
+struct docinfo_part_st {
+	docinfo doc;
+	size_t start, end;
+	unsigned int *map, *prev;
+	unsigned int documents_offset, words_offset, wordstats_offset;
+	unsigned int first_rank;
+	int ok;
+} docinfo_part;
+
+typedef
+struct docinfo_parts_st {
+	docinfo *doc;
+	const char *master_file;
+	docinfo_part *parts;
+	vocab v;
+} docinfo_parts;
+
 void docinfo_reset(docinfo *doc)
 {
 	hashtable_reset(&doc->ht);
@@ -100,6 +130,197 @@ void docinfo_clear(docinfo *doc, int keep_strings)
 	doc->words_length = 0;
 }
 
+/* Keeps only the documents in the range [first, end) (counting from
+ * zero), with their words and wordstats, so that a process can work on
+ * a shard of the collection. The vocabulary is kept whole, and the
+ * word counters are recomputed for the documents kept.
+ */
+int docinfo_shard(docinfo *doc, unsigned int first, unsigned int end)
+{
+	docinfo_wordstats *wordstats;
+	hashtable_entry *entry;
+	unsigned int i, l, n, offset, *map;
+
+	end = MIN(end, doc->documents_length);
+	first = MIN(first, end);
+
+	map = (unsigned int *) xmalloc((doc->wordstats_length + 1)
+	                               * sizeof(unsigned int));
+	if (!map) return FALSE;
+
+	for (i = 1; i <= hashtable_num_entries(&doc->ht); i++) {
+		entry = hashtable_get_entry(&doc->ht, i);
+		entry->count = 0;
+		entry->val.uintval = 0;
+	}
+
+	/* The wordstats are sorted by document */
+	map[0] = 0;
+	n = 0;
+	for (l = 0; l < doc->wordstats_length; l++) {
+		wordstats = &doc->wordstats[l];
+		map[l + 1] = 0;
+		if (wordstats->document <= first || wordstats->document > end)
+			continue;
+
+		map[l + 1] = ++n;
+		doc->wordstats[n - 1] = *wordstats;
+		wordstats = &doc->wordstats[n - 1];
+		wordstats->document -= first;
+		wordstats->next = map[wordstats->next];
+
+		entry = hashtable_get_entry(&doc->ht, wordstats->word);
+		entry->count += wordstats->count;
+		entry->val.uintval = n;
+	}
+	doc->wordstats_length = n;
+	free(map);
+
+	offset = 0;
+	n = 0;
+	if (first < end) {
+		offset = doc->documents[first].words - 1;
+		for (i = first; i < end; i++)
+			n += doc->documents[i].word_count;
+	}
+	memmove(doc->words, &doc->words[offset], n * sizeof(unsigned int));
+	doc->words_length = n;
+
+	memmove(doc->documents, &doc->documents[first],
+	        (end - first) * sizeof(docinfo_document));
+	doc->documents_length = end - first;
+	for (i = 0; i < doc->documents_length; i++)
+		doc->documents[i].words -= offset;
+
+	return TRUE;
+}
+
+/* Drops from the vocabulary the words seen less than `min_count'
+ * times, the words found in more than the fraction `max_df' of the
+ * documents (if positive), and all but the `max_words' most frequent
+ * words (if positive). The words kept are numbered again in the same
+ * order, and the words and wordstats of the documents are rewritten
+ * in place. The words dropped are ignored from then on.
+ */
+int docinfo_prune(docinfo *doc, unsigned int min_count, double max_df,
+                  unsigned int max_words)
+{
+	docinfo_wordstats *wordstats;
+	docinfo_document *document;
+	hashtable_entry *entry;
+	unsigned int i, l, n, start, length, num_words, *map, *stats_map;
+	topk_item *top;
+	double max_documents;
+
+	num_words = hashtable_num_entries(&doc->ht);
+	map = (unsigned int *) xmalloc((num_words + 1) * sizeof(unsigned int));
+	if (!map) return FALSE;
+
+	stats_map = NULL;
+	top = NULL;
+	if (max_words > 0 && max_words < num_words) {
+		top = (topk_item *) xmalloc(max_words * sizeof(topk_item));
+		if (!top) goto error_prune;
+	}
+
+	/* The document frequencies */
+	memset(map, 0, (num_words + 1) * sizeof(unsigned int));
+	for (l = 0; l < doc->wordstats_length; l++)
+		map[doc->wordstats[l].word]++;
+
+	max_documents = max_df * doc->documents_length;
+	length = 0;
+	for (i = 1; i <= num_words; i++) {
+		entry = hashtable_get_entry(&doc->ht, i);
+		if (entry->count < min_count
+		    || (max_df > 0 && map[i] > max_documents)) {
+			map[i] = 0;
+			continue;
+		}
+		map[i] = 1;
+		if (top) {
+			topk_push(top, &length, max_words, i,
+			          (double) entry->count);
+		}
+	}
+	if (top) {
+		memset(map, 0, (num_words + 1) * sizeof(unsigned int));
+		for (i = 0; i < length; i++)
+			map[top[i].idx] = 1;
+		free(top);
+		top = NULL;
+	}
+
+	n = 0;
+	for (i = 1; i <= num_words; i++) {
+		if (map[i]) {
+			map[i] = ++n;
+		} else {
+			entry = hashtable_get_entry(&doc->ht, i);
+			if (!hashtable_find(&doc->ignored,
+			                    hashtable_str(&doc->ht, entry), TRUE))
+				goto error_prune;
+		}
+	}
+	printf("Pruned vocabulary: %u of %u words kept\n", n, num_words);
+	if (n == num_words) {
+		free(map);
+		return TRUE;
+	}
+
+	/* The words of each document */
+	n = 0;
+	for (i = 0; i < doc->documents_length; i++) {
+		document = &doc->documents[i];
+		start = document->words - 1;
+		length = document->word_count;
+		document->words = n + 1;
+		document->word_count = 0;
+		for (l = start; l < start + length; l++) {
+			if (!map[doc->words[l]]) continue;
+			doc->words[n++] = map[doc->words[l]];
+			document->word_count++;
+		}
+	}
+	doc->words_length = n;
+
+	/* The wordstats stay sorted by document */
+	stats_map = (unsigned int *) xmalloc((doc->wordstats_length + 1)
+	                                     * sizeof(unsigned int));
+	if (!stats_map) goto error_prune;
+
+	stats_map[0] = 0;
+	n = 0;
+	for (l = 0; l < doc->wordstats_length; l++) {
+		wordstats = &doc->wordstats[l];
+		stats_map[l + 1] = 0;
+		if (!map[wordstats->word]) continue;
+
+		stats_map[l + 1] = ++n;
+		doc->wordstats[n - 1] = *wordstats;
+		wordstats = &doc->wordstats[n - 1];
+		wordstats->word = map[wordstats->word];
+		wordstats->next = stats_map[wordstats->next];
+	}
+	doc->wordstats_length = n;
+
+	for (i = 1; i <= num_words; i++) {
+		if (!map[i]) continue;
+		entry = hashtable_get_entry(&doc->ht, i);
+		entry->val.uintval = stats_map[entry->val.uintval];
+	}
+	hashtable_compact(&doc->ht, map);
+
+	free(stats_map);
+	free(map);
+	return TRUE;
+
+error_prune:
+	if (top) free(top);
+	free(map);
+	return FALSE;
+}
+
 void docinfo_clear_ignored(docinfo *doc)
 {
 	hashtable_clear(&doc->ignored);
@@ -113,20 +334,20 @@ int docinfo_add_ignored(docinfo *doc, const char *word)
 int docinfo_add_ignored_from_file(docinfo *doc, const char *filename)
 {
 	int ret = TRUE;
-	char *token;
+	const char *token;
+	unsigned int length;
 	reader_close(&doc->r);
 
 	if (!reader_open(&doc->r, filename))
 		return FALSE;
 
 	while (TRUE) {
-		token = reader_read(&doc->r);
-		if (!token) {
+		if (!reader_next(&doc->r, &token, &length)) {
 			ret = FALSE;
 			break;
 		}
-		if (token[0] == '\0') break;
-		if (!docinfo_add_ignored(doc, token)) {
+		if (length == 0) break;
+		if (!hashtable_find_n(&doc->ignored, token, length, TRUE)) {
 			ret = FALSE;
 			break;
 		}
@@ -189,13 +410,23 @@ unsigned int docinfo_new_word(docinfo *doc)
 
 int docinfo_add(docinfo *doc, const char *str, unsigned int doc_id,
                 int add_to_hash)
+{
+	return docinfo_add_n(doc, str, (unsigned int) strlen(str), doc_id,
+	                     add_to_hash);
+}
+
+/* Same as docinfo_add(), for the word of `len' characters at `str',
+ * which need not end with a null character.
+ */
+int docinfo_add_n(docinfo *doc, const char *str, unsigned int len,
+                  unsigned int doc_id, int add_to_hash)
 {
 	hashtable_entry *entry;
 	docinfo_document *document;
 	docinfo_wordstats *wordstats;
 	unsigned int word_idx, entry_idx, document_idx, stats_idx;
 
-	if (hashtable_find(&doc->ignored, str, FALSE))
+	if (hashtable_find_n(&doc->ignored, str, len, FALSE))
 		return TRUE;
 
 	document = NULL;
@@ -216,14 +447,16 @@ int docinfo_add(docinfo *doc, const char *str, unsigned int doc_id,
 		document->words = doc->words_length + 1;
 	}
 
-	entry = hashtable_find(&doc->ht, str, add_to_hash);
+	entry = hashtable_find_n(&doc->ht, str, len, add_to_hash);
 	if (!entry) {
 		if (add_to_hash) return FALSE;
 		else {
-			error("could not find word `%s' in dictionary", str);
+			error("could not find word `%.*s' in dictionary",
+			      (int) len, str);
 			return TRUE;
 		}
 	}
+	if (!add_to_hash) entry->count++;
 
 	document->word_count++;
 	word_idx = docinfo_new_word(doc);
@@ -262,39 +495,412 @@ int docinfo_add(docinfo *doc, const char *str, unsigned int doc_id,
 int docinfo_process_file(docinfo *doc, const char *master_file,
                          int add_to_hash)
 {
-	unsigned int j, doc_id = 0;
-	char *token;
-	int first;
+	int ret;
+
+	if (!docinfo_open_stream(doc, master_file))
+		return FALSE;
+
+	ret = docinfo_process_stream(doc, 0, add_to_hash);
+	docinfo_close_stream(doc);
+	return ret;
+}
+
+/* Grows `*ptr', an array of `*capacity' elements of `size' bytes, to
+ * hold at least `length' elements, doubling its capacity as the
+ * elements were added one at a time.
+ */
+static
+int docinfo_grow(void **ptr, unsigned int *capacity, unsigned int length,
+                 size_t size)
+{
+	unsigned int new_capacity;
+	void *new_ptr;
+
+	new_capacity = *capacity;
+	while (new_capacity < length) new_capacity *= 2;
+	if (new_capacity == *capacity) return TRUE;
+
+	new_ptr = xrealloc(*ptr, new_capacity * size);
+	if (!new_ptr) return FALSE;
+	*ptr = new_ptr;
+	*capacity = new_capacity;
+	return TRUE;
+}
+
+/* Finds the end of the first document separator at or after data[pos]
+ * in the stream of `doc', which must be mapped, and stores it in
+ * `*split' (the end of the file if there is none). A token cut by
+ * `pos' is skipped.
+ */
+static
+int docinfo_find_split(docinfo *doc, size_t pos, size_t size, size_t *split)
+{
+	reader *r = &doc->r;
+	unsigned int length;
+	const char *token;
+	int skip;
+
+	if (!reader_seek(r, pos, size)) return FALSE;
+
+	skip = (pos > 0 && !isspace((unsigned char) r->data[pos - 1]));
+	while (TRUE) {
+		if (!reader_next(r, &token, &length)) return FALSE;
+		if (length == 0) break;
+		if (skip && token == r->data + pos) {
+			skip = FALSE;
+			continue;
+		}
+		skip = FALSE;
+
+		if (r->token_dashes && length >= 8) {
+			*split = (size_t) (token - r->data) + length;
+			return TRUE;
+		}
+	}
+	*split = size;
+	return TRUE;
+}
+
+/* Reads the part `thread_idx' of the file */
+static
+void docinfo_read_part(void *arg, unsigned int thread_idx,
+                       unsigned int num_threads)
+{
+	docinfo_parts *ctx = (docinfo_parts *) arg;
+	docinfo_part *part = &ctx->parts[thread_idx];
+
+	part->ok = FALSE;
+	if (!docinfo_open_stream(&part->doc, ctx->master_file))
+		return;
+	if (reader_seek(&part->doc.r, part->start, part->end))
+		part->ok = docinfo_process_stream(&part->doc, 0, TRUE);
+	docinfo_close_stream(&part->doc);
+}
+
+/* Adds the words of the part `thread_idx' to the vocabulary of all the
+ * parts, ranked by the part and then by their first occurrence.
+ */
+static
+void docinfo_add_part_words(void *arg, unsigned int thread_idx,
+                            unsigned int num_threads)
+{
+	docinfo_parts *ctx = (docinfo_parts *) arg;
+	docinfo_part *part = &ctx->parts[thread_idx];
+	const hashtable *ht = &part->doc.ht;
+	const hashtable_entry *entry;
+	const char *str;
+	unsigned int i;
+
+	part->ok = FALSE;
+	part->map[0] = 0;
+	for (i = 1; i <= hashtable_num_entries(ht); i++) {
+		entry = hashtable_get_entry(ht, i);
+		part->map[i] = 0;
+
+		/* The words left without documents are dropped */
+		if (!entry->count) continue;
+
+		str = hashtable_str(ht, entry);
+		part->map[i] = vocab_add(&ctx->v, str, (unsigned int) strlen(str),
+		                         entry->count, part->first_rank + i);
+		if (!part->map[i]) return;
+	}
+	part->ok = TRUE;
+}
+
+/* Copies the part `thread_idx' to its place in the whole DOCINFO */
+static
+void docinfo_copy_part(void *arg, unsigned int thread_idx,
+                       unsigned int num_threads)
+{
+	docinfo_parts *ctx = (docinfo_parts *) arg;
+	docinfo_part *part = &ctx->parts[thread_idx];
+	docinfo *doc = ctx->doc;
+	const docinfo *src = &part->doc;
+	docinfo_document *document;
+	docinfo_wordstats *wordstats;
+	unsigned int i, l;
+
+	for (i = 0; i < src->documents_length; i++) {
+		document = &doc->documents[part->documents_offset + i];
+		*document = src->documents[i];
+		document->words += part->words_offset;
+	}
+
+	for (i = 0; i < src->words_length; i++)
+		doc->words[part->words_offset + i] = part->map[src->words[i]];
+
+	for (l = 0; l < src->wordstats_length; l++) {
+		wordstats = &doc->wordstats[part->wordstats_offset + l];
+		*wordstats = src->wordstats[l];
+		wordstats->document += part->documents_offset;
+		if (wordstats->next)
+			wordstats->next += part->wordstats_offset;
+		else
+			wordstats->next = part->prev[src->wordstats[l].word];
+		wordstats->word = part->map[wordstats->word];
+	}
+}
+
+/* Merges the parts into `doc', as if they were read in order by a
+ * single thread: the words are numbered in the order they are first
+ * seen, and a document that goes on from a part to the next is kept
+ * whole.
+ */
+static
+int docinfo_merge_parts(docinfo *doc, docinfo_parts *ctx,
+                        unsigned int num_parts)
+{
+	docinfo_part *part;
+	docinfo_document *document;
+	docinfo *src, *prev_doc;
+	hashtable_entry *entry;
+	unsigned int i, j, e, p, rank, num_words, *ids, *last;
+	unsigned int documents_length, words_length, wordstats_length;
+
+	/* A document split by the parts has the same id on both sides */
+	prev_doc = (doc->documents_length > 0) ? doc : NULL;
+	for (p = 0; p < num_parts; p++) {
+		src = &ctx->parts[p].doc;
+		if (prev_doc && src->documents_length > 0
+		    && src->documents[0].doc_id
+		       == prev_doc->documents[prev_doc->documents_length
+		                              - 1].doc_id) {
+			document = &src->documents[0];
+			for (j = 1; j <= document->word_count; j++) {
+				if (!docinfo_add(prev_doc, docinfo_get_word_in_doc(
+				                 src, document, j),
+				                 document->doc_id, TRUE))
+					return FALSE;
+			}
+			if (!docinfo_shard(src, 1, src->documents_length))
+				return FALSE;
+		}
+		if (src->documents_length > 0) prev_doc = src;
+	}
+
+	documents_length = doc->documents_length;
+	words_length = doc->words_length;
+	wordstats_length = doc->wordstats_length;
+	rank = 0;
+	for (p = 0; p < num_parts; p++) {
+		part = &ctx->parts[p];
+		src = &part->doc;
+		part->documents_offset = documents_length;
+		part->words_offset = words_length;
+		part->wordstats_offset = wordstats_length;
+		part->first_rank = rank;
+		documents_length += src->documents_length;
+		words_length += src->words_length;
+		wordstats_length += src->wordstats_length;
+		rank += hashtable_num_entries(&src->ht);
+
+		num_words = hashtable_num_entries(&src->ht);
+		part->map = (unsigned int *) xmalloc((num_words + 1)
+		                                     * sizeof(unsigned int));
+		if (!part->map) return FALSE;
+		part->prev = (unsigned int *) xmalloc((num_words + 1)
+		                                      * sizeof(unsigned int));
+		if (!part->prev) return FALSE;
+	}
+
+	/* The parts add their words at the same time, each word once */
+	ids = NULL;
+	if (!vocab_initialize(&ctx->v)) return FALSE;
+	if (!parallel_run(num_parts, &docinfo_add_part_words, ctx))
+		goto error_merge;
+	for (p = 0; p < num_parts; p++) {
+		if (!ctx->parts[p].ok) goto error_merge;
+	}
+
+	num_words = hashtable_num_entries(&doc->ht);
+	ids = (unsigned int *) xmalloc((vocab_num_words(&ctx->v) + 1)
+	                               * sizeof(unsigned int));
+	if (!ids) goto error_merge;
+	if (!vocab_freeze(&ctx->v, &doc->ht, ids)) goto error_merge;
+	vocab_cleanup(&ctx->v);
+
+	last = (unsigned int *) xmalloc((hashtable_num_entries(&doc->ht) + 1)
+	                                * sizeof(unsigned int));
+	if (!last) goto error_merge;
+	for (i = 1; i <= hashtable_num_entries(&doc->ht); i++) {
+		entry = hashtable_get_entry(&doc->ht, i);
+		last[i] = (i <= num_words) ? entry->val.uintval : 0;
+	}
+
+	/* The wordstats of a word are chained from a part to the next */
+	for (p = 0; p < num_parts; p++) {
+		part = &ctx->parts[p];
+		src = &part->doc;
+		for (i = 1; i <= hashtable_num_entries(&src->ht); i++) {
+			part->prev[i] = 0;
+			if (!part->map[i]) continue;
+
+			e = part->map[i] = ids[part->map[i]];
+			part->prev[i] = last[e];
+			last[e] = part->wordstats_offset
+			          + hashtable_get_entry(&src->ht, i)->val.uintval;
+		}
+	}
+	for (i = 1; i <= hashtable_num_entries(&doc->ht); i++)
+		hashtable_get_entry(&doc->ht, i)->val.uintval = last[i];
+	free(last);
+	free(ids);
+
+	if (!docinfo_grow((void **) &doc->documents, &doc->documents_capacity,
+	                  documents_length, sizeof(docinfo_document)))
+		return FALSE;
+	if (!docinfo_grow((void **) &doc->words, &doc->words_capacity,
+	                  words_length, sizeof(unsigned int)))
+		return FALSE;
+	if (!docinfo_grow((void **) &doc->wordstats, &doc->wordstats_capacity,
+	                  wordstats_length, sizeof(docinfo_wordstats)))
+		return FALSE;
+
+	doc->documents_length = documents_length;
+	doc->words_length = words_length;
+	doc->wordstats_length = wordstats_length;
+	return parallel_run(num_parts, &docinfo_copy_part, ctx);
+
+error_merge:
+	vocab_cleanup(&ctx->v);
+	if (ids) free(ids);
+	return FALSE;
+}
+
+/* Same as docinfo_process_file(), adding the words to the hash, with
+ * the file split in up to `num_threads' parts at the document
+ * separators. Each part is read by a thread of its own, and the parts
+ * are then merged in order, so the result does not depend on the
+ * number of threads. A file that cannot be mapped is read by a single
+ * thread.
+ */
+int docinfo_process_file_parallel(docinfo *doc, const char *master_file,
+                                  unsigned int num_threads)
+{
+	docinfo_parts ctx;
+	docinfo_part *part;
+	unsigned int p, num_parts;
+	size_t size, start;
+	int ret;
+
+	if (!docinfo_open_stream(doc, master_file))
+		return FALSE;
+
+	size = doc->r.length;
+	num_parts = (unsigned int) MIN(num_threads, size / MIN_PART_SIZE + 1);
+	if (!doc->r.mapped || num_parts <= 1) {
+		ret = docinfo_process_stream(doc, 0, TRUE);
+		docinfo_close_stream(doc);
+		return ret;
+	}
+
+	ctx.doc = doc;
+	ctx.master_file = master_file;
+	ctx.parts = (docinfo_part *) xmalloc(num_parts * sizeof(docinfo_part));
+	if (!ctx.parts) {
+		docinfo_close_stream(doc);
+		return FALSE;
+	}
+	for (p = 0; p < num_parts; p++) {
+		part = &ctx.parts[p];
+		docinfo_reset(&part->doc);
+		part->map = NULL;
+		part->prev = NULL;
+	}
+
+	ret = FALSE;
+	start = 0;
+	for (p = 0; p < num_parts; p++) {
+		part = &ctx.parts[p];
+		part->start = start;
+		part->end = size;
+		if (p + 1 < num_parts) {
+			if (!docinfo_find_split(doc, MAX(start, (size / num_parts)
+			                                        * (p + 1)),
+			                        size, &part->end))
+				goto error_parts;
+		}
+		start = part->end;
+
+		/* The parts share the ignored words, which they only read */
+		if (!docinfo_initialize(&part->doc))
+			goto error_parts;
+		hashtable_cleanup(&part->doc.ignored);
+		part->doc.ignored = doc->ignored;
+	}
+	docinfo_close_stream(doc);
+
+	if (!parallel_run(num_parts, &docinfo_read_part, &ctx))
+		goto error_parts;
+	for (p = 0; p < num_parts; p++) {
+		if (!ctx.parts[p].ok) goto error_parts;
+	}
+	ret = docinfo_merge_parts(doc, &ctx, num_parts);
+
+error_parts:
+	docinfo_close_stream(doc);
+	for (p = 0; p < num_parts; p++) {
+		part = &ctx.parts[p];
+		hashtable_reset(&part->doc.ignored);
+		docinfo_cleanup(&part->doc);
+		if (part->map) free(part->map);
+		if (part->prev) free(part->prev);
+	}
+	free(ctx.parts);
+	return ret;
+}
 
+int docinfo_open_stream(docinfo *doc, const char *master_file)
+{
 	reader_close(&doc->r);
 	if (!reader_open(&doc->r, master_file))
 		return FALSE;
 
-	first = TRUE;
+	doc->stream_doc_id = 0;
+	doc->stream_first = TRUE;
+	return TRUE;
+}
+
+/* Adds the documents of the stream until its end, or until there are
+ * `max_documents' documents in `doc' (no limit if it is zero).
+ * The end of the stream is reached when no document is added.
+ */
+int docinfo_process_stream(docinfo *doc, unsigned int max_documents,
+                           int add_to_hash)
+{
+	unsigned int length;
+	const char *token;
+	char *str;
+
 	while (TRUE) {
-		token = reader_read(&doc->r);
-		if (!token) goto error_process;
-		if (token[0] == '\0') break;
-		if (first) {
-			doc_id = strtoul(token, NULL, 10);
-			first = FALSE;
+		if (!reader_next(&doc->r, &token, &length)) return FALSE;
+		if (length == 0) break;
+		if (doc->stream_first) {
+			str = reader_string(&doc->r, token, length);
+			if (!str) return FALSE;
+			doc->stream_doc_id = strtoul(str, NULL, 10);
+			doc->stream_first = FALSE;
 			continue;
 		}
 
-		for(j = 0; token[j] == '-'; j++);
-		if (token[j] == '\0' && j >= 8) {
-			first = TRUE;
+		if (doc->r.token_dashes && length >= 8) {
+			doc->stream_first = TRUE;
+			if (max_documents > 0
+			    && doc->documents_length >= max_documents)
+				break;
 			continue;
 		}
-		if (!docinfo_add(doc, token, doc_id, add_to_hash))
-			goto error_process;
+		if (!docinfo_add_n(doc, token, length, doc->stream_doc_id,
+		                   add_to_hash))
+			return FALSE;
 	}
-	reader_close(&doc->r);
 	return TRUE;
+}
 
-error_process:
+void docinfo_close_stream(docinfo *doc)
+{
 	reader_close(&doc->r);
-	return FALSE;
 }
 
 unsigned int docinfo_num_documents(const docinfo *doc)
@@ -509,8 +1115,12 @@ int docinfo_load_easy(docinfo *doc, const char *filename)
 	return ret;
 }
 
+/* Loads the DOCINFO `docinfo_file' if it exists, otherwise builds it
+ * from `master_file' with `num_threads' threads and saves it.
+ */
 int docinfo_build_cached(docinfo *doc, const char *docinfo_file,
-                         const char *master_file, const char *ignore_file)
+                         const char *master_file, const char *ignore_file,
+                         unsigned int num_threads)
 {
 	FILE *fp;
 	int ret;
@@ -526,6 +1136,10 @@ int docinfo_build_cached(docinfo *doc, const char *docinfo_file,
 		}
 	}
 
+	if (!master_file) {
+		error("no DOCINFO to load and no training file");
+		return FALSE;
+	}
 	if (!docinfo_initialize(doc))
 		return FALSE;
 
@@ -537,7 +1151,7 @@ int docinfo_build_cached(docinfo *doc, const char *docinfo_file,
 	}
 
 	printf("Building DOCINFO from `%s'...\n", master_file);
-	if (!docinfo_process_file(doc, master_file, TRUE)) {
+	if (!docinfo_process_file_parallel(doc, master_file, num_threads)) {
 		docinfo_cleanup(doc);
 		return FALSE;
 	}
@@ -556,3 +1170,73 @@ int docinfo_build_cached(docinfo *doc, const char *docinfo_file,
 
 	return TRUE;
 }
+
+/* Builds only the vocabulary of `master_file', reading it in blocks of
+ * `max_documents' documents which are discarded afterwards, and saves
+ * it to `docinfo_file'. If `docinfo_file' exists, the vocabulary is
+ * loaded from it instead.
+ */
+int docinfo_build_vocabulary(docinfo *doc, const char *docinfo_file,
+                             const char *master_file,
+                             const char *ignore_file,
+                             unsigned int max_documents)
+{
+	unsigned int num_documents;
+	FILE *fp;
+
+	docinfo_reset(doc);
+	if (docinfo_file) {
+		fp = fopen(docinfo_file, "rb");
+		if (fp) {
+			printf("Loading DOCINFO `%s'...\n", docinfo_file);
+			if (!docinfo_load(doc, fp)) {
+				fclose(fp);
+				return FALSE;
+			}
+			fclose(fp);
+			docinfo_clear(doc, TRUE);
+			return TRUE;
+		}
+	}
+
+	if (!master_file) {
+		error("no DOCINFO to load and no training file");
+		return FALSE;
+	}
+	if (!docinfo_initialize(doc))
+		return FALSE;
+
+	if (ignore_file) {
+		if (!docinfo_add_ignored_from_file(doc, ignore_file))
+			goto error_build;
+	}
+
+	printf("Building vocabulary from `%s'...\n", master_file);
+	if (!docinfo_open_stream(doc, master_file))
+		goto error_build;
+
+	num_documents = 0;
+	do {
+		docinfo_clear(doc, TRUE);
+		if (!docinfo_process_stream(doc, max_documents, TRUE)) {
+			docinfo_close_stream(doc);
+			goto error_build;
+		}
+		num_documents += docinfo_num_documents(doc);
+	} while (docinfo_num_documents(doc) > 0);
+	docinfo_close_stream(doc);
+
+	printf("Num documents: %u\n", num_documents);
+	printf("Num different words: %u\n", docinfo_num_different_words(doc));
+
+	if (docinfo_file) {
+		printf("Saving DOCINFO `%s'...\n", docinfo_file);
+		if (!docinfo_save_easy(doc, docinfo_file))
+			goto error_build;
+	}
+	return TRUE;
+
+error_build:
+	docinfo_cleanup(doc);
+	return FALSE;
+}
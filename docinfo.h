@@ -34,6 +34,10 @@ struct docinfo_st {
 	docinfo_wordstats *wordstats;
 	docinfo_document *documents;
 	unsigned int *words;
+
+	/* State of the stream being read by docinfo_process_stream() */
+	unsigned int stream_doc_id;
+	int stream_first;
 } docinfo;
 
 /* Functions */
@@ -42,6 +46,9 @@ int docinfo_initialize(docinfo *doc);
 void docinfo_cleanup(docinfo *doc);
 
 void docinfo_clear(docinfo *doc, int keep_strings);
+int docinfo_shard(docinfo *doc, unsigned int first, unsigned int end);
+int docinfo_prune(docinfo *doc, unsigned int min_count, double max_df,
+                  unsigned int max_words);
 
 void docinfo_clear_ignored(docinfo *doc);
 int docinfo_add_ignored(docinfo *doc, const char *word);
@@ -49,8 +56,17 @@ int docinfo_add_ignored_from_file(docinfo *doc, const char *filename);
 
 int docinfo_add(docinfo *doc, const char *str, unsigned int doc_id,
                 int add_to_hash);
+int docinfo_add_n(docinfo *doc, const char *str, unsigned int len,
+                  unsigned int doc_id, int add_to_hash);
 int docinfo_process_file(docinfo *doc, const char *master_file,
                          int add_to_hash);
+int docinfo_process_file_parallel(docinfo *doc, const char *master_file,
+                                  unsigned int num_threads);
+
+int docinfo_open_stream(docinfo *doc, const char *master_file);
+int docinfo_process_stream(docinfo *doc, unsigned int max_documents,
+                           int add_to_hash);
+void docinfo_close_stream(docinfo *doc);
 
 unsigned int docinfo_num_documents(const docinfo *doc);
 unsigned int docinfo_num_different_words(const docinfo *doc);
@@ -75,7 +91,12 @@ int docinfo_load(docinfo *doc, FILE *fp);
 int docinfo_load_easy(docinfo *doc, const char *filename);
 
 int docinfo_build_cached(docinfo *doc, const char *docinfo_file,
-                         const char *master_file, const char *ignore_file);
+                         const char *master_file, const char *ignore_file,
+                         unsigned int num_threads);
+int docinfo_build_vocabulary(docinfo *doc, const char *docinfo_file,
+                             const char *master_file,
+                             const char *ignore_file,
+                             unsigned int max_documents);
 
 
 #endif /* __DOCINFO_H */
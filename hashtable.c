@@ -10,6 +10,14 @@
 #define INITIAL_ENTRIES_CAPACITY  1024
 #define INITIAL_STRS_CAPACITY     8192
 
+/* Constants of the hash, from the splitmix64 generator */
+#define HASH_SEED                 0x9e3779b97f4a7c15UL
+#define HASH_MUL1                 0xbf58476d1ce4e5b9UL
+#define HASH_MUL2                 0x94d049bb133111ebUL
+
+/* The 32 bits of the hash kept in the entries and in the table */
+#define HASH_FOLD(h)              ((unsigned int) ((h) ^ ((h) >> 32)))
+
 void hashtable_reset(hashtable *ht)
 {
 	ht->table = NULL;
@@ -26,8 +34,8 @@ int hashtable_initialize_aux(hashtable *ht, unsigned int table_size,
 
 	hashtable_reset(ht);
 
-	size = table_size * sizeof(unsigned int);
-	ht->table = (unsigned int *) xmalloc(size);
+	size = table_size * sizeof(hashtable_slot);
+	ht->table = (hashtable_slot *) xmalloc(size);
 	if (!ht->table) goto error_init;
 
 	size = entries_capacity * sizeof(hashtable_entry);
@@ -38,7 +46,7 @@ int hashtable_initialize_aux(hashtable *ht, unsigned int table_size,
 	if (!ht->strs) goto error_init;
 
 	ht->table_size = table_size;
-	memset(ht->table, 0, ht->table_size * sizeof(unsigned int));
+	memset(ht->table, 0, ht->table_size * sizeof(hashtable_slot));
 
 	ht->entries_length = 0;
 	ht->entries_capacity = entries_capacity;
@@ -79,7 +87,7 @@ void hashtable_clear(hashtable *ht)
 {
 	ht->entries_length = 0;
 	ht->strs_length = 0;
-	memset(ht->table, 0, ht->table_size * sizeof(unsigned int));
+	memset(ht->table, 0, ht->table_size * sizeof(hashtable_slot));
 }
 
 void hashtable_clear_counters(hashtable *ht)
@@ -93,6 +101,58 @@ void hashtable_clear_counters(hashtable *ht)
 	}
 }
 
+/* Puts the entry `e' (counting from one) in the first free slot after
+ * the one of its hash.
+ */
+static
+void hashtable_insert(hashtable *ht, unsigned int e)
+{
+	const hashtable_entry *entry = &ht->entries[e - 1];
+	hashtable_slot *slot;
+	unsigned int idx, mask;
+
+	mask = ht->table_size - 1;
+	idx = entry->hash & mask;
+	while (ht->table[idx].entry)
+		idx = (idx + 1) & mask;
+
+	slot = &ht->table[idx];
+	slot->hash = entry->hash;
+	slot->str = entry->str;
+	slot->entry = e;
+}
+
+/* Keeps only the entries `i' (counting from one) with a nonzero
+ * `map[i]', which becomes their new index. The entries kept must
+ * keep their order, numbered from one. Their strings are packed too.
+ */
+void hashtable_compact(hashtable *ht, const unsigned int *map)
+{
+	unsigned int i, n, len, strs_length;
+	hashtable_entry *entry;
+
+	memset(ht->table, 0, ht->table_size * sizeof(hashtable_slot));
+	strs_length = 0;
+	n = 0;
+	for (i = 1; i <= ht->entries_length; i++) {
+		if (!map[i]) continue;
+		entry = &ht->entries[map[i] - 1];
+		*entry = ht->entries[i - 1];
+
+		/* The strings are stored in the order of the entries */
+		len = (unsigned int) strlen(&ht->strs[entry->str - 1]) + 1;
+		memmove(&ht->strs[strs_length], &ht->strs[entry->str - 1],
+		        len);
+		entry->str = strs_length + 1;
+		strs_length += len;
+
+		hashtable_insert(ht, map[i]);
+		n = map[i];
+	}
+	ht->entries_length = n;
+	ht->strs_length = strs_length;
+}
+
 static
 unsigned int hashtable_new_entry(hashtable *ht)
 {
@@ -111,10 +171,10 @@ unsigned int hashtable_new_entry(hashtable *ht)
 }
 
 static
-unsigned int hashtable_new_str(hashtable *ht, const char *str)
+unsigned int hashtable_new_str(hashtable *ht, const char *str,
+                               unsigned int len)
 {
-	unsigned int len, pos;
-	len = (unsigned int) strlen(str);
+	unsigned int pos;
 	while(ht->strs_length + len >= ht->strs_capacity) {
 		size_t size;
 		void *ptr;
@@ -127,7 +187,8 @@ unsigned int hashtable_new_str(hashtable *ht, const char *str)
 		ht->strs_capacity *= 2;
 	}
 	pos = ht->strs_length;
-	memcpy(&ht->strs[pos], str, len + 1);
+	memcpy(&ht->strs[pos], str, len);
+	ht->strs[pos + len] = '\0';
 	ht->strs_length += len + 1;
 	return pos + 1;
 }
@@ -135,54 +196,63 @@ unsigned int hashtable_new_str(hashtable *ht, const char *str)
 static
 int hashtable_rehash(hashtable *ht)
 {
-	unsigned int i, idx;
-	unsigned int new_size, *new_table;
-	hashtable_entry *entry;
+	unsigned int i, new_size;
+	hashtable_slot *new_table;
 
 	new_size = 2 * ht->table_size;
-	new_table = (unsigned int *) xmalloc(new_size * sizeof(unsigned int));
+	new_table = (hashtable_slot *) xmalloc(new_size
+	                                       * sizeof(hashtable_slot));
 	if (!new_table) return FALSE;
 	free(ht->table);
 
 	ht->table = new_table;
 	ht->table_size = new_size;
-	memset(new_table, 0, new_size * sizeof(unsigned int));
-	for (i = 0; i < ht->entries_length; i++) {
-		entry = &ht->entries[i];
-		idx = (entry->hash % new_size);
-		entry->next = new_table[idx];
-		new_table[idx] = i + 1;
-	}
+	memset(new_table, 0, new_size * sizeof(hashtable_slot));
+	for (i = 0; i < ht->entries_length; i++)
+		hashtable_insert(ht, i + 1);
 	return TRUE;
 }
 
 hashtable_entry *hashtable_find(hashtable *ht, const char *str, int add)
 {
-	unsigned long hash;
-	unsigned int idx, e;
+	return hashtable_find_n(ht, str, (unsigned int) strlen(str), add);
+}
+
+/* Same as hashtable_find(), for the `len' characters at `str', which
+ * need not end with a null character.
+ */
+hashtable_entry *hashtable_find_n(hashtable *ht, const char *str,
+                                  unsigned int len, int add)
+{
+	unsigned int hash;
+	unsigned int idx, mask, e;
 	hashtable_entry *entry;
+	const hashtable_slot *slot;
 	unsigned int str_pos;
-
-	hash = hashtable_hash(str);
-	idx = hash % ht->table_size;
-	e = ht->table[idx];
-	while (e) {
-		entry = &ht->entries[e - 1];
-		if (entry->hash == hash) {
-			if (strcmp(&ht->strs[entry->str - 1], str) == 0) {
+	const char *other;
+
+	hash = HASH_FOLD(hashtable_hash_n(str, len));
+	mask = ht->table_size - 1;
+	idx = hash & mask;
+	while ((e = ht->table[idx].entry)) {
+		slot = &ht->table[idx];
+		if (slot->hash == hash) {
+			other = &ht->strs[slot->str - 1];
+			if (memcmp(other, str, len) == 0
+			    && other[len] == '\0') {
+				entry = &ht->entries[e - 1];
 				if (add) entry->count++;
 				return entry;
 			}
 		}
-		e = entry->next;
+		idx = (idx + 1) & mask;
 	}
 	if (!add) return NULL;
 	if (2 * ht->entries_length >= ht->table_size) {
 		if (!hashtable_rehash(ht)) return NULL;
-		idx = hash % ht->table_size;
 	}
 
-	str_pos = hashtable_new_str(ht, str);
+	str_pos = hashtable_new_str(ht, str, len);
 	if (!str_pos) return NULL;
 
 	e = hashtable_new_entry(ht);
@@ -192,8 +262,7 @@ hashtable_entry *hashtable_find(hashtable *ht, const char *str, int add)
 	entry->hash = hash;
 	entry->str = str_pos;
 	entry->count = 1;
-	entry->next = ht->table[idx];
-	ht->table[idx] = e;
+	hashtable_insert(ht, e);
 
 	return entry;
 }
@@ -224,12 +293,46 @@ const char *hashtable_str(const hashtable *ht, const hashtable_entry *entry)
 
 unsigned long hashtable_hash(const char *str)
 {
-	unsigned long hash = 5381;
-	int c;
+	return hashtable_hash_n(str, (unsigned int) strlen(str));
+}
 
-	while ((c = *str++)) {
-		hash = ((hash << 5) + hash) + ((unsigned long) c);
+/* Same as hashtable_hash(), for the `len' characters at `str'. The
+ * characters are read 8 at a time (unsigned long has 64 bits on the
+ * targets of the kernels), the last ones with reads that overlap the
+ * ones before, so that the short words need no loop. The result is
+ * mixed as in splitmix64.
+ */
+unsigned long hashtable_hash_n(const char *str, unsigned int len)
+{
+	const unsigned char *p = (const unsigned char *) str;
+	unsigned long hash, word;
+	unsigned int i, lo, hi;
+
+	hash = HASH_SEED ^ (unsigned long) len;
+	if (len > sizeof(word)) {
+		for (i = 0; i + sizeof(word) < len; i += sizeof(word)) {
+			memcpy(&word, &p[i], sizeof(word));
+			hash = (hash ^ word) * HASH_MUL1;
+			hash ^= hash >> 32;
+		}
+		memcpy(&word, &p[len - sizeof(word)], sizeof(word));
+	} else if (len >= sizeof(lo)) {
+		memcpy(&lo, p, sizeof(lo));
+		memcpy(&hi, &p[len - sizeof(hi)], sizeof(hi));
+		word = ((unsigned long) hi << 32) | lo;
+	} else if (len > 0) {
+		word = ((unsigned long) p[0] << 16)
+		       | ((unsigned long) p[len / 2] << 8) | p[len - 1];
+	} else {
+		word = 0;
 	}
+	hash = (hash ^ word) * HASH_MUL1;
+
+	hash ^= hash >> 30;
+	hash *= HASH_MUL1;
+	hash ^= hash >> 27;
+	hash *= HASH_MUL2;
+	hash ^= hash >> 31;
 	return hash;
 }
 
@@ -289,7 +392,7 @@ int hashtable_save_easy(const hashtable *ht, const char *filename,
 int hashtable_load(hashtable *ht, FILE *fp,
                    hashtable_load_cb cb, void *arg)
 {
-	unsigned int i, idx;
+	unsigned int i, size;
 	unsigned int table_size;
 	unsigned int entries_length, strs_length;
 	unsigned int entries_capacity, strs_capacity;
@@ -306,7 +409,11 @@ int hashtable_load(hashtable *ht, FILE *fp,
 	if (fread(&strs_capacity, sizeof(unsigned int), 1, fp) != 1)
 		return FALSE;
 
-	if (!hashtable_initialize_aux(ht, table_size, entries_capacity,
+	/* The table keeps its size, if it can hold the entries */
+	size = INITIAL_TABLE_SIZE;
+	while (size < table_size || 2 * entries_length > size) size *= 2;
+
+	if (!hashtable_initialize_aux(ht, size, entries_capacity,
 	                              strs_capacity))
 		return FALSE;
 
@@ -324,16 +431,20 @@ int hashtable_load(hashtable *ht, FILE *fp,
 
 		if (!cb(ht, fp, entry, arg))
 			goto error_load;
-
-		idx = entry->hash % table_size;
-		entry->next = ht->table[idx];
-		ht->table[idx] = i + 1;
 	}
 
 	ht->strs_length = strs_length;
 	if (fread(ht->strs, sizeof(char), strs_length, fp) != strs_length)
 		goto error_load;
 
+	/* The hashes are computed again, as older files hold others */
+	for (i = 0; i < entries_length; i++) {
+		entry = &ht->entries[i];
+		entry->hash = HASH_FOLD(hashtable_hash(&ht->strs[entry->str
+		                                                 - 1]));
+		hashtable_insert(ht, i + 1);
+	}
+
 	return TRUE;
 
 error_load:
@@ -20,15 +20,27 @@ struct hashtable_entry_st {
 	unsigned int count;
 	hashtable_val val;
 	hashtable_val extra;
-	unsigned int next;
 } hashtable_entry;
 
+/* A slot of the table, which holds the hash and the string of its
+ * entry, so that a lookup only reads the table and the strings.
+ */
+typedef
+struct hashtable_slot_st {
+	unsigned int hash;
+	unsigned int str;
+	unsigned int entry; /* counting from one, zero if the slot is free */
+} hashtable_slot;
+
+/* The entries are found by linear probing in a table whose size is a
+ * power of two, and which is at most half full.
+ */
 typedef
 struct hashtable_st {
 	unsigned int table_size;
 	unsigned int entries_capacity, entries_length;
 	unsigned int strs_capacity, strs_length;
-	unsigned int *table;
+	hashtable_slot *table;
 	hashtable_entry *entries;
 	char *strs;
 } hashtable;
@@ -45,8 +57,11 @@ void hashtable_cleanup(hashtable *ht);
 
 void hashtable_clear(hashtable *ht);
 void hashtable_clear_counters(hashtable *ht);
+void hashtable_compact(hashtable *ht, const unsigned int *map);
 
 hashtable_entry *hashtable_find(hashtable *ht, const char *str, int add);
+hashtable_entry *hashtable_find_n(hashtable *ht, const char *str,
+                                  unsigned int len, int add);
 
 unsigned int hashtable_num_entries(const hashtable *ht);
 hashtable_entry *hashtable_get_entry(const hashtable *ht, unsigned int idx);
@@ -54,6 +69,7 @@ unsigned int hashtable_get_entry_idx(const hashtable *ht,
                                      const hashtable_entry *entry);
 const char *hashtable_str(const hashtable *ht, const hashtable_entry *entry);
 unsigned long hashtable_hash(const char *str);
+unsigned long hashtable_hash_n(const char *str, unsigned int len);
 
 int hashtable_save(const hashtable *ht, FILE *fp,
                    hashtable_save_cb cb, void *arg);
@@ -9,9 +9,29 @@
 #include "docinfo.h"
 #include "utils.h"
 #include "random.h"
+#include "kernels.h"
+#include "squarem.h"
+#include "checkpoint.h"
 
 #define EPS 1e-12
 
+/* Sections of the mapped model files */
+#define HMM_SECTION_SS 1
+#define HMM_SECTION_SW 2
+#define HMM_SECTION_RNG 3
+
+/* A copy of the model handed to the checkpoint thread */
+typedef
+struct hmm_snapshot_st {
+	hmm h;
+	int mapped; /* saved in the mapped format */
+} hmm_snapshot;
+
+/* Access to the elements of the tables of `h' */
+#define HMM_LOAD(h, table, pos) KERNEL_LOAD((h)->precision, table, pos)
+#define HMM_STORE(h, table, pos, val) \
+	KERNEL_STORE((h)->precision, table, pos, val)
+
 void hmm_reset(hmm *h)
 {
 	h->ss = NULL;
@@ -30,33 +50,48 @@ void hmm_reset(hmm *h)
 	h->opt_sw_i = NULL;
 	h->tmp_i = NULL;
 	h->tmp_d = NULL;
+	mapfile_reset(&h->map);
+	h->verify_checksums = FALSE;
+
+	h->precision = KERNEL_DOUBLE;
+	h->accelerate = FALSE;
+	h->checkpoint_interval = CHECKPOINT_INTERVAL;
+	h->checkpoint_seconds = 0;
+	h->iteration = 0;
 }
 
 int hmm_initialize(hmm *h)
 {
-	hmm_reset(h);
 	h->likelihood = 1;
 	h->old_likelihood = 1;
+	h->iteration = 0;
 	return TRUE;
 }
 
+/* Frees a table, unless it lives in the mapped model file */
+static
+void hmm_free(hmm *h, void *ptr)
+{
+	if (!mapfile_contains(&h->map, ptr)) free(ptr);
+}
+
 static
 void hmm_cleanup_tables(hmm *h)
 {
 	if (h->ss) {
-		free(h->ss);
+		hmm_free(h, h->ss);
 		h->ss = NULL;
 	}
 	if (h->ss2) {
-		free(h->ss2);
+		hmm_free(h, h->ss2);
 		h->ss2 = NULL;
 	}
 	if (h->sw) {
-		free(h->sw);
+		hmm_free(h, h->sw);
 		h->sw = NULL;
 	}
 	if (h->sw2) {
-		free(h->sw2);
+		hmm_free(h, h->sw2);
 		h->sw2 = NULL;
 	}
 }
@@ -116,10 +151,11 @@ void hmm_cleanup(hmm *h)
 	hmm_cleanup_tables(h);
 	hmm_cleanup_dp_tables(h);
 	hmm_cleanup_optimization_tables(h);
+	mapfile_unmap(&h->map);
 }
 
 static
-void hmm_normalize_tables(hmm *h, double *ss, double *sw)
+void hmm_normalize_tables(hmm *h, void *ss, void *sw)
 {
 	unsigned int i, j, k, pos;
 	double sum;
@@ -128,24 +164,26 @@ void hmm_normalize_tables(hmm *h, double *ss, double *sw)
 		sum = 0;
 		for (j = 0; j < h->num_states; j++) {
 			pos = i * h->num_states + j;
-			sum += ss[pos];
+			sum += HMM_LOAD(h, ss, pos);
 		}
 		if (fabs(sum) >= EPS) {
 			for (j = 0; j < h->num_states; j++) {
 				pos = i * h->num_states + j;
-				ss[pos] /= sum;
+				HMM_STORE(h, ss, pos,
+				          HMM_LOAD(h, ss, pos) / sum);
 			}
 		}
 
 		sum = 0;
 		for (k = 0; k < h->num_words; k++) {
 			pos = i * h->num_words + k;
-			sum += sw[pos];
+			sum += HMM_LOAD(h, sw, pos);
 		}
 		if (fabs(sum) >= EPS) {
 			for (k = 0; k < h->num_words; k++) {
 				pos = i * h->num_words + k;
-				sw[pos] /= sum;
+				HMM_STORE(h, sw, pos,
+				          HMM_LOAD(h, sw, pos) / sum);
 			}
 		}
 	}
@@ -158,25 +196,26 @@ void hmm_initialize_random(hmm *h)
 
 	for (i = 0; i < h->num_states; i++) {
 		pos = i * h->num_states;
-		h->ss[pos] = 0.0;
+		HMM_STORE(h, h->ss, pos, 0.0);
 		if (i != 1) {
 			for (j = 1; j < h->num_states; j++) {
 				pos = i * h->num_states + j;
-				h->ss[pos] = -log(genrand_real1());
+				HMM_STORE(h, h->ss, pos,
+				          -log(genrand_real1()));
 			}
 		} else {
 			pos = h->num_states + 1;
-			h->ss[pos] = 1.0;
+			HMM_STORE(h, h->ss, pos, 1.0);
 			for (j = 2; j < h->num_states; j++) {
 				pos = i * h->num_states + j;
-				h->ss[pos] = 0.0;
+				HMM_STORE(h, h->ss, pos, 0.0);
 			}
 		}
 
 		if (i <= 1) continue;
 		for (k = 0; k < h->num_words; k++) {
 			pos = i * h->num_words + k;
-			h->sw[pos] = -log(genrand_real1());
+			HMM_STORE(h, h->sw, pos, -log(genrand_real1()));
 		}
 	}
 	hmm_normalize_tables(h, h->ss, h->sw);
@@ -192,11 +231,11 @@ int hmm_allocate_tables(hmm *h, unsigned int num_words,
 		hmm_cleanup_tables(h);
 	} else if (h->num_words != num_words) {
 		if (h->sw) {
-			free(h->sw);
+			hmm_free(h, h->sw);
 			h->sw = NULL;
 		}
 		if (h->sw2) {
-			free(h->sw2);
+			hmm_free(h, h->sw2);
 			h->sw2 = NULL;
 		}
 	}
@@ -204,25 +243,25 @@ int hmm_allocate_tables(hmm *h, unsigned int num_words,
 	h->num_words = num_words;
 	h->num_states = num_states;
 
-	size = num_states * num_states * sizeof(double);
+	size = num_states * num_states * KERNEL_SIZE(h->precision);
 	if (!h->ss) {
-		h->ss = (double *) xmalloc(size);
+		h->ss = xmalloc(size);
 		if (!h->ss) return FALSE;
 	}
 
 	if (!h->ss2) {
-		h->ss2 = (double *) xmalloc(size);
+		h->ss2 = xmalloc(size);
 		if (!h->ss2) return FALSE;
 	}
 
-	size = num_states * h->num_words * sizeof(double);
+	size = num_states * h->num_words * KERNEL_SIZE(h->precision);
 	if (!h->sw) {
-		h->sw = (double *) xmalloc(size);
+		h->sw = xmalloc(size);
 		if (!h->sw) return FALSE;
 	}
 
 	if (!h->sw2) {
-		h->sw2 = (double *) xmalloc(size);
+		h->sw2 = xmalloc(size);
 		if (!h->sw2) return FALSE;
 	}
 
@@ -253,11 +292,99 @@ int hmm_allocate_dp_tables(hmm *h, unsigned int max_document_length)
 	return TRUE;
 }
 
+/* Returns the sum of table[first + k * stride] * x[k], for k < n. The
+ * precision of `table' is tested once, not for each element.
+ */
+static
+double hmm_dot(int precision, const void *table, size_t first,
+               size_t stride, const double *x, unsigned int n)
+{
+	const double *dt;
+	const float *ft;
+	unsigned int k;
+	double sum;
+
+	sum = 0;
+	if (precision == KERNEL_FLOAT) {
+		ft = (const float *) table + first;
+		for (k = 0; k < n; k++)
+			sum += (double) ft[k * stride] * x[k];
+	} else {
+		dt = (const double *) table + first;
+		for (k = 0; k < n; k++)
+			sum += dt[k * stride] * x[k];
+	}
+	return sum;
+}
+
+/* Computes y[k] += alpha * x[k] * table[k] * factor, for k < n, where
+ * `y' and `table' have the precision `precision'.
+ */
+static
+void hmm_axpy(int precision, void *y, double alpha, const double *x,
+              const void *table, double factor, unsigned int n)
+{
+	const double *dt;
+	const float *ft;
+	double *dy;
+	float *fy;
+	unsigned int k;
+
+	if (precision == KERNEL_FLOAT) {
+		fy = (float *) y;
+		ft = (const float *) table;
+		for (k = 0; k < n; k++)
+			fy[k] = (float) ((double) fy[k]
+			                 + alpha * x[k] * (double) ft[k] * factor);
+	} else {
+		dy = (double *) y;
+		dt = (const double *) table;
+		for (k = 0; k < n; k++)
+			dy[k] += alpha * x[k] * dt[k] * factor;
+	}
+}
+
+/* Adds the expected count of the word in the column `first' of `sw'
+ * for the states j >= 2, with y[first + j * stride] += a[j] * b[j]
+ * * factor / sw[first + j * stride], skipping the null probabilities.
+ */
+static
+void hmm_add_word(int precision, void *y, const void *sw, size_t first,
+                  size_t stride, const double *a, const double *b,
+                  double factor, unsigned int n)
+{
+	const double *dsw;
+	const float *fsw;
+	double *dy;
+	float *fy;
+	unsigned int j;
+	double val;
+
+	if (precision == KERNEL_FLOAT) {
+		fy = (float *) y + first;
+		fsw = (const float *) sw + first;
+		for (j = 2; j < n; j++) {
+			val = fsw[j * stride];
+			if (val < EPS) continue;
+			fy[j * stride] = (float) ((double) fy[j * stride]
+			                          + a[j] * b[j] * factor / val);
+		}
+	} else {
+		dy = (double *) y + first;
+		dsw = (const double *) sw + first;
+		for (j = 2; j < n; j++) {
+			val = dsw[j * stride];
+			if (val < EPS) continue;
+			dy[j * stride] += a[j] * b[j] * factor / val;
+		}
+	}
+}
+
 static
 double hmm_compute_dp_tables(hmm *h, const docinfo *doc,
                              const docinfo_document *document)
 {
-	unsigned int i, j, k, l;
+	unsigned int i, j, l;
 	unsigned int pos, pos2, pos3, pos4;
 	double likelihood;
 
@@ -272,13 +399,12 @@ double hmm_compute_dp_tables(hmm *h, const docinfo *doc,
 			pos = i * h->num_states + j;
 			h->dps_s[pos] = 0;
 			if (j == 0 || j == 1) continue;
-			for (k = 0; k < h->num_states; k++) {
-				pos2 = (i - 1) * h->num_states + k;
-				pos3 = k * h->num_states + j;
-				h->dps_s[pos] += h->ss[pos3] * h->dps_s[pos2];
-			}
+			pos2 = (i - 1) * h->num_states;
+			h->dps_s[pos] = hmm_dot(h->precision, h->ss, j,
+			                        h->num_states, &h->dps_s[pos2],
+			                        h->num_states);
 			pos4 = j * h->num_words + l;
-			h->dps_s[pos] *= h->sw[pos4];
+			h->dps_s[pos] *= HMM_LOAD(h, h->sw, pos4);
 			h->dps[i] += h->dps_s[pos];
 		}
 		for (j = 2; j < h->num_states; j++) {
@@ -290,11 +416,9 @@ double hmm_compute_dp_tables(hmm *h, const docinfo *doc,
 	memset(&h->dps_s[i * h->num_states], 0,
 	       h->num_states * sizeof(double));
 	pos = i * h->num_states + 1;
-	for (k = 0; k < h->num_states; k++) {
-		pos2 = (i - 1) * h->num_states + k;
-		pos3 = k * h->num_states + 1;
-		h->dps_s[pos] += h->ss[pos3] * h->dps_s[pos2];
-	}
+	pos2 = (i - 1) * h->num_states;
+	h->dps_s[pos] = hmm_dot(h->precision, h->ss, 1, h->num_states,
+	                        &h->dps_s[pos2], h->num_states);
 	h->dps[i] = h->dps_s[pos];
 	h->dps_s[pos] = 1;
 	likelihood += log(h->dps[i]);
@@ -312,13 +436,12 @@ double hmm_compute_dp_tables(hmm *h, const docinfo *doc,
 			pos = i * h->num_states + j;
 			h->dpe_s[pos] = 0;
 			if (j == 0 || j == 1) continue;
-			for (k = 0; k < h->num_states; k++) {
-				pos2 = (i + 1) * h->num_states + k;
-				pos3 = j * h->num_states + k;
-				h->dpe_s[pos] += h->ss[pos3] * h->dpe_s[pos2];
-			}
+			pos2 = (i + 1) * h->num_states;
+			pos3 = j * h->num_states;
+			h->dpe_s[pos] = hmm_dot(h->precision, h->ss, pos3, 1,
+			                        &h->dpe_s[pos2], h->num_states);
 			pos4 = j * h->num_words + l;
-			h->dpe_s[pos] *= h->sw[pos4];
+			h->dpe_s[pos] *= HMM_LOAD(h, h->sw, pos4);
 			h->dpe[i] += h->dpe_s[pos];
 		}
 		for (j = 2; j < h->num_states; j++) {
@@ -328,11 +451,8 @@ double hmm_compute_dp_tables(hmm *h, const docinfo *doc,
 	}
 	memset(h->dpe_s, 0, h->num_states * sizeof(double));
 	pos = 0;
-	for (k = 0; k < h->num_states; k++) {
-		pos2 = 1 * h->num_states + k;
-		pos3 = k;
-		h->dpe_s[pos] += h->ss[pos3] * h->dpe_s[pos2];
-	}
+	h->dpe_s[pos] = hmm_dot(h->precision, h->ss, 0, 1,
+	                        &h->dpe_s[h->num_states], h->num_states);
 	h->dpe[0] = h->dpe_s[pos];
 	h->dpe_s[pos] = 1;
 
@@ -343,34 +463,33 @@ static
 void hmm_iteration_aux(hmm *h, const docinfo *doc,
                        const docinfo_document *document)
 {
-	unsigned int i, j, k, l;
+	unsigned int i, j, l;
 	unsigned int pos, pos2, pos3;
+	size_t row;
 	double factor;
 
+	row = KERNEL_SIZE(h->precision);
 	factor = h->dps[0] / h->dpe[0];
 	for (i = 1; i <= document->word_count; i++) {
 		l = docinfo_get_wordidx_in_doc(doc, document, i) - 1;
 		factor *= h->dps[i];
-		for (j = 2; j < h->num_states; j++) {
-			pos = i * h->num_states + j;
-			pos2 = j * h->num_words + l;
-			if (h->sw[pos2] < EPS) continue;
-			h->sw2[pos2] += h->dps_s[pos] * h->dpe_s[pos] * factor
-			                / h->sw[pos2];
-		}
+		pos = i * h->num_states;
+		hmm_add_word(h->precision, h->sw2, h->sw, l, h->num_words,
+		             &h->dps_s[pos], &h->dpe_s[pos], factor,
+		             h->num_states);
 		factor /= h->dpe[i];
 	}
 	factor = 1;
 	for (i = 0; i <= document->word_count; i++) {
 		factor *= h->dps[i] / h->dpe[i];
 		for (j = 0; j < h->num_states; j++) {
-			for (k = 0; k < h->num_states; k++) {
-				pos = i * h->num_states + j;
-				pos2 = (i + 1) * h->num_states + k;
-				pos3 = j * h->num_states + k;
-				h->ss2[pos3] += h->dps_s[pos] * h->dpe_s[pos2]
-				                * h->ss[pos3] * factor;
-			}
+			pos = i * h->num_states + j;
+			pos2 = (i + 1) * h->num_states;
+			pos3 = j * h->num_states;
+			hmm_axpy(h->precision, (char *) h->ss2 + pos3 * row,
+			         h->dps_s[pos], &h->dpe_s[pos2],
+			         (const char *) h->ss + pos3 * row, factor,
+			         h->num_states);
 		}
 	}
 }
@@ -383,10 +502,10 @@ double hmm_iteration(hmm *h, const docinfo *doc)
 	double likelihood;
 	size_t size;
 
-	size = h->num_states * h->num_states * sizeof(double);
+	size = h->num_states * h->num_states * KERNEL_SIZE(h->precision);
 	memset(h->ss2, 0, size);
 
-	size = h->num_states * h->num_words * sizeof(double);
+	size = h->num_states * h->num_words * KERNEL_SIZE(h->precision);
 	memset(h->sw2, 0, size);
 
 	likelihood = 0;
@@ -397,17 +516,99 @@ double hmm_iteration(hmm *h, const docinfo *doc)
 		likelihood += hmm_compute_dp_tables(h, doc, document);
 		hmm_iteration_aux(h, doc, document);
 	}
-	h->ss2[h->num_states + 1] = 1.0;
+	HMM_STORE(h, h->ss2, h->num_states + 1, 1.0);
 	hmm_normalize_tables(h, h->ss2, h->sw2);
 	return likelihood / total_words;
 }
 
+static
+int hmm_accelerate(hmm *h, squarem *sq, int *status)
+{
+	void *tables[2], *previous[2];
+	size_t lengths[2];
+
+	tables[0] = h->ss;
+	previous[0] = h->ss2;
+	lengths[0] = (size_t) h->num_states * h->num_states;
+	tables[1] = h->sw;
+	previous[1] = h->sw2;
+	lengths[1] = (size_t) h->num_states * h->num_words;
+
+	if (!squarem_update(sq, tables, previous, lengths,
+	                    h->likelihood, status))
+		return FALSE;
+
+	if (*status == SQUAREM_EXTRAPOLATED)
+		hmm_normalize_tables(h, h->ss, h->sw);
+	return TRUE;
+}
+
+static
+void hmm_snapshot_free(void *arg)
+{
+	hmm_snapshot *snap = (hmm_snapshot *) arg;
+
+	hmm_cleanup(&snap->h);
+	free(snap);
+}
+
+static
+int hmm_snapshot_save(void *arg, const char *filename)
+{
+	hmm_snapshot *snap = (hmm_snapshot *) arg;
+
+	if (snap->mapped)
+		return hmm_save_mapped(&snap->h, filename);
+	return hmm_save_easy(&snap->h, filename);
+}
+
+/* Hands a copy of the tables of `h' after `iteration' iterations to
+ * the checkpoint thread.
+ */
+static
+int hmm_checkpoint(const hmm *h, checkpoint *cp, unsigned int iteration)
+{
+	size_t size_ss, size_sw;
+	hmm_snapshot *snap;
+
+	snap = (hmm_snapshot *) xmalloc(sizeof(hmm_snapshot));
+	if (!snap) return FALSE;
+
+	hmm_reset(&snap->h);
+	snap->mapped = (h->map.base != NULL);
+	snap->h.num_words = h->num_words;
+	snap->h.num_documents = h->num_documents;
+	snap->h.num_states = h->num_states;
+	snap->h.precision = h->precision;
+	snap->h.likelihood = h->likelihood;
+	snap->h.old_likelihood = h->old_likelihood;
+	snap->h.iteration = iteration;
+	genrand_get_state(snap->h.rng_state);
+
+	size_ss = (size_t) h->num_states * h->num_states
+	          * KERNEL_SIZE(h->precision);
+	size_sw = (size_t) h->num_states * h->num_words
+	          * KERNEL_SIZE(h->precision);
+	snap->h.ss = xmalloc(MAX(size_ss, 1));
+	snap->h.sw = xmalloc(MAX(size_sw, 1));
+	if (!snap->h.ss || !snap->h.sw) {
+		hmm_snapshot_free(snap);
+		return FALSE;
+	}
+	memcpy(snap->h.ss, h->ss, size_ss);
+	memcpy(snap->h.sw, h->sw, size_sw);
+	return checkpoint_write(cp, snap, iteration);
+}
+
 int hmm_train(hmm *h, const docinfo *doc, unsigned int num_states,
               unsigned int max_iterations, double tol,
               const char *hmm_filename)
 {
-	unsigned int iter;
-	double *temp;
+	unsigned int iter, first;
+	int status;
+	checkpoint cp;
+	squarem sq;
+	void *temp, *tables[2];
 
 	if (!hmm_allocate_tables(h, docinfo_num_different_words(doc),
 	                         docinfo_num_documents(doc), num_states))
@@ -422,12 +623,39 @@ int hmm_train(hmm *h, const docinfo *doc, unsigned int num_states,
 		return TRUE;
 	}
 
+	/* A model saved by a checkpoint goes on from the same iteration,
+	 * with the same random numbers.
+	 */
+	first = 0;
+	if (h->likelihood < 0 && h->iteration > 0) {
+		first = h->iteration;
+		genrand_set_state(h->rng_state);
+		printf("Resuming the training after %u iterations...\n",
+		       first);
+	}
+	h->iteration = 0;
+
+	checkpoint_reset(&cp);
+	if (hmm_filename) {
+		if (!checkpoint_initialize(&cp, hmm_filename,
+		                           h->checkpoint_interval,
+		                           h->checkpoint_seconds,
+		                           &hmm_snapshot_save,
+		                           &hmm_snapshot_free))
+			return FALSE;
+		cp.last_iteration = first;
+	}
+
+	squarem_reset(&sq);
+	if (h->accelerate) {
+		if (!squarem_initialize(&sq, h->precision, 2))
+			goto error_train;
+	}
+
 	printf("Training HMM on data...\n");
-	for (iter = 0; iter < max_iterations; iter++) {
+	for (iter = first; iter < max_iterations; iter++) {
 		h->old_likelihood = h->likelihood;
 		h->likelihood = hmm_iteration(h, doc);
-		printf("Iteration %d: likelihood = %g\n",
-		       iter + 1, h->likelihood);
 
 		temp = h->ss;
 		h->ss = h->ss2;
@@ -437,16 +665,49 @@ int hmm_train(hmm *h, const docinfo *doc, unsigned int num_states,
 		h->sw = h->sw2;
 		h->sw2 = temp;
 
-		if ((iter % 10) == 9 && hmm_filename) {
-			printf("Saving temporary HMM `%s'...\n", hmm_filename);
-			if (!hmm_save_easy(h, hmm_filename))
-				return FALSE;
+		status = SQUAREM_NONE;
+		if (h->accelerate) {
+			if (!hmm_accelerate(h, &sq, &status))
+				goto error_train;
+		}
+		printf("Iteration %d: likelihood = %g", iter + 1, h->likelihood);
+		squarem_print_status(&sq, status);
+
+		if (checkpoint_due(&cp, iter + 1) && !squarem_pending(&sq)) {
+			if (!hmm_checkpoint(h, &cp, iter + 1))
+				goto error_train;
+			if (checkpoint_interrupted()) {
+				checkpoint_wait(&cp);
+				printf("Training interrupted after %u "
+				       "iterations\n", iter + 1);
+				goto error_train;
+			}
+		}
+
+		/* The rejected parameters were replaced by the plain EM */
+		if (status == SQUAREM_REJECTED) {
+			h->likelihood = h->old_likelihood;
+			continue;
 		}
 
 		if (h->old_likelihood < 0
 		    && fabs(h->likelihood - h->old_likelihood) < tol)
 			break;
 	}
+
+	if (!checkpoint_wait(&cp))
+		goto error_train;
+	checkpoint_cleanup(&cp);
+
+	if (h->accelerate) {
+		tables[0] = h->ss;
+		tables[1] = h->sw;
+		squarem_finish(&sq, tables);
+		printf("SQUAREM: %u extrapolations accepted, %u rejected\n",
+		       sq.num_accepted, sq.num_rejected);
+		squarem_cleanup(&sq);
+	}
+
 	if (hmm_filename) {
 		printf("Saving HMM `%s'...\n", hmm_filename);
 		if (!hmm_save_easy(h, hmm_filename))
@@ -454,6 +715,11 @@ int hmm_train(hmm *h, const docinfo *doc, unsigned int num_states,
 	}
 
 	return TRUE;
+
+error_train:
+	checkpoint_cleanup(&cp);
+	squarem_cleanup(&sq);
+	return FALSE;
 }
 
 static
@@ -468,7 +734,7 @@ int cmp_dbl_indirect(const void *p1, const void *p2, void *arg)
 }
 
 static
-void hmm_optimize_array(hmm *h, double *array, unsigned int size,
+void hmm_optimize_array(hmm *h, const void *array, unsigned int size,
                         double *opt_v, unsigned int *opt_i)
 {
 	double thresh;
@@ -481,7 +747,7 @@ void hmm_optimize_array(hmm *h, double *array, unsigned int size,
 	thresh = 1.0 / size;
 	for (j = 0; j < size; j++) {
 		ti[j] = j;
-		td[j] = array[j];
+		td[j] = HMM_LOAD(h, array, j);
 	}
 	xsort(ti, size, sizeof(unsigned int), &cmp_dbl_indirect, td);
 
@@ -553,13 +819,17 @@ int hmm_optimize_generator(hmm *h)
 
 	for (i = 0; i < h->num_states; i++) {
 		pos = i * h->num_states;
-		hmm_optimize_array(h, &h->ss[pos], h->num_states,
+		hmm_optimize_array(h, (char *) h->ss
+		                      + pos * KERNEL_SIZE(h->precision),
+		                   h->num_states,
 		                   &h->opt_ss[pos], &h->opt_ss_i[2 * pos]);
 	}
 
 	for (i = 0; i < h->num_states; i++) {
 		pos = i * h->num_words;
-		hmm_optimize_array(h, &h->sw[pos], h->num_words,
+		hmm_optimize_array(h, (char *) h->sw
+		                      + pos * KERNEL_SIZE(h->precision),
+		                   h->num_words,
 		                   &h->opt_sw[pos], &h->opt_sw_i[2 * pos]);
 	}
 	return TRUE;
@@ -597,7 +867,14 @@ void hmm_generate_text(const hmm *h, const docinfo *doc)
 
 int hmm_save(const hmm *h, FILE *fp)
 {
-	unsigned int nmemb;
+	unsigned int header[3];
+	size_t nmemb;
+
+	header[0] = HMM_MAGIC;
+	header[1] = HMM_VERSION;
+	header[2] = (unsigned int) h->precision;
+	if (fwrite(header, sizeof(unsigned int), 3, fp) != 3)
+		return FALSE;
 
 	if (fwrite(&h->num_words, sizeof(unsigned int), 1, fp) != 1)
 		return FALSE;
@@ -611,41 +888,236 @@ int hmm_save(const hmm *h, FILE *fp)
 		return FALSE;
 
 	nmemb = h->num_states * h->num_states;
-	if (fwrite(h->ss, sizeof(double), nmemb, fp) != nmemb)
+	if (fwrite(h->ss, KERNEL_SIZE(h->precision), nmemb, fp) != nmemb)
 		return FALSE;
 
 	nmemb = h->num_states * h->num_words;
-	if (fwrite(h->sw, sizeof(double), nmemb, fp) != nmemb)
+	if (fwrite(h->sw, KERNEL_SIZE(h->precision), nmemb, fp) != nmemb)
 		return FALSE;
 
+	/* The state of an interrupted training */
+	if (fwrite(&h->iteration, sizeof(unsigned int), 1, fp) != 1)
+		return FALSE;
+	if (h->iteration > 0) {
+		if (fwrite(h->rng_state, sizeof(unsigned int),
+		           GENRAND_STATE_SIZE, fp) != GENRAND_STATE_SIZE)
+			return FALSE;
+	}
+
 	return TRUE;
 }
 
+/* Saves the model to a temporary file, which then replaces
+ * `filename'.
+ */
 int hmm_save_easy(const hmm *h, const char *filename)
 {
+	char *temp_filename;
 	FILE *fp;
 	int ret;
 
-	fp = fopen(filename, "wb");
-	if (!fp) {
-		error("could not open `%s' for writing", filename);
+	/* Models loaded from a mapped file are saved in the same format */
+	if (h->map.base)
+		return hmm_save_mapped(h, filename);
+
+	fp = atomic_fopen(filename, &temp_filename);
+	if (!fp) return FALSE;
+
+	ret = hmm_save(h, fp);
+	if (!ret) error("could not write `%s'", filename);
+	return atomic_fclose(fp, temp_filename, filename, ret);
+}
+
+/* Reads a table with `num_rows' rows of `length' elements of
+ * type `type', converting them to the precision of `h'.
+ */
+static
+int hmm_load_table(hmm *h, FILE *fp, void *table, unsigned int num_rows,
+                   unsigned int length, int type)
+{
+	unsigned int i;
+	size_t size;
+	void *row;
+
+	size = KERNEL_SIZE(type);
+	row = xmalloc(MAX(length, 1) * size);
+	if (!row) return FALSE;
+
+	for (i = 0; i < num_rows; i++) {
+		if (fread(row, size, length, fp) != length) {
+			free(row);
+			return FALSE;
+		}
+		kernels_convert(h->precision, (char *) table + (size_t) i
+		                * length * KERNEL_SIZE(h->precision),
+		                type, row, length);
+	}
+	free(row);
+	return TRUE;
+}
+
+/* Points `table' to the section `id' of the mapped model file, which
+ * holds `nmemb' elements of type `type'. If the precision of `h' is
+ * different, the section is converted to a new table instead.
+ */
+static
+int hmm_map_table(hmm *h, unsigned int id, int type, size_t nmemb,
+                  void **table)
+{
+	void *data;
+
+	*table = NULL;
+	if (nmemb == 0) return TRUE;
+
+	data = mapfile_get(&h->map, id, (unsigned int) type,
+	                   nmemb * KERNEL_SIZE(type));
+	if (!data) return FALSE;
+
+	if (type == h->precision) {
+		*table = data;
+		return TRUE;
+	}
+
+	*table = xmalloc(nmemb * KERNEL_SIZE(h->precision));
+	if (!*table) return FALSE;
+	kernels_convert(h->precision, *table, type, data, nmemb);
+	return TRUE;
+}
+
+/* Loads a model file in the mapped format, without reading the
+ * tables: they point inside the mapping.
+ */
+static
+int hmm_load_mapped(hmm *h, int fd)
+{
+	const unsigned int *params, *state;
+	size_t nmemb;
+	int type;
+
+	if (!mapfile_map(&h->map, fd, HMM_MAGIC))
+		goto error_load;
+
+	if (h->verify_checksums) {
+		if (!mapfile_verify(&h->map))
+			goto error_load;
+	}
+
+	params = h->map.header.params;
+	type = (int) params[3];
+	if (type != KERNEL_DOUBLE && type != KERNEL_FLOAT) {
+		error("unsupported HMM file format");
+		goto error_load;
+	}
+	h->num_words = params[0];
+	h->num_documents = params[1];
+	h->num_states = params[2];
+	h->likelihood = h->map.header.values[0];
+	h->old_likelihood = h->map.header.values[1];
+	h->iteration = params[4];
+	if (h->iteration > 0) {
+		state = (const unsigned int *)
+			mapfile_get(&h->map, HMM_SECTION_RNG, MAPFILE_UINT,
+			            sizeof(h->rng_state));
+		if (!state) goto error_load;
+		memcpy(h->rng_state, state, sizeof(h->rng_state));
+	}
+
+	nmemb = (size_t) h->num_states * h->num_states;
+	if (!hmm_map_table(h, HMM_SECTION_SS, type, nmemb, &h->ss))
+		goto error_load;
+
+	nmemb = (size_t) h->num_states * h->num_words;
+	if (!hmm_map_table(h, HMM_SECTION_SW, type, nmemb, &h->sw))
+		goto error_load;
+
+	if (!hmm_allocate_tables(h, h->num_words, h->num_documents,
+	                         h->num_states))
+		goto error_load;
+
+	return TRUE;
+
+error_load:
+	error("could not load HMM");
+	hmm_cleanup(h);
+	return FALSE;
+}
+
+/* Saves the model in the mapped format, replacing the file
+ * atomically.
+ */
+int hmm_save_mapped(const hmm *h, const char *filename)
+{
+	mapfile mf;
+	unsigned int type;
+	size_t nmemb;
+
+	if (!mapfile_create(&mf, filename, HMM_MAGIC))
 		return FALSE;
+
+	type = (unsigned int) h->precision;
+	mf.header.params[0] = h->num_words;
+	mf.header.params[1] = h->num_documents;
+	mf.header.params[2] = h->num_states;
+	mf.header.params[3] = type;
+	mf.header.params[4] = h->iteration;
+	mf.header.values[0] = h->likelihood;
+	mf.header.values[1] = h->old_likelihood;
+
+	nmemb = (size_t) h->num_states * h->num_states;
+	if (!mapfile_write(&mf, HMM_SECTION_SS, type, h->ss,
+	                   nmemb * KERNEL_SIZE(h->precision)))
+		goto error_save;
+
+	nmemb = (size_t) h->num_states * h->num_words;
+	if (!mapfile_write(&mf, HMM_SECTION_SW, type, h->sw,
+	                   nmemb * KERNEL_SIZE(h->precision)))
+		goto error_save;
+
+	if (h->iteration > 0) {
+		if (!mapfile_write(&mf, HMM_SECTION_RNG, MAPFILE_UINT,
+		                   h->rng_state, sizeof(h->rng_state)))
+			goto error_save;
 	}
-	ret = hmm_save(h, fp);
-	fclose(fp);
-	return ret;
+
+	return mapfile_commit(&mf);
+
+error_save:
+	error("could not write `%s'", filename);
+	mapfile_abort(&mf);
+	return FALSE;
 }
 
 int hmm_load(hmm *h, FILE *fp)
 {
-	unsigned int nmemb, num_words, num_documents, num_states;
+	unsigned int num_words, num_documents, num_states;
+	unsigned int header[2];
+	int type, version;
 
-	hmm_reset(h);
+	hmm_cleanup(h);
 	if (!hmm_initialize(h))
 		return FALSE;
 
+	/* Files without the header have the tables in double precision */
 	if (fread(&num_words, sizeof(unsigned int), 1, fp) != 1)
 		return FALSE;
+	if (num_words == MAPFILE_MAGIC)
+		return hmm_load_mapped(h, fileno(fp));
+
+	type = KERNEL_DOUBLE;
+	version = 0;
+	if (num_words == HMM_MAGIC) {
+		if (fread(header, sizeof(unsigned int), 2, fp) != 2)
+			return FALSE;
+		if (header[0] == 0 || header[0] > HMM_VERSION ||
+		    (header[1] != KERNEL_DOUBLE && header[1] != KERNEL_FLOAT)) {
+			error("unsupported HMM file format");
+			return FALSE;
+		}
+		version = (int) header[0];
+		type = (int) header[1];
+		if (fread(&num_words, sizeof(unsigned int), 1, fp) != 1)
+			return FALSE;
+	}
 	if (fread(&num_documents, sizeof(unsigned int), 1, fp) != 1)
 		return FALSE;
 	if (fread(&num_states, sizeof(unsigned int), 1, fp) != 1)
@@ -656,16 +1128,25 @@ int hmm_load(hmm *h, FILE *fp)
 		return FALSE;
 
 	if (!hmm_allocate_tables(h, num_words, num_documents, num_states))
-		return FALSE;
+		goto error_load;
 
-	nmemb = h->num_states * h->num_states;
-	if (fread(h->ss, sizeof(double), nmemb, fp) != nmemb)
+	if (!hmm_load_table(h, fp, h->ss, h->num_states,
+	                    h->num_states, type))
 		goto error_load;
 
-	nmemb = h->num_states * h->num_words;
-	if (fread(h->sw, sizeof(double), nmemb, fp) != nmemb)
+	if (!hmm_load_table(h, fp, h->sw, h->num_states,
+	                    h->num_words, type))
 		goto error_load;
 
+	if (version >= 2) {
+		if (fread(&h->iteration, sizeof(unsigned int), 1, fp) != 1)
+			goto error_load;
+		if (h->iteration > 0
+		    && fread(h->rng_state, sizeof(unsigned int),
+		             GENRAND_STATE_SIZE, fp) != GENRAND_STATE_SIZE)
+			goto error_load;
+	}
+
 	return TRUE;
 
 error_load:
@@ -698,7 +1179,7 @@ void hmm_print(const hmm *h, const docinfo *doc)
 	for (i = 0; i < h->num_states; i++) {
 		for (j = 0; j < h->num_states; j++) {
 			pos = i * h->num_states + j;
-			printf("%.3f ", h->ss[pos]);
+			printf("%.3f ", HMM_LOAD(h, h->ss, pos));
 		}
 		printf("\n");
 	}
@@ -706,7 +1187,7 @@ void hmm_print(const hmm *h, const docinfo *doc)
 	for (i = 0; i < h->num_states; i++) {
 		for (k = 0; k < h->num_words; k++) {
 			pos = i * h->num_words + k;
-			printf("%.3f ", h->sw[pos]);
+			printf("%.3f ", HMM_LOAD(h, h->sw, pos));
 		}
 		printf("\n");
 	}
@@ -724,7 +1205,6 @@ int hmm_build_cached(hmm *h, const char *hmm_file, const docinfo *doc,
 	FILE *fp = NULL;
 	int ret;
 
-	hmm_reset(h);
 	if (hmm_file) fp = fopen(hmm_file, "rb");
 	if (fp) {
 		printf("Loading HMM `%s'...\n", hmm_file);
@@ -752,7 +1232,11 @@ static
 int do_main(const char *docinfo_file, const char *training_file,
             const char *ignore_file, const char *hmm_file,
             unsigned int num_states, unsigned int max_iter, double tol,
-            unsigned int num_generated_texts)
+            unsigned int num_generated_texts, unsigned int single_precision,
+            unsigned int accelerate, const char *mapped_file,
+            unsigned int verify_checksums, unsigned int checkpoint_interval,
+            double checkpoint_seconds, unsigned int min_count,
+            double max_df, unsigned int max_words)
 {
 	unsigned int i;
 	docinfo doc;
@@ -760,15 +1244,31 @@ int do_main(const char *docinfo_file, const char *training_file,
 
 	docinfo_reset(&doc);
 	hmm_reset(&h);
+	h.precision = (single_precision) ? KERNEL_FLOAT : KERNEL_DOUBLE;
+	h.accelerate = (accelerate != 0);
+	h.verify_checksums = (verify_checksums != 0);
+	h.checkpoint_interval = checkpoint_interval;
+	h.checkpoint_seconds = checkpoint_seconds;
 
 	if (!docinfo_build_cached(&doc, docinfo_file,
-	                          training_file, ignore_file))
+	                          training_file, ignore_file, 1))
 		goto error_main;
 
+	if (min_count > 1 || max_df > 0 || max_words > 0) {
+		if (!docinfo_prune(&doc, min_count, max_df, max_words))
+			goto error_main;
+	}
+
 	if (!hmm_build_cached(&h, hmm_file, &doc,
 	                      num_states, max_iter, tol))
 		goto error_main;
 
+	if (mapped_file) {
+		printf("Saving mapped HMM `%s'...\n", mapped_file);
+		if (!hmm_save_mapped(&h, mapped_file))
+			goto error_main;
+	}
+
 	if (!hmm_optimize_generator(&h))
 		goto error_main;
 
@@ -792,9 +1292,13 @@ int main(int argc, char **argv)
 {
 	char *docinfo_file, *hmm_file;
 	char *training_file, *ignore_file;
+	char *mapped_file;
 	unsigned int num_states, max_iter;
 	unsigned int num_generated_texts;
-	double tol;
+	unsigned int single_precision, accelerate;
+	unsigned int verify_checksums, checkpoint_interval;
+	unsigned int min_count, max_words, seed;
+	double tol, checkpoint_seconds, max_df;
 	option opts[] = {
 		{ "-d", NULL, ARGTYPE_FILE,
 		  "specify the DOCINFO file" },
@@ -812,6 +1316,28 @@ int main(int argc, char **argv)
 		  "the tolerance for convergence" },
 		{ "-n", NULL, ARGTYPE_UINT,
 		  "the number of generated texts" },
+		{ "-f", NULL, ARGTYPE_UINT,
+		  "1 to store the tables in single precision" },
+		{ "-o", NULL, ARGTYPE_UINT,
+		  "1 to accelerate the EM with SQUAREM" },
+		{ "-v", NULL, ARGTYPE_FILE,
+		  "save the HMM in the mapped format to this file" },
+		{ "-V", NULL, ARGTYPE_UINT,
+		  "1 to verify the checksums of mapped HMM files" },
+		{ "-C", NULL, ARGTYPE_UINT,
+		  "the number of iterations between checkpoints" },
+		{ "-T", NULL, ARGTYPE_DBL,
+		  "the number of seconds between checkpoints" },
+		{ "-M", NULL, ARGTYPE_UINT,
+		  "drop the words seen less than this number of times" },
+		{ "-D", NULL, ARGTYPE_DBL,
+		  "drop the words found in more than this fraction of the "
+		  "documents" },
+		{ "-W", NULL, ARGTYPE_UINT,
+		  "keep only this number of most frequent words" },
+		{ "-S", NULL, ARGTYPE_UINT,
+		  "the seed of the random numbers (0, the default, to take "
+		  "it from the clock)" },
 		{ "--help", NULL, ARGTYPE_NONE,
 		  "print this help" },
 	};
@@ -831,15 +1357,34 @@ int main(int argc, char **argv)
 	opts[5].ptr = &max_iter;
 	opts[6].ptr = &tol;
 	opts[7].ptr = &num_generated_texts;
-
-	genrand_randomize();
+	opts[8].ptr = &single_precision;
+	opts[9].ptr = &accelerate;
+	opts[10].ptr = &mapped_file;
+	opts[11].ptr = &verify_checksums;
+	opts[12].ptr = &checkpoint_interval;
+	opts[13].ptr = &checkpoint_seconds;
+	opts[14].ptr = &min_count;
+	opts[15].ptr = &max_df;
+	opts[16].ptr = &max_words;
+	opts[17].ptr = &seed;
 
 	docinfo_file = NULL;
 	hmm_file = NULL;
 	training_file = NULL;
 	ignore_file = NULL;
+	mapped_file = NULL;
 	num_states = 0;
 	max_iter = 0;
+	num_generated_texts = 0;
+	single_precision = 0;
+	accelerate = 0;
+	verify_checksums = 0;
+	checkpoint_interval = CHECKPOINT_INTERVAL;
+	checkpoint_seconds = 0;
+	min_count = 0;
+	max_df = 0;
+	max_words = 0;
+	seed = 0;
 	tol = 0;
 
 	num_opts = sizeof(opts) / sizeof(option);
@@ -850,9 +1395,17 @@ int main(int argc, char **argv)
 	ret = process_args(argc, argv, opts, num_opts);
 	if (ret <= 0) return ret;
 
+	/* A fixed seed repeats the same run */
+	if (seed > 0)
+		init_genrand((unsigned long) seed);
+	else
+		genrand_randomize();
+
 	if (!do_main(docinfo_file, training_file, ignore_file,
 	             hmm_file, num_states, max_iter, tol,
-	             num_generated_texts))
+	             num_generated_texts, single_precision, accelerate,
+	             mapped_file, verify_checksums, checkpoint_interval,
+	             checkpoint_seconds, min_count, max_df, max_words))
 		return -1;
 
 	return 0;
@@ -5,6 +5,12 @@
 #include <stdio.h>
 
 #include "docinfo.h"
+#include "mapfile.h"
+#include "random.h"
+
+/* Constants */
+#define HMM_MAGIC                 0x204D4D48 /* "HMM " */
+#define HMM_VERSION               2
 
 /* Data structures and types */
 typedef
@@ -12,11 +18,14 @@ struct hmm_st {
 	unsigned int num_words;
 	unsigned int num_documents;
 	unsigned int num_states;
+	int precision; /* KERNEL_DOUBLE or KERNEL_FLOAT */
+	int accelerate; /* extrapolate the EM with SQUAREM */
 	double likelihood, old_likelihood;
 
-	double *ss, *ss2;
-	double *sw, *sw2;
+	void *ss, *ss2;
+	void *sw, *sw2;
 
+	/* The accumulators of the forward-backward pass are always doubles */
 	double *dps, *dpe;
 	double *dps_s, *dpe_s;
 
@@ -25,6 +34,23 @@ struct hmm_st {
 
 	double *tmp_d;
 	unsigned int *tmp_i;
+
+	/* The tables may point inside a mapped model file */
+	mapfile map;
+	int verify_checksums;
+
+	/* A checkpoint is written every `checkpoint_interval' iterations
+	 * and every `checkpoint_seconds' seconds (0 for never).
+	 */
+	unsigned int checkpoint_interval;
+	double checkpoint_seconds;
+
+	/* The number of iterations of a training saved by a checkpoint,
+	 * or 0 if the training is complete, and the state of the random
+	 * generator at that point.
+	 */
+	unsigned int iteration;
+	unsigned int rng_state[GENRAND_STATE_SIZE];
 } hmm;
 
 /* Functions */
@@ -42,6 +68,7 @@ int hmm_save(const hmm *h, FILE *fp);
 int hmm_save_easy(const hmm *h, const char *filename);
 int hmm_load(hmm *h, FILE *fp);
 int hmm_load_easy(hmm *h, const char *filename);
+int hmm_save_mapped(const hmm *h, const char *filename);
 
 void hmm_print(const hmm *h, const docinfo *doc);
 int hmm_build_cached(hmm *h, const char *hmm_file, const docinfo *doc,
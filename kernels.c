@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "kernels.h"
+#include "utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#	define KERNELS_X86
+#endif
+
+static
+double scalar_dot(const void *a, const void *b, unsigned int n)
+{
+	const double *da = (const double *) a;
+	const double *db = (const double *) b;
+	unsigned int i;
+	double sum = 0;
+
+	for (i = 0; i < n; i++)
+		sum += da[i] * db[i];
+	return sum;
+}
+
+static
+void scalar_axpy_prod(void *y, double alpha, const void *a,
+                      const void *b, unsigned int n)
+{
+	const double *da = (const double *) a;
+	const double *db = (const double *) b;
+	double *dy = (double *) y;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		dy[i] += alpha * da[i] * db[i];
+}
+
+static
+double scalar_dot_float(const void *a, const void *b, unsigned int n)
+{
+	const float *fa = (const float *) a;
+	const float *fb = (const float *) b;
+	unsigned int i;
+	double sum = 0;
+
+	for (i = 0; i < n; i++)
+		sum += fa[i] * fb[i];
+	return sum;
+}
+
+static
+void scalar_axpy_prod_float(void *y, double alpha, const void *a,
+                            const void *b, unsigned int n)
+{
+	const float *fa = (const float *) a;
+	const float *fb = (const float *) b;
+	float *fy = (float *) y;
+	float falpha = (float) alpha;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		fy[i] += falpha * fa[i] * fb[i];
+}
+
+static
+double scalar_sum_log(const double *w, const double *x, unsigned int n)
+{
+	unsigned int i;
+	double sum = 0;
+
+	for (i = 0; i < n; i++)
+		sum += w[i] * log(x[i]);
+	return sum;
+}
+
+static
+unsigned int scalar_scan(const char *p, unsigned int *dashes)
+{
+	unsigned int i, spaces;
+
+	spaces = 0;
+	*dashes = 0;
+	for (i = 0; i < KERNEL_SCAN_WIDTH; i++) {
+		if (p[i] == ' ' || (p[i] >= '\t' && p[i] <= '\r'))
+			spaces |= 1U << i;
+		else if (p[i] == '-')
+			*dashes |= 1U << i;
+	}
+	return spaces;
+}
+
+static
+const kernel_ops kernels_scalar[2] = {
+	{
+		"scalar",
+		&scalar_dot,
+		&scalar_axpy_prod,
+		&scalar_sum_log,
+		&scalar_scan
+	}, {
+		"scalar",
+		&scalar_dot_float,
+		&scalar_axpy_prod_float,
+		&scalar_sum_log,
+		&scalar_scan
+	}
+};
+
+static
+const kernel_ops *kernels_current = NULL;
+
+static
+int kernels_supported(const kernel_ops *ops)
+{
+#ifdef KERNELS_X86
+	if (ops == kernels_sse2)
+		return __builtin_cpu_supports("sse2");
+	if (ops == kernels_avx2)
+		return __builtin_cpu_supports("avx2")
+		       && __builtin_cpu_supports("fma");
+	if (ops == kernels_avx512)
+		return __builtin_cpu_supports("avx512f");
+#endif
+	return (ops == kernels_scalar);
+}
+
+/* Returns the kernels in use for elements of type `type',
+ * detecting the best ones for this CPU on the first call.
+ */
+const kernel_ops *kernels_get(int type)
+{
+	if (!kernels_current)
+		kernels_select(NULL);
+	return &kernels_current[type];
+}
+
+/* Selects the kernels named `name', or the best ones for this
+ * CPU if `name' is NULL or "auto".
+ */
+int kernels_select(const char *name)
+{
+	const kernel_ops *all[4];
+	unsigned int i, num;
+
+	num = 0;
+#ifdef KERNELS_X86
+	all[num++] = kernels_avx512;
+	all[num++] = kernels_avx2;
+	all[num++] = kernels_sse2;
+#endif
+	all[num++] = kernels_scalar;
+
+	for (i = 0; i < num; i++) {
+		if (name && strcmp(name, "auto") != 0
+		    && strcmp(name, all[i]->name) != 0)
+			continue;
+		if (!kernels_supported(all[i])) {
+			if (name && strcmp(name, "auto") != 0) {
+				error("kernels `%s' not supported "
+				      "by this CPU", name);
+				return FALSE;
+			}
+			continue;
+		}
+		kernels_current = all[i];
+		return TRUE;
+	}
+	error("invalid kernels `%s'", name);
+	return FALSE;
+}
+
+/* Computes y[i] += x[i] */
+void kernels_add(int type, void *y, const void *x, size_t n)
+{
+	size_t i;
+
+	if (type == KERNEL_FLOAT) {
+		float *fy = (float *) y;
+		const float *fx = (const float *) x;
+		for (i = 0; i < n; i++)
+			fy[i] += fx[i];
+	} else {
+		double *dy = (double *) y;
+		const double *dx = (const double *) x;
+		for (i = 0; i < n; i++)
+			dy[i] += dx[i];
+	}
+}
+
+/* Computes sums[idx[i]] += x[i], the sums being always in double.
+ * If `idx' is NULL, computes sums[i] += x[i].
+ */
+void kernels_sum(int type, double *sums, const unsigned int *idx,
+                 const void *x, size_t n)
+{
+	size_t i;
+
+	if (idx) {
+		for (i = 0; i < n; i++)
+			sums[idx[i]] += KERNEL_LOAD(type, x, i);
+	} else if (type == KERNEL_FLOAT) {
+		const float *fx = (const float *) x;
+		for (i = 0; i < n; i++)
+			sums[i] += fx[i];
+	} else {
+		const double *dx = (const double *) x;
+		for (i = 0; i < n; i++)
+			sums[i] += dx[i];
+	}
+}
+
+/* Computes y[i] /= d[idx[i]], or y[i] /= d[i] if `idx' is NULL */
+void kernels_divide(int type, void *y, const double *d,
+                    const unsigned int *idx, size_t n)
+{
+	size_t i;
+
+	if (idx) {
+		for (i = 0; i < n; i++) {
+			KERNEL_STORE(type, y, i,
+			             KERNEL_LOAD(type, y, i) / d[idx[i]]);
+		}
+	} else if (type == KERNEL_FLOAT) {
+		float *fy = (float *) y;
+		for (i = 0; i < n; i++)
+			fy[i] = (float) (fy[i] / d[i]);
+	} else {
+		double *dy = (double *) y;
+		for (i = 0; i < n; i++)
+			dy[i] /= d[i];
+	}
+}
+
+/* Returns the sum of a[idx[i]] * b[i] */
+double kernels_dot_sparse(int type, const void *a, const unsigned int *idx,
+                          const void *b, unsigned int n)
+{
+	unsigned int i;
+	double sum = 0;
+
+	if (type == KERNEL_FLOAT) {
+		const float *fa = (const float *) a;
+		const float *fb = (const float *) b;
+		for (i = 0; i < n; i++)
+			sum += fa[idx[i]] * fb[i];
+	} else {
+		const double *da = (const double *) a;
+		const double *db = (const double *) b;
+		for (i = 0; i < n; i++)
+			sum += da[idx[i]] * db[i];
+	}
+	return sum;
+}
+
+/* Computes y[i] += alpha * a[idx[i]] * b[i] */
+void kernels_axpy_sparse(int type, void *y, double alpha, const void *a,
+                         const unsigned int *idx, const void *b,
+                         unsigned int n)
+{
+	unsigned int i;
+
+	if (type == KERNEL_FLOAT) {
+		const float *fa = (const float *) a;
+		const float *fb = (const float *) b;
+		float *fy = (float *) y;
+		float falpha = (float) alpha;
+		for (i = 0; i < n; i++)
+			fy[i] += falpha * fa[idx[i]] * fb[i];
+	} else {
+		const double *da = (const double *) a;
+		const double *db = (const double *) b;
+		double *dy = (double *) y;
+		for (i = 0; i < n; i++)
+			dy[i] += alpha * da[idx[i]] * db[i];
+	}
+}
+
+/* Computes y[idx[i]] += alpha * a[idx[i]] * b[i] */
+void kernels_axpy_scatter(int type, void *y, double alpha, const void *a,
+                          const unsigned int *idx, const void *b,
+                          unsigned int n)
+{
+	unsigned int i;
+
+	if (type == KERNEL_FLOAT) {
+		const float *fa = (const float *) a;
+		const float *fb = (const float *) b;
+		float *fy = (float *) y;
+		float falpha = (float) alpha;
+		for (i = 0; i < n; i++)
+			fy[idx[i]] += falpha * fa[idx[i]] * fb[i];
+	} else {
+		const double *da = (const double *) a;
+		const double *db = (const double *) b;
+		double *dy = (double *) y;
+		for (i = 0; i < n; i++)
+			dy[idx[i]] += alpha * da[idx[i]] * db[i];
+	}
+}
+
+/* Returns the sum of a[idx[i]] * b[idx[i]] */
+double kernels_dot_gather(int type, const void *a, const unsigned int *idx,
+                          const void *b, unsigned int n)
+{
+	unsigned int i;
+	double sum = 0;
+
+	if (type == KERNEL_FLOAT) {
+		const float *fa = (const float *) a;
+		const float *fb = (const float *) b;
+		for (i = 0; i < n; i++)
+			sum += fa[idx[i]] * fb[idx[i]];
+	} else {
+		const double *da = (const double *) a;
+		const double *db = (const double *) b;
+		for (i = 0; i < n; i++)
+			sum += da[idx[i]] * db[idx[i]];
+	}
+	return sum;
+}
+
+/* Computes y[idx[i]] += alpha * a[idx[i]] * b[idx[i]] */
+void kernels_axpy_gather(int type, void *y, double alpha, const void *a,
+                         const unsigned int *idx, const void *b,
+                         unsigned int n)
+{
+	unsigned int i;
+
+	if (type == KERNEL_FLOAT) {
+		const float *fa = (const float *) a;
+		const float *fb = (const float *) b;
+		float *fy = (float *) y;
+		float falpha = (float) alpha;
+		for (i = 0; i < n; i++)
+			fy[idx[i]] += falpha * fa[idx[i]] * fb[idx[i]];
+	} else {
+		const double *da = (const double *) a;
+		const double *db = (const double *) b;
+		double *dy = (double *) y;
+		for (i = 0; i < n; i++)
+			dy[idx[i]] += alpha * da[idx[i]] * db[idx[i]];
+	}
+}
+
+/* Copies `n' elements of type `src_type' to an array of `dst_type' */
+void kernels_convert(int dst_type, void *dst, int src_type,
+                     const void *src, size_t n)
+{
+	size_t i;
+
+	if (dst_type == src_type) {
+		memmove(dst, src, n * KERNEL_SIZE(src_type));
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		KERNEL_STORE(dst_type, dst, i,
+		             KERNEL_LOAD(src_type, src, i));
+	}
+}
@@ -0,0 +1,83 @@
+#ifndef __KERNELS_H
+#define __KERNELS_H
+
+#include <stddef.h>
+
+/* Constants */
+#define KERNEL_DOUBLE   0
+#define KERNEL_FLOAT    1
+
+/* Number of bytes classified at a time by the `scan' kernels */
+#define KERNEL_SCAN_WIDTH 32
+
+/* Access to the elements of arrays of doubles or floats */
+#define KERNEL_SIZE(type) \
+	((type) == KERNEL_FLOAT ? sizeof(float) : sizeof(double))
+#define KERNEL_LOAD(type, ptr, idx) \
+	((type) == KERNEL_FLOAT ? (double) ((const float *) (ptr))[idx] \
+	                        : ((const double *) (ptr))[idx])
+#define KERNEL_STORE(type, ptr, idx, val) \
+	((type) == KERNEL_FLOAT \
+	 ? (void) (((float *) (ptr))[idx] = (float) (val)) \
+	 : (void) (((double *) (ptr))[idx] = (val)))
+
+/* Data structures and types */
+typedef
+struct kernel_ops_st {
+	const char *name;
+
+	/* Returns the sum of a[i] * b[i] */
+	double (*dot)(const void *a, const void *b, unsigned int n);
+
+	/* Computes y[i] += alpha * a[i] * b[i] */
+	void (*axpy_prod)(void *y, double alpha, const void *a,
+	                  const void *b, unsigned int n);
+
+	/* Returns the sum of w[i] * log(x[i]), for positive x[i] */
+	double (*sum_log)(const double *w, const double *x, unsigned int n);
+
+	/* Returns the mask of the KERNEL_SCAN_WIDTH bytes at `p' that are
+	 * white space (bit i for p[i]), and stores the mask of the ones
+	 * that are '-' in `*dashes'.
+	 */
+	unsigned int (*scan)(const char *p, unsigned int *dashes);
+} kernel_ops;
+
+/* Functions */
+const kernel_ops *kernels_get(int type);
+int kernels_select(const char *name);
+
+void kernels_add(int type, void *y, const void *x, size_t n);
+void kernels_sum(int type, double *sums, const unsigned int *idx,
+                 const void *x, size_t n);
+void kernels_divide(int type, void *y, const double *d,
+                    const unsigned int *idx, size_t n);
+
+/* Kernels for sparse rows, whose i-th element is in column idx[i] */
+double kernels_dot_sparse(int type, const void *a, const unsigned int *idx,
+                          const void *b, unsigned int n);
+void kernels_axpy_sparse(int type, void *y, double alpha, const void *a,
+                         const unsigned int *idx, const void *b,
+                         unsigned int n);
+void kernels_axpy_scatter(int type, void *y, double alpha, const void *a,
+                          const unsigned int *idx, const void *b,
+                          unsigned int n);
+
+/* Kernels for dense rows gone over along the columns idx[i] */
+double kernels_dot_gather(int type, const void *a, const unsigned int *idx,
+                          const void *b, unsigned int n);
+void kernels_axpy_gather(int type, void *y, double alpha, const void *a,
+                         const unsigned int *idx, const void *b,
+                         unsigned int n);
+
+void kernels_convert(int dst_type, void *dst, int src_type,
+                     const void *src, size_t n);
+
+/* Kernels compiled with separate flags (see the Makefile),
+ * indexed by KERNEL_DOUBLE and KERNEL_FLOAT.
+ */
+extern const kernel_ops kernels_sse2[2];
+extern const kernel_ops kernels_avx2[2];
+extern const kernel_ops kernels_avx512[2];
+
+#endif /* __KERNELS_H */
@@ -0,0 +1,239 @@
+#include <math.h>
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define SQRT2       1.41421356237309504880
+#define LN2_HI      6.93147180369123816490e-01
+#define LN2_LO      1.90821492927058770002e-10
+#define MAGIC_BIAS  (4503599627370496.0 + 1023)
+
+/* Bit patterns of the mantissa mask and of 2^52 */
+static
+const unsigned int mantissa[8] = {
+	0xffffffffU, 0x000fffffU, 0xffffffffU, 0x000fffffU,
+	0xffffffffU, 0x000fffffU, 0xffffffffU, 0x000fffffU
+};
+static
+const unsigned int magic[8] = {
+	0x00000000U, 0x43300000U, 0x00000000U, 0x43300000U,
+	0x00000000U, 0x43300000U, 0x00000000U, 0x43300000U
+};
+
+/* Coefficients of log(m) = 2 f (1 + f^2/3 + f^4/5 + ...),
+ * where f = (m - 1) / (m + 1) and 1/sqrt(2) <= m <= sqrt(2).
+ */
+static
+const double log_coef[11] = {
+	1.0 / 21, 1.0 / 19, 1.0 / 17, 1.0 / 15, 1.0 / 13, 1.0 / 11,
+	1.0 / 9, 1.0 / 7, 1.0 / 5, 1.0 / 3, 1.0
+};
+
+static
+double avx2_hsum(__m256d v)
+{
+	__m128d lo, hi;
+
+	lo = _mm256_castpd256_pd128(v);
+	hi = _mm256_extractf128_pd(v, 1);
+	lo = _mm_add_pd(lo, hi);
+	return _mm_cvtsd_f64(lo) + _mm_cvtsd_f64(_mm_unpackhi_pd(lo, lo));
+}
+
+static
+double avx2_dot(const void *pa, const void *pb, unsigned int n)
+{
+	const double *a = (const double *) pa;
+	const double *b = (const double *) pb;
+	__m256d s0, s1;
+	unsigned int i;
+	double sum;
+
+	s0 = _mm256_setzero_pd();
+	s1 = _mm256_setzero_pd();
+	for (i = 0; i + 8 <= n; i += 8) {
+		s0 = _mm256_fmadd_pd(_mm256_loadu_pd(&a[i]),
+		                     _mm256_loadu_pd(&b[i]), s0);
+		s1 = _mm256_fmadd_pd(_mm256_loadu_pd(&a[i + 4]),
+		                     _mm256_loadu_pd(&b[i + 4]), s1);
+	}
+	if (i + 4 <= n) {
+		s0 = _mm256_fmadd_pd(_mm256_loadu_pd(&a[i]),
+		                     _mm256_loadu_pd(&b[i]), s0);
+		i += 4;
+	}
+	sum = avx2_hsum(_mm256_add_pd(s0, s1));
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+static
+void avx2_axpy_prod(void *py, double alpha, const void *pa,
+                    const void *pb, unsigned int n)
+{
+	const double *a = (const double *) pa;
+	const double *b = (const double *) pb;
+	double *y = (double *) py;
+	__m256d va, v;
+	unsigned int i;
+
+	va = _mm256_set1_pd(alpha);
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm256_mul_pd(_mm256_loadu_pd(&a[i]),
+		                  _mm256_loadu_pd(&b[i]));
+		v = _mm256_fmadd_pd(va, v, _mm256_loadu_pd(&y[i]));
+		_mm256_storeu_pd(&y[i], v);
+	}
+	for (; i < n; i++)
+		y[i] += alpha * a[i] * b[i];
+}
+
+static
+double avx2_hsum_float(__m256 v)
+{
+	__m128 t;
+
+	t = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+	t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+	return (double) _mm_cvtss_f32(t);
+}
+
+static
+double avx2_dot_float(const void *pa, const void *pb, unsigned int n)
+{
+	const float *a = (const float *) pa;
+	const float *b = (const float *) pb;
+	__m256 s0, s1;
+	unsigned int i;
+	double sum;
+
+	s0 = _mm256_setzero_ps();
+	s1 = _mm256_setzero_ps();
+	for (i = 0; i + 16 <= n; i += 16) {
+		s0 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i]),
+		                     _mm256_loadu_ps(&b[i]), s0);
+		s1 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i + 8]),
+		                     _mm256_loadu_ps(&b[i + 8]), s1);
+	}
+	if (i + 8 <= n) {
+		s0 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i]),
+		                     _mm256_loadu_ps(&b[i]), s0);
+		i += 8;
+	}
+	sum = avx2_hsum_float(_mm256_add_ps(s0, s1));
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+static
+void avx2_axpy_prod_float(void *py, double alpha, const void *pa,
+                          const void *pb, unsigned int n)
+{
+	const float *a = (const float *) pa;
+	const float *b = (const float *) pb;
+	float *y = (float *) py;
+	float falpha = (float) alpha;
+	__m256 va, v;
+	unsigned int i;
+
+	va = _mm256_set1_ps(falpha);
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm256_mul_ps(_mm256_loadu_ps(&a[i]),
+		                  _mm256_loadu_ps(&b[i]));
+		v = _mm256_fmadd_ps(va, v, _mm256_loadu_ps(&y[i]));
+		_mm256_storeu_ps(&y[i], v);
+	}
+	for (; i < n; i++)
+		y[i] += falpha * a[i] * b[i];
+}
+
+/* Natural logarithm of four positive normal numbers */
+static
+__m256d avx2_log(__m256d x)
+{
+	__m256d m, e, f, s, p, mask, one;
+	__m256i bits;
+	unsigned int k;
+
+	one = _mm256_set1_pd(1.0);
+	bits = _mm256_srli_epi64(_mm256_castpd_si256(x), 52);
+	bits = _mm256_or_si256(bits,
+	                       _mm256_loadu_si256((const __m256i *) magic));
+	e = _mm256_sub_pd(_mm256_castsi256_pd(bits),
+	                  _mm256_set1_pd(MAGIC_BIAS));
+
+	bits = _mm256_and_si256(_mm256_castpd_si256(x),
+	                        _mm256_loadu_si256((const __m256i *) mantissa));
+	bits = _mm256_or_si256(bits, _mm256_castpd_si256(one));
+	m = _mm256_castsi256_pd(bits);
+
+	mask = _mm256_cmp_pd(m, _mm256_set1_pd(SQRT2), _CMP_GT_OQ);
+	m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), mask);
+	e = _mm256_add_pd(e, _mm256_and_pd(mask, one));
+
+	f = _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one));
+	s = _mm256_mul_pd(f, f);
+	p = _mm256_set1_pd(log_coef[0]);
+	for (k = 1; k < 11; k++)
+		p = _mm256_fmadd_pd(p, s, _mm256_set1_pd(log_coef[k]));
+	p = _mm256_mul_pd(_mm256_add_pd(f, f), p);
+	p = _mm256_fmadd_pd(e, _mm256_set1_pd(LN2_LO), p);
+	return _mm256_fmadd_pd(e, _mm256_set1_pd(LN2_HI), p);
+}
+
+static
+double avx2_sum_log(const double *w, const double *x, unsigned int n)
+{
+	__m256d acc;
+	unsigned int i;
+	double sum;
+
+	acc = _mm256_setzero_pd();
+	for (i = 0; i + 4 <= n; i += 4) {
+		acc = _mm256_fmadd_pd(_mm256_loadu_pd(&w[i]),
+		                      avx2_log(_mm256_loadu_pd(&x[i])), acc);
+	}
+	sum = avx2_hsum(acc);
+	for (; i < n; i++)
+		sum += w[i] * log(x[i]);
+	return sum;
+}
+
+/* White space is ' ' and the bytes from '\t' to '\r' */
+static
+unsigned int avx2_scan(const char *p, unsigned int *dashes)
+{
+	__m256i x, t, range;
+
+	x = _mm256_loadu_si256((const __m256i *) p);
+	range = _mm256_set1_epi8('\r' - '\t');
+	t = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+	t = _mm256_cmpeq_epi8(_mm256_min_epu8(t, range), t);
+	t = _mm256_or_si256(t, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')));
+	*dashes = (unsigned int) _mm256_movemask_epi8(
+		_mm256_cmpeq_epi8(x, _mm256_set1_epi8('-')));
+	return (unsigned int) _mm256_movemask_epi8(t);
+}
+
+const kernel_ops kernels_avx2[2] = {
+	{
+		"avx2",
+		&avx2_dot,
+		&avx2_axpy_prod,
+		&avx2_sum_log,
+		&avx2_scan
+	}, {
+		"avx2",
+		&avx2_dot_float,
+		&avx2_axpy_prod_float,
+		&avx2_sum_log,
+		&avx2_scan
+	}
+};
+
+#endif
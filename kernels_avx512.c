@@ -0,0 +1,205 @@
+#include <math.h>
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define SQRT2       1.41421356237309504880
+#define LN2_HI      6.93147180369123816490e-01
+#define LN2_LO      1.90821492927058770002e-10
+
+/* Coefficients of log(m) = 2 f (1 + f^2/3 + f^4/5 + ...),
+ * where f = (m - 1) / (m + 1) and 1/sqrt(2) <= m <= sqrt(2).
+ */
+static
+const double log_coef[11] = {
+	1.0 / 21, 1.0 / 19, 1.0 / 17, 1.0 / 15, 1.0 / 13, 1.0 / 11,
+	1.0 / 9, 1.0 / 7, 1.0 / 5, 1.0 / 3, 1.0
+};
+
+static
+__mmask8 avx512_tail(unsigned int n)
+{
+	return (__mmask8) ((1U << n) - 1);
+}
+
+static
+__mmask16 avx512_tail_float(unsigned int n)
+{
+	return (__mmask16) ((1U << n) - 1);
+}
+
+static
+double avx512_dot(const void *pa, const void *pb, unsigned int n)
+{
+	const double *a = (const double *) pa;
+	const double *b = (const double *) pb;
+	__m512d s0, s1;
+	__mmask8 mask;
+	unsigned int i;
+
+	s0 = _mm512_setzero_pd();
+	s1 = _mm512_setzero_pd();
+	for (i = 0; i + 16 <= n; i += 16) {
+		s0 = _mm512_fmadd_pd(_mm512_loadu_pd(&a[i]),
+		                     _mm512_loadu_pd(&b[i]), s0);
+		s1 = _mm512_fmadd_pd(_mm512_loadu_pd(&a[i + 8]),
+		                     _mm512_loadu_pd(&b[i + 8]), s1);
+	}
+	for (; i < n; i += 8) {
+		mask = (n - i >= 8) ? (__mmask8) 0xff : avx512_tail(n - i);
+		s0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, &a[i]),
+		                     _mm512_maskz_loadu_pd(mask, &b[i]), s0);
+	}
+	return _mm512_reduce_add_pd(_mm512_add_pd(s0, s1));
+}
+
+static
+void avx512_axpy_prod(void *py, double alpha, const void *pa,
+                      const void *pb, unsigned int n)
+{
+	const double *a = (const double *) pa;
+	const double *b = (const double *) pb;
+	double *y = (double *) py;
+	__m512d va, v;
+	__mmask8 mask;
+	unsigned int i;
+
+	va = _mm512_set1_pd(alpha);
+	for (i = 0; i < n; i += 8) {
+		mask = (n - i >= 8) ? (__mmask8) 0xff : avx512_tail(n - i);
+		v = _mm512_mul_pd(_mm512_maskz_loadu_pd(mask, &a[i]),
+		                  _mm512_maskz_loadu_pd(mask, &b[i]));
+		v = _mm512_fmadd_pd(va, v, _mm512_maskz_loadu_pd(mask, &y[i]));
+		_mm512_mask_storeu_pd(&y[i], mask, v);
+	}
+}
+
+static
+double avx512_dot_float(const void *pa, const void *pb, unsigned int n)
+{
+	const float *a = (const float *) pa;
+	const float *b = (const float *) pb;
+	__m512 s0, s1;
+	__mmask16 mask;
+	unsigned int i;
+
+	s0 = _mm512_setzero_ps();
+	s1 = _mm512_setzero_ps();
+	for (i = 0; i + 32 <= n; i += 32) {
+		s0 = _mm512_fmadd_ps(_mm512_loadu_ps(&a[i]),
+		                     _mm512_loadu_ps(&b[i]), s0);
+		s1 = _mm512_fmadd_ps(_mm512_loadu_ps(&a[i + 16]),
+		                     _mm512_loadu_ps(&b[i + 16]), s1);
+	}
+	for (; i < n; i += 16) {
+		mask = (n - i >= 16) ? (__mmask16) 0xffff
+		                     : avx512_tail_float(n - i);
+		s0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, &a[i]),
+		                     _mm512_maskz_loadu_ps(mask, &b[i]), s0);
+	}
+	return (double) _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+static
+void avx512_axpy_prod_float(void *py, double alpha, const void *pa,
+                            const void *pb, unsigned int n)
+{
+	const float *a = (const float *) pa;
+	const float *b = (const float *) pb;
+	float *y = (float *) py;
+	__mmask16 mask;
+	__m512 va, v;
+	unsigned int i;
+
+	va = _mm512_set1_ps((float) alpha);
+	for (i = 0; i < n; i += 16) {
+		mask = (n - i >= 16) ? (__mmask16) 0xffff
+		                     : avx512_tail_float(n - i);
+		v = _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, &a[i]),
+		                  _mm512_maskz_loadu_ps(mask, &b[i]));
+		v = _mm512_fmadd_ps(va, v, _mm512_maskz_loadu_ps(mask, &y[i]));
+		_mm512_mask_storeu_ps(&y[i], mask, v);
+	}
+}
+
+/* Natural logarithm of eight positive normal numbers */
+static
+__m512d avx512_log(__m512d x)
+{
+	__m512d m, e, f, s, p, one;
+	__mmask8 mask;
+	unsigned int k;
+
+	one = _mm512_set1_pd(1.0);
+	e = _mm512_getexp_pd(x);
+	m = _mm512_getmant_pd(x, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_src);
+
+	mask = _mm512_cmp_pd_mask(m, _mm512_set1_pd(SQRT2), _CMP_GT_OQ);
+	m = _mm512_mask_mul_pd(m, mask, m, _mm512_set1_pd(0.5));
+	e = _mm512_mask_add_pd(e, mask, e, one);
+
+	f = _mm512_div_pd(_mm512_sub_pd(m, one), _mm512_add_pd(m, one));
+	s = _mm512_mul_pd(f, f);
+	p = _mm512_set1_pd(log_coef[0]);
+	for (k = 1; k < 11; k++)
+		p = _mm512_fmadd_pd(p, s, _mm512_set1_pd(log_coef[k]));
+	p = _mm512_mul_pd(_mm512_add_pd(f, f), p);
+	p = _mm512_fmadd_pd(e, _mm512_set1_pd(LN2_LO), p);
+	return _mm512_fmadd_pd(e, _mm512_set1_pd(LN2_HI), p);
+}
+
+static
+double avx512_sum_log(const double *w, const double *x, unsigned int n)
+{
+	__m512d acc, one;
+	__mmask8 mask;
+	unsigned int i;
+
+	acc = _mm512_setzero_pd();
+	one = _mm512_set1_pd(1.0);
+	for (i = 0; i < n; i += 8) {
+		mask = (n - i >= 8) ? (__mmask8) 0xff : avx512_tail(n - i);
+		acc = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, &w[i]),
+		        avx512_log(_mm512_mask_loadu_pd(one, mask, &x[i])),
+		        acc);
+	}
+	return _mm512_reduce_add_pd(acc);
+}
+
+/* The byte compares of AVX-512 need AVX512BW, so the ones of AVX2
+ * are used instead.
+ */
+static
+unsigned int avx512_scan(const char *p, unsigned int *dashes)
+{
+	__m256i x, t, range;
+
+	x = _mm256_loadu_si256((const __m256i *) p);
+	range = _mm256_set1_epi8('\r' - '\t');
+	t = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+	t = _mm256_cmpeq_epi8(_mm256_min_epu8(t, range), t);
+	t = _mm256_or_si256(t, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')));
+	*dashes = (unsigned int) _mm256_movemask_epi8(
+		_mm256_cmpeq_epi8(x, _mm256_set1_epi8('-')));
+	return (unsigned int) _mm256_movemask_epi8(t);
+}
+
+const kernel_ops kernels_avx512[2] = {
+	{
+		"avx512",
+		&avx512_dot,
+		&avx512_axpy_prod,
+		&avx512_sum_log,
+		&avx512_scan
+	}, {
+		"avx512",
+		&avx512_dot_float,
+		&avx512_axpy_prod_float,
+		&avx512_sum_log,
+		&avx512_scan
+	}
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include <math.h>
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+
+#define SQRT2       1.41421356237309504880
+#define LN2_HI      6.93147180369123816490e-01
+#define LN2_LO      1.90821492927058770002e-10
+#define MAGIC_BIAS  (4503599627370496.0 + 1023)
+
+/* Bit patterns of the mantissa mask and of 2^52 */
+static
+const unsigned int mantissa[4] = {
+	0xffffffffU, 0x000fffffU, 0xffffffffU, 0x000fffffU
+};
+static
+const unsigned int magic[4] = {
+	0x00000000U, 0x43300000U, 0x00000000U, 0x43300000U
+};
+
+/* Coefficients of log(m) = 2 f (1 + f^2/3 + f^4/5 + ...),
+ * where f = (m - 1) / (m + 1) and 1/sqrt(2) <= m <= sqrt(2).
+ */
+static
+const double log_coef[11] = {
+	1.0 / 21, 1.0 / 19, 1.0 / 17, 1.0 / 15, 1.0 / 13, 1.0 / 11,
+	1.0 / 9, 1.0 / 7, 1.0 / 5, 1.0 / 3, 1.0
+};
+
+static
+double sse2_hsum(__m128d v)
+{
+	return _mm_cvtsd_f64(v) + _mm_cvtsd_f64(_mm_unpackhi_pd(v, v));
+}
+
+static
+double sse2_dot(const void *pa, const void *pb, unsigned int n)
+{
+	const double *a = (const double *) pa;
+	const double *b = (const double *) pb;
+	__m128d s0, s1;
+	unsigned int i;
+	double sum;
+
+	s0 = _mm_setzero_pd();
+	s1 = _mm_setzero_pd();
+	for (i = 0; i + 4 <= n; i += 4) {
+		s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(&a[i]),
+		                               _mm_loadu_pd(&b[i])));
+		s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(&a[i + 2]),
+		                               _mm_loadu_pd(&b[i + 2])));
+	}
+	sum = sse2_hsum(_mm_add_pd(s0, s1));
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+static
+void sse2_axpy_prod(void *py, double alpha, const void *pa,
+                    const void *pb, unsigned int n)
+{
+	const double *a = (const double *) pa;
+	const double *b = (const double *) pb;
+	double *y = (double *) py;
+	__m128d va, v;
+	unsigned int i;
+
+	va = _mm_set1_pd(alpha);
+	for (i = 0; i + 2 <= n; i += 2) {
+		v = _mm_mul_pd(_mm_loadu_pd(&a[i]), _mm_loadu_pd(&b[i]));
+		v = _mm_add_pd(_mm_loadu_pd(&y[i]), _mm_mul_pd(va, v));
+		_mm_storeu_pd(&y[i], v);
+	}
+	for (; i < n; i++)
+		y[i] += alpha * a[i] * b[i];
+}
+
+static
+double sse2_hsum_float(__m128 v)
+{
+	__m128 t;
+
+	t = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+	return (double) _mm_cvtss_f32(t);
+}
+
+static
+double sse2_dot_float(const void *pa, const void *pb, unsigned int n)
+{
+	const float *a = (const float *) pa;
+	const float *b = (const float *) pb;
+	__m128 s0, s1;
+	unsigned int i;
+	double sum;
+
+	s0 = _mm_setzero_ps();
+	s1 = _mm_setzero_ps();
+	for (i = 0; i + 8 <= n; i += 8) {
+		s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(&a[i]),
+		                               _mm_loadu_ps(&b[i])));
+		s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(&a[i + 4]),
+		                               _mm_loadu_ps(&b[i + 4])));
+	}
+	sum = sse2_hsum_float(_mm_add_ps(s0, s1));
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+static
+void sse2_axpy_prod_float(void *py, double alpha, const void *pa,
+                          const void *pb, unsigned int n)
+{
+	const float *a = (const float *) pa;
+	const float *b = (const float *) pb;
+	float *y = (float *) py;
+	float falpha = (float) alpha;
+	__m128 va, v;
+	unsigned int i;
+
+	va = _mm_set1_ps(falpha);
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_mul_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i]));
+		v = _mm_add_ps(_mm_loadu_ps(&y[i]), _mm_mul_ps(va, v));
+		_mm_storeu_ps(&y[i], v);
+	}
+	for (; i < n; i++)
+		y[i] += falpha * a[i] * b[i];
+}
+
+/* Natural logarithm of two positive normal numbers */
+static
+__m128d sse2_log(__m128d x)
+{
+	__m128d m, e, f, s, p, mask, one;
+	__m128i bits;
+	unsigned int k;
+
+	one = _mm_set1_pd(1.0);
+	bits = _mm_srli_epi64(_mm_castpd_si128(x), 52);
+	bits = _mm_or_si128(bits, _mm_loadu_si128((const __m128i *) magic));
+	e = _mm_sub_pd(_mm_castsi128_pd(bits), _mm_set1_pd(MAGIC_BIAS));
+
+	bits = _mm_and_si128(_mm_castpd_si128(x),
+	                     _mm_loadu_si128((const __m128i *) mantissa));
+	bits = _mm_or_si128(bits, _mm_castpd_si128(one));
+	m = _mm_castsi128_pd(bits);
+
+	mask = _mm_cmpgt_pd(m, _mm_set1_pd(SQRT2));
+	m = _mm_or_pd(_mm_andnot_pd(mask, m),
+	              _mm_and_pd(mask, _mm_mul_pd(m, _mm_set1_pd(0.5))));
+	e = _mm_add_pd(e, _mm_and_pd(mask, one));
+
+	f = _mm_div_pd(_mm_sub_pd(m, one), _mm_add_pd(m, one));
+	s = _mm_mul_pd(f, f);
+	p = _mm_set1_pd(log_coef[0]);
+	for (k = 1; k < 11; k++)
+		p = _mm_add_pd(_mm_mul_pd(p, s), _mm_set1_pd(log_coef[k]));
+	p = _mm_mul_pd(_mm_add_pd(f, f), p);
+	p = _mm_add_pd(p, _mm_mul_pd(e, _mm_set1_pd(LN2_LO)));
+	return _mm_add_pd(p, _mm_mul_pd(e, _mm_set1_pd(LN2_HI)));
+}
+
+static
+double sse2_sum_log(const double *w, const double *x, unsigned int n)
+{
+	__m128d acc;
+	unsigned int i;
+	double sum;
+
+	acc = _mm_setzero_pd();
+	for (i = 0; i + 2 <= n; i += 2) {
+		acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(&w[i]),
+		                 sse2_log(_mm_loadu_pd(&x[i]))));
+	}
+	sum = sse2_hsum(acc);
+	for (; i < n; i++)
+		sum += w[i] * log(x[i]);
+	return sum;
+}
+
+/* White space is ' ' and the bytes from '\t' to '\r' */
+static
+unsigned int sse2_scan16(__m128i x, unsigned int *dashes)
+{
+	__m128i t;
+
+	t = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+	t = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8('\r' - '\t')), t);
+	t = _mm_or_si128(t, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')));
+	*dashes = (unsigned int) _mm_movemask_epi8(
+		_mm_cmpeq_epi8(x, _mm_set1_epi8('-')));
+	return (unsigned int) _mm_movemask_epi8(t);
+}
+
+static
+unsigned int sse2_scan(const char *p, unsigned int *dashes)
+{
+	unsigned int lo, hi, dashes_lo, dashes_hi;
+
+	lo = sse2_scan16(_mm_loadu_si128((const __m128i *) p), &dashes_lo);
+	hi = sse2_scan16(_mm_loadu_si128((const __m128i *) (p + 16)),
+	                 &dashes_hi);
+	*dashes = dashes_lo | (dashes_hi << 16);
+	return lo | (hi << 16);
+}
+
+const kernel_ops kernels_sse2[2] = {
+	{
+		"sse2",
+		&sse2_dot,
+		&sse2_axpy_prod,
+		&sse2_sum_log,
+		&sse2_scan
+	}, {
+		"sse2",
+		&sse2_dot_float,
+		&sse2_axpy_prod_float,
+		&sse2_sum_log,
+		&sse2_scan
+	}
+};
+
+#endif
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "mapfile.h"
+#include "utils.h"
+
+/* Offset of the first section */
+#define MAPFILE_DATA_OFFSET \
+	((sizeof(mapfile_header) + MAPFILE_MAX_SECTIONS \
+	  * sizeof(mapfile_section) + MAPFILE_ALIGNMENT - 1) \
+	 / MAPFILE_ALIGNMENT * MAPFILE_ALIGNMENT)
+
+/* Largest number of bytes summed before the Adler-32 sums overflow */
+#define MAPFILE_ADLER_BLOCK 5552
+
+static
+size_t mapfile_join(unsigned int lo, unsigned int hi)
+{
+	return ((((size_t) hi) << 16) << 16) | (size_t) lo;
+}
+
+static
+void mapfile_split(size_t value, unsigned int *lo, unsigned int *hi)
+{
+	*lo = (unsigned int) (value & 0xFFFFFFFFUL);
+	*hi = (unsigned int) ((value >> 16) >> 16);
+}
+
+/* Adler-32 checksum of `data' */
+unsigned int mapfile_checksum(const void *data, size_t size)
+{
+	const unsigned char *ptr = (const unsigned char *) data;
+	unsigned long a = 1, b = 0;
+	size_t i, n;
+
+	while (size > 0) {
+		n = MIN(size, MAPFILE_ADLER_BLOCK);
+		for (i = 0; i < n; i++) {
+			a += ptr[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+		ptr += n;
+		size -= n;
+	}
+	return (unsigned int) ((b << 16) | a);
+}
+
+/* Checksum of the header (with its checksum field zeroed) and of the
+ * section table.
+ */
+static
+unsigned int mapfile_header_checksum(const mapfile *mf)
+{
+	mapfile_header header;
+	unsigned long a, b, c;
+
+	header = mf->header;
+	header.checksum = 0;
+	a = mapfile_checksum(&header, sizeof(mapfile_header));
+	b = mapfile_checksum(mf->sections, sizeof(mf->sections));
+	c = (a ^ (b * 2654435761UL)) & 0xFFFFFFFFUL;
+	return (unsigned int) c;
+}
+
+void mapfile_reset(mapfile *mf)
+{
+	memset(&mf->header, 0, sizeof(mapfile_header));
+	memset(mf->sections, 0, sizeof(mf->sections));
+	mf->base = NULL;
+	mf->length = 0;
+	mf->fp = NULL;
+	mf->filename = NULL;
+	mf->temp_filename = NULL;
+	mf->offset = 0;
+}
+
+/* Maps the model file `fd' of the model `model' in memory. The
+ * mapping is private: the pages are shared with the page cache
+ * (and with other processes mapping the same file) until they are
+ * written, and the file itself is never modified.
+ */
+int mapfile_map(mapfile *mf, int fd, unsigned int model)
+{
+	mapfile_section *section;
+	struct stat st;
+	size_t offset, size;
+	unsigned int i;
+
+	mapfile_reset(mf);
+	if (fstat(fd, &st) < 0) {
+		error("could not stat model file: %s", strerror(errno));
+		return FALSE;
+	}
+	if ((size_t) st.st_size < MAPFILE_DATA_OFFSET) {
+		error("truncated model file");
+		return FALSE;
+	}
+
+	mf->length = (size_t) st.st_size;
+	mf->base = mmap(NULL, mf->length, PROT_READ | PROT_WRITE,
+	                MAP_PRIVATE, fd, 0);
+	if (mf->base == MAP_FAILED) {
+		error("could not map model file: %s", strerror(errno));
+		mf->base = NULL;
+		return FALSE;
+	}
+
+	memcpy(&mf->header, mf->base, sizeof(mapfile_header));
+	memcpy(mf->sections, (char *) mf->base + sizeof(mapfile_header),
+	       sizeof(mf->sections));
+
+	if (mf->header.magic != MAPFILE_MAGIC
+	    || mf->header.version != MAPFILE_VERSION
+	    || mf->header.model != model
+	    || mf->header.num_sections > MAPFILE_MAX_SECTIONS) {
+		error("unsupported model file format");
+		goto error_map;
+	}
+	if (mf->header.checksum != mapfile_header_checksum(mf)) {
+		error("corrupted model file header");
+		goto error_map;
+	}
+
+	for (i = 0; i < mf->header.num_sections; i++) {
+		section = &mf->sections[i];
+		offset = mapfile_join(section->offset_lo, section->offset_hi);
+		size = mapfile_join(section->size_lo, section->size_hi);
+		if (offset % MAPFILE_ALIGNMENT != 0 || offset > mf->length
+		    || size > mf->length - offset) {
+			error("corrupted model file section table");
+			goto error_map;
+		}
+	}
+	return TRUE;
+
+error_map:
+	mapfile_unmap(mf);
+	return FALSE;
+}
+
+void mapfile_unmap(mapfile *mf)
+{
+	if (mf->base) munmap(mf->base, mf->length);
+	mapfile_reset(mf);
+}
+
+/* Returns the data of the section `id', checking that its elements
+ * are of type `type' and that it has `size' bytes.
+ */
+void *mapfile_get(const mapfile *mf, unsigned int id, unsigned int type,
+                  size_t size)
+{
+	const mapfile_section *section;
+	unsigned int i;
+
+	for (i = 0; i < mf->header.num_sections; i++) {
+		section = &mf->sections[i];
+		if (section->id != id) continue;
+
+		if (section->type != type || size
+		    != mapfile_join(section->size_lo, section->size_hi)) {
+			error("section %u of the model file has the "
+			      "wrong size or type", id);
+			return NULL;
+		}
+		return (char *) mf->base + mapfile_join(section->offset_lo,
+		                                        section->offset_hi);
+	}
+	error("section %u missing in the model file", id);
+	return NULL;
+}
+
+/* Checks whether `ptr' points inside the mapping */
+int mapfile_contains(const mapfile *mf, const void *ptr)
+{
+	const char *p = (const char *) ptr;
+	const char *base = (const char *) mf->base;
+
+	if (!base || !p) return FALSE;
+	return (p >= base && p < base + mf->length);
+}
+
+/* Checks the checksums of all the sections. It reads the whole file,
+ * so it is not done when the file is mapped.
+ */
+int mapfile_verify(const mapfile *mf)
+{
+	const mapfile_section *section;
+	unsigned int i;
+	size_t offset, size;
+
+	for (i = 0; i < mf->header.num_sections; i++) {
+		section = &mf->sections[i];
+		offset = mapfile_join(section->offset_lo, section->offset_hi);
+		size = mapfile_join(section->size_lo, section->size_hi);
+		if (mapfile_checksum((char *) mf->base + offset, size)
+		    != section->checksum) {
+			error("checksum mismatch in section %u of the "
+			      "model file", section->id);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static
+int mapfile_pad(mapfile *mf, size_t offset)
+{
+	static const char zeros[MAPFILE_ALIGNMENT] = { 0 };
+	size_t n;
+
+	while (mf->offset < offset) {
+		n = MIN(offset - mf->offset, sizeof(zeros));
+		if (fwrite(zeros, 1, n, mf->fp) != n)
+			return FALSE;
+		mf->offset += n;
+	}
+	return TRUE;
+}
+
+/* Starts writing the model file `filename' for the model `model'.
+ * The data goes to a temporary file, which replaces `filename' in
+ * mapfile_commit(), so that processes that mapped the old file keep
+ * a consistent copy. The caller fills the parameters and values of
+ * the header before committing.
+ */
+int mapfile_create(mapfile *mf, const char *filename, unsigned int model)
+{
+	mapfile_reset(mf);
+	mf->filename = xstrdup(filename);
+	if (!mf->filename) return FALSE;
+
+	mf->temp_filename = (char *) xmalloc(strlen(filename) + 5);
+	if (!mf->temp_filename) goto error_create;
+	sprintf(mf->temp_filename, "%s.tmp", filename);
+
+	mf->fp = fopen(mf->temp_filename, "wb");
+	if (!mf->fp) {
+		error("could not open `%s' for writing", mf->temp_filename);
+		goto error_create;
+	}
+
+	mf->header.magic = MAPFILE_MAGIC;
+	mf->header.version = MAPFILE_VERSION;
+	mf->header.model = model;
+	if (!mapfile_pad(mf, MAPFILE_DATA_OFFSET))
+		goto error_create;
+	return TRUE;
+
+error_create:
+	mapfile_abort(mf);
+	return FALSE;
+}
+
+/* Appends the section `id' with `size' bytes of elements of type
+ * `type'.
+ */
+int mapfile_write(mapfile *mf, unsigned int id, unsigned int type,
+                  const void *data, size_t size)
+{
+	mapfile_section *section;
+	size_t offset;
+
+	if (mf->header.num_sections == MAPFILE_MAX_SECTIONS) {
+		error("too many sections in the model file");
+		return FALSE;
+	}
+
+	offset = (mf->offset + MAPFILE_ALIGNMENT - 1)
+	         / MAPFILE_ALIGNMENT * MAPFILE_ALIGNMENT;
+	if (!mapfile_pad(mf, offset))
+		return FALSE;
+	if (size > 0 && fwrite(data, 1, size, mf->fp) != size)
+		return FALSE;
+	mf->offset += size;
+
+	section = &mf->sections[mf->header.num_sections++];
+	section->id = id;
+	section->type = type;
+	mapfile_split(offset, &section->offset_lo, &section->offset_hi);
+	mapfile_split(size, &section->size_lo, &section->size_hi);
+	section->checksum = mapfile_checksum(data, size);
+	return TRUE;
+}
+
+/* Writes the header and replaces the destination file */
+int mapfile_commit(mapfile *mf)
+{
+	mf->header.checksum = mapfile_header_checksum(mf);
+	if (fseek(mf->fp, 0, SEEK_SET) != 0
+	    || fwrite(&mf->header, sizeof(mapfile_header), 1, mf->fp) != 1
+	    || fwrite(mf->sections, sizeof(mf->sections), 1, mf->fp) != 1)
+		goto error_commit;
+
+	if (fflush(mf->fp) != 0 || fsync(fileno(mf->fp)) != 0)
+		goto error_commit;
+
+	if (fclose(mf->fp) != 0) {
+		mf->fp = NULL;
+		goto error_commit;
+	}
+	mf->fp = NULL;
+
+	if (rename(mf->temp_filename, mf->filename) != 0)
+		goto error_commit;
+
+	free(mf->temp_filename);
+	free(mf->filename);
+	mapfile_reset(mf);
+	return TRUE;
+
+error_commit:
+	error("could not write `%s': %s", mf->filename, strerror(errno));
+	mapfile_abort(mf);
+	return FALSE;
+}
+
+/* Gives up writing the file */
+void mapfile_abort(mapfile *mf)
+{
+	if (mf->fp) fclose(mf->fp);
+	if (mf->temp_filename) {
+		unlink(mf->temp_filename);
+		free(mf->temp_filename);
+	}
+	if (mf->filename) free(mf->filename);
+	mapfile_reset(mf);
+}
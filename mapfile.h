@@ -0,0 +1,84 @@
+#ifndef __MAPFILE_H
+#define __MAPFILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Constants */
+#define MAPFILE_MAGIC             0x4C444F4D /* "MODL" */
+#define MAPFILE_VERSION           1
+
+#define MAPFILE_MAX_SECTIONS      8
+#define MAPFILE_NUM_PARAMS        8
+#define MAPFILE_NUM_VALUES        8
+
+/* The sections start at multiples of this many bytes */
+#define MAPFILE_ALIGNMENT         64
+
+/* Type of the elements of a section, besides KERNEL_DOUBLE and
+ * KERNEL_FLOAT.
+ */
+#define MAPFILE_UINT              16
+
+/* Data structures and types */
+
+/* Header at the start of the file, followed by the table of sections.
+ * The sizes and offsets of the sections are split in two 32-bit
+ * halves, so that the layout is the same on every platform.
+ */
+typedef
+struct mapfile_header_st {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int model; /* the magic number of the model */
+	unsigned int num_sections;
+	unsigned int checksum; /* of the header and the section table */
+	unsigned int reserved[3];
+	unsigned int params[MAPFILE_NUM_PARAMS];
+	double values[MAPFILE_NUM_VALUES];
+} mapfile_header;
+
+typedef
+struct mapfile_section_st {
+	unsigned int id;
+	unsigned int type;
+	unsigned int offset_lo, offset_hi;
+	unsigned int size_lo, size_hi;
+	unsigned int checksum; /* of the data */
+	unsigned int reserved;
+} mapfile_section;
+
+typedef
+struct mapfile_st {
+	mapfile_header header;
+	mapfile_section sections[MAPFILE_MAX_SECTIONS];
+
+	/* The mapping of a file being read */
+	void *base;
+	size_t length;
+
+	/* The file being written */
+	FILE *fp;
+	char *filename, *temp_filename;
+	size_t offset;
+} mapfile;
+
+/* Functions */
+void mapfile_reset(mapfile *mf);
+
+int mapfile_map(mapfile *mf, int fd, unsigned int model);
+void mapfile_unmap(mapfile *mf);
+void *mapfile_get(const mapfile *mf, unsigned int id, unsigned int type,
+                  size_t size);
+int mapfile_contains(const mapfile *mf, const void *ptr);
+int mapfile_verify(const mapfile *mf);
+
+int mapfile_create(mapfile *mf, const char *filename, unsigned int model);
+int mapfile_write(mapfile *mf, unsigned int id, unsigned int type,
+                  const void *data, size_t size);
+int mapfile_commit(mapfile *mf);
+void mapfile_abort(mapfile *mf);
+
+unsigned int mapfile_checksum(const void *data, size_t size);
+
+#endif /* __MAPFILE_H */
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "parallel.h"
+#include "utils.h"
+
+typedef
+struct parallel_task_st {
+	parallel_fn fn;
+	void *arg;
+	unsigned int thread_idx;
+	unsigned int num_threads;
+} parallel_task;
+
+static
+void *parallel_thread_main(void *ptr)
+{
+	parallel_task *task = (parallel_task *) ptr;
+	(*task->fn)(task->arg, task->thread_idx, task->num_threads);
+	return NULL;
+}
+
+/* Runs `fn' on `num_threads' threads and waits for all of them.
+ * The calling thread takes the role of thread 0.
+ */
+int parallel_run(unsigned int num_threads, parallel_fn fn, void *arg)
+{
+	parallel_task *tasks;
+	pthread_t *threads;
+	unsigned int i, started;
+
+	if (num_threads <= 1) {
+		(*fn)(arg, 0, 1);
+		return TRUE;
+	}
+
+	tasks = (parallel_task *) xmalloc(num_threads * sizeof(parallel_task));
+	if (!tasks) return FALSE;
+
+	threads = (pthread_t *) xmalloc(num_threads * sizeof(pthread_t));
+	if (!threads) {
+		free(tasks);
+		return FALSE;
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		tasks[i].fn = fn;
+		tasks[i].arg = arg;
+		tasks[i].thread_idx = i;
+		tasks[i].num_threads = num_threads;
+	}
+
+	for (started = 1; started < num_threads; started++) {
+		if (pthread_create(&threads[started], NULL,
+		                   &parallel_thread_main,
+		                   &tasks[started]) != 0) {
+			error("could not create thread");
+			break;
+		}
+	}
+
+	/* If a thread could not be created, the calling thread
+	 * picks up its share of the work as well.
+	 */
+	(*fn)(arg, 0, num_threads);
+	for (i = started; i < num_threads; i++)
+		(*fn)(arg, i, num_threads);
+
+	for (i = 1; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	free(tasks);
+	return TRUE;
+}
+
+static
+void *parallel_pool_main(void *ptr)
+{
+	parallel_worker *worker = (parallel_worker *) ptr;
+	parallel_pool *pool = worker->pool;
+	unsigned long generation;
+	unsigned int num_threads;
+	parallel_fn fn;
+	void *arg;
+
+	/* A task may be handed out before the thread gets here */
+	generation = 0;
+	pthread_mutex_lock(&pool->mutex);
+	while (TRUE) {
+		while (pool->generation == generation && !pool->quit)
+			pthread_cond_wait(&pool->wake, &pool->mutex);
+		if (pool->quit) break;
+
+		generation = pool->generation;
+		if (worker->thread_idx >= pool->num_threads) continue;
+
+		fn = pool->fn;
+		arg = pool->arg;
+		num_threads = pool->num_threads;
+		pthread_mutex_unlock(&pool->mutex);
+
+		(*fn)(arg, worker->thread_idx, num_threads);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->num_busy == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+/* Starts the `num_threads' - 1 threads of a pool, besides the calling
+ * thread. Returns NULL on errors.
+ */
+parallel_pool *parallel_pool_create(unsigned int num_threads)
+{
+	parallel_pool *pool;
+	parallel_worker *worker;
+	unsigned int i;
+
+	pool = (parallel_pool *) xmalloc(sizeof(parallel_pool));
+	if (!pool) return NULL;
+
+	pool->workers = (parallel_worker *) xmalloc(MAX(num_threads, 1)
+	                                            * sizeof(parallel_worker));
+	if (!pool->workers) {
+		free(pool);
+		return NULL;
+	}
+	if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
+		error("could not create mutex");
+		goto error_mutex;
+	}
+	if (pthread_cond_init(&pool->wake, NULL) != 0) {
+		error("could not create condition variable");
+		goto error_wake;
+	}
+	if (pthread_cond_init(&pool->done, NULL) != 0) {
+		error("could not create condition variable");
+		goto error_done;
+	}
+
+	pool->size = MAX(num_threads, 1);
+	pool->num_workers = 0;
+	pool->num_busy = 0;
+	pool->generation = 0;
+	pool->quit = FALSE;
+	pool->fn = NULL;
+	pool->arg = NULL;
+	pool->num_threads = 0;
+
+	/* If a thread could not be created, the calling thread picks
+	 * up its share of the work in parallel_pool_run().
+	 */
+	for (i = 1; i < num_threads; i++) {
+		worker = &pool->workers[pool->num_workers];
+		worker->pool = pool;
+		worker->thread_idx = i;
+		if (pthread_create(&worker->thread, NULL, &parallel_pool_main,
+		                   worker) != 0) {
+			error("could not create thread");
+			break;
+		}
+		pool->num_workers++;
+	}
+	return pool;
+
+error_done:
+	pthread_cond_destroy(&pool->wake);
+error_wake:
+	pthread_mutex_destroy(&pool->mutex);
+error_mutex:
+	free(pool->workers);
+	free(pool);
+	return NULL;
+}
+
+/* Stops the threads of the pool and frees it */
+void parallel_pool_destroy(parallel_pool *pool)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = TRUE;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->num_workers; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->workers);
+	free(pool);
+}
+
+unsigned int parallel_pool_size(const parallel_pool *pool)
+{
+	return pool->size;
+}
+
+/* Runs `fn' on `num_threads' threads of `pool' and waits for all of
+ * them, like parallel_run(). The shares beyond the threads of the
+ * pool are run by the calling thread. Without a pool, the threads
+ * are created for this run only.
+ */
+int parallel_pool_run(parallel_pool *pool, unsigned int num_threads,
+                      parallel_fn fn, void *arg)
+{
+	unsigned int i;
+
+	if (!pool || pool->num_workers == 0 || num_threads <= 1)
+		return parallel_run(num_threads, fn, arg);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->num_threads = num_threads;
+	pool->num_busy = MIN(pool->num_workers, num_threads - 1);
+	pool->generation++;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->mutex);
+
+	(*fn)(arg, 0, num_threads);
+	for (i = pool->num_workers + 1; i < num_threads; i++)
+		(*fn)(arg, i, num_threads);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->num_busy > 0)
+		pthread_cond_wait(&pool->done, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+	return TRUE;
+}
+
+/* Computes the range [start, end) of a list of `length' elements
+ * that belongs to thread `thread_idx'.
+ */
+void parallel_range(unsigned int length, unsigned int thread_idx,
+                    unsigned int num_threads, unsigned int *start,
+                    unsigned int *end)
+{
+	unsigned long l = (unsigned long) length;
+	*start = (unsigned int) ((l * thread_idx) / num_threads);
+	*end = (unsigned int) ((l * (thread_idx + 1)) / num_threads);
+}
+
+int parallel_queue_initialize(parallel_queue *queue, unsigned int length,
+                              unsigned int chunk)
+{
+	if (pthread_mutex_init(&queue->mutex, NULL) != 0) {
+		error("could not create mutex");
+		return FALSE;
+	}
+	queue->next = 0;
+	queue->length = length;
+	queue->chunk = (chunk > 0) ? chunk : 1;
+	return TRUE;
+}
+
+void parallel_queue_cleanup(parallel_queue *queue)
+{
+	pthread_mutex_destroy(&queue->mutex);
+}
+
+/* Takes the next chunk [start, end) of the queue. Returns FALSE when
+ * the queue is empty.
+ */
+int parallel_queue_next(parallel_queue *queue, unsigned int *start,
+                        unsigned int *end)
+{
+	pthread_mutex_lock(&queue->mutex);
+	*start = queue->next;
+	*end = queue->next + MIN(queue->chunk, queue->length - queue->next);
+	queue->next = *end;
+	pthread_mutex_unlock(&queue->mutex);
+	return (*start < *end);
+}
@@ -0,0 +1,68 @@
+#ifndef __PARALLEL_H
+#define __PARALLEL_H
+
+#include <pthread.h>
+
+/* Data structures and types */
+typedef void (*parallel_fn)(void *arg, unsigned int thread_idx,
+                            unsigned int num_threads);
+
+/* A list of `length' elements shared by the threads, which take
+ * `chunk' elements at a time.
+ */
+typedef
+struct parallel_queue_st {
+	pthread_mutex_t mutex;
+	unsigned int next, length, chunk;
+} parallel_queue;
+
+/* A thread of a pool, which runs the share `thread_idx' of each task */
+typedef
+struct parallel_worker_st {
+	struct parallel_pool_st *pool;
+	unsigned int thread_idx;
+	pthread_t thread;
+} parallel_worker;
+
+/* Threads started once and woken for each task handed to
+ * parallel_pool_run(), so that the steps of an iteration do not
+ * create and join threads every time. The calling thread takes the
+ * role of thread 0. The workers refer to the pool, so it does not
+ * move once created.
+ */
+typedef
+struct parallel_pool_st {
+	pthread_mutex_t mutex;
+	pthread_cond_t wake, done;
+	parallel_worker *workers;
+	unsigned int size; /* the threads asked for, with the caller */
+	unsigned int num_workers; /* the threads started */
+	unsigned int num_busy; /* the workers still on the task */
+	unsigned long generation; /* the number of tasks handed out */
+	int quit;
+
+	/* The current task */
+	parallel_fn fn;
+	void *arg;
+	unsigned int num_threads;
+} parallel_pool;
+
+/* Functions */
+int parallel_run(unsigned int num_threads, parallel_fn fn, void *arg);
+void parallel_range(unsigned int length, unsigned int thread_idx,
+                    unsigned int num_threads, unsigned int *start,
+                    unsigned int *end);
+
+parallel_pool *parallel_pool_create(unsigned int num_threads);
+void parallel_pool_destroy(parallel_pool *pool);
+unsigned int parallel_pool_size(const parallel_pool *pool);
+int parallel_pool_run(parallel_pool *pool, unsigned int num_threads,
+                      parallel_fn fn, void *arg);
+
+int parallel_queue_initialize(parallel_queue *queue, unsigned int length,
+                              unsigned int chunk);
+void parallel_queue_cleanup(parallel_queue *queue);
+int parallel_queue_next(parallel_queue *queue, unsigned int *start,
+                        unsigned int *end);
+
+#endif /* __PARALLEL_H */
@@ -2,13 +2,160 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <float.h>
 #include <math.h>
 
 #include "plsa.h"
+#include "plsa_server.h"
 #include "args.h"
+#include "checkpoint.h"
 #include "docinfo.h"
+#include "kernels.h"
+#include "parallel.h"
 #include "utils.h"
 #include "random.h"
+#include "squarem.h"
+
+/* Number of dot products whose logarithms are computed together */
+#define PLSA_LOG_BATCH 256
+
+/* Address of the row `row' of one of the tables of `pl' */
+#define PLSA_ROW(pl, table, row) \
+	((void *) ((char *) (table) + (size_t) (row) * (pl)->num_topics \
+	                              * KERNEL_SIZE((pl)->precision)))
+
+/* Address of the row of `word' in one of the topic-word tables */
+#define PLSA_TW_ROW(pl, table, word) \
+	((void *) ((char *) (table) + plsa_tw_offset(pl, word) \
+	                              * KERNEL_SIZE((pl)->precision)))
+
+/* Number of elements of the topic-word tables */
+#define PLSA_TW_LENGTH(pl) plsa_tw_offset(pl, (pl)->num_words)
+
+/* Number of iterations between two prunings of the topic-word table */
+#define PLSA_PRUNE_INTERVAL 10
+
+/* Number of iterations between two checks of all the topics frozen */
+#define PLSA_FREEZE_INTERVAL 10
+
+/* The topics still updated are gathered below one in this many */
+#define PLSA_GATHER_RATIO 4
+
+/* Number of documents taken at a time by the threads of the fold-in */
+#define PLSA_FOLD_IN_CHUNK 16
+
+/* Number of documents whose topics are ranked together when printing */
+#define PLSA_TOP_BLOCK 4096
+
+/* Sections of the mapped model files */
+#define PLSA_SECTION_DT           1
+#define PLSA_SECTION_TW           2
+#define PLSA_SECTION_TW_START     3
+#define PLSA_SECTION_TW_TOPIC     4
+#define PLSA_SECTION_RNG          5
+
+/* Data structures and types */
+
+/* A copy of the model handed to the checkpoint thread */
+typedef
+struct plsa_snapshot_st {
+	plsa pl;
+	int mapped; /* saved in the mapped format */
+} plsa_snapshot;
+
+/* The models trained together by plsa_train_restarts() */
+typedef
+struct plsa_restart_context_st {
+	const docinfo *doc;
+	plsa *runs;
+	unsigned int num_runs, num_alive;
+	int *alive, *converged;
+
+	/* The threads of `pool' run the restarts of `active' taken from
+	 * `queue'
+	 */
+	unsigned int num_threads, total_threads;
+	parallel_pool *pool;
+	parallel_queue queue;
+	unsigned int *active;
+	int *ok;
+
+	plsa_topmost *best;
+} plsa_restart_context;
+
+/* The models trained together by plsa_train_sweep() */
+typedef
+struct plsa_sweep_context_st {
+	const docinfo *doc;
+	plsa *models;
+	unsigned int max_iterations;
+	double tol;
+	const char *plsa_filename;
+
+	/* The threads train the models of `order' taken from `queue' */
+	unsigned int total_threads;
+	parallel_queue queue;
+	unsigned int *order;
+	unsigned int *iterations;
+	double *times;
+	int *ok;
+} plsa_sweep_context;
+
+typedef
+struct plsa_topk_context_st {
+	const plsa *pl;
+	unsigned int num, num_threads;
+	plsa_topmost *top;
+
+	/* The heaps of each thread, for plsa_top_words() */
+	plsa_topmost *heaps;
+	unsigned int *lengths;
+
+	/* The documents of plsa_top_documents() */
+	unsigned int first, count;
+} plsa_topk_context;
+
+typedef
+struct plsa_context_st {
+	const kernel_ops *ops;
+	plsa *pl;
+	const docinfo *doc;
+	int update_dt, update_tw;
+	double step;
+
+	/* For the residual EM, the E-step only goes over the documents
+	 * pl->doc_list[first], ..., pl->doc_list[last - 1] if
+	 * `use_list' is set, and the M-step adds `tw_frozen' if
+	 * `add_frozen' is set.
+	 */
+	int use_list, add_frozen;
+	unsigned int first, last;
+
+	/* The topics updated in the topic-word table, or NULL for all */
+	const unsigned int *free_topics;
+	unsigned int num_free;
+} plsa_context;
+
+/* The log-likelihood summed by a thread of the E-step, whose terms
+ * are taken by batches of PLSA_LOG_BATCH.
+ */
+typedef
+struct plsa_loglik_st {
+	unsigned int num;
+	double likelihood, total_weight;
+	double counts[PLSA_LOG_BATCH], dotprods[PLSA_LOG_BATCH];
+} plsa_loglik;
+
+typedef
+struct plsa_fold_context_st {
+	plsa_context ctx;
+	parallel_queue queue;
+	const unsigned int *doc_start;
+	unsigned int max_iterations;
+	double tol;
+	unsigned int *iterations;
+} plsa_fold_context;
 
 void plsa_reset(plsa *pl)
 {
@@ -16,36 +163,192 @@ void plsa_reset(plsa *pl)
 	pl->dt2 = NULL;
 	pl->tw = NULL;
 	pl->tw2 = NULL;
+	pl->tw_start = NULL;
+	pl->tw_topic = NULL;
+	pl->dt_floor = 0;
+	pl->dt_start = NULL;
+	pl->dt_topic = NULL;
+	pl->residual = 0;
+	pl->residual_interval = PLSA_RESIDUAL_INTERVAL;
+	pl->residual_pass = 0;
+	pl->num_skipped = 0;
+	pl->doc_residual = NULL;
+	pl->doc_start = NULL;
+	pl->doc_list = NULL;
+	pl->doc_weight = NULL;
+	pl->tw_frozen = NULL;
+	pl->frozen[0] = 0;
+	pl->frozen[1] = 0;
+	pl->topic_tol = 0;
+	pl->topic_pass = 0;
+	pl->num_free = 0;
+	pl->topic_list = NULL;
+	pl->topic_delta = NULL;
+	pl->tw2_local = NULL;
+	pl->partial = NULL;
+	pl->sums = NULL;
+	pl->order = NULL;
+	pl->ratio = NULL;
 	pl->top = NULL;
+	mapfile_reset(&pl->map);
+	pl->verify_checksums = FALSE;
+	pl->ar = NULL;
+	pl->shard_first = 0;
+	pl->shard_total = 0;
+	pl->checkpoint_interval = CHECKPOINT_INTERVAL;
+	pl->checkpoint_seconds = 0;
+	pl->iteration = 0;
+	pl->online_pass = 0;
+	pl->online_batch = 0;
+	pl->online_sum = 0;
+	pl->online_weight = 0;
+	pl->num_restarts = 1;
+	pl->restart_iterations = 0;
+	pl->num_threads = 1;
+	pl->pool = NULL;
+	pl->parallel_mode = PLSA_PARALLEL_REPLICATE;
+	pl->precision = KERNEL_DOUBLE;
+	pl->accelerate = FALSE;
+	pl->prune_threshold = 0;
+	pl->prune_top = 0;
+	pl->prune_after = 0;
+	pl->batch_size = 0;
+	pl->batch_iterations = 1;
+	pl->kappa = 0.7;
+	pl->tau0 = 1;
 }
 
 int plsa_initialize(plsa *pl)
 {
-	plsa_reset(pl);
 	pl->likelihood = 1;
 	pl->old_likelihood = 1;
+	pl->iteration = 0;
+	pl->online_pass = 0;
+	pl->online_batch = 0;
+	pl->online_sum = 0;
+	pl->online_weight = 0;
 	return TRUE;
 }
 
+/* Frees a table, unless it lives in the mapped model file */
+static
+void plsa_free(plsa *pl, void *ptr)
+{
+	if (!mapfile_contains(&pl->map, ptr)) free(ptr);
+}
+
+static
+void plsa_cleanup_sparse(plsa *pl)
+{
+	if (pl->tw_start) {
+		plsa_free(pl, pl->tw_start);
+		pl->tw_start = NULL;
+	}
+	if (pl->tw_topic) {
+		plsa_free(pl, pl->tw_topic);
+		pl->tw_topic = NULL;
+	}
+}
+
+/* Forgets the topics of the documents, after `dt' changed */
+static
+void plsa_cleanup_active(plsa *pl)
+{
+	if (pl->dt_start) {
+		free(pl->dt_start);
+		pl->dt_start = NULL;
+	}
+	if (pl->dt_topic) {
+		free(pl->dt_topic);
+		pl->dt_topic = NULL;
+	}
+}
+
+/* Forgets the state of the residual EM, so that the next iteration
+ * is a full pass.
+ */
+static
+void plsa_cleanup_residual(plsa *pl)
+{
+	if (pl->doc_residual) {
+		free(pl->doc_residual);
+		pl->doc_residual = NULL;
+	}
+	if (pl->doc_start) {
+		free(pl->doc_start);
+		pl->doc_start = NULL;
+	}
+	if (pl->doc_list) {
+		free(pl->doc_list);
+		pl->doc_list = NULL;
+	}
+	if (pl->doc_weight) {
+		free(pl->doc_weight);
+		pl->doc_weight = NULL;
+	}
+	if (pl->tw_frozen) {
+		free(pl->tw_frozen);
+		pl->tw_frozen = NULL;
+	}
+	pl->residual_pass = 0;
+	pl->num_skipped = 0;
+}
+
 static
 void plsa_cleanup_tables(plsa *pl)
 {
 	if (pl->dt) {
-		free(pl->dt);
+		plsa_free(pl, pl->dt);
 		pl->dt = NULL;
 	}
 	if (pl->dt2) {
-		free(pl->dt2);
+		plsa_free(pl, pl->dt2);
 		pl->dt2 = NULL;
 	}
 	if (pl->tw) {
-		free(pl->tw);
+		plsa_free(pl, pl->tw);
 		pl->tw = NULL;
 	}
 	if (pl->tw2) {
-		free(pl->tw2);
+		plsa_free(pl, pl->tw2);
 		pl->tw2 = NULL;
 	}
+	plsa_cleanup_sparse(pl);
+	plsa_cleanup_active(pl);
+	plsa_cleanup_residual(pl);
+}
+
+static
+void plsa_cleanup_workers(plsa *pl)
+{
+	if (pl->tw2_local) {
+		free(pl->tw2_local);
+		pl->tw2_local = NULL;
+	}
+	if (pl->partial) {
+		free(pl->partial);
+		pl->partial = NULL;
+	}
+	if (pl->sums) {
+		free(pl->sums);
+		pl->sums = NULL;
+	}
+	if (pl->order) {
+		free(pl->order);
+		pl->order = NULL;
+	}
+	if (pl->ratio) {
+		free(pl->ratio);
+		pl->ratio = NULL;
+	}
+	if (pl->topic_list) {
+		free(pl->topic_list);
+		pl->topic_list = NULL;
+	}
+	if (pl->topic_delta) {
+		free(pl->topic_delta);
+		pl->topic_delta = NULL;
+	}
 }
 
 static
@@ -60,318 +363,3126 @@ void plsa_cleanup_temporary(plsa *pl)
 void plsa_cleanup(plsa *pl)
 {
 	plsa_cleanup_tables(pl);
+	plsa_cleanup_workers(pl);
 	plsa_cleanup_temporary(pl);
+	mapfile_unmap(&pl->map);
+	if (pl->pool) {
+		parallel_pool_destroy(pl->pool);
+		pl->pool = NULL;
+	}
+}
+
+/* Runs `fn' on the threads of `pl' */
+static
+int plsa_run(plsa *pl, parallel_fn fn, void *arg)
+{
+	return parallel_pool_run(pl->pool, pl->num_threads, fn, arg);
 }
 
 static
 void plsa_initialize_random(plsa *pl, int retrain_dt)
 {
-	unsigned int i, j, k, pos;
-	double sum;
+	unsigned int i, j, k;
+	size_t pos, skip;
+	double sum, val;
+
+	/* A shard draws the numbers that a single process would draw for
+	 * its documents, so that both start from the same point.
+	 */
+	plsa_cleanup_active(pl);
+	plsa_cleanup_residual(pl);
+
+	skip = 0;
+	if (pl->ar) skip = (size_t) pl->shard_first * pl->num_topics;
+	for (pos = 0; pos < skip; pos++)
+		genrand_real1();
 
 	for (i = 0; i < pl->num_documents; i++) {
 		sum = 0;
 		for (j = 0; j < pl->num_topics; j++) {
-			pos = i * pl->num_topics + j;
-			pl->dt[pos] = -log(genrand_real1());
-			sum += pl->dt[pos];
+			pos = (size_t) i * pl->num_topics + j;
+			val = -log(genrand_real1());
+			KERNEL_STORE(pl->precision, pl->dt, pos, val);
+			sum += val;
 		}
 		for (j = 0; j < pl->num_topics; j++) {
-			pos = i * pl->num_topics + j;
-			pl->dt[pos] /= sum;
+			pos = (size_t) i * pl->num_topics + j;
+			val = KERNEL_LOAD(pl->precision, pl->dt, pos);
+			KERNEL_STORE(pl->precision, pl->dt, pos, val / sum);
 		}
 	}
+
+	skip = 0;
+	if (pl->ar) {
+		skip = (size_t) (pl->shard_total - pl->shard_first
+		                 - pl->num_documents) * pl->num_topics;
+	}
+	for (pos = 0; pos < skip; pos++)
+		genrand_real1();
 	if (retrain_dt) return;
 
 	for (j = 0; j < pl->num_topics; j++) {
 		sum = 0;
 		for (k = 0; k < pl->num_words; k++) {
-			pos = j * pl->num_words + k;
-			pl->tw[pos] = -log(genrand_real1());
-			sum += pl->tw[pos];
+			pos = (size_t) k * pl->num_topics + j;
+			val = -log(genrand_real1());
+			KERNEL_STORE(pl->precision, pl->tw, pos, val);
+			sum += val;
 		}
 		for (k = 0; k < pl->num_words; k++) {
-			pos = j * pl->num_words + k;
-			pl->tw[pos] /= sum;
+			pos = (size_t) k * pl->num_topics + j;
+			val = KERNEL_LOAD(pl->precision, pl->tw, pos);
+			KERNEL_STORE(pl->precision, pl->tw, pos, val / sum);
+		}
+	}
+}
+
+/* Offset, in elements, of the row of `word' in the topic-word
+ * tables. For sparse tables, the row holds the entries of the topics
+ * in tw_topic[tw_start[word]], ..., tw_topic[tw_start[word + 1] - 1].
+ */
+static
+size_t plsa_tw_offset(const plsa *pl, unsigned int word)
+{
+	if (pl->tw_start)
+		return pl->tw_start[word];
+	return (size_t) word * pl->num_topics;
+}
+
+/* Returns the topics of the row of `word' (NULL if the tables are
+ * dense), and stores the length of the row in `n'.
+ */
+static
+const unsigned int *plsa_tw_topics(const plsa *pl, unsigned int word,
+                                   unsigned int *n)
+{
+	if (pl->tw_start) {
+		*n = pl->tw_start[word + 1] - pl->tw_start[word];
+		return &pl->tw_topic[pl->tw_start[word]];
+	}
+	*n = pl->num_topics;
+	return NULL;
+}
+
+/* Returns the topics of the row of `document', if they are fewer
+ * than the `n' topics of a dense row of the topic-word table, and
+ * stores their number in `n'. Otherwise returns NULL.
+ */
+static
+const unsigned int *plsa_dt_topics(const plsa *pl, unsigned int document,
+                                   const unsigned int *idx, unsigned int *n)
+{
+	size_t m;
+
+	if (!pl->dt_start || idx) return NULL;
+	m = pl->dt_start[document + 1] - pl->dt_start[document];
+	if (m >= *n) return NULL;
+	*n = (unsigned int) m;
+	return &pl->dt_topic[pl->dt_start[document]];
+}
+
+/* Dot product of the row `dt' with the row `tw' of length `n', or
+ * along the topics `active' of the document.
+ */
+static
+double plsa_dot(const plsa_context *ctx, const void *dt, const void *tw,
+                const unsigned int *idx, const unsigned int *active,
+                unsigned int n)
+{
+	if (active) {
+		return kernels_dot_gather(ctx->pl->precision, dt, active,
+		                          tw, n);
+	}
+	if (idx)
+		return kernels_dot_sparse(ctx->pl->precision, dt, idx, tw, n);
+	return ctx->ops->dot(dt, tw, n);
+}
+
+/* Computes dt2[topic] += alpha * dt[topic] * tw[topic] */
+static
+void plsa_axpy_dt(const plsa_context *ctx, void *dt2, double alpha,
+                  const void *dt, const void *tw, const unsigned int *idx,
+                  const unsigned int *active, unsigned int n)
+{
+	if (active) {
+		kernels_axpy_gather(ctx->pl->precision, dt2, alpha,
+		                    dt, active, tw, n);
+	} else if (idx) {
+		kernels_axpy_scatter(ctx->pl->precision, dt2, alpha,
+		                     dt, idx, tw, n);
+	} else {
+		ctx->ops->axpy_prod(dt2, alpha, dt, tw, n);
+	}
+}
+
+/* Computes tw2[topic] += alpha * dt[topic] * tw[topic] */
+static
+void plsa_axpy_tw(const plsa_context *ctx, void *tw2, double alpha,
+                  const void *dt, const void *tw, const unsigned int *idx,
+                  const unsigned int *active, unsigned int n)
+{
+	/* The columns of the topics frozen are not needed, but the
+	 * kernels of whole rows are vectorized, unlike the gathers.
+	 */
+	if (ctx->free_topics && !idx
+	    && ((active && ctx->num_free < n)
+	        || (!active && ctx->num_free * PLSA_GATHER_RATIO <= n))) {
+		kernels_axpy_gather(ctx->pl->precision, tw2, alpha,
+		                    dt, ctx->free_topics, tw, ctx->num_free);
+	} else if (active) {
+		kernels_axpy_gather(ctx->pl->precision, tw2, alpha,
+		                    dt, active, tw, n);
+	} else if (idx) {
+		kernels_axpy_sparse(ctx->pl->precision, tw2, alpha,
+		                    dt, idx, tw, n);
+	} else {
+		ctx->ops->axpy_prod(tw2, alpha, dt, tw, n);
+	}
+}
+
+/* Computes the range [start, end) of the wordstats processed by
+ * thread `thread_idx'. The wordstats are sorted by document, so the
+ * limits are moved to document boundaries, and each document (and
+ * its row of `dt2') is owned by exactly one thread.
+ */
+static
+void plsa_wordstats_range(const docinfo *doc, unsigned int thread_idx,
+                          unsigned int num_threads, unsigned int *start,
+                          unsigned int *end)
+{
+	unsigned int *limits[2];
+	unsigned int i, l, num_wordstats;
+
+	num_wordstats = docinfo_num_wordstats(doc);
+	parallel_range(num_wordstats, thread_idx, num_threads, start, end);
+	limits[0] = start;
+	limits[1] = end;
+	for (i = 0; i < 2; i++) {
+		l = *limits[i];
+		while (l > 0 && l < num_wordstats
+		       && doc->wordstats[l].document
+		          == doc->wordstats[l - 1].document)
+			l++;
+		*limits[i] = l;
+	}
+}
+
+/* Computes the range [start, end) of `pl->doc_list' processed by
+ * thread `thread_idx' among the documents ctx->first, ...,
+ * ctx->last - 1, balanced by their numbers of wordstats.
+ */
+static
+void plsa_list_range(const plsa_context *ctx, unsigned int thread_idx,
+                     unsigned int num_threads, unsigned int *start,
+                     unsigned int *end)
+{
+	const unsigned int *weight = ctx->pl->doc_weight;
+	unsigned int *limits[2];
+	unsigned int i, lo, hi, mid, base, total, target;
+
+	base = weight[ctx->first];
+	total = weight[ctx->last] - base;
+	parallel_range(total, thread_idx, num_threads, start, end);
+	limits[0] = start;
+	limits[1] = end;
+	for (i = 0; i < 2; i++) {
+		target = *limits[i];
+		if (target == 0) {
+			*limits[i] = ctx->first;
+			continue;
+		}
+		if (target == total) {
+			*limits[i] = ctx->last;
+			continue;
 		}
+
+		/* The first document whose wordstats start at `target' */
+		lo = ctx->first;
+		hi = ctx->last;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (weight[mid] - base < target)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		*limits[i] = lo;
 	}
 }
 
+/* Runs the E-step over the wordstats [start, end), adding the
+ * statistics of the topic-word table to `tw2'.
+ */
 static
-double plsa_iteration(plsa *pl, const docinfo *doc,
-                      int update_dt, int update_tw)
+void plsa_estep_range(const plsa_context *ctx, void *tw2,
+                      unsigned int start, unsigned int end,
+                      plsa_loglik *ll)
 {
-	unsigned pos, pos2;
-	unsigned int i, j, k, l, num_wordstats;
-	double dotprod, val, sum, likelihood, total_weight;
+	plsa *pl = ctx->pl;
+	unsigned int l, n;
+	double dotprod, factor;
 	docinfo_wordstats *wordstats;
 	docinfo_document *document;
+	const unsigned int *idx, *active;
+	void *dt, *tw;
+
+	for (l = start; l < end; l++) {
+		wordstats = docinfo_get_wordstats(ctx->doc, l + 1);
+		document = docinfo_get_document(ctx->doc, wordstats->document);
+		dt = PLSA_ROW(pl, pl->dt, wordstats->document - 1);
+		tw = PLSA_TW_ROW(pl, pl->tw, wordstats->word - 1);
+		idx = plsa_tw_topics(pl, wordstats->word - 1, &n);
+		active = plsa_dt_topics(pl, wordstats->document - 1, idx, &n);
+
+		dotprod = plsa_dot(ctx, dt, tw, idx, active, n);
+
+		/* The topics kept for the document may all miss the word */
+		factor = 0;
+		if (dotprod > 0)
+			factor = wordstats->count / dotprod;
+		else
+			dotprod = DBL_MIN;
+
+		ll->counts[ll->num] = wordstats->count;
+		ll->dotprods[ll->num] = dotprod;
+		if (++ll->num == PLSA_LOG_BATCH) {
+			ll->likelihood += ctx->ops->sum_log(ll->counts,
+			                                    ll->dotprods,
+			                                    ll->num);
+			ll->num = 0;
+		}
+		ll->total_weight += wordstats->count;
+
+		if (ctx->update_dt) {
+			plsa_axpy_dt(ctx, PLSA_ROW(pl, pl->dt2,
+			                           wordstats->document - 1),
+			             factor / document->word_count,
+			             dt, tw, idx, active, n);
+		}
+		if (ctx->update_tw) {
+			plsa_axpy_tw(ctx, PLSA_TW_ROW(pl, tw2,
+			                              wordstats->word - 1),
+			             factor, dt, tw, idx, active, n);
+		}
+	}
+}
+
+static
+void plsa_estep(void *arg, unsigned int thread_idx, unsigned int num_threads)
+{
+	plsa_context *ctx = (plsa_context *) arg;
+	plsa *pl = ctx->pl;
+	unsigned int i, start, end, document;
+	plsa_loglik ll;
+	void *tw2;
 	size_t size;
 
-	if (update_dt) {
-		size = pl->num_documents * pl->num_topics * sizeof(double);
-		memset(pl->dt2, 0, size);
+	tw2 = pl->tw2;
+	if (ctx->update_tw) {
+		size = PLSA_TW_LENGTH(pl) * KERNEL_SIZE(pl->precision);
+		if (thread_idx > 0)
+			tw2 = (char *) pl->tw2_local + (thread_idx - 1) * size;
+		memset(tw2, 0, size);
 	}
 
-	if (update_tw) {
-		size = pl->num_topics * pl->num_words * sizeof(double);
-		memset(pl->tw2, 0, size);
+	ll.num = 0;
+	ll.likelihood = 0;
+	ll.total_weight = 0;
+	if (ctx->use_list) {
+		plsa_list_range(ctx, thread_idx, num_threads, &start, &end);
+		for (i = start; i < end; i++) {
+			document = pl->doc_list[i];
+			plsa_estep_range(ctx, tw2, pl->doc_start[document],
+			                 pl->doc_start[document + 1], &ll);
+		}
+	} else {
+		plsa_wordstats_range(ctx->doc, thread_idx, num_threads,
+		                     &start, &end);
+		plsa_estep_range(ctx, tw2, start, end, &ll);
+	}
+	ll.likelihood += ctx->ops->sum_log(ll.counts, ll.dotprods, ll.num);
+	pl->partial[2 * thread_idx] = ll.likelihood;
+	pl->partial[2 * thread_idx + 1] = ll.total_weight;
+}
+
+/* Computes the range [start, end) of `pl->order' processed by
+ * thread `thread_idx', moved to word boundaries.
+ */
+static
+void plsa_word_range(const plsa *pl, const docinfo *doc,
+                     unsigned int thread_idx, unsigned int num_threads,
+                     unsigned int *start, unsigned int *end)
+{
+	unsigned int *limits[2];
+	unsigned int i, l, num_wordstats;
+
+	num_wordstats = docinfo_num_wordstats(doc);
+	parallel_range(num_wordstats, thread_idx, num_threads, start, end);
+	limits[0] = start;
+	limits[1] = end;
+	for (i = 0; i < 2; i++) {
+		l = *limits[i];
+		while (l > 0 && l < num_wordstats
+		       && doc->wordstats[pl->order[l]].word
+		          == doc->wordstats[pl->order[l - 1]].word)
+			l++;
+		*limits[i] = l;
+	}
+}
+
+/* First phase of the partitioned strategy: each thread owns a range
+ * of words and writes its columns of `tw2' directly. The ratio
+ * count / dotprod of each wordstats is kept for the second phase.
+ */
+static
+void plsa_estep_words(void *arg, unsigned int thread_idx,
+                      unsigned int num_threads)
+{
+	plsa_context *ctx = (plsa_context *) arg;
+	const kernel_ops *ops = ctx->ops;
+	plsa *pl = ctx->pl;
+	unsigned int l, m, n, num, start, end, first, last;
+	double dotprod, likelihood, total_weight;
+	double counts[PLSA_LOG_BATCH], dotprods[PLSA_LOG_BATCH];
+	docinfo_wordstats *wordstats;
+	const unsigned int *idx, *active;
+	void *dt, *tw;
+
+	plsa_word_range(pl, ctx->doc, thread_idx, num_threads, &start, &end);
+	if (start < end) {
+		first = ctx->doc->wordstats[pl->order[start]].word - 1;
+		last = ctx->doc->wordstats[pl->order[end - 1]].word;
+		memset(PLSA_TW_ROW(pl, pl->tw2, first), 0,
+		       (plsa_tw_offset(pl, last) - plsa_tw_offset(pl, first))
+		       * KERNEL_SIZE(pl->precision));
 	}
 
+	num = 0;
 	likelihood = 0;
 	total_weight = 0;
-	num_wordstats = docinfo_num_wordstats(doc);
-	for (l = 0; l < num_wordstats; l++) {
-		wordstats = docinfo_get_wordstats(doc, l + 1);
-		k = wordstats->document - 1;
-		i = wordstats->word - 1;
-		document = docinfo_get_document(doc, wordstats->document);
-		dotprod = 0;
-		for (j = 0; j < pl->num_topics; j++) {
-			pos = k * pl->num_topics + j;
-			pos2 = j * pl->num_words + i;
-			dotprod += pl->dt[pos] * pl->tw[pos2];
+	for (m = start; m < end; m++) {
+		l = pl->order[m];
+		wordstats = docinfo_get_wordstats(ctx->doc, l + 1);
+		dt = PLSA_ROW(pl, pl->dt, wordstats->document - 1);
+		tw = PLSA_TW_ROW(pl, pl->tw, wordstats->word - 1);
+		idx = plsa_tw_topics(pl, wordstats->word - 1, &n);
+		active = plsa_dt_topics(pl, wordstats->document - 1, idx, &n);
+
+		dotprod = plsa_dot(ctx, dt, tw, idx, active, n);
+
+		/* The topics kept for the document may all miss the word */
+		pl->ratio[l] = 0;
+		if (dotprod > 0)
+			pl->ratio[l] = wordstats->count / dotprod;
+		else
+			dotprod = DBL_MIN;
+
+		counts[num] = wordstats->count;
+		dotprods[num] = dotprod;
+		if (++num == PLSA_LOG_BATCH) {
+			likelihood += ops->sum_log(counts, dotprods, num);
+			num = 0;
 		}
-		likelihood += wordstats->count * log(dotprod);
 		total_weight += wordstats->count;
 
-		for (j = 0; j < pl->num_topics; j++) {
-			pos = k * pl->num_topics + j;
-			pos2 = j * pl->num_words + i;
-			val = wordstats->count * pl->dt[pos]
-			        * pl->tw[pos2] / dotprod;
-			if (update_dt)
-				pl->dt2[pos] += val / document->word_count;
-			if (update_tw)
-				pl->tw2[pos2] += val;
-		}
+		plsa_axpy_tw(ctx, PLSA_TW_ROW(pl, pl->tw2, wordstats->word - 1),
+		             pl->ratio[l], dt, tw, idx, active, n);
 	}
+	likelihood += ops->sum_log(counts, dotprods, num);
+	pl->partial[2 * thread_idx] = likelihood;
+	pl->partial[2 * thread_idx + 1] = total_weight;
+}
 
-	if (update_tw) {
-		for (j = 0; j < pl->num_topics; j++) {
-			sum = 0;
-			for (i = 0; i < pl->num_words; i++) {
-				pos2 = j * pl->num_words + i;
-				sum += pl->tw2[pos2];
-			}
-			for (i = 0; i < pl->num_words; i++) {
-				pos2 = j * pl->num_words + i;
-				pl->tw2[pos2] /= sum;
-			}
-		}
+/* Second phase of the partitioned strategy: the contributions to
+ * `dt2' are merged per document, using the ratios of the first phase.
+ */
+static
+void plsa_estep_documents(void *arg, unsigned int thread_idx,
+                          unsigned int num_threads)
+{
+	plsa_context *ctx = (plsa_context *) arg;
+	plsa *pl = ctx->pl;
+	unsigned int l, n, start, end;
+	docinfo_wordstats *wordstats;
+	docinfo_document *document;
+	const unsigned int *idx, *active;
+	void *dt, *tw;
+
+	plsa_wordstats_range(ctx->doc, thread_idx, num_threads, &start, &end);
+	for (l = start; l < end; l++) {
+		wordstats = docinfo_get_wordstats(ctx->doc, l + 1);
+		document = docinfo_get_document(ctx->doc, wordstats->document);
+		dt = PLSA_ROW(pl, pl->dt, wordstats->document - 1);
+		tw = PLSA_TW_ROW(pl, pl->tw, wordstats->word - 1);
+		idx = plsa_tw_topics(pl, wordstats->word - 1, &n);
+		active = plsa_dt_topics(pl, wordstats->document - 1, idx, &n);
+		plsa_axpy_dt(ctx, PLSA_ROW(pl, pl->dt2, wordstats->document - 1),
+		             pl->ratio[l] / document->word_count,
+		             dt, tw, idx, active, n);
 	}
-	return likelihood / total_weight;
 }
 
+/* Adds the contributions of the other threads to `tw2' for the
+ * words in the range of thread `thread_idx', and computes the partial
+ * sums of each topic over these words.
+ */
 static
-int plsa_allocate_tables(plsa *pl, unsigned int num_words,
-                         unsigned int num_documents, unsigned int num_topics)
+void plsa_mstep_reduce(void *arg, unsigned int thread_idx,
+                       unsigned int num_threads)
 {
+	plsa_context *ctx = (plsa_context *) arg;
+	plsa *pl = ctx->pl;
+	unsigned int i, n, t, start, end;
+	const unsigned int *idx;
+	void *row, *local;
+	double *sums;
 	size_t size;
 
-	if (pl->num_documents != num_documents
-	    || pl->num_topics != num_topics) {
-		if (pl->dt) {
-			free(pl->dt);
-			pl->dt = NULL;
+	sums = &pl->sums[thread_idx * pl->num_topics];
+	memset(sums, 0, pl->num_topics * sizeof(double));
+
+	size = PLSA_TW_LENGTH(pl) * KERNEL_SIZE(pl->precision);
+	parallel_range(pl->num_words, thread_idx, num_threads, &start, &end);
+	for (i = start; i < end; i++) {
+		row = PLSA_TW_ROW(pl, pl->tw2, i);
+		idx = plsa_tw_topics(pl, i, &n);
+		for (t = 1; pl->tw2_local && t < pl->num_threads; t++) {
+			local = (char *) pl->tw2_local + (t - 1) * size;
+			kernels_add(pl->precision, row,
+			            PLSA_TW_ROW(pl, local, i), n);
 		}
-		if (pl->dt2) {
-			free(pl->dt2);
-			pl->dt2 = NULL;
+		if (ctx->add_frozen) {
+			kernels_add(pl->precision, row,
+			            PLSA_TW_ROW(pl, pl->tw_frozen, i), n);
 		}
+		kernels_sum(pl->precision, sums, idx, row, n);
 	}
+}
 
-	if (pl->num_topics != num_topics || pl->num_words != num_words) {
-		if (pl->tw) {
-			free(pl->tw);
-			pl->tw = NULL;
+/* Normalizes the topics still updated for the words [start, end),
+ * measuring how much they moved, and copies the columns of the
+ * topics frozen from `tw'.
+ */
+static
+void plsa_mstep_freeze(plsa *pl, unsigned int thread_idx,
+                       unsigned int start, unsigned int end)
+{
+	unsigned int i, j, k;
+	double *delta, val;
+	const void *tw;
+	void *tw2;
+
+	delta = &pl->topic_delta[thread_idx * pl->num_topics];
+	for (k = 0; k < pl->num_free; k++)
+		delta[pl->topic_list[k]] = 0;
+
+	for (i = start; i < end; i++) {
+		tw = PLSA_ROW(pl, pl->tw, i);
+		tw2 = PLSA_ROW(pl, pl->tw2, i);
+		for (k = 0; k < pl->num_free; k++) {
+			j = pl->topic_list[k];
+			val = KERNEL_LOAD(pl->precision, tw2, j) / pl->sums[j];
+			KERNEL_STORE(pl->precision, tw2, j, val);
+			delta[j] += fabs(val - KERNEL_LOAD(pl->precision, tw, j));
 		}
-		if (pl->tw2) {
-			free(pl->tw2);
-			pl->tw2 = NULL;
+		for (k = pl->num_free; k < pl->num_topics; k++) {
+			j = pl->topic_list[k];
+			KERNEL_STORE(pl->precision, tw2, j,
+			             KERNEL_LOAD(pl->precision, tw, j));
 		}
 	}
+}
 
-	pl->num_documents = num_documents;
-	pl->num_words = num_words;
-	pl->num_topics = num_topics;
+/* Normalizes the topics for the words in the range of thread
+ * `thread_idx'. The total sums are in the first row of `pl->sums'.
+ */
+static
+void plsa_mstep_normalize(void *arg, unsigned int thread_idx,
+                          unsigned int num_threads)
+{
+	plsa_context *ctx = (plsa_context *) arg;
+	plsa *pl = ctx->pl;
+	unsigned int i, n, start, end;
+	const unsigned int *idx;
 
-	size = pl->num_documents * num_topics * sizeof(double);
-	if (!pl->dt) {
-		pl->dt = (double *) xmalloc(size);
-		if (!pl->dt) return FALSE;
+	parallel_range(pl->num_words, thread_idx, num_threads, &start, &end);
+	if (pl->topic_list) {
+		plsa_mstep_freeze(pl, thread_idx, start, end);
+		return;
 	}
-
-	if (!pl->dt2) {
-		pl->dt2 = (double *) xmalloc(size);
-		if (!pl->dt2) return FALSE;
+	for (i = start; i < end; i++) {
+		idx = plsa_tw_topics(pl, i, &n);
+		kernels_divide(pl->precision, PLSA_TW_ROW(pl, pl->tw2, i),
+		               pl->sums, idx, n);
 	}
+}
 
-	size = num_topics * pl->num_words * sizeof(double);
-	if (!pl->tw) {
-		pl->tw = (double *) xmalloc(size);
-		if (!pl->tw) return FALSE;
-	}
+/* Picks the topics to freeze from the changes measured by the threads
+ * of plsa_mstep_freeze(). All the topics are updated again every
+ * PLSA_FREEZE_INTERVAL iterations, to check the topics frozen.
+ */
+static
+void plsa_freeze_topics(plsa *pl)
+{
+	unsigned int i, j, k, t, n;
+	double delta;
 
-	if (!pl->tw2) {
-		pl->tw2 = (double *) xmalloc(size);
-		if (!pl->tw2) return FALSE;
+	n = 0;
+	for (i = 0; i < pl->num_free; i++) {
+		j = pl->topic_list[i];
+		delta = 0;
+		for (t = 0; t < pl->num_threads; t++)
+			delta += pl->topic_delta[t * pl->num_topics + j];
+		if (delta >= pl->topic_tol) {
+			pl->topic_list[i] = pl->topic_list[n];
+			pl->topic_list[n++] = j;
+		}
 	}
+	pl->num_free = n;
 
-	return TRUE;
+	if (++pl->topic_pass % PLSA_FREEZE_INTERVAL == 0) {
+		for (k = 0; k < pl->num_topics; k++)
+			pl->topic_list[k] = k;
+		pl->num_free = pl->num_topics;
+	}
 }
 
-int plsa_train(plsa *pl, const docinfo *doc, unsigned int num_topics,
-               unsigned int max_iterations, double tol, int retrain_dt,
-               const char *plsa_filename)
+/* Measures how much the rows of `dt' moved for the documents
+ * pl->doc_list[ctx->first], ..., pl->doc_list[ctx->last - 1], which
+ * were visited, and copies the rows of the documents before them,
+ * which were skipped.
+ */
+static
+void plsa_residual_rows(void *arg, unsigned int thread_idx,
+                        unsigned int num_threads)
 {
-	unsigned int iter;
-	double *temp;
+	plsa_context *ctx = (plsa_context *) arg;
+	plsa *pl = ctx->pl;
+	unsigned int i, j, document, start, end;
+	const void *dt;
+	void *dt2;
+	double diff;
 
-	if (!plsa_allocate_tables(pl, docinfo_num_different_words(doc),
-	                          docinfo_num_documents(doc), num_topics))
-		return FALSE;
+	parallel_range(pl->num_documents, thread_idx, num_threads,
+	               &start, &end);
+	for (i = start; i < end; i++) {
+		document = pl->doc_list[i];
+		dt = PLSA_ROW(pl, pl->dt, document);
+		dt2 = PLSA_ROW(pl, pl->dt2, document);
+		if (i < ctx->first) {
+			memcpy(dt2, dt, pl->num_topics
+			                * KERNEL_SIZE(pl->precision));
+			continue;
+		}
 
-	if (retrain_dt) {
-		pl->likelihood = 1;
-		pl->old_likelihood = 1;
+		diff = 0;
+		for (j = 0; j < pl->num_topics; j++) {
+			diff += fabs(KERNEL_LOAD(pl->precision, dt2, j)
+			             - KERNEL_LOAD(pl->precision, dt, j));
+		}
+		pl->doc_residual[document] = diff;
 	}
+}
 
-	if (pl->likelihood >= 0)
-		plsa_initialize_random(pl, retrain_dt);
-	else if (fabs(pl->likelihood - pl->old_likelihood) < tol) {
-		return TRUE;
+/* Runs the E-step of the residual EM. A full pass first picks the
+ * documents to skip and freezes their statistics, and the other
+ * iterations only go over the remaining documents.
+ */
+static
+int plsa_estep_residual(plsa *pl, plsa_context *ctx)
+{
+	unsigned int i, n, t, document;
+	size_t size;
+	int full;
+
+	size = PLSA_TW_LENGTH(pl) * KERNEL_SIZE(pl->precision);
+	full = (!pl->tw_frozen
+	        || pl->residual_pass % pl->residual_interval == 0);
+	if (full) {
+		n = 0;
+		for (i = 0; i < pl->num_documents; i++) {
+			if (pl->doc_residual[i] < pl->residual)
+				pl->doc_list[n++] = i;
+		}
+		pl->num_skipped = n;
+		for (i = 0; i < pl->num_documents; i++) {
+			if (!(pl->doc_residual[i] < pl->residual))
+				pl->doc_list[n++] = i;
+		}
+
+		pl->doc_weight[0] = 0;
+		for (i = 0; i < pl->num_documents; i++) {
+			document = pl->doc_list[i];
+			pl->doc_weight[i + 1] = pl->doc_weight[i]
+			                        + pl->doc_start[document + 1]
+			                        - pl->doc_start[document];
+		}
+
+		if (!pl->tw_frozen) {
+			pl->tw_frozen = xmalloc(MAX(size, 1));
+			if (!pl->tw_frozen) return FALSE;
+		}
+
+		pl->frozen[0] = 0;
+		pl->frozen[1] = 0;
+		if (pl->num_skipped == 0) {
+			memset(pl->tw_frozen, 0, size);
+		} else {
+			ctx->first = 0;
+			ctx->last = pl->num_skipped;
+			if (!plsa_run(pl, &plsa_estep, ctx))
+				return FALSE;
+			if (!plsa_run(pl, &plsa_mstep_reduce, ctx))
+				return FALSE;
+			memcpy(pl->tw_frozen, pl->tw2, size);
+			for (t = 0; t < pl->num_threads; t++) {
+				pl->frozen[0] += pl->partial[2 * t];
+				pl->frozen[1] += pl->partial[2 * t + 1];
+			}
+		}
 	}
 
-	printf("Running PLSA on data...\n");
-	for (iter = 0; iter < max_iterations; iter++) {
-		pl->old_likelihood = pl->likelihood;
-		pl->likelihood = plsa_iteration(pl, doc, TRUE, !retrain_dt);
-		printf("Iteration %d: likelihood = %g\n",
-		       iter + 1, pl->likelihood);
+	ctx->first = pl->num_skipped;
+	ctx->last = pl->num_documents;
+	if (!plsa_run(pl, &plsa_estep, ctx))
+		return FALSE;
+	pl->partial[0] += pl->frozen[0];
+	pl->partial[1] += pl->frozen[1];
 
-		temp = pl->dt;
-		pl->dt = pl->dt2;
-		pl->dt2 = temp;
+	if (full) ctx->first = 0;
+	if (!plsa_run(pl, &plsa_residual_rows, ctx))
+		return FALSE;
 
-		if (!retrain_dt) {
+	ctx->add_frozen = TRUE;
+	pl->residual_pass++;
+	return TRUE;
+}
+
+static
+int plsa_iteration(plsa *pl, const docinfo *doc,
+                   int update_dt, int update_tw, double *likelihood)
+{
+	plsa_context ctx;
+	double totals[2]; /* the log-likelihood and the total weight */
+	unsigned int j, t;
+	size_t size;
+
+	ctx.ops = kernels_get(pl->precision);
+	ctx.pl = pl;
+	ctx.doc = doc;
+	ctx.update_dt = update_dt;
+	ctx.update_tw = update_tw;
+	ctx.use_list = FALSE;
+	ctx.add_frozen = FALSE;
+	ctx.first = 0;
+	ctx.last = 0;
+	ctx.free_topics = NULL;
+	ctx.num_free = 0;
+	if (update_tw && pl->topic_list
+	    && pl->num_free < pl->num_topics) {
+		ctx.free_topics = pl->topic_list;
+		ctx.num_free = pl->num_free;
+	}
+
+	if (update_dt) {
+		size = (size_t) pl->num_documents * pl->num_topics
+		       * KERNEL_SIZE(pl->precision);
+		memset(pl->dt2, 0, size);
+	}
+
+	if (update_tw && pl->parallel_mode == PLSA_PARALLEL_PARTITION) {
+		if (!plsa_run(pl, &plsa_estep_words, &ctx))
+			return FALSE;
+		if (update_dt) {
+			if (!plsa_run(pl, &plsa_estep_documents, &ctx))
+				return FALSE;
+		}
+	} else if (update_dt && update_tw && pl->doc_residual) {
+		ctx.use_list = TRUE;
+		if (!plsa_estep_residual(pl, &ctx))
+			return FALSE;
+	} else {
+		if (!plsa_run(pl, &plsa_estep, &ctx))
+			return FALSE;
+	}
+
+	totals[0] = 0;
+	totals[1] = 0;
+	for (t = 0; t < pl->num_threads; t++) {
+		totals[0] += pl->partial[2 * t];
+		totals[1] += pl->partial[2 * t + 1];
+	}
+	if (pl->ar) {
+		if (!allreduce_sum(pl->ar, KERNEL_DOUBLE, totals, 2))
+			return FALSE;
+	}
+
+	if (update_tw) {
+		if (!plsa_run(pl, &plsa_mstep_reduce, &ctx))
+			return FALSE;
+
+		for (t = 1; t < pl->num_threads; t++) {
+			for (j = 0; j < pl->num_topics; j++) {
+				pl->sums[j] += pl->sums[t * pl->num_topics + j];
+			}
+		}
+
+		/* The statistics of all the shards are added together */
+		if (pl->ar) {
+			if (!allreduce_sum(pl->ar, pl->precision, pl->tw2,
+			                   PLSA_TW_LENGTH(pl)))
+				return FALSE;
+			if (!allreduce_sum(pl->ar, KERNEL_DOUBLE, pl->sums,
+			                   pl->num_topics))
+				return FALSE;
+		}
+
+		/* A topic dropped by all the documents keeps its zeros */
+		for (j = 0; j < pl->num_topics; j++) {
+			if (pl->sums[j] <= 0) pl->sums[j] = 1;
+		}
+
+		if (!plsa_run(pl, &plsa_mstep_normalize, &ctx))
+			return FALSE;
+		if (pl->topic_list) plsa_freeze_topics(pl);
+	}
+	*likelihood = totals[0] / totals[1];
+	return TRUE;
+}
+
+static
+int plsa_allocate_tables(plsa *pl, unsigned int num_words,
+                         unsigned int num_documents, unsigned int num_topics)
+{
+	size_t size;
+
+	/* The documents may not be the ones of the last training */
+	plsa_cleanup_residual(pl);
+	if (pl->num_documents != num_documents
+	    || pl->num_topics != num_topics) {
+		plsa_cleanup_active(pl);
+		if (pl->dt) {
+			plsa_free(pl, pl->dt);
+			pl->dt = NULL;
+		}
+		if (pl->dt2) {
+			plsa_free(pl, pl->dt2);
+			pl->dt2 = NULL;
+		}
+	}
+
+	if (pl->num_topics != num_topics || pl->num_words != num_words) {
+		if (pl->tw) {
+			plsa_free(pl, pl->tw);
+			pl->tw = NULL;
+		}
+		if (pl->tw2) {
+			plsa_free(pl, pl->tw2);
+			pl->tw2 = NULL;
+		}
+		plsa_cleanup_sparse(pl);
+	}
+
+	pl->num_documents = num_documents;
+	pl->num_words = num_words;
+	pl->num_topics = num_topics;
+
+	size = (size_t) pl->num_documents * num_topics
+	       * KERNEL_SIZE(pl->precision);
+	if (!pl->dt) {
+		pl->dt = xmalloc(size);
+		if (!pl->dt) return FALSE;
+	}
+
+	if (!pl->dt2) {
+		pl->dt2 = xmalloc(size);
+		if (!pl->dt2) return FALSE;
+	}
+
+	size = PLSA_TW_LENGTH(pl) * KERNEL_SIZE(pl->precision);
+	if (!pl->tw) {
+		pl->tw = xmalloc(size);
+		if (!pl->tw) return FALSE;
+	}
+
+	if (!pl->tw2) {
+		pl->tw2 = xmalloc(size);
+		if (!pl->tw2) return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Sorts the wordstats by word (counting sort), so that the words
+ * can be split among the threads in the partitioned strategy.
+ */
+static
+int plsa_allocate_word_order(plsa *pl, const docinfo *doc)
+{
+	unsigned int i, l, num_wordstats;
+	docinfo_wordstats *wordstats;
+	unsigned int *word_start;
+	size_t size;
+
+	num_wordstats = docinfo_num_wordstats(doc);
+	size = MAX(num_wordstats, 1) * sizeof(unsigned int);
+	pl->order = (unsigned int *) xmalloc(size);
+	if (!pl->order) return FALSE;
+
+	size = MAX(num_wordstats, 1) * sizeof(double);
+	pl->ratio = (double *) xmalloc(size);
+	if (!pl->ratio) return FALSE;
+
+	size = (pl->num_words + 1) * sizeof(unsigned int);
+	word_start = (unsigned int *) xmalloc(size);
+	if (!word_start) return FALSE;
+
+	memset(word_start, 0, size);
+	for (l = 0; l < num_wordstats; l++) {
+		wordstats = docinfo_get_wordstats(doc, l + 1);
+		word_start[wordstats->word]++;
+	}
+	for (i = 0; i < pl->num_words; i++)
+		word_start[i + 1] += word_start[i];
+
+	for (l = 0; l < num_wordstats; l++) {
+		wordstats = docinfo_get_wordstats(doc, l + 1);
+		pl->order[word_start[wordstats->word - 1]++] = l;
+	}
+	free(word_start);
+	return TRUE;
+}
+
+static
+int plsa_allocate_workers(plsa *pl, const docinfo *doc, int update_tw)
+{
+	unsigned int j;
+	size_t size;
+
+	plsa_cleanup_workers(pl);
+	if (pl->num_threads == 0)
+		pl->num_threads = 1;
+
+	/* The threads are started once, and only again for another
+	 * number of threads
+	 */
+	if (pl->pool && parallel_pool_size(pl->pool) != pl->num_threads) {
+		parallel_pool_destroy(pl->pool);
+		pl->pool = NULL;
+	}
+	if (!pl->pool && pl->num_threads > 1) {
+		pl->pool = parallel_pool_create(pl->num_threads);
+		if (!pl->pool) return FALSE;
+	}
+
+	size = 2 * pl->num_threads * sizeof(double);
+	pl->partial = (double *) xmalloc(size);
+	if (!pl->partial) return FALSE;
+
+	size = pl->num_threads * pl->num_topics * sizeof(double);
+	pl->sums = (double *) xmalloc(size);
+	if (!pl->sums) return FALSE;
+
+	/* All the topics are updated until they settle */
+	if (update_tw && pl->topic_tol > 0) {
+		size = pl->num_topics * sizeof(unsigned int);
+		pl->topic_list = (unsigned int *) xmalloc(size);
+		if (!pl->topic_list) return FALSE;
+
+		size = pl->num_threads * pl->num_topics * sizeof(double);
+		pl->topic_delta = (double *) xmalloc(size);
+		if (!pl->topic_delta) return FALSE;
+
+		for (j = 0; j < pl->num_topics; j++)
+			pl->topic_list[j] = j;
+		pl->num_free = pl->num_topics;
+		pl->topic_pass = 0;
+	}
+
+	if (update_tw && pl->parallel_mode == PLSA_PARALLEL_PARTITION)
+		return plsa_allocate_word_order(pl, doc);
+
+	if (update_tw && pl->num_threads > 1) {
+		size = (size_t) (pl->num_threads - 1) * PLSA_TW_LENGTH(pl)
+		       * KERNEL_SIZE(pl->precision);
+		pl->tw2_local = xmalloc(size);
+		if (!pl->tw2_local) return FALSE;
+	}
+	return TRUE;
+}
+
+/* Starts the residual EM, with all the documents to visit */
+static
+int plsa_allocate_residual(plsa *pl, const docinfo *doc)
+{
+	unsigned int i, l, num_wordstats;
+	docinfo_wordstats *wordstats;
+	size_t size;
+
+	plsa_cleanup_residual(pl);
+	if (pl->residual_interval == 0)
+		pl->residual_interval = 1;
+
+	size = MAX(pl->num_documents, 1) * sizeof(double);
+	pl->doc_residual = (double *) xmalloc(size);
+	if (!pl->doc_residual) goto error_residual;
+
+	size = (pl->num_documents + 1) * sizeof(unsigned int);
+	pl->doc_start = (unsigned int *) xmalloc(size);
+	if (!pl->doc_start) goto error_residual;
+	pl->doc_weight = (unsigned int *) xmalloc(size);
+	if (!pl->doc_weight) goto error_residual;
+
+	size = MAX(pl->num_documents, 1) * sizeof(unsigned int);
+	pl->doc_list = (unsigned int *) xmalloc(size);
+	if (!pl->doc_list) goto error_residual;
+
+	/* The wordstats are sorted by document */
+	memset(pl->doc_start, 0, (pl->num_documents + 1)
+	                         * sizeof(unsigned int));
+	num_wordstats = docinfo_num_wordstats(doc);
+	for (l = 0; l < num_wordstats; l++) {
+		wordstats = docinfo_get_wordstats(doc, l + 1);
+		pl->doc_start[wordstats->document]++;
+	}
+	for (i = 0; i < pl->num_documents; i++) {
+		pl->doc_start[i + 1] += pl->doc_start[i];
+		pl->doc_residual[i] = DBL_MAX;
+	}
+	return TRUE;
+
+error_residual:
+	plsa_cleanup_residual(pl);
+	return FALSE;
+}
+
+/* Returns the k-th largest (1 <= k <= n) of the values in `v',
+ * which are reordered in the process.
+ */
+static
+double plsa_select(double *v, unsigned int n, unsigned int k)
+{
+	long lo, hi, i, j, pos;
+	double pivot, temp;
+
+	lo = 0;
+	hi = (long) n - 1;
+	pos = (long) k - 1;
+	while (lo < hi) {
+		pivot = v[lo + (hi - lo) / 2];
+		i = lo;
+		j = hi;
+		while (i <= j) {
+			while (v[i] > pivot) i++;
+			while (v[j] < pivot) j--;
+			if (i <= j) {
+				temp = v[i];
+				v[i++] = v[j];
+				v[j--] = temp;
+			}
+		}
+		if (pos <= j)
+			hi = j;
+		else if (pos >= i)
+			lo = i;
+		else
+			break;
+	}
+	return v[pos];
+}
+
+/* Computes, for each topic, the smallest value kept by the pruning */
+static
+int plsa_prune_cutoff(const plsa *pl, double *cutoff)
+{
+	unsigned int i, j, k, n, *count;
+	const unsigned int *idx;
+	double *values;
+	size_t length;
+	void *row;
+
+	for (j = 0; j < pl->num_topics; j++)
+		cutoff[j] = pl->prune_threshold;
+	if (pl->prune_top == 0)
+		return TRUE;
+
+	/* Groups the values of the table by topic */
+	length = PLSA_TW_LENGTH(pl);
+	values = (double *) xmalloc(MAX(length, 1) * sizeof(double));
+	if (!values) return FALSE;
+
+	count = (unsigned int *) xmalloc((pl->num_topics + 1)
+	                                 * sizeof(unsigned int));
+	if (!count) {
+		free(values);
+		return FALSE;
+	}
+
+	memset(count, 0, (pl->num_topics + 1) * sizeof(unsigned int));
+	for (i = 0; i < pl->num_words; i++) {
+		idx = plsa_tw_topics(pl, i, &n);
+		for (k = 0; k < n; k++)
+			count[(idx ? idx[k] : k) + 1]++;
+	}
+	for (j = 0; j < pl->num_topics; j++)
+		count[j + 1] += count[j];
+
+	for (i = 0; i < pl->num_words; i++) {
+		row = PLSA_TW_ROW(pl, pl->tw, i);
+		idx = plsa_tw_topics(pl, i, &n);
+		for (k = 0; k < n; k++) {
+			j = (idx) ? idx[k] : k;
+			values[count[j]++] = KERNEL_LOAD(pl->precision, row, k);
+		}
+	}
+
+	/* Now count[j] is the end of the values of topic j */
+	for (j = 0; j < pl->num_topics; j++) {
+		i = (j > 0) ? count[j - 1] : 0;
+		n = count[j] - i;
+		if (pl->prune_top < n) {
+			cutoff[j] = MAX(cutoff[j],
+			                plsa_select(&values[i], n,
+			                            pl->prune_top));
+		}
+	}
+
+	free(count);
+	free(values);
+	return TRUE;
+}
+
+/* Drops the entries of the topic-word table below `prune_threshold',
+ * or outside the `prune_top' largest ones of their topic, converting
+ * the tables to the sparse representation. Each word keeps at least
+ * its largest entry, and the topics are normalized again. The workers
+ * stay allocated: the order of the words does not change, and the
+ * tables of the threads only shrink.
+ */
+static
+int plsa_prune(plsa *pl)
+{
+	unsigned int i, j, k, n, best, *start, *topic;
+	const unsigned int *idx;
+	double *cutoff, *sums, val;
+	void *row, *tw, *tw2, *ptr;
+	size_t pos, size;
+
+	cutoff = (double *) xmalloc(2 * pl->num_topics * sizeof(double));
+	if (!cutoff) return FALSE;
+	sums = &cutoff[pl->num_topics];
+
+	start = NULL;
+	topic = NULL;
+	tw = NULL;
+	tw2 = NULL;
+	if (!plsa_prune_cutoff(pl, cutoff))
+		goto error_prune;
+
+	start = (unsigned int *) xmalloc((pl->num_words + 1)
+	                                 * sizeof(unsigned int));
+	if (!start) goto error_prune;
+
+	/* Counts the entries kept */
+	start[0] = 0;
+	for (i = 0; i < pl->num_words; i++) {
+		row = PLSA_TW_ROW(pl, pl->tw, i);
+		idx = plsa_tw_topics(pl, i, &n);
+		best = 0;
+		start[i + 1] = start[i];
+		for (k = 0; k < n; k++) {
+			j = (idx) ? idx[k] : k;
+			val = KERNEL_LOAD(pl->precision, row, k);
+			if (val > 0 && val >= cutoff[j])
+				start[i + 1]++;
+			if (val > KERNEL_LOAD(pl->precision, row, best))
+				best = k;
+		}
+		if (start[i + 1] == start[i] && n > 0)
+			start[i + 1]++;
+	}
+
+	size = MAX(start[pl->num_words], 1);
+	topic = (unsigned int *) xmalloc(size * sizeof(unsigned int));
+	if (!topic) goto error_prune;
+
+	tw = xmalloc(size * KERNEL_SIZE(pl->precision));
+	if (!tw) goto error_prune;
+
+	tw2 = xmalloc(size * KERNEL_SIZE(pl->precision));
+	if (!tw2) goto error_prune;
+
+	/* Copies the entries kept, and normalizes the topics again */
+	memset(sums, 0, pl->num_topics * sizeof(double));
+	for (i = 0; i < pl->num_words; i++) {
+		row = PLSA_TW_ROW(pl, pl->tw, i);
+		idx = plsa_tw_topics(pl, i, &n);
+		pos = start[i];
+		best = 0;
+		for (k = 0; k < n; k++) {
+			j = (idx) ? idx[k] : k;
+			val = KERNEL_LOAD(pl->precision, row, k);
+			if (val > KERNEL_LOAD(pl->precision, row, best))
+				best = k;
+			if (val > 0 && val >= cutoff[j]) {
+				topic[pos] = j;
+				KERNEL_STORE(pl->precision, tw, pos, val);
+				sums[j] += val;
+				pos++;
+			}
+		}
+		if (pos == start[i] && n > 0) {
+			j = (idx) ? idx[best] : best;
+			val = KERNEL_LOAD(pl->precision, row, best);
+			topic[pos] = j;
+			KERNEL_STORE(pl->precision, tw, pos, val);
+			sums[j] += val;
+		}
+	}
+	for (pos = 0; pos < start[pl->num_words]; pos++) {
+		if (sums[topic[pos]] <= 0) continue;
+		val = KERNEL_LOAD(pl->precision, tw, pos);
+		KERNEL_STORE(pl->precision, tw, pos, val / sums[topic[pos]]);
+	}
+
+	printf("Pruned topic-word table: %u of %lu entries kept\n",
+	       start[pl->num_words],
+	       (unsigned long) pl->num_words * pl->num_topics);
+
+	plsa_free(pl, pl->tw);
+	plsa_free(pl, pl->tw2);
+	plsa_cleanup_sparse(pl);
+	pl->tw = tw;
+	pl->tw2 = tw2;
+	pl->tw_start = start;
+	pl->tw_topic = topic;
+	free(cutoff);
+
+	/* The residual EM takes its frozen statistics again */
+	if (pl->tw_frozen) {
+		free(pl->tw_frozen);
+		pl->tw_frozen = NULL;
+	}
+	pl->residual_pass = 0;
+
+	if (pl->tw2_local) {
+		size = (size_t) (pl->num_threads - 1) * PLSA_TW_LENGTH(pl)
+		       * KERNEL_SIZE(pl->precision);
+		ptr = xrealloc(pl->tw2_local, size);
+		if (!ptr) return FALSE;
+		pl->tw2_local = ptr;
+	}
+	return TRUE;
+
+error_prune:
+	if (tw2) free(tw2);
+	if (tw) free(tw);
+	if (topic) free(topic);
+	if (start) free(start);
+	free(cutoff);
+	return FALSE;
+}
+
+/* Drops the topics of the documents below `dt_floor' in the range of
+ * thread `thread_idx', keeping at least the largest one, normalizes
+ * the rows again and counts the topics left in `dt_start'.
+ */
+static
+void plsa_floor_rows(void *arg, unsigned int thread_idx,
+                     unsigned int num_threads)
+{
+	plsa *pl = (plsa *) arg;
+	unsigned int i, j, best, count, start, end;
+	double sum, val;
+	void *row;
+
+	parallel_range(pl->num_documents, thread_idx, num_threads,
+	               &start, &end);
+	for (i = start; i < end; i++) {
+		row = PLSA_ROW(pl, pl->dt, i);
+		best = 0;
+		for (j = 1; j < pl->num_topics; j++) {
+			if (KERNEL_LOAD(pl->precision, row, j)
+			    > KERNEL_LOAD(pl->precision, row, best))
+				best = j;
+		}
+
+		sum = 0;
+		count = 0;
+		for (j = 0; j < pl->num_topics; j++) {
+			val = KERNEL_LOAD(pl->precision, row, j);
+			if (val < pl->dt_floor && j != best) {
+				KERNEL_STORE(pl->precision, row, j, 0);
+				continue;
+			}
+			sum += val;
+			if (val != 0) count++;
+		}
+		for (j = 0; sum > 0 && j < pl->num_topics; j++) {
+			val = KERNEL_LOAD(pl->precision, row, j);
+			KERNEL_STORE(pl->precision, row, j, val / sum);
+		}
+		pl->dt_start[i + 1] = count;
+	}
+}
+
+/* Lists the topics left in the range of thread `thread_idx' */
+static
+void plsa_floor_topics(void *arg, unsigned int thread_idx,
+                       unsigned int num_threads)
+{
+	plsa *pl = (plsa *) arg;
+	unsigned int i, j, start, end;
+	size_t pos;
+	void *row;
+
+	parallel_range(pl->num_documents, thread_idx, num_threads,
+	               &start, &end);
+	for (i = start; i < end; i++) {
+		row = PLSA_ROW(pl, pl->dt, i);
+		pos = pl->dt_start[i];
+		for (j = 0; j < pl->num_topics; j++) {
+			if (KERNEL_LOAD(pl->precision, row, j) != 0)
+				pl->dt_topic[pos++] = j;
+		}
+	}
+}
+
+/* Drops the topics of each document below `dt_floor', and lists the
+ * topics left, so that the next iterations only go over them. Since
+ * the EM keeps the zeros of `dt', the lists stay valid until `dt' is
+ * extrapolated or replaced.
+ */
+static
+int plsa_floor(plsa *pl)
+{
+	unsigned int i;
+	size_t old, total;
+	void *ptr;
+
+	if (!pl->dt_start) {
+		pl->dt_start = (size_t *) xmalloc(((size_t) pl->num_documents
+		                                   + 1) * sizeof(size_t));
+		if (!pl->dt_start) return FALSE;
+		old = 0;
+	} else {
+		old = pl->dt_start[pl->num_documents];
+	}
+
+	if (!plsa_run(pl, &plsa_floor_rows, pl))
+		return FALSE;
+
+	pl->dt_start[0] = 0;
+	for (i = 0; i < pl->num_documents; i++)
+		pl->dt_start[i + 1] += pl->dt_start[i];
+	total = pl->dt_start[pl->num_documents];
+
+	if (!pl->dt_topic || total > old) {
+		ptr = xrealloc(pl->dt_topic, MAX(total, 1)
+		                             * sizeof(unsigned int));
+		if (!ptr) {
+			plsa_cleanup_active(pl);
+			return FALSE;
+		}
+		pl->dt_topic = (unsigned int *) ptr;
+	}
+	return plsa_run(pl, &plsa_floor_topics, pl);
+}
+
+/* Checks whether the topics of the documents should be floored
+ * after the iteration `iter' (counting from zero).
+ */
+static
+int plsa_should_floor(const plsa *pl, unsigned int iter)
+{
+	return (pl->dt_floor > 0 && iter + 1 >= pl->prune_after);
+}
+
+/* Checks whether the topic-word table should be pruned after
+ * the iteration `iter' (counting from zero).
+ */
+static
+int plsa_should_prune(const plsa *pl, unsigned int iter)
+{
+	if (pl->prune_threshold <= 0 && pl->prune_top == 0)
+		return FALSE;
+	if (iter + 1 < pl->prune_after)
+		return FALSE;
+	return ((iter + 1 - pl->prune_after) % PLSA_PRUNE_INTERVAL) == 0;
+}
+
+/* Normalizes the rows of `dt' and, if `normalize_tw' is set, the
+ * topics of `tw', after an extrapolation of the parameters.
+ */
+static
+void plsa_normalize(plsa *pl, int normalize_tw)
+{
+	unsigned int i, j, n;
+	const unsigned int *idx;
+	double sum;
+	size_t pos;
+
+	for (i = 0; i < pl->num_documents; i++) {
+		pos = (size_t) i * pl->num_topics;
+		sum = 0;
+		for (j = 0; j < pl->num_topics; j++)
+			sum += KERNEL_LOAD(pl->precision, pl->dt, pos + j);
+		if (sum <= 0) continue;
+		for (j = 0; j < pl->num_topics; j++) {
+			KERNEL_STORE(pl->precision, pl->dt, pos + j,
+			             KERNEL_LOAD(pl->precision, pl->dt,
+			                         pos + j) / sum);
+		}
+	}
+	if (!normalize_tw) return;
+
+	memset(pl->sums, 0, pl->num_topics * sizeof(double));
+	for (i = 0; i < pl->num_words; i++) {
+		idx = plsa_tw_topics(pl, i, &n);
+		kernels_sum(pl->precision, pl->sums, idx,
+		            PLSA_TW_ROW(pl, pl->tw, i), n);
+	}
+	for (j = 0; j < pl->num_topics; j++) {
+		if (pl->sums[j] <= 0) pl->sums[j] = 1;
+	}
+	for (i = 0; i < pl->num_words; i++) {
+		idx = plsa_tw_topics(pl, i, &n);
+		kernels_divide(pl->precision, PLSA_TW_ROW(pl, pl->tw, i),
+		               pl->sums, idx, n);
+	}
+}
+
+/* Lists the tables updated by the iterations, for the extrapolation */
+static
+unsigned int plsa_squarem_tables(plsa *pl, int update_tw, void **tables,
+                                 void **previous, size_t *lengths)
+{
+	tables[0] = pl->dt;
+	previous[0] = pl->dt2;
+	lengths[0] = (size_t) pl->num_documents * pl->num_topics;
+	if (!update_tw) return 1;
+
+	tables[1] = pl->tw;
+	previous[1] = pl->tw2;
+	lengths[1] = PLSA_TW_LENGTH(pl);
+	return 2;
+}
+
+static
+int plsa_accelerate(plsa *pl, squarem *sq, int update_tw, int *status)
+{
+	void *tables[2], *previous[2];
+	size_t lengths[2];
+
+	plsa_squarem_tables(pl, update_tw, tables, previous, lengths);
+	if (!squarem_update(sq, tables, previous, lengths,
+	                    pl->likelihood, status))
+		return FALSE;
+
+	if (*status == SQUAREM_EXTRAPOLATED)
+		plsa_normalize(pl, update_tw);
+	return TRUE;
+}
+
+static
+void plsa_accelerate_finish(plsa *pl, squarem *sq, int update_tw)
+{
+	void *tables[2], *previous[2];
+	size_t lengths[2];
+
+	plsa_squarem_tables(pl, update_tw, tables, previous, lengths);
+	squarem_finish(sq, tables);
+
+	/* The tables may be back to the plain EM */
+	plsa_cleanup_active(pl);
+}
+
+/* Collects the rows of `dt' of all the processes in `all', for the
+ * first process, which gets `num_documents' rows. The other processes
+ * only send their rows, and get NULL.
+ */
+static
+int plsa_gather_documents(plsa *pl, void **all, unsigned int *num_documents)
+{
+	double total;
+	size_t row, size;
+
+	*all = NULL;
+	total = pl->num_documents;
+	if (!allreduce_sum(pl->ar, KERNEL_DOUBLE, &total, 1))
+		return FALSE;
+	*num_documents = (unsigned int) total;
+
+	row = pl->num_topics * KERNEL_SIZE(pl->precision);
+	size = (size_t) *num_documents * row;
+	if (pl->ar->rank == 0) {
+		*all = xmalloc(MAX(size, 1));
+		if (!*all) return FALSE;
+	}
+
+	if (!allreduce_gather(pl->ar, pl->dt, pl->num_documents * row,
+	                      *all, size)) {
+		if (*all) free(*all);
+		*all = NULL;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Returns a copy of the `size' bytes of `ptr' */
+static
+void *plsa_copy(const void *ptr, size_t size)
+{
+	void *copy;
+
+	copy = xmalloc(MAX(size, 1));
+	if (copy && size > 0) memcpy(copy, ptr, size);
+	return copy;
+}
+
+static
+void plsa_snapshot_free(void *arg)
+{
+	plsa_snapshot *snap = (plsa_snapshot *) arg;
+
+	plsa_cleanup(&snap->pl);
+	free(snap);
+}
+
+static
+int plsa_snapshot_save(void *arg, const char *filename)
+{
+	plsa_snapshot *snap = (plsa_snapshot *) arg;
+
+	if (snap->mapped)
+		return plsa_save_mapped(&snap->pl, filename);
+	return plsa_save_easy(&snap->pl, filename);
+}
+
+/* Copies the tables of `pl' after `iteration' iterations, with the
+ * rows `dt' of `num_documents' documents, which the snapshot takes.
+ */
+static
+plsa_snapshot *plsa_snapshot_take(const plsa *pl, void *dt,
+                                  unsigned int num_documents,
+                                  unsigned int iteration)
+{
+	plsa_snapshot *snap;
+	size_t size;
+
+	snap = (plsa_snapshot *) xmalloc(sizeof(plsa_snapshot));
+	if (!snap) {
+		free(dt);
+		return NULL;
+	}
+
+	plsa_reset(&snap->pl);
+	snap->mapped = (pl->map.base != NULL);
+	snap->pl.num_words = pl->num_words;
+	snap->pl.num_documents = num_documents;
+	snap->pl.num_topics = pl->num_topics;
+	snap->pl.precision = pl->precision;
+	snap->pl.likelihood = pl->likelihood;
+	snap->pl.old_likelihood = pl->old_likelihood;
+	snap->pl.iteration = iteration;
+	snap->pl.online_pass = pl->online_pass;
+	snap->pl.online_batch = pl->online_batch;
+	snap->pl.online_sum = pl->online_sum;
+	snap->pl.online_weight = pl->online_weight;
+	genrand_get_state(snap->pl.rng_state);
+	snap->pl.dt = dt;
+
+	size = PLSA_TW_LENGTH(pl) * KERNEL_SIZE(pl->precision);
+	snap->pl.tw = plsa_copy(pl->tw, size);
+	if (!snap->pl.tw) goto error_snapshot;
+
+	if (pl->tw_start) {
+		size = ((size_t) pl->num_words + 1) * sizeof(unsigned int);
+		snap->pl.tw_start = (unsigned int *)
+			plsa_copy(pl->tw_start, size);
+		if (!snap->pl.tw_start) goto error_snapshot;
+
+		size = PLSA_TW_LENGTH(pl) * sizeof(unsigned int);
+		snap->pl.tw_topic = (unsigned int *)
+			plsa_copy(pl->tw_topic, size);
+		if (!snap->pl.tw_topic) goto error_snapshot;
+	}
+	return snap;
+
+error_snapshot:
+	plsa_snapshot_free(snap);
+	return NULL;
+}
+
+/* Decides whether to write a checkpoint after the iteration
+ * `iteration', and whether to stop the training because of a
+ * signal. All the processes take the same decision.
+ */
+static
+int plsa_checkpoint_due(plsa *pl, checkpoint *cp, unsigned int iteration,
+                        int *due, int *stop)
+{
+	double flags[2];
+
+	flags[0] = (checkpoint_due(cp, iteration)) ? 1 : 0;
+	flags[1] = (checkpoint_interrupted()) ? 1 : 0;
+	if (pl->ar) {
+		if (!allreduce_sum(pl->ar, KERNEL_DOUBLE, flags, 2))
+			return FALSE;
+	}
+	*due = (flags[0] > 0 || flags[1] > 0);
+	*stop = (flags[1] > 0);
+	return TRUE;
+}
+
+/* Hands a snapshot of the model to the checkpoint thread. With
+ * several processes, the first one takes the rows of `dt' of all of
+ * them.
+ */
+static
+int plsa_checkpoint(plsa *pl, checkpoint *cp, unsigned int iteration)
+{
+	plsa_snapshot *snap;
+	unsigned int total;
+	void *dt;
+
+	total = pl->num_documents;
+	if (pl->ar) {
+		if (!plsa_gather_documents(pl, &dt, &total))
+			return FALSE;
+		if (pl->ar->rank > 0)
+			return TRUE;
+	} else {
+		dt = plsa_copy(pl->dt, (size_t) total * pl->num_topics
+		                       * KERNEL_SIZE(pl->precision));
+		if (!dt) return FALSE;
+	}
+
+	/* The other processes may write checkpoints without this one */
+	if (!cp->started) {
+		free(dt);
+		return TRUE;
+	}
+
+	snap = plsa_snapshot_take(pl, dt, total, iteration);
+	if (!snap) return FALSE;
+	return checkpoint_write(cp, snap, iteration);
+}
+
+/* Ends the training with several processes: the first process takes
+ * the rows of `dt' of all of them, and holds the whole model.
+ */
+static
+int plsa_gather(plsa *pl)
+{
+	unsigned int total;
+	void *all;
+
+	if (!plsa_gather_documents(pl, &all, &total))
+		return FALSE;
+	if (pl->ar->rank > 0)
+		return TRUE;
+
+	plsa_free(pl, pl->dt);
+	plsa_free(pl, pl->dt2);
+	plsa_cleanup_active(pl);
+	plsa_cleanup_residual(pl);
+	pl->dt = all;
+	pl->num_documents = total;
+	pl->dt2 = xmalloc(MAX((size_t) total * pl->num_topics, 1)
+	                  * KERNEL_SIZE(pl->precision));
+	return (pl->dt2 != NULL);
+}
+
+int plsa_train(plsa *pl, const docinfo *doc, unsigned int num_topics,
+               unsigned int max_iterations, double tol, int retrain_dt,
+               const char *plsa_filename)
+{
+	unsigned int iter, first, num_frozen;
+	int new_documents, status, due, stop;
+	checkpoint cp;
+	squarem sq;
+	void *temp;
+
+	/* Zero topics keeps the number of topics of a loaded model */
+	if (num_topics == 0) num_topics = pl->num_topics;
+
+	/* The rows of `dt' of a loaded model may be of other documents,
+	 * as they are with several processes.
+	 */
+	new_documents = (pl->num_documents != docinfo_num_documents(doc)
+	                 || pl->ar);
+	if (!plsa_allocate_tables(pl, docinfo_num_different_words(doc),
+	                          docinfo_num_documents(doc), num_topics))
+		return FALSE;
+
+	if (!plsa_allocate_workers(pl, doc, !retrain_dt))
+		return FALSE;
+
+	if (retrain_dt) {
+		pl->likelihood = 1;
+		pl->old_likelihood = 1;
+	}
+
+	if (pl->likelihood >= 0)
+		plsa_initialize_random(pl, retrain_dt);
+	else if (new_documents)
+		plsa_initialize_random(pl, TRUE);
+	else if (fabs(pl->likelihood - pl->old_likelihood) < tol) {
+		return TRUE;
+	}
+
+	/* A model saved by a checkpoint goes on from the same iteration,
+	 * with the same random numbers. The state of SQUAREM, of the
+	 * residual EM and of the frozen topics is not saved, so SQUAREM
+	 * starts its extrapolation over, the residual EM starts with a
+	 * full pass and all the topics start unfrozen.
+	 */
+	first = 0;
+	if (pl->likelihood < 0 && !new_documents && pl->iteration > 0) {
+		first = pl->iteration;
+		genrand_set_state(pl->rng_state);
+		printf("Resuming the training after %u iterations...\n",
+		       first);
+	}
+	pl->iteration = 0;
+
+	/* All the processes start from the topics of the first one */
+	if (pl->ar && !retrain_dt) {
+		if (!allreduce_broadcast(pl->ar, pl->tw, PLSA_TW_LENGTH(pl)
+		                         * KERNEL_SIZE(pl->precision)))
+			return FALSE;
+	}
+
+	if (pl->residual > 0 && !retrain_dt) {
+		if (!plsa_allocate_residual(pl, doc))
+			return FALSE;
+	}
+
+	checkpoint_reset(&cp);
+	if (plsa_filename && !retrain_dt) {
+		if (!checkpoint_initialize(&cp, plsa_filename,
+		                           pl->checkpoint_interval,
+		                           pl->checkpoint_seconds,
+		                           &plsa_snapshot_save,
+		                           &plsa_snapshot_free))
+			return FALSE;
+		cp.last_iteration = first;
+	}
+
+	squarem_reset(&sq);
+	if (pl->accelerate) {
+		if (!squarem_initialize(&sq, pl->precision,
+		                        (retrain_dt) ? 1 : 2))
+			goto error_train;
+	}
+
+	printf("Running PLSA on data...\n");
+	for (iter = first; iter < max_iterations; iter++) {
+		pl->old_likelihood = pl->likelihood;
+		num_frozen = pl->num_topics - pl->num_free;
+		if (!plsa_iteration(pl, doc, TRUE, !retrain_dt,
+		                    &pl->likelihood))
+			goto error_train;
+
+		temp = pl->dt;
+		pl->dt = pl->dt2;
+		pl->dt2 = temp;
+
+		if (!retrain_dt) {
 			temp = pl->tw;
 			pl->tw = pl->tw2;
 			pl->tw2 = temp;
+		}
+
+		status = SQUAREM_NONE;
+		if (pl->accelerate) {
+			if (!plsa_accelerate(pl, &sq, !retrain_dt, &status))
+				goto error_train;
+		}
+		printf("Iteration %d: likelihood = %g", iter + 1,
+		       pl->likelihood);
+		if (pl->topic_list)
+			printf(", %u topics frozen", num_frozen);
+		squarem_print_status(&sq, status);
+
+		if (plsa_should_floor(pl, iter)) {
+			if (!plsa_floor(pl))
+				goto error_train;
+		}
+
+		if (!retrain_dt) {
+			if (plsa_should_prune(pl, iter)) {
+				plsa_accelerate_finish(pl, &sq, TRUE);
+				if (!plsa_prune(pl))
+					goto error_train;
+			}
+
+			if (!plsa_checkpoint_due(pl, &cp, iter + 1, &due,
+			                         &stop))
+				goto error_train;
+			if (due && !squarem_pending(&sq)) {
+				if (!plsa_checkpoint(pl, &cp, iter + 1))
+					goto error_train;
+				if (stop) {
+					checkpoint_wait(&cp);
+					printf("Training interrupted after "
+					       "%u iterations\n", iter + 1);
+					goto error_train;
+				}
+			}
+		}
+
+		/* The rejected parameters were replaced by the plain EM */
+		if (status == SQUAREM_REJECTED) {
+			pl->likelihood = pl->old_likelihood;
+			continue;
+		}
+
+		if (pl->old_likelihood < 0 &&
+		    fabs(pl->likelihood - pl->old_likelihood) < tol) {
+			break;
+		}
+	}
+
+	if (!checkpoint_wait(&cp))
+		goto error_train;
+	checkpoint_cleanup(&cp);
+
+	if (pl->accelerate) {
+		plsa_accelerate_finish(pl, &sq, !retrain_dt);
+		printf("SQUAREM: %u extrapolations accepted, %u rejected\n",
+		       sq.num_accepted, sq.num_rejected);
+		squarem_cleanup(&sq);
+	}
+
+	if (pl->ar) {
+		if (!plsa_gather(pl))
+			return FALSE;
+		if (pl->ar->rank > 0)
+			return TRUE;
+	}
+
+	if (plsa_filename) {
+		printf("Saving PLSA `%s'...\n", plsa_filename);
+		if (!plsa_save_easy(pl, plsa_filename)) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+
+error_train:
+	checkpoint_cleanup(&cp);
+	squarem_cleanup(&sq);
+	return FALSE;
+}
+
+/* Runs one iteration of the restarts taken from the queue, each one
+ * with its own threads.
+ */
+static
+void plsa_restart_step(void *arg, unsigned int thread_idx,
+                       unsigned int num_threads)
+{
+	plsa_restart_context *ctx = (plsa_restart_context *) arg;
+	unsigned int k, start, end;
+	void *temp;
+	plsa *run;
+
+	while (parallel_queue_next(&ctx->queue, &start, &end)) {
+		for (k = start; k < end; k++) {
+			run = &ctx->runs[ctx->active[k]];
+			run->old_likelihood = run->likelihood;
+			ctx->ok[k] = plsa_iteration(run, ctx->doc, TRUE, TRUE,
+			                            &run->likelihood);
+
+			temp = run->dt;
+			run->dt = run->dt2;
+			run->dt2 = temp;
+
+			temp = run->tw;
+			run->tw = run->tw2;
+			run->tw2 = temp;
+		}
+	}
+}
+
+/* Keeps the `keep' restarts with the best likelihoods, and shares
+ * the threads among them again.
+ */
+static
+int plsa_restart_keep(plsa_restart_context *ctx, unsigned int keep)
+{
+	unsigned int i, length;
+	plsa_topmost *best;
+
+	best = ctx->best;
+	length = 0;
+	for (i = 0; i < ctx->num_runs; i++) {
+		if (ctx->alive[i]) {
+			topk_push(best, &length, keep, i,
+			          ctx->runs[i].likelihood);
+		}
+	}
+	topk_sort(best, length);
+
+	memset(ctx->alive, 0, ctx->num_runs * sizeof(int));
+	for (i = 0; i < length; i++)
+		ctx->alive[best[i].idx] = TRUE;
+
+	for (i = 0; i < ctx->num_runs; i++) {
+		if (!ctx->alive[i] && ctx->runs[i].dt) {
+			printf("Dropping restart %u: likelihood = %g\n",
+			       i + 1, ctx->runs[i].likelihood);
+			plsa_cleanup(&ctx->runs[i]);
+		}
+	}
+	ctx->num_alive = length;
+
+	ctx->num_threads = MIN(ctx->total_threads, MAX(length, 1));
+	for (i = 0; i < ctx->num_runs; i++) {
+		if (!ctx->alive[i]) continue;
+		ctx->runs[i].num_threads = ctx->total_threads
+		                           / ctx->num_threads;
+		if (!plsa_allocate_workers(&ctx->runs[i], ctx->doc, TRUE))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* Trains `pl->num_restarts' models from different random starts
+ * together, against the same documents, and keeps the one with the
+ * best likelihood. The restarts run concurrently and share the
+ * threads of `pl'. If `pl->restart_iterations' is positive, the
+ * weaker half of the restarts is dropped after that many iterations,
+ * then after twice as many, and so on. The last restart left goes on
+ * with plsa_train(), with SQUAREM and the checkpoints.
+ */
+int plsa_train_restarts(plsa *pl, const docinfo *doc,
+                        unsigned int num_topics,
+                        unsigned int max_iterations, double tol,
+                        const char *plsa_filename)
+{
+	plsa_restart_context ctx;
+	unsigned int i, k, iter, next_cut, best;
+	plsa *run;
+	int ret = FALSE;
+
+	if (num_topics == 0) num_topics = pl->num_topics;
+
+	ctx.doc = doc;
+	ctx.pool = NULL;
+	ctx.num_runs = pl->num_restarts;
+	ctx.total_threads = MAX(pl->num_threads, 1);
+	ctx.runs = (plsa *) xmalloc(ctx.num_runs * sizeof(plsa));
+	ctx.alive = (int *) xmalloc(ctx.num_runs * sizeof(int));
+	ctx.converged = (int *) xmalloc(ctx.num_runs * sizeof(int));
+	ctx.ok = (int *) xmalloc(ctx.num_runs * sizeof(int));
+	ctx.active = (unsigned int *) xmalloc(ctx.num_runs
+	                                      * sizeof(unsigned int));
+	ctx.best = (plsa_topmost *) xmalloc(ctx.num_runs
+	                                    * sizeof(plsa_topmost));
+	if (!ctx.runs || !ctx.alive || !ctx.converged || !ctx.ok
+	    || !ctx.active || !ctx.best)
+		goto done_restarts;
+
+	/* The restarts draw their random numbers one after the other,
+	 * before any of them starts.
+	 */
+	for (i = 0; i < ctx.num_runs; i++) {
+		ctx.runs[i] = *pl;
+		ctx.runs[i].pool = NULL;
+		ctx.alive[i] = FALSE;
+		ctx.converged[i] = FALSE;
+	}
+	for (i = 0; i < ctx.num_runs; i++) {
+		ctx.alive[i] = TRUE;
+		if (!plsa_allocate_tables(&ctx.runs[i],
+		                          docinfo_num_different_words(doc),
+		                          docinfo_num_documents(doc),
+		                          num_topics))
+			goto done_restarts;
+		plsa_initialize_random(&ctx.runs[i], FALSE);
+	}
+	if (!plsa_restart_keep(&ctx, ctx.num_runs))
+		goto done_restarts;
+
+	/* The restarts only ever share fewer threads */
+	if (ctx.num_threads > 1) {
+		ctx.pool = parallel_pool_create(ctx.num_threads);
+		if (!ctx.pool) goto done_restarts;
+	}
+
+	printf("Running %u restarts of the PLSA on data...\n",
+	       ctx.num_runs);
+	next_cut = pl->restart_iterations;
+	for (iter = 0; iter < max_iterations; iter++) {
+		k = 0;
+		for (i = 0; i < ctx.num_runs; i++) {
+			if (ctx.alive[i] && !ctx.converged[i])
+				ctx.active[k++] = i;
+		}
+		if (k == 0) break;
+
+		if (!parallel_queue_initialize(&ctx.queue, k, 1))
+			goto done_restarts;
+		if (!parallel_pool_run(ctx.pool, MIN(ctx.num_threads, k),
+		                       &plsa_restart_step, &ctx)) {
+			parallel_queue_cleanup(&ctx.queue);
+			goto done_restarts;
+		}
+		parallel_queue_cleanup(&ctx.queue);
+
+		printf("Iteration %d: likelihoods =", iter + 1);
+		for (i = 0; i < ctx.num_runs; i++) {
+			if (ctx.alive[i])
+				printf(" %g", ctx.runs[i].likelihood);
+			else
+				printf(" -");
+		}
+		printf("\n");
+
+		for (i = 0; i < k; i++) {
+			if (!ctx.ok[i]) goto done_restarts;
+			run = &ctx.runs[ctx.active[i]];
+			if (plsa_should_prune(pl, iter)) {
+				if (!plsa_prune(run))
+					goto done_restarts;
+			}
+			if (plsa_should_floor(pl, iter)) {
+				if (!plsa_floor(run))
+					goto done_restarts;
+			}
+			if (run->old_likelihood < 0 && fabs(run->likelihood
+			    - run->old_likelihood) < tol)
+				ctx.converged[ctx.active[i]] = TRUE;
+		}
+
+		if (next_cut > 0 && iter + 1 == next_cut) {
+			if (!plsa_restart_keep(&ctx, (ctx.num_alive + 1) / 2))
+				goto done_restarts;
+			next_cut *= 2;
+		}
+		if (ctx.num_alive == 1) {
+			iter++;
+			break;
+		}
+	}
+
+	if (!plsa_restart_keep(&ctx, 1))
+		goto done_restarts;
+	best = ctx.best[0].idx;
+	printf("Keeping restart %u: likelihood = %g\n", best + 1,
+	       ctx.runs[best].likelihood);
+
+	if (pl->pool) parallel_pool_destroy(pl->pool);
+	*pl = ctx.runs[best];
+	ctx.alive[best] = FALSE;
+	pl->num_threads = ctx.total_threads;
+
+	/* The restart left goes on from where it stopped */
+	if (!ctx.converged[best] && iter < max_iterations) {
+		pl->iteration = iter;
+		genrand_get_state(pl->rng_state);
+		ret = plsa_train(pl, doc, num_topics, max_iterations, tol,
+		                 FALSE, plsa_filename);
+		goto done_restarts;
+	}
+
+	if (!plsa_allocate_workers(pl, doc, TRUE))
+		goto done_restarts;
+	ret = TRUE;
+	if (plsa_filename) {
+		printf("Saving PLSA `%s'...\n", plsa_filename);
+		ret = plsa_save_easy(pl, plsa_filename);
+	}
+
+done_restarts:
+	if (ctx.pool) parallel_pool_destroy(ctx.pool);
+	if (ctx.runs && ctx.alive) {
+		for (i = 0; i < ctx.num_runs; i++) {
+			if (ctx.alive[i]) plsa_cleanup(&ctx.runs[i]);
+		}
+	}
+	if (ctx.runs) free(ctx.runs);
+	if (ctx.alive) free(ctx.alive);
+	if (ctx.converged) free(ctx.converged);
+	if (ctx.ok) free(ctx.ok);
+	if (ctx.active) free(ctx.active);
+	if (ctx.best) free(ctx.best);
+	return ret;
+}
+
+/* Trains the model `pl' of a sweep on its own, with plain EM, and
+ * saves it to its own file.
+ */
+static
+int plsa_sweep_model(plsa_sweep_context *ctx, plsa *pl,
+                     unsigned int *iterations, double *time)
+{
+	unsigned int iter;
+	double start;
+	char *filename;
+	void *temp;
+	int ret;
+
+	start = get_time();
+	if (!plsa_allocate_workers(pl, ctx->doc, TRUE))
+		return FALSE;
+
+	for (iter = 0; iter < ctx->max_iterations; iter++) {
+		pl->old_likelihood = pl->likelihood;
+		if (!plsa_iteration(pl, ctx->doc, TRUE, TRUE,
+		                    &pl->likelihood))
+			return FALSE;
+
+		temp = pl->dt;
+		pl->dt = pl->dt2;
+		pl->dt2 = temp;
+
+		temp = pl->tw;
+		pl->tw = pl->tw2;
+		pl->tw2 = temp;
+
+		printf("Topics %u, iteration %d: likelihood = %g\n",
+		       pl->num_topics, iter + 1, pl->likelihood);
+
+		if (plsa_should_prune(pl, iter)) {
+			if (!plsa_prune(pl))
+				return FALSE;
+		}
+		if (plsa_should_floor(pl, iter)) {
+			if (!plsa_floor(pl))
+				return FALSE;
+		}
+
+		if (pl->old_likelihood < 0 &&
+		    fabs(pl->likelihood - pl->old_likelihood) < ctx->tol) {
+			iter++;
+			break;
+		}
+	}
+	*iterations = iter;
+	*time = get_time() - start;
+
+	if (!ctx->plsa_filename) return TRUE;
+
+	filename = (char *) xmalloc(strlen(ctx->plsa_filename) + 16);
+	if (!filename) return FALSE;
+	sprintf(filename, "%s.%u", ctx->plsa_filename, pl->num_topics);
+	printf("Saving PLSA `%s'...\n", filename);
+	ret = plsa_save_easy(pl, filename);
+	free(filename);
+	return ret;
+}
+
+/* Trains the models of the sweep taken from the queue. The threads
+ * of the sweep are shared among its workers.
+ */
+static
+void plsa_sweep_train(void *arg, unsigned int thread_idx,
+                      unsigned int num_threads)
+{
+	plsa_sweep_context *ctx = (plsa_sweep_context *) arg;
+	unsigned int k, m, start, end;
+	plsa *pl;
+
+	while (parallel_queue_next(&ctx->queue, &start, &end)) {
+		for (k = start; k < end; k++) {
+			m = ctx->order[k];
+			pl = &ctx->models[m];
+			pl->num_threads = ctx->total_threads / num_threads;
+			if (thread_idx < ctx->total_threads % num_threads)
+				pl->num_threads++;
+			ctx->ok[m] = plsa_sweep_model(ctx, pl,
+			                              &ctx->iterations[m],
+			                              &ctx->times[m]);
+		}
+	}
+}
+
+/* Trains the `num_models' models of `models' together, against the
+ * same documents. Each model holds its own number of topics and
+ * options, and the models share the threads of the first one. The
+ * models with the most topics start first. Each model is saved to
+ * `plsa_filename' followed by its number of topics, and its number
+ * of iterations and its training time are returned in `iterations'
+ * and `times'.
+ */
+int plsa_train_sweep(plsa *models, unsigned int num_models,
+                     const docinfo *doc, unsigned int max_iterations,
+                     double tol, const char *plsa_filename,
+                     unsigned int *iterations, double *times)
+{
+	plsa_sweep_context ctx;
+	unsigned int i, k, m;
+	int ret = FALSE;
+
+	ctx.doc = doc;
+	ctx.models = models;
+	ctx.max_iterations = max_iterations;
+	ctx.tol = tol;
+	ctx.plsa_filename = plsa_filename;
+	ctx.total_threads = MAX(models[0].num_threads, 1);
+	ctx.iterations = iterations;
+	ctx.times = times;
+	ctx.order = (unsigned int *) xmalloc(num_models
+	                                     * sizeof(unsigned int));
+	ctx.ok = (int *) xmalloc(num_models * sizeof(int));
+	if (!ctx.order || !ctx.ok)
+		goto done_sweep;
+
+	/* The models draw their random numbers one after the other,
+	 * before any of them starts.
+	 */
+	for (i = 0; i < num_models; i++) {
+		if (!plsa_allocate_tables(&models[i],
+		                          docinfo_num_different_words(doc),
+		                          docinfo_num_documents(doc),
+		                          models[i].num_topics))
+			goto done_sweep;
+		plsa_initialize_random(&models[i], FALSE);
+
+		/* Sorted by decreasing number of topics */
+		for (k = i; k > 0; k--) {
+			m = ctx.order[k - 1];
+			if (models[m].num_topics >= models[i].num_topics)
+				break;
+			ctx.order[k] = m;
+		}
+		ctx.order[k] = i;
+		ctx.ok[i] = FALSE;
+		iterations[i] = 0;
+		times[i] = 0;
+	}
+
+	printf("Running a sweep of %u PLSA models on data...\n",
+	       num_models);
+	if (!parallel_queue_initialize(&ctx.queue, num_models, 1))
+		goto done_sweep;
+	ret = parallel_run(MIN(ctx.total_threads, num_models),
+	                   &plsa_sweep_train, &ctx);
+	parallel_queue_cleanup(&ctx.queue);
+
+	for (i = 0; i < num_models; i++) {
+		models[i].num_threads = ctx.total_threads;
+		if (!ctx.ok[i]) ret = FALSE;
+	}
+
+done_sweep:
+	if (ctx.order) free(ctx.order);
+	if (ctx.ok) free(ctx.ok);
+	return ret;
+}
+
+/* Moves `tw' towards the estimate `tw2' of the current mini-batch
+ * by the step size of the context, for the words in the range of
+ * thread `thread_idx'. Topics absent from the mini-batch are kept.
+ */
+static
+void plsa_mstep_blend(void *arg, unsigned int thread_idx,
+                      unsigned int num_threads)
+{
+	plsa_context *ctx = (plsa_context *) arg;
+	plsa *pl = ctx->pl;
+	unsigned int i, j, k, n, start, end;
+	const unsigned int *idx;
+	void *row, *row2;
+	double val;
+
+	parallel_range(pl->num_words, thread_idx, num_threads, &start, &end);
+	for (i = start; i < end; i++) {
+		row = PLSA_TW_ROW(pl, pl->tw, i);
+		row2 = PLSA_TW_ROW(pl, pl->tw2, i);
+		idx = plsa_tw_topics(pl, i, &n);
+		for (k = 0; k < n; k++) {
+			j = (idx) ? idx[k] : k;
+			if (pl->sums[j] <= 0) continue;
+			val = (1 - ctx->step) * KERNEL_LOAD(pl->precision, row, k)
+			      + ctx->step * KERNEL_LOAD(pl->precision, row2, k);
+			KERNEL_STORE(pl->precision, row, k, val);
+		}
+	}
+}
+
+/* Processes one mini-batch of the online EM: the rows of `dt' of the
+ * batch are estimated with `tw' fixed, and then `tw' moves towards
+ * the estimate of the batch by the step size `rho'.
+ */
+static
+int plsa_online_batch(plsa *pl, const docinfo *doc, double rho,
+                      double *likelihood)
+{
+	plsa_context ctx;
+	unsigned int iter;
+	int update_tw;
+	void *temp;
+
+	if (!plsa_allocate_workers(pl, doc, TRUE))
+		return FALSE;
+
+	for (iter = 0; iter < pl->batch_iterations; iter++) {
+		update_tw = (iter + 1 == pl->batch_iterations);
+		if (!plsa_iteration(pl, doc, TRUE, update_tw, likelihood))
+			return FALSE;
+
+		temp = pl->dt;
+		pl->dt = pl->dt2;
+		pl->dt2 = temp;
+	}
+
+	ctx.ops = kernels_get(pl->precision);
+	ctx.pl = pl;
+	ctx.doc = doc;
+	ctx.step = rho;
+	return plsa_run(pl, &plsa_mstep_blend, &ctx);
+}
+
+/* Online EM: each pass reads the documents of `master_file' in
+ * mini-batches of `pl->batch_size' documents, keeping only the rows
+ * of `dt' of the current batch. The step size of the t-th batch is
+ * rho = (tau0 + t)^(-kappa). The vocabulary is the one of `doc'.
+ * The checkpoints are written after the mini-batches, and a model
+ * saved by one goes on from the next mini-batch of the same pass.
+ */
+int plsa_train_online(plsa *pl, docinfo *doc, const char *master_file,
+                      unsigned int num_topics, unsigned int max_passes,
+                      double tol, const char *plsa_filename)
+{
+	unsigned int pass, first_pass, batch, skip, num_batches;
+	double likelihood, sum, total_weight, rho;
+	int initialized, due, stop;
+	checkpoint cp;
+
+	if (pl->batch_iterations == 0)
+		pl->batch_iterations = 1;
+
+	initialized = (pl->likelihood < 0);
+	if (initialized && pl->iteration == 0
+	    && fabs(pl->likelihood - pl->old_likelihood) < tol)
+		return TRUE;
+
+	/* The mini-batches already seen are skipped again. A checkpoint
+	 * of the first pass has no likelihood yet.
+	 */
+	num_batches = 0;
+	first_pass = 0;
+	skip = 0;
+	sum = 0;
+	total_weight = 0;
+	if (pl->iteration > 0) {
+		initialized = TRUE;
+		num_batches = pl->iteration;
+		first_pass = pl->online_pass;
+		skip = pl->online_batch;
+		sum = pl->online_sum;
+		total_weight = pl->online_weight;
+		genrand_set_state(pl->rng_state);
+		printf("Resuming the online training after %u "
+		       "mini-batches...\n", num_batches);
+	}
+	pl->iteration = 0;
+
+	checkpoint_reset(&cp);
+	if (plsa_filename) {
+		if (!checkpoint_initialize(&cp, plsa_filename,
+		                           pl->checkpoint_interval,
+		                           pl->checkpoint_seconds,
+		                           &plsa_snapshot_save,
+		                           &plsa_snapshot_free))
+			return FALSE;
+		cp.last_iteration = num_batches;
+	}
+
+	printf("Running online PLSA on data...\n");
+	for (pass = first_pass; pass < max_passes; pass++) {
+		if (!docinfo_open_stream(doc, master_file))
+			goto error_stream;
+
+		for (batch = 0; batch < skip; batch++) {
+			docinfo_clear(doc, TRUE);
+			if (!docinfo_process_stream(doc, pl->batch_size, FALSE))
+				goto error_online;
+		}
+		skip = 0;
+
+		while (TRUE) {
+			docinfo_clear(doc, TRUE);
+			if (!docinfo_process_stream(doc, pl->batch_size, FALSE))
+				goto error_online;
+			if (docinfo_num_documents(doc) == 0)
+				break;
+
+			if (!plsa_allocate_tables(pl,
+			                          docinfo_num_different_words(doc),
+			                          docinfo_num_documents(doc),
+			                          num_topics))
+				goto error_online;
+
+			plsa_initialize_random(pl, initialized);
+			initialized = TRUE;
+
+			rho = pow(pl->tau0 + ++num_batches, -pl->kappa);
+			if (!plsa_online_batch(pl, doc, rho, &likelihood))
+				goto error_online;
+
+			sum += likelihood * docinfo_num_words(doc);
+			total_weight += docinfo_num_words(doc);
+			batch++;
+
+			if (!plsa_checkpoint_due(pl, &cp, num_batches, &due,
+			                         &stop))
+				goto error_online;
+			if (due) {
+				pl->online_pass = pass;
+				pl->online_batch = batch;
+				pl->online_sum = sum;
+				pl->online_weight = total_weight;
+				if (!plsa_checkpoint(pl, &cp, num_batches))
+					goto error_online;
+				if (stop) {
+					checkpoint_wait(&cp);
+					printf("Training interrupted after %u "
+					       "mini-batches\n", num_batches);
+					goto error_online;
+				}
+			}
+		}
+		docinfo_close_stream(doc);
+		if (total_weight == 0) {
+			error("no documents in `%s'", master_file);
+			goto error_stream;
+		}
+
+		pl->old_likelihood = pl->likelihood;
+		pl->likelihood = sum / total_weight;
+		printf("Pass %d: likelihood = %g (%u batches)\n",
+		       pass + 1, pl->likelihood, num_batches);
+		sum = 0;
+		total_weight = 0;
+
+		if (plsa_should_prune(pl, pass)) {
+			if (!plsa_prune(pl))
+				goto error_stream;
+		}
+
+		if (pl->old_likelihood < 0 &&
+		    fabs(pl->likelihood - pl->old_likelihood) < tol) {
+			break;
+		}
+	}
+
+	if (!checkpoint_wait(&cp))
+		goto error_stream;
+	checkpoint_cleanup(&cp);
+
+	pl->online_pass = 0;
+	pl->online_batch = 0;
+	pl->online_sum = 0;
+	pl->online_weight = 0;
+	if (plsa_filename) {
+		printf("Saving PLSA `%s'...\n", plsa_filename);
+		if (!plsa_save_easy(pl, plsa_filename)) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+
+error_online:
+	docinfo_close_stream(doc);
+error_stream:
+	checkpoint_cleanup(&cp);
+	return FALSE;
+}
+
+/* Folds in the document `document' (starting from 0) on its own,
+ * until its likelihood changes less than `tol'. Stores the sum of its
+ * log-likelihoods and of its word counts in `likelihood' and `weight',
+ * and returns the number of iterations.
+ */
+static
+unsigned int plsa_fold_in_document(const plsa_fold_context *fc,
+                                   unsigned int document, double *likelihood,
+                                   double *weight)
+{
+	const plsa_context *ctx = &fc->ctx;
+	plsa *pl = ctx->pl;
+	unsigned int iter, l, n, num, start, end;
+	double dotprod, value, old_value, word_count;
+	double counts[PLSA_LOG_BATCH], dotprods[PLSA_LOG_BATCH];
+	docinfo_wordstats *wordstats;
+	const unsigned int *idx;
+	void *dt, *dt2, *tw;
+	size_t size;
+
+	*likelihood = 0;
+	*weight = 0;
+	start = fc->doc_start[document];
+	end = fc->doc_start[document + 1];
+	if (start == end) return 0;
+
+	dt = PLSA_ROW(pl, pl->dt, document);
+	dt2 = PLSA_ROW(pl, pl->dt2, document);
+	size = pl->num_topics * KERNEL_SIZE(pl->precision);
+	word_count = docinfo_get_document(ctx->doc, document + 1)->word_count;
+
+	old_value = 1;
+	for (iter = 0; iter < fc->max_iterations; iter++) {
+		memset(dt2, 0, size);
+		num = 0;
+		*likelihood = 0;
+		*weight = 0;
+		for (l = start; l < end; l++) {
+			wordstats = docinfo_get_wordstats(ctx->doc, l + 1);
+			tw = PLSA_TW_ROW(pl, pl->tw, wordstats->word - 1);
+			idx = plsa_tw_topics(pl, wordstats->word - 1, &n);
+
+			dotprod = plsa_dot(ctx, dt, tw, idx, NULL, n);
+
+			/* A word may have lost all its topics in the training */
+			if (dotprod > 0) {
+				plsa_axpy_dt(ctx, dt2, wordstats->count
+				             / dotprod / word_count,
+				             dt, tw, idx, NULL, n);
+			} else {
+				dotprod = DBL_MIN;
+			}
+
+			counts[num] = wordstats->count;
+			dotprods[num] = dotprod;
+			if (++num == PLSA_LOG_BATCH) {
+				*likelihood += ctx->ops->sum_log(counts,
+				                                 dotprods, num);
+				num = 0;
+			}
+			*weight += wordstats->count;
+		}
+		*likelihood += ctx->ops->sum_log(counts, dotprods, num);
+		memcpy(dt, dt2, size);
+
+		value = *likelihood / *weight;
+		if (old_value < 0 && fabs(value - old_value) < fc->tol)
+			return iter + 1;
+		old_value = value;
+	}
+	return fc->max_iterations;
+}
+
+static
+void plsa_fold_in_documents(void *arg, unsigned int thread_idx,
+                            unsigned int num_threads)
+{
+	plsa_fold_context *fc = (plsa_fold_context *) arg;
+	plsa *pl = fc->ctx.pl;
+	unsigned int i, iterations, start, end;
+	double likelihood, weight, total_likelihood, total_weight;
+
+	total_likelihood = 0;
+	total_weight = 0;
+	while (parallel_queue_next(&fc->queue, &start, &end)) {
+		for (i = start; i < end; i++) {
+			iterations = plsa_fold_in_document(fc, i, &likelihood,
+			                                   &weight);
+			if (fc->iterations) fc->iterations[i] = iterations;
+			total_likelihood += likelihood;
+			total_weight += weight;
+		}
+	}
+	pl->partial[2 * thread_idx] = total_likelihood;
+	pl->partial[2 * thread_idx + 1] = total_weight;
+}
+
+/* Estimates the rows of `dt' for the documents of `doc', with `tw'
+ * fixed. Each document is iterated on its own until its likelihood
+ * changes less than `tol', and the documents are shared among the
+ * threads. If `iterations' is not NULL, it receives the number of
+ * iterations of each document.
+ */
+int plsa_fold_in(plsa *pl, const docinfo *doc, unsigned int max_iterations,
+                 double tol, double *likelihood, unsigned int *iterations)
+{
+	plsa_fold_context fc;
+	docinfo_wordstats *wordstats;
+	unsigned int *doc_start;
+	unsigned int i, l, t, num_wordstats;
+	double total_weight;
+	int ret;
+
+	if (!plsa_allocate_tables(pl, docinfo_num_different_words(doc),
+	                          docinfo_num_documents(doc), pl->num_topics))
+		return FALSE;
+
+	if (!plsa_allocate_workers(pl, doc, FALSE))
+		return FALSE;
+
+	/* The wordstats are sorted by document */
+	doc_start = (unsigned int *) xmalloc((pl->num_documents + 1)
+	                                     * sizeof(unsigned int));
+	if (!doc_start) return FALSE;
+
+	memset(doc_start, 0, (pl->num_documents + 1) * sizeof(unsigned int));
+	num_wordstats = docinfo_num_wordstats(doc);
+	for (l = 0; l < num_wordstats; l++) {
+		wordstats = docinfo_get_wordstats(doc, l + 1);
+		doc_start[wordstats->document]++;
+	}
+	for (i = 0; i < pl->num_documents; i++)
+		doc_start[i + 1] += doc_start[i];
+
+	if (!parallel_queue_initialize(&fc.queue, pl->num_documents,
+	                               PLSA_FOLD_IN_CHUNK)) {
+		free(doc_start);
+		return FALSE;
+	}
+
+	fc.ctx.ops = kernels_get(pl->precision);
+	fc.ctx.pl = pl;
+	fc.ctx.doc = doc;
+	fc.ctx.update_dt = TRUE;
+	fc.ctx.update_tw = FALSE;
+	fc.doc_start = doc_start;
+	fc.max_iterations = max_iterations;
+	fc.tol = tol;
+	fc.iterations = iterations;
+
+	plsa_initialize_random(pl, TRUE);
+	ret = plsa_run(pl, &plsa_fold_in_documents, &fc);
+	parallel_queue_cleanup(&fc.queue);
+	free(doc_start);
+	if (!ret) return FALSE;
+
+	*likelihood = 0;
+	total_weight = 0;
+	for (t = 0; t < pl->num_threads; t++) {
+		*likelihood += pl->partial[2 * t];
+		total_weight += pl->partial[2 * t + 1];
+	}
+	if (total_weight > 0) *likelihood /= total_weight;
+	return TRUE;
+}
+
+/* Stores the `num' most probable topics of `document' in `top', in
+ * decreasing order, and returns their number.
+ */
+unsigned int plsa_top_topics(const plsa *pl, unsigned int document,
+                             plsa_topmost *top, unsigned int num)
+{
+	return topk_row(pl->precision, PLSA_ROW(pl, pl->dt, document - 1),
+	                pl->num_topics, num, top);
+}
+
+/* Each thread scans a range of the words, and keeps the `num' most
+ * probable words of every topic in its own heaps.
+ */
+static
+void plsa_top_words_scan(void *arg, unsigned int thread_idx,
+                         unsigned int num_threads)
+{
+	plsa_topk_context *ctx = (plsa_topk_context *) arg;
+	const plsa *pl = ctx->pl;
+	unsigned int i, j, k, n, start, end, *lengths;
+	const unsigned int *idx;
+	plsa_topmost *heaps;
+	const void *row;
+
+	heaps = &ctx->heaps[(size_t) thread_idx * pl->num_topics * ctx->num];
+	lengths = &ctx->lengths[thread_idx * pl->num_topics];
+	memset(lengths, 0, pl->num_topics * sizeof(unsigned int));
+
+	parallel_range(pl->num_words, thread_idx, num_threads, &start, &end);
+	for (i = start; i < end; i++) {
+		row = PLSA_TW_ROW(pl, pl->tw, i);
+		idx = plsa_tw_topics(pl, i, &n);
+		for (k = 0; k < n; k++) {
+			j = (idx) ? idx[k] : k;
+			topk_push(&heaps[(size_t) j * ctx->num], &lengths[j],
+			          ctx->num, i, KERNEL_LOAD(pl->precision,
+			                                   row, k));
+		}
+	}
+}
+
+/* Merges the heaps of all the threads for a range of the topics */
+static
+void plsa_top_words_merge(void *arg, unsigned int thread_idx,
+                          unsigned int num_threads)
+{
+	plsa_topk_context *ctx = (plsa_topk_context *) arg;
+	const plsa *pl = ctx->pl;
+	unsigned int j, t, start, end;
+	plsa_topmost *heap;
+	size_t pos;
+
+	parallel_range(pl->num_topics, thread_idx, num_threads, &start, &end);
+	for (j = start; j < end; j++) {
+		heap = &ctx->heaps[(size_t) j * ctx->num];
+		for (t = 1; t < ctx->num_threads; t++) {
+			pos = (size_t) t * pl->num_topics + j;
+			topk_merge(heap, &ctx->lengths[j], ctx->num,
+			           &ctx->heaps[pos * ctx->num],
+			           ctx->lengths[pos]);
+		}
+		topk_sort(heap, ctx->lengths[j]);
+		memcpy(&ctx->top[(size_t) j * ctx->num], heap,
+		       ctx->lengths[j] * sizeof(plsa_topmost));
+	}
+}
+
+/* Stores the `num' most probable words of each topic in `top', in
+ * decreasing order: the words of `topic' start at top[topic * num],
+ * and their number is lengths[topic]. A topic of a sparse table may
+ * have fewer words.
+ */
+int plsa_top_words(const plsa *pl, unsigned int num, plsa_topmost *top,
+                   unsigned int *lengths)
+{
+	plsa_topk_context ctx;
+	size_t size;
+	int ret;
+
+	ctx.pl = pl;
+	ctx.num = num;
+	ctx.top = top;
+	ctx.num_threads = MAX(pl->num_threads, 1);
+
+	size = (size_t) ctx.num_threads * pl->num_topics
+	       * MAX(num, 1) * sizeof(plsa_topmost);
+	ctx.heaps = (plsa_topmost *) xmalloc(MAX(size, 1));
+	if (!ctx.heaps) return FALSE;
+
+	size = (size_t) ctx.num_threads * pl->num_topics * sizeof(unsigned int);
+	ctx.lengths = (unsigned int *) xmalloc(MAX(size, 1));
+	if (!ctx.lengths) {
+		free(ctx.heaps);
+		return FALSE;
+	}
+
+	ret = parallel_run(ctx.num_threads, &plsa_top_words_scan, &ctx);
+	if (ret) {
+		ret = parallel_run(ctx.num_threads, &plsa_top_words_merge,
+		                   &ctx);
+	}
+	if (ret) {
+		memcpy(lengths, ctx.lengths,
+		       pl->num_topics * sizeof(unsigned int));
+	}
+	free(ctx.lengths);
+	free(ctx.heaps);
+	return ret;
+}
+
+static
+void plsa_top_documents_range(void *arg, unsigned int thread_idx,
+                              unsigned int num_threads)
+{
+	plsa_topk_context *ctx = (plsa_topk_context *) arg;
+	unsigned int i, start, end;
+
+	parallel_range(ctx->count, thread_idx, num_threads, &start, &end);
+	for (i = start; i < end; i++) {
+		plsa_top_topics(ctx->pl, ctx->first + i,
+		                &ctx->top[(size_t) i * ctx->num], ctx->num);
+	}
+}
+
+/* Stores the `num' most probable topics of each of the `count'
+ * documents from `first' (counting from one) in `top', in decreasing
+ * order: the topics of the document `first + i' start at
+ * top[i * num]. Each document gets MIN(num, num_topics) topics.
+ */
+int plsa_top_documents(const plsa *pl, unsigned int first,
+                       unsigned int count, unsigned int num,
+                       plsa_topmost *top)
+{
+	plsa_topk_context ctx;
+
+	ctx.pl = pl;
+	ctx.num = num;
+	ctx.top = top;
+	ctx.first = first;
+	ctx.count = count;
+	ctx.num_threads = MAX(pl->num_threads, 1);
+	return parallel_run(ctx.num_threads, &plsa_top_documents_range, &ctx);
+}
+
+static
+int plsa_allocate_temporary(plsa *pl, size_t nmemb)
+{
+	plsa_cleanup_temporary(pl);
+	pl->top = (plsa_topmost *) xmalloc(MAX(nmemb, 1)
+	                                   * sizeof(plsa_topmost));
+	if (!pl->top) return FALSE;
+
+	return TRUE;
+}
+
+int plsa_print_topics(plsa *pl, const docinfo *doc, unsigned top_words)
+{
+	unsigned int j, l, *lengths;
+	plsa_topmost *top;
+	const char *token;
+
+	top_words = MIN(top_words, pl->num_words);
+	if (!plsa_allocate_temporary(pl, (size_t) pl->num_topics * top_words))
+		return FALSE;
+
+	lengths = (unsigned int *) xmalloc(MAX(pl->num_topics, 1)
+	                                   * sizeof(unsigned int));
+	if (!lengths) return FALSE;
+
+	if (!plsa_top_words(pl, top_words, pl->top, lengths)) {
+		free(lengths);
+		return FALSE;
+	}
+
+	printf("Summary of topics:\n\n");
+	for (l = 0; l < pl->num_topics; l++) {
+		top = &pl->top[(size_t) l * top_words];
+		printf("\nTopic %d:\n", l + 1);
+		for (j = 0; j < lengths[l]; j++) {
+			token = docinfo_get_word(doc, top[j].idx + 1);
+			printf("%s: %g\n", token, top[j].val);
+		}
+	}
+	printf("\n\n");
+	free(lengths);
+	return TRUE;
+}
+
+int plsa_print_documents(plsa *pl, const docinfo *doc, unsigned top_topics)
+{
+	unsigned int i, j, l, first, count;
+	docinfo_document *document;
+	plsa_topmost *top;
+
+	top_topics = MIN(top_topics, pl->num_topics);
+	if (!plsa_allocate_temporary(pl, (size_t) PLSA_TOP_BLOCK
+	                                 * top_topics))
+		return FALSE;
+
+	for (first = 0; first < pl->num_documents; first += count) {
+		count = MIN(pl->num_documents - first, PLSA_TOP_BLOCK);
+		if (!plsa_top_documents(pl, first + 1, count, top_topics,
+		                        pl->top))
+			return FALSE;
+
+		for (i = first; i < first + count; i++) {
+			printf("Document %u:\n", i + 1);
+			document = docinfo_get_document(doc, i + 1);
+			for (j = 0; j < document->word_count; j++) {
+				printf("%s ", docinfo_get_word_in_doc(doc,
+				       document, j + 1));
+			}
+			printf("\n");
+
+			top = &pl->top[(size_t) (i - first) * top_topics];
+			for (l = 0; l < top_topics; l++) {
+				printf("%u: %.4f, ", top[l].idx + 1,
+				       top[l].val);
+			}
+			printf("\n\n");
+		}
+	}
+
+	return TRUE;
+}
+
+/* The files keep the dense topic-word table in topic-major order,
+ * while in memory it is stored in word-major order. Sparse tables
+ * are stored as they are in memory.
+ */
+static
+int plsa_save_tw(const plsa *pl, FILE *fp)
+{
+	unsigned int i, j;
+	size_t size, nmemb;
+	double val;
+	void *row;
+
+	size = KERNEL_SIZE(pl->precision);
+	if (pl->tw_start) {
+		nmemb = PLSA_TW_LENGTH(pl);
+		return (fwrite(pl->tw, size, nmemb, fp) == nmemb);
+	}
+
+	row = xmalloc(MAX(pl->num_words, 1) * size);
+	if (!row) return FALSE;
+
+	for (j = 0; j < pl->num_topics; j++) {
+		for (i = 0; i < pl->num_words; i++) {
+			val = KERNEL_LOAD(pl->precision, pl->tw,
+			                  (size_t) i * pl->num_topics + j);
+			KERNEL_STORE(pl->precision, row, i, val);
+		}
+		if (fwrite(row, size, pl->num_words, fp) != pl->num_words) {
+			free(row);
+			return FALSE;
+		}
+	}
+	free(row);
+	return TRUE;
+}
+
+/* Reads the rows of the sparse topic-word table */
+static
+int plsa_load_sparse(plsa *pl, FILE *fp)
+{
+	size_t size, nmemb;
+
+	size = (pl->num_words + 1) * sizeof(unsigned int);
+	pl->tw_start = (unsigned int *) xmalloc(size);
+	if (!pl->tw_start) return FALSE;
+
+	nmemb = pl->num_words + 1;
+	if (fread(pl->tw_start, sizeof(unsigned int), nmemb, fp) != nmemb)
+		return FALSE;
+
+	nmemb = PLSA_TW_LENGTH(pl);
+	pl->tw_topic = (unsigned int *) xmalloc(MAX(nmemb, 1)
+	                                        * sizeof(unsigned int));
+	if (!pl->tw_topic) return FALSE;
+
+	if (fread(pl->tw_topic, sizeof(unsigned int), nmemb, fp) != nmemb)
+		return FALSE;
+
+	return TRUE;
+}
+
+/* Reads the tables stored with elements of type `type', converting
+ * them to the precision of `pl'.
+ */
+static
+int plsa_load_tables(plsa *pl, FILE *fp, int type)
+{
+	unsigned int i, j, length;
+	size_t size;
+	double val;
+	void *row;
 
-			if ((iter % 10) == 9 && plsa_filename) {
-				printf("Saving temporary PLSA `%s'...\n",
-				       plsa_filename);
-				if (!plsa_save_easy(pl, plsa_filename))
-					return FALSE;
-			}
-		}
+	size = KERNEL_SIZE(type);
+	length = MAX(pl->num_words, pl->num_topics);
+	row = xmalloc(MAX(length, 1) * size);
+	if (!row) return FALSE;
 
+	for (i = 0; i < pl->num_documents; i++) {
+		if (fread(row, size, pl->num_topics, fp) != pl->num_topics)
+			goto error_load;
+		kernels_convert(pl->precision, PLSA_ROW(pl, pl->dt, i),
+		                type, row, pl->num_topics);
+	}
 
-		if (pl->old_likelihood < 0 &&
-		    fabs(pl->likelihood - pl->old_likelihood) < tol) {
-			break;
+	if (pl->tw_start) {
+		for (i = 0; i < pl->num_words; i++) {
+			length = pl->tw_start[i + 1] - pl->tw_start[i];
+			if (fread(row, size, length, fp) != length)
+				goto error_load;
+			kernels_convert(pl->precision,
+			                PLSA_TW_ROW(pl, pl->tw, i),
+			                type, row, length);
 		}
+		free(row);
+		return TRUE;
 	}
-	if (plsa_filename) {
-		printf("Saving PLSA `%s'...\n", plsa_filename);
-		if (!plsa_save_easy(pl, plsa_filename)) {
-			return FALSE;
+
+	for (j = 0; j < pl->num_topics; j++) {
+		if (fread(row, size, pl->num_words, fp) != pl->num_words)
+			goto error_load;
+		for (i = 0; i < pl->num_words; i++) {
+			val = KERNEL_LOAD(type, row, i);
+			KERNEL_STORE(pl->precision, pl->tw,
+			             (size_t) i * pl->num_topics + j, val);
 		}
 	}
+	free(row);
 	return TRUE;
-}
 
-static
-int cmp_topmost(const void *p1, const void *p2, void *arg)
-{
-	const plsa_topmost *t1 = (const plsa_topmost *) p1;
-	const plsa_topmost *t2 = (const plsa_topmost *) p2;
-	if (t1->val < t2->val) return 1;
-	if (t1->val > t2->val) return -1;
-	return 0;
+error_load:
+	free(row);
+	return FALSE;
 }
 
+/* Points `table' to the section `id' of the mapped model file, which
+ * holds `nmemb' elements of type `type'. If the precision of `pl' is
+ * different, the section is converted to a new table instead.
+ */
 static
-int plsa_allocate_temporary(plsa *pl)
+int plsa_map_table(plsa *pl, unsigned int id, int type, size_t nmemb,
+                   void **table)
 {
-	size_t size;
+	void *data;
 
-	plsa_cleanup_temporary(pl);
-	size = MAX(pl->num_words, pl->num_topics) * sizeof(plsa_topmost);
-	pl->top = (plsa_topmost *) xmalloc(size);
-	if (!pl->top) return FALSE;
+	*table = NULL;
+	if (nmemb == 0) return TRUE;
+
+	data = mapfile_get(&pl->map, id, (unsigned int) type,
+	                   nmemb * KERNEL_SIZE(type));
+	if (!data) return FALSE;
+
+	if (type == pl->precision) {
+		*table = data;
+		return TRUE;
+	}
 
+	*table = xmalloc(nmemb * KERNEL_SIZE(pl->precision));
+	if (!*table) return FALSE;
+	kernels_convert(pl->precision, *table, type, data, nmemb);
 	return TRUE;
 }
 
-int plsa_print_topics(plsa *pl, const docinfo *doc, unsigned top_words)
+/* Loads a model file in the mapped format. The tables point inside
+ * the mapping, so nothing is read until it is used; only the tables
+ * of the next iteration are allocated.
+ */
+static
+int plsa_load_mapped(plsa *pl, int fd)
 {
-	unsigned int j, l;
-	const char *token;
+	const unsigned int *params, *state;
+	size_t nmemb;
+	int type;
 
-	if (!plsa_allocate_temporary(pl))
-		return FALSE;
+	if (!mapfile_map(&pl->map, fd, PLSA_MAGIC))
+		goto error_load;
 
-	top_words = MIN(top_words, pl->num_words);
-	printf("Summary of topics:\n\n");
-	for (l = 0; l < pl->num_topics; l++) {
-		for (j = 0; j < pl->num_words; j++) {
-			pl->top[j].idx = j;
-			pl->top[j].val = pl->tw[l * pl->num_words + j];
-		}
-		xsort(pl->top, pl->num_words, sizeof(plsa_topmost),
-		      &cmp_topmost, NULL);
+	if (pl->verify_checksums) {
+		if (!mapfile_verify(&pl->map))
+			goto error_load;
+	}
 
-		printf("\nTopic %d:\n", l + 1);
-		for (j = 0; j < top_words; j++) {
-			token = docinfo_get_word(doc,
-			                         pl->top[j].idx + 1);
-			printf("%s: %g\n", token, pl->top[j].val);
+	params = pl->map.header.params;
+	type = (int) params[3];
+	if (type != KERNEL_DOUBLE && type != KERNEL_FLOAT) {
+		error("unsupported PLSA file format");
+		goto error_load;
+	}
+	pl->num_words = params[0];
+	pl->num_documents = params[1];
+	pl->num_topics = params[2];
+	pl->likelihood = pl->map.header.values[0];
+	pl->old_likelihood = pl->map.header.values[1];
+	pl->iteration = params[5];
+	pl->online_pass = params[6];
+	pl->online_batch = params[7];
+	pl->online_sum = pl->map.header.values[2];
+	pl->online_weight = pl->map.header.values[3];
+	if (pl->iteration > 0) {
+		state = (const unsigned int *)
+			mapfile_get(&pl->map, PLSA_SECTION_RNG, MAPFILE_UINT,
+			            sizeof(pl->rng_state));
+		if (!state) goto error_load;
+		memcpy(pl->rng_state, state, sizeof(pl->rng_state));
+	}
+
+	if (params[4]) {
+		nmemb = (size_t) pl->num_words + 1;
+		pl->tw_start = (unsigned int *)
+			mapfile_get(&pl->map, PLSA_SECTION_TW_START,
+			            MAPFILE_UINT, nmemb * sizeof(unsigned int));
+		if (!pl->tw_start) goto error_load;
+
+		nmemb = PLSA_TW_LENGTH(pl);
+		if (nmemb > 0) {
+			pl->tw_topic = (unsigned int *)
+				mapfile_get(&pl->map, PLSA_SECTION_TW_TOPIC,
+				            MAPFILE_UINT,
+				            nmemb * sizeof(unsigned int));
+		} else {
+			pl->tw_topic = (unsigned int *)
+				xmalloc(sizeof(unsigned int));
 		}
+		if (!pl->tw_topic) goto error_load;
 	}
-	printf("\n\n");
+
+	nmemb = (size_t) pl->num_documents * pl->num_topics;
+	if (!plsa_map_table(pl, PLSA_SECTION_DT, type, nmemb, &pl->dt))
+		goto error_load;
+
+	if (!plsa_map_table(pl, PLSA_SECTION_TW, type, PLSA_TW_LENGTH(pl),
+	                    &pl->tw))
+		goto error_load;
+
+	if (!plsa_allocate_tables(pl, pl->num_words, pl->num_documents,
+	                          pl->num_topics))
+		goto error_load;
+
 	return TRUE;
+
+error_load:
+	error("could not load PLSA");
+	plsa_cleanup(pl);
+	return FALSE;
 }
 
-int plsa_print_documents(plsa *pl, const docinfo *doc, unsigned top_topics)
+/* Saves the model in the mapped format. The file is replaced
+ * atomically, so it can be written while other processes map it.
+ */
+int plsa_save_mapped(const plsa *pl, const char *filename)
 {
-	unsigned int i, j, l;
+	mapfile mf;
+	unsigned int type;
+	size_t nmemb;
 
-	if (!plsa_allocate_temporary(pl))
+	if (!mapfile_create(&mf, filename, PLSA_MAGIC))
 		return FALSE;
 
-	top_topics = MIN(top_topics, pl->num_topics);
-	for (i = 0; i < pl->num_documents; i++) {
-		docinfo_document *document;
+	type = (unsigned int) pl->precision;
+	mf.header.params[0] = pl->num_words;
+	mf.header.params[1] = pl->num_documents;
+	mf.header.params[2] = pl->num_topics;
+	mf.header.params[3] = type;
+	mf.header.params[4] = (pl->tw_start) ? 1 : 0;
+	mf.header.params[5] = pl->iteration;
+	mf.header.params[6] = pl->online_pass;
+	mf.header.params[7] = pl->online_batch;
+	mf.header.values[0] = pl->likelihood;
+	mf.header.values[1] = pl->old_likelihood;
+	mf.header.values[2] = pl->online_sum;
+	mf.header.values[3] = pl->online_weight;
 
-		printf("Document %u:\n", i + 1);
-		document = docinfo_get_document(doc, i + 1);
-		for (j = 0; j < document->word_count; j++) {
-			printf("%s ",
-			       docinfo_get_word_in_doc(doc, document, j + 1));
-		}
-		printf("\n");
+	nmemb = (size_t) pl->num_documents * pl->num_topics;
+	if (!mapfile_write(&mf, PLSA_SECTION_DT, type, pl->dt,
+	                   nmemb * KERNEL_SIZE(pl->precision)))
+		goto error_save;
 
-		for (l = 0; l < pl->num_topics; l++) {
-			pl->top[l].idx = l;
-			pl->top[l].val = pl->dt[i * pl->num_topics + l];
-		}
-		xsort(pl->top, pl->num_topics, sizeof(plsa_topmost),
-		      &cmp_topmost, NULL);
-		for (l = 0; l < top_topics; l++) {
-			printf("%u: %.4f, ", pl->top[l].idx + 1,
-			       pl->top[l].val);
-		}
-		printf("\n\n");
+	nmemb = PLSA_TW_LENGTH(pl);
+	if (!mapfile_write(&mf, PLSA_SECTION_TW, type, pl->tw,
+	                   nmemb * KERNEL_SIZE(pl->precision)))
+		goto error_save;
+
+	if (pl->tw_start) {
+		if (!mapfile_write(&mf, PLSA_SECTION_TW_START, MAPFILE_UINT,
+		                   pl->tw_start, ((size_t) pl->num_words + 1)
+		                                 * sizeof(unsigned int)))
+			goto error_save;
+		if (!mapfile_write(&mf, PLSA_SECTION_TW_TOPIC, MAPFILE_UINT,
+		                   pl->tw_topic, nmemb * sizeof(unsigned int)))
+			goto error_save;
 	}
 
-	return TRUE;
+	if (pl->iteration > 0) {
+		if (!mapfile_write(&mf, PLSA_SECTION_RNG, MAPFILE_UINT,
+		                   pl->rng_state, sizeof(pl->rng_state)))
+			goto error_save;
+	}
+
+	return mapfile_commit(&mf);
+
+error_save:
+	error("could not write `%s'", filename);
+	mapfile_abort(&mf);
+	return FALSE;
 }
 
 int plsa_save(const plsa *pl, FILE *fp)
 {
-	unsigned int nmemb;
+	unsigned int header[4];
+	size_t nmemb;
+
+	header[0] = PLSA_MAGIC;
+	header[1] = PLSA_VERSION;
+	header[2] = (unsigned int) pl->precision;
+	header[3] = (pl->tw_start) ? 1 : 0;
+	if (fwrite(header, sizeof(unsigned int), 4, fp) != 4)
+		return FALSE;
 
 	if (fwrite(&pl->num_words, sizeof(unsigned int), 1, fp) != 1)
 		return FALSE;
@@ -384,42 +3495,105 @@ int plsa_save(const plsa *pl, FILE *fp)
 	if (fwrite(&pl->old_likelihood, sizeof(double), 1, fp) != 1)
 		return FALSE;
 
-	nmemb = pl->num_documents * pl->num_topics;
-	if (fwrite(pl->dt, sizeof(double), nmemb, fp) != nmemb)
+	if (pl->tw_start) {
+		nmemb = pl->num_words + 1;
+		if (fwrite(pl->tw_start, sizeof(unsigned int), nmemb, fp)
+		    != nmemb)
+			return FALSE;
+		nmemb = PLSA_TW_LENGTH(pl);
+		if (fwrite(pl->tw_topic, sizeof(unsigned int), nmemb, fp)
+		    != nmemb)
+			return FALSE;
+	}
+
+	nmemb = (size_t) pl->num_documents * pl->num_topics;
+	if (fwrite(pl->dt, KERNEL_SIZE(pl->precision), nmemb, fp) != nmemb)
+		return FALSE;
+
+	if (!plsa_save_tw(pl, fp))
 		return FALSE;
 
-	nmemb = pl->num_topics * pl->num_words;
-	if (fwrite(pl->tw, sizeof(double), nmemb, fp) != nmemb)
+	/* The state of an interrupted training */
+	if (fwrite(&pl->iteration, sizeof(unsigned int), 1, fp) != 1)
 		return FALSE;
+	if (pl->iteration > 0) {
+		if (fwrite(pl->rng_state, sizeof(unsigned int),
+		           GENRAND_STATE_SIZE, fp) != GENRAND_STATE_SIZE)
+			return FALSE;
+		if (fwrite(&pl->online_pass, sizeof(unsigned int), 1, fp) != 1)
+			return FALSE;
+		if (fwrite(&pl->online_batch, sizeof(unsigned int), 1, fp) != 1)
+			return FALSE;
+		if (fwrite(&pl->online_sum, sizeof(double), 1, fp) != 1)
+			return FALSE;
+		if (fwrite(&pl->online_weight, sizeof(double), 1, fp) != 1)
+			return FALSE;
+	}
 
 	return TRUE;
 }
 
+/* Saves the model to a temporary file, which then replaces
+ * `filename', so a failure never leaves a truncated model behind.
+ */
 int plsa_save_easy(const plsa *pl, const char *filename)
 {
+	char *temp_filename;
 	FILE *fp;
 	int ret;
 
-	fp = fopen(filename, "wb");
-	if (!fp) {
-		error("could not open `%s' for writing", filename);
-		return FALSE;
-	}
+	/* Models loaded from a mapped file are saved in the same format */
+	if (pl->map.base)
+		return plsa_save_mapped(pl, filename);
+
+	fp = atomic_fopen(filename, &temp_filename);
+	if (!fp) return FALSE;
+
 	ret = plsa_save(pl, fp);
-	fclose(fp);
-	return ret;
+	if (!ret) error("could not write `%s'", filename);
+	return atomic_fclose(fp, temp_filename, filename, ret);
 }
 
 int plsa_load(plsa *pl, FILE *fp)
 {
-	unsigned int nmemb, num_words, num_documents, num_topics;
+	unsigned int num_words, num_documents, num_topics;
+	unsigned int header[3];
+	int type, sparse, version;
 
-	plsa_reset(pl);
+	plsa_cleanup(pl);
 	if (!plsa_initialize(pl))
 		return FALSE;
 
+	/* Files without the header have the tables in double precision */
 	if (fread(&num_words, sizeof(unsigned int), 1, fp) != 1)
 		return FALSE;
+	if (num_words == MAPFILE_MAGIC)
+		return plsa_load_mapped(pl, fileno(fp));
+
+	type = KERNEL_DOUBLE;
+	sparse = FALSE;
+	version = 0;
+	if (num_words == PLSA_MAGIC) {
+		if (fread(header, sizeof(unsigned int), 2, fp) != 2)
+			return FALSE;
+		if (header[0] == 0 || header[0] > PLSA_VERSION) {
+			error("unsupported PLSA file format");
+			return FALSE;
+		}
+		version = (int) header[0];
+		if (version >= 2) {
+			if (fread(&header[2], sizeof(unsigned int), 1, fp) != 1)
+				return FALSE;
+			sparse = (header[2] != 0);
+		}
+		if (header[1] != KERNEL_DOUBLE && header[1] != KERNEL_FLOAT) {
+			error("unsupported PLSA file format");
+			return FALSE;
+		}
+		type = (int) header[1];
+		if (fread(&num_words, sizeof(unsigned int), 1, fp) != 1)
+			return FALSE;
+	}
 	if (fread(&num_documents, sizeof(unsigned int), 1, fp) != 1)
 		return FALSE;
 	if (fread(&num_topics, sizeof(unsigned int), 1, fp) != 1)
@@ -429,16 +3603,37 @@ int plsa_load(plsa *pl, FILE *fp)
 	if (fread(&pl->old_likelihood, sizeof(double), 1, fp) != 1)
 		return FALSE;
 
+	if (sparse) {
+		pl->num_words = num_words;
+		pl->num_topics = num_topics;
+		if (!plsa_load_sparse(pl, fp))
+			goto error_load;
+	}
+
 	if (!plsa_allocate_tables(pl, num_words, num_documents, num_topics))
 		goto error_load;
 
-	nmemb = pl->num_documents * pl->num_topics;
-	if (fread(pl->dt, sizeof(double), nmemb, fp) != nmemb)
+	if (!plsa_load_tables(pl, fp, type))
 		goto error_load;
 
-	nmemb = pl->num_topics * pl->num_words;
-	if (fread(pl->tw, sizeof(double), nmemb, fp) != nmemb)
-		goto error_load;
+	if (version >= 3) {
+		if (fread(&pl->iteration, sizeof(unsigned int), 1, fp) != 1)
+			goto error_load;
+		if (pl->iteration > 0
+		    && fread(pl->rng_state, sizeof(unsigned int),
+		             GENRAND_STATE_SIZE, fp) != GENRAND_STATE_SIZE)
+			goto error_load;
+	}
+	if (version >= 4 && pl->iteration > 0) {
+		if (fread(&pl->online_pass, sizeof(unsigned int), 1, fp) != 1)
+			goto error_load;
+		if (fread(&pl->online_batch, sizeof(unsigned int), 1, fp) != 1)
+			goto error_load;
+		if (fread(&pl->online_sum, sizeof(double), 1, fp) != 1)
+			goto error_load;
+		if (fread(&pl->online_weight, sizeof(double), 1, fp) != 1)
+			goto error_load;
+	}
 
 	return TRUE;
 
@@ -463,27 +3658,65 @@ int plsa_load_easy(plsa *pl, const char *filename)
 	return ret;
 }
 
-int plsa_build_cached(plsa *pl, const char *plsa_file, const docinfo *doc,
-                      unsigned int num_topics, unsigned int max_iter,
-                      double tol)
+static
+int plsa_load_cached(plsa *pl, const char *plsa_file)
 {
 	FILE *fp = NULL;
 	int ret;
 
-	plsa_reset(pl);
 	if (plsa_file) fp = fopen(plsa_file, "rb");
 	if (fp) {
 		printf("Loading PLSA `%s'...\n", plsa_file);
 		ret = plsa_load(pl, fp);
 		fclose(fp);
-		if (!ret) return FALSE;
+		return ret;
+	}
+	return plsa_initialize(pl);
+}
+
+int plsa_build_cached(plsa *pl, const char *plsa_file, const docinfo *doc,
+                      unsigned int num_topics, unsigned int max_iter,
+                      double tol)
+{
+	int ret;
+
+	if (!plsa_load_cached(pl, plsa_file))
+		return FALSE;
+
+	/* Only a new model is chosen among several random starts */
+	if (pl->num_restarts > 1 && pl->likelihood >= 0 && !pl->dt) {
+		ret = plsa_train_restarts(pl, doc, num_topics, max_iter, tol,
+		                          plsa_file);
 	} else {
-		if (!plsa_initialize(pl))
-			return FALSE;
+		ret = plsa_train(pl, doc, num_topics, max_iter, tol,
+		                 FALSE, plsa_file);
+	}
+	if (!ret) {
+		plsa_cleanup(pl);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+int plsa_build_online(plsa *pl, const char *plsa_file, docinfo *doc,
+                      const char *master_file, unsigned int num_topics,
+                      unsigned int max_iter, double tol)
+{
+	if (!plsa_load_cached(pl, plsa_file))
+		return FALSE;
+
+	/* Without the documents, only a saved model can be used */
+	if (!master_file) {
+		if (pl->likelihood < 0)
+			return TRUE;
+		error("the online EM needs a training file");
+		plsa_cleanup(pl);
+		return FALSE;
 	}
 
-	if (!plsa_train(pl, doc, num_topics, max_iter, tol,
-	                FALSE, plsa_file)) {
+	if (!plsa_train_online(pl, doc, master_file, num_topics,
+	                       max_iter, tol, plsa_file)) {
 		plsa_cleanup(pl);
 		return FALSE;
 	}
@@ -491,65 +3724,459 @@ int plsa_build_cached(plsa *pl, const char *plsa_file, const docinfo *doc,
 	return TRUE;
 }
 
+/* Folds in the test documents and reports the number of iterations
+ * they needed.
+ */
+static
+int plsa_fold_in_test(plsa *pl, const docinfo *doc, unsigned int max_iter,
+                      double tol)
+{
+	unsigned int *iterations;
+	unsigned int i, max_iterations;
+	double likelihood, total;
+
+	iterations = (unsigned int *) xmalloc(MAX(docinfo_num_documents(doc), 1)
+	                                      * sizeof(unsigned int));
+	if (!iterations) return FALSE;
+
+	printf("Folding in %u documents...\n", docinfo_num_documents(doc));
+	if (!plsa_fold_in(pl, doc, max_iter, tol, &likelihood, iterations)) {
+		free(iterations);
+		return FALSE;
+	}
+
+	total = 0;
+	max_iterations = 0;
+	for (i = 0; i < docinfo_num_documents(doc); i++) {
+		total += iterations[i];
+		max_iterations = MAX(max_iterations, iterations[i]);
+	}
+	printf("Likelihood = %g\n", likelihood);
+	printf("Iterations per document: mean = %.2f, max = %u\n",
+	       total / MAX(docinfo_num_documents(doc), 1), max_iterations);
+	free(iterations);
+	return TRUE;
+}
+
+/* Reads a list of numbers of topics separated by commas */
+static
+int plsa_parse_topics(const char *list, unsigned int **topics,
+                      unsigned int *num_models)
+{
+	unsigned int i, j, n;
+	unsigned long val;
+	const char *p;
+	char *end;
+
+	n = 1;
+	for (p = list; *p; p++) {
+		if (*p == ',') n++;
+	}
+	*topics = (unsigned int *) xmalloc(n * sizeof(unsigned int));
+	if (!*topics) return FALSE;
+
+	p = list;
+	for (i = 0; i < n; i++) {
+		val = strtoul(p, &end, 10);
+		if (end == p || val == 0 || val > UINT_MAX
+		    || (*end != ',' && *end != '\0'))
+			goto error_parse;
+		(*topics)[i] = (unsigned int) val;
+		p = end + 1;
+	}
+
+	/* Each model has its own file */
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < i; j++) {
+			if ((*topics)[j] == (*topics)[i])
+				goto error_parse;
+		}
+	}
+	*num_models = n;
+	return TRUE;
+
+error_parse:
+	error("invalid list of numbers of topics `%s'", list);
+	free(*topics);
+	*topics = NULL;
+	return FALSE;
+}
+
+/* Trains one model for each number of topics of `list' against the
+ * same documents, folds in the test documents of `test_file' with
+ * each one, and compares them.
+ */
+static
+int plsa_sweep(const plsa *pl, docinfo *doc, const char *list,
+               const char *plsa_file, unsigned int max_iter, double tol,
+               const char *test_file)
+{
+	unsigned int *topics, *iterations;
+	unsigned int i, num_models;
+	double *times, *test_times, *held_out;
+	plsa *models;
+	int ret = FALSE;
+
+	if (!plsa_parse_topics(list, &topics, &num_models))
+		return FALSE;
+
+	models = (plsa *) xmalloc(num_models * sizeof(plsa));
+	iterations = (unsigned int *) xmalloc(num_models
+	                                      * sizeof(unsigned int));
+	times = (double *) xmalloc(3 * num_models * sizeof(double));
+	if (!models || !iterations || !times) {
+		if (models) free(models);
+		if (iterations) free(iterations);
+		if (times) free(times);
+		free(topics);
+		return FALSE;
+	}
+	test_times = &times[num_models];
+	held_out = &times[2 * num_models];
+
+	for (i = 0; i < num_models; i++) {
+		models[i] = *pl;
+		models[i].pool = NULL;
+		plsa_initialize(&models[i]);
+		models[i].num_topics = topics[i];
+		test_times[i] = 0;
+	}
+
+	if (!plsa_train_sweep(models, num_models, doc, max_iter, tol,
+	                      plsa_file, iterations, times))
+		goto done_sweep;
+
+	if (test_file) {
+		docinfo_clear(doc, TRUE);
+		if (!docinfo_process_file(doc, test_file, FALSE))
+			goto done_sweep;
+
+		printf("Folding in %u documents...\n",
+		       docinfo_num_documents(doc));
+		for (i = 0; i < num_models; i++) {
+			test_times[i] = get_time();
+			if (!plsa_fold_in(&models[i], doc, max_iter, tol,
+			                  &held_out[i], NULL))
+				goto done_sweep;
+			test_times[i] = get_time() - test_times[i];
+		}
+	}
+
+	printf("%8s %10s %14s %14s %10s %10s\n", "Topics", "Iterations",
+	       "Likelihood", "Held-out", "Train (s)", "Test (s)");
+	for (i = 0; i < num_models; i++) {
+		printf("%8u %10u %14g", models[i].num_topics, iterations[i],
+		       models[i].likelihood);
+		if (test_file)
+			printf(" %14g", held_out[i]);
+		else
+			printf(" %14s", "-");
+		printf(" %10.2f %10.2f\n", times[i], test_times[i]);
+	}
+	ret = TRUE;
+
+done_sweep:
+	for (i = 0; i < num_models; i++)
+		plsa_cleanup(&models[i]);
+	free(models);
+	free(iterations);
+	free(times);
+	free(topics);
+	return ret;
+}
+
+/* The options of the command line */
+typedef
+struct plsa_options_st {
+	char *docinfo_file, *training_file, *ignore_file, *plsa_file;
+	char *test_file, *kernels_name, *server_address, *mapped_file;
+	char *group_address, *sweep_topics;
+	unsigned int num_topics, max_iter, top_words, top_topics;
+	unsigned int num_threads, parallel_mode, single_precision;
+	unsigned int prune_top, prune_after;
+	unsigned int batch_size, batch_iterations;
+	unsigned int accelerate, verify_checksums;
+	unsigned int num_processes, rank, checkpoint_interval;
+	unsigned int num_restarts, restart_iterations;
+	unsigned int min_count, max_words, residual_interval, seed;
+	double tol, prune_threshold, kappa, tau0, checkpoint_seconds;
+	double max_df, dt_floor, residual, topic_tol;
+} plsa_options;
+
+static
+void plsa_options_reset(plsa_options *o)
+{
+	o->docinfo_file = NULL;
+	o->training_file = NULL;
+	o->ignore_file = NULL;
+	o->plsa_file = NULL;
+	o->test_file = NULL;
+	o->kernels_name = NULL;
+	o->server_address = NULL;
+	o->mapped_file = NULL;
+	o->group_address = NULL;
+	o->sweep_topics = NULL;
+	o->num_topics = 0;
+	o->max_iter = 0;
+	o->top_words = 0;
+	o->top_topics = 0;
+	o->num_threads = 1;
+	o->parallel_mode = PLSA_PARALLEL_REPLICATE;
+	o->single_precision = 0;
+	o->prune_top = 0;
+	o->prune_after = 10;
+	o->batch_size = 0;
+	o->batch_iterations = 5;
+	o->accelerate = 0;
+	o->verify_checksums = 0;
+	o->num_processes = 1;
+	o->rank = 0;
+	o->checkpoint_interval = CHECKPOINT_INTERVAL;
+	o->num_restarts = 1;
+	o->restart_iterations = 0;
+	o->min_count = 0;
+	o->max_words = 0;
+	o->residual_interval = PLSA_RESIDUAL_INTERVAL;
+	o->seed = 0;
+	o->tol = 0;
+	o->prune_threshold = 0;
+	o->kappa = 0.7;
+	o->tau0 = 1;
+	o->checkpoint_seconds = 0;
+	o->max_df = 0;
+	o->dt_floor = 0;
+	o->residual = 0;
+	o->topic_tol = 0;
+}
+
+/* Checks the options that cannot be combined */
+static
+int plsa_check_options(const plsa_options *o)
+{
+	if (o->server_address && o->max_iter == 0) {
+		error("the server needs a positive number of iterations");
+		return FALSE;
+	}
+
+	if (o->num_restarts > 1
+	    && (o->batch_size > 0 || o->num_processes > 1)) {
+		error("the restarts need a single process without the "
+		      "online EM");
+		return FALSE;
+	}
+
+	if (o->sweep_topics && (o->batch_size > 0 || o->num_processes > 1
+	                        || o->num_restarts > 1 || o->accelerate)) {
+		error("the sweep needs a single process without the online "
+		      "EM, SQUAREM or the restarts");
+		return FALSE;
+	}
+
+	/* A word would lose all the topics kept by some documents */
+	if (o->dt_floor > 0
+	    && (o->prune_threshold > 0 || o->prune_top > 0)) {
+		error("the document topics and the topic-word table cannot "
+		      "both be pruned");
+		return FALSE;
+	}
+
+	/* The frozen statistics hold for the plain EM of one model */
+	if (o->residual > 0
+	    && (o->batch_size > 0 || o->accelerate || o->parallel_mode
+	        || o->num_restarts > 1 || o->sweep_topics)) {
+		error("the residual EM cannot be combined with the online "
+		      "EM, SQUAREM, the partitioned strategy, the restarts "
+		      "or the sweep");
+		return FALSE;
+	}
+
+	/* The topics frozen keep dense columns from one iteration on */
+	if (o->topic_tol > 0
+	    && (o->batch_size > 0 || o->accelerate || o->residual > 0
+	        || o->prune_threshold > 0 || o->prune_top > 0
+	        || o->num_restarts > 1 || o->sweep_topics)) {
+		error("the topics cannot be frozen with the online EM, "
+		      "SQUAREM, the residual EM, the pruning of the "
+		      "topic-word table, the restarts or the sweep");
+		return FALSE;
+	}
+
+	if (o->batch_size > 0 && (o->min_count > 1 || o->max_df > 0
+	                          || o->max_words > 0)) {
+		error("the vocabulary pruning needs the whole corpus in "
+		      "memory, not the online EM");
+		return FALSE;
+	}
+
+	if (o->num_processes > 1 && (o->batch_size > 0 || o->accelerate)) {
+		error("the online EM and SQUAREM need a single process");
+		return FALSE;
+	}
+	return TRUE;
+}
+
 static
-int do_main(const char *docinfo_file, const char *training_file,
-            const char *ignore_file, const char *plsa_file,
-            unsigned int num_topics, unsigned int max_iter, double tol,
-            unsigned int top_words, const char *test_file,
-            unsigned int top_topics)
+int do_main(const plsa_options *o)
 {
+	unsigned int first, end;
+	allreduce ar;
 	docinfo doc;
 	plsa pl;
 
 	docinfo_reset(&doc);
 	plsa_reset(&pl);
+	allreduce_reset(&ar);
+	if (!kernels_select(o->kernels_name))
+		return FALSE;
 
-	if (!docinfo_build_cached(&doc, docinfo_file,
-	                          training_file, ignore_file))
-		goto error_main;
+	pl.num_threads = o->num_threads;
+	pl.parallel_mode = (int) o->parallel_mode;
+	pl.precision = (o->single_precision) ? KERNEL_FLOAT : KERNEL_DOUBLE;
+	pl.accelerate = (o->accelerate != 0);
+	pl.verify_checksums = (o->verify_checksums != 0);
+	pl.prune_threshold = o->prune_threshold;
+	pl.prune_top = o->prune_top;
+	pl.prune_after = o->prune_after;
+	pl.dt_floor = o->dt_floor;
+	pl.residual = o->residual;
+	pl.residual_interval = o->residual_interval;
+	pl.topic_tol = o->topic_tol;
+	pl.batch_size = o->batch_size;
+	pl.batch_iterations = o->batch_iterations;
+	pl.kappa = o->kappa;
+	pl.tau0 = o->tau0;
+	pl.checkpoint_interval = o->checkpoint_interval;
+	pl.checkpoint_seconds = o->checkpoint_seconds;
+	pl.num_restarts = o->num_restarts;
+	pl.restart_iterations = o->restart_iterations;
+	printf("Using %s kernels\n", kernels_get(pl.precision)->name);
 
-	if (!plsa_build_cached(&pl, plsa_file, &doc,
-	                       num_topics, max_iter, tol))
+	if (!plsa_check_options(o))
 		goto error_main;
 
-	if (top_words > 0) {
-		if (!plsa_print_topics(&pl,  &doc, top_words))
+	if (o->num_processes > 1) {
+		if (!allreduce_initialize(&ar, o->group_address, o->rank,
+		                          o->num_processes))
+			goto error_main;
+		pl.ar = &ar;
+
+		/* The processes share the random numbers of the first one,
+		 * which are the ones of a single process with the same seed
+		 */
+		genrand_get_state(pl.rng_state);
+		if (!allreduce_broadcast(&ar, pl.rng_state,
+		                         sizeof(pl.rng_state)))
 			goto error_main;
+		genrand_set_state(pl.rng_state);
 	}
 
-	if (test_file) {
+	if (o->batch_size > 0) {
+		if (!docinfo_build_vocabulary(&doc, o->docinfo_file,
+		                              o->training_file, o->ignore_file,
+		                              o->batch_size))
+			goto error_main;
+
+		if (!plsa_build_online(&pl, o->plsa_file, &doc,
+		                       o->training_file, o->num_topics,
+		                       o->max_iter, o->tol))
+			goto error_main;
+	} else {
+		/* The first process builds the DOCINFO file for the others */
+		if (pl.ar && o->rank > 0) {
+			if (!allreduce_barrier(&ar))
+				goto error_main;
+		}
+		if (!docinfo_build_cached(&doc, o->docinfo_file,
+		                          o->training_file, o->ignore_file,
+		                          o->num_threads))
+			goto error_main;
+
+		/* All the processes prune the whole vocabulary the same way */
+		if (o->min_count > 1 || o->max_df > 0 || o->max_words > 0) {
+			if (!docinfo_prune(&doc, o->min_count, o->max_df,
+			                   o->max_words))
+				goto error_main;
+		}
+
+		if (pl.ar) {
+			if (o->rank == 0 && !allreduce_barrier(&ar))
+				goto error_main;
+
+			parallel_range(docinfo_num_documents(&doc), o->rank,
+			               o->num_processes, &first, &end);
+			printf("Training on documents %u to %u of %u\n",
+			       first + 1, end, docinfo_num_documents(&doc));
+			pl.shard_first = first;
+			pl.shard_total = docinfo_num_documents(&doc);
+			if (!docinfo_shard(&doc, first, end))
+				goto error_main;
+		}
+
+		if (o->sweep_topics) {
+			if (!plsa_sweep(&pl, &doc, o->sweep_topics,
+			                o->plsa_file, o->max_iter, o->tol,
+			                o->test_file))
+				goto error_main;
+			goto done_main;
+		}
+
+		if (!plsa_build_cached(&pl, o->plsa_file, &doc,
+		                       o->num_topics, o->max_iter, o->tol))
+			goto error_main;
+
+		/* The first process goes on with the whole model */
+		pl.ar = NULL;
+		if (ar.rank > 0)
+			goto done_main;
+	}
+
+	if (o->mapped_file) {
+		printf("Saving mapped PLSA `%s'...\n", o->mapped_file);
+		if (!plsa_save_mapped(&pl, o->mapped_file))
+			goto error_main;
+	}
+
+	if (o->top_words > 0) {
+		if (!plsa_print_topics(&pl,  &doc, o->top_words))
+			goto error_main;
+	}
+
+	if (o->test_file) {
 		docinfo_clear(&doc, TRUE);
-		if (!docinfo_process_file(&doc, test_file, FALSE))
+		if (!docinfo_process_file(&doc, o->test_file, FALSE))
 			goto error_main;
 
-		if (!plsa_train(&pl, &doc, num_topics, max_iter, tol,
-		                TRUE, NULL))
+		if (!plsa_fold_in_test(&pl, &doc, o->max_iter, o->tol))
 			goto error_main;
 
-		if (top_topics > 0) {
-			if (!plsa_print_documents(&pl,  &doc, top_topics))
+		if (o->top_topics > 0) {
+			if (!plsa_print_documents(&pl,  &doc, o->top_topics))
 				goto error_main;
 		}
 	}
 
+	if (o->server_address) {
+		if (!plsa_server_run_easy(&pl, &doc, o->server_address,
+		                          o->max_iter, o->tol, o->top_topics))
+			goto error_main;
+	}
+
+done_main:
 	docinfo_cleanup(&doc);
 	plsa_cleanup(&pl);
+	allreduce_cleanup(&ar);
 	return TRUE;
 
 error_main:
 	docinfo_cleanup(&doc);
 	plsa_cleanup(&pl);
+	allreduce_cleanup(&ar);
 	return FALSE;
 }
 
 int main(int argc, char **argv)
 {
-	char *docinfo_file, *plsa_file;
-	char *training_file, *ignore_file;
-	char *test_file;
-        unsigned int top_words, top_topics;
-	unsigned int num_topics, max_iter;
-	double tol;
+	plsa_options o;
 	option opts[] = {
 		{ "-d", NULL, ARGTYPE_FILE,
 		  "specify the DOCINFO file" },
@@ -571,6 +4198,76 @@ int main(int argc, char **argv)
 		  "specify the test file" },
 		{ "-z", NULL, ARGTYPE_UINT,
 		  "the number of topics per document" },
+		{ "-j", NULL, ARGTYPE_UINT,
+		  "the number of threads" },
+		{ "-s", NULL, ARGTYPE_UINT,
+		  "parallel strategy (0 = replicate, 1 = partition)" },
+		{ "-k", NULL, ARGTYPE_STR,
+		  "kernels (auto, scalar, sse2, avx2, avx512)" },
+		{ "-f", NULL, ARGTYPE_UINT,
+		  "1 to store the tables in single precision" },
+		{ "-r", NULL, ARGTYPE_DBL,
+		  "prune the topic-word entries below this value" },
+		{ "-u", NULL, ARGTYPE_UINT,
+		  "keep only this number of words per topic when pruning" },
+		{ "-x", NULL, ARGTYPE_UINT,
+		  "the number of iterations before pruning" },
+		{ "-b", NULL, ARGTYPE_UINT,
+		  "the number of documents per mini-batch (online EM)" },
+		{ "-l", NULL, ARGTYPE_UINT,
+		  "the number of iterations per mini-batch" },
+		{ "-c", NULL, ARGTYPE_DBL,
+		  "the decay kappa of the online step size" },
+		{ "-g", NULL, ARGTYPE_DBL,
+		  "the delay tau0 of the online step size" },
+		{ "-a", NULL, ARGTYPE_STR,
+		  "serve the model on this address (unix:PATH or tcp:PORT)" },
+		{ "-o", NULL, ARGTYPE_UINT,
+		  "1 to accelerate the EM with SQUAREM" },
+		{ "-v", NULL, ARGTYPE_FILE,
+		  "save the PLSA in the mapped format to this file" },
+		{ "-V", NULL, ARGTYPE_UINT,
+		  "1 to verify the checksums of mapped PLSA files" },
+		{ "-P", NULL, ARGTYPE_UINT,
+		  "the number of processes training together" },
+		{ "-R", NULL, ARGTYPE_UINT,
+		  "the rank of this process, from 0" },
+		{ "-A", NULL, ARGTYPE_STR,
+		  "the address of the first process (unix:PATH or "
+		  "tcp:[HOST:]PORT)" },
+		{ "-C", NULL, ARGTYPE_UINT,
+		  "the number of iterations (mini-batches with -b) "
+		  "between checkpoints" },
+		{ "-T", NULL, ARGTYPE_DBL,
+		  "the number of seconds between checkpoints" },
+		{ "-n", NULL, ARGTYPE_UINT,
+		  "the number of random restarts" },
+		{ "-N", NULL, ARGTYPE_UINT,
+		  "the number of iterations before dropping the weaker "
+		  "half of the restarts" },
+		{ "-Q", NULL, ARGTYPE_STR,
+		  "train one model for each of these numbers of topics "
+		  "(e.g. 20,40,80)" },
+		{ "-M", NULL, ARGTYPE_UINT,
+		  "drop the words seen less than this number of times" },
+		{ "-D", NULL, ARGTYPE_DBL,
+		  "drop the words found in more than this fraction of the "
+		  "documents" },
+		{ "-W", NULL, ARGTYPE_UINT,
+		  "keep only this number of most frequent words" },
+		{ "-F", NULL, ARGTYPE_DBL,
+		  "drop the topics of a document below this value" },
+		{ "-E", NULL, ARGTYPE_DBL,
+		  "skip the documents whose topics move less than this "
+		  "value" },
+		{ "-K", NULL, ARGTYPE_UINT,
+		  "the number of iterations between full passes when "
+		  "skipping documents" },
+		{ "-Z", NULL, ARGTYPE_DBL,
+		  "freeze the topics that move less than this value" },
+		{ "-S", NULL, ARGTYPE_UINT,
+		  "the seed of the random numbers (0, the default, to take "
+		  "it from the clock)" },
 		{ "--help", NULL, ARGTYPE_NONE,
 		  "print this help" },
 	};
@@ -581,29 +4278,49 @@ int main(int argc, char **argv)
 	setvbuf(stdout, 0, _IONBF, 0);
 	setvbuf(stderr, 0, _IONBF, 0);
 #endif
-	opts[0].ptr = &docinfo_file;
-	opts[1].ptr = &training_file;
-	opts[2].ptr = &ignore_file;
-	opts[3].ptr = &plsa_file;
-	opts[4].ptr = &num_topics;
-	opts[5].ptr = &max_iter;
-	opts[6].ptr = &tol;
-	opts[7].ptr = &top_words;
-	opts[8].ptr = &test_file;
-	opts[9].ptr = &top_topics;
-
-	genrand_randomize();
-
-	docinfo_file = NULL;
-	plsa_file = NULL;
-	training_file = NULL;
-	ignore_file = NULL;
-	test_file = NULL;
-	top_words = 0;
-	top_topics = 0;
-	num_topics = 0;
-	max_iter = 0;
-	tol = 0;
+	opts[0].ptr = &o.docinfo_file;
+	opts[1].ptr = &o.training_file;
+	opts[2].ptr = &o.ignore_file;
+	opts[3].ptr = &o.plsa_file;
+	opts[4].ptr = &o.num_topics;
+	opts[5].ptr = &o.max_iter;
+	opts[6].ptr = &o.tol;
+	opts[7].ptr = &o.top_words;
+	opts[8].ptr = &o.test_file;
+	opts[9].ptr = &o.top_topics;
+	opts[10].ptr = &o.num_threads;
+	opts[11].ptr = &o.parallel_mode;
+	opts[12].ptr = &o.kernels_name;
+	opts[13].ptr = &o.single_precision;
+	opts[14].ptr = &o.prune_threshold;
+	opts[15].ptr = &o.prune_top;
+	opts[16].ptr = &o.prune_after;
+	opts[17].ptr = &o.batch_size;
+	opts[18].ptr = &o.batch_iterations;
+	opts[19].ptr = &o.kappa;
+	opts[20].ptr = &o.tau0;
+	opts[21].ptr = &o.server_address;
+	opts[22].ptr = &o.accelerate;
+	opts[23].ptr = &o.mapped_file;
+	opts[24].ptr = &o.verify_checksums;
+	opts[25].ptr = &o.num_processes;
+	opts[26].ptr = &o.rank;
+	opts[27].ptr = &o.group_address;
+	opts[28].ptr = &o.checkpoint_interval;
+	opts[29].ptr = &o.checkpoint_seconds;
+	opts[30].ptr = &o.num_restarts;
+	opts[31].ptr = &o.restart_iterations;
+	opts[32].ptr = &o.sweep_topics;
+	opts[33].ptr = &o.min_count;
+	opts[34].ptr = &o.max_df;
+	opts[35].ptr = &o.max_words;
+	opts[36].ptr = &o.dt_floor;
+	opts[37].ptr = &o.residual;
+	opts[38].ptr = &o.residual_interval;
+	opts[39].ptr = &o.topic_tol;
+	opts[40].ptr = &o.seed;
+
+	plsa_options_reset(&o);
 
 	num_opts = sizeof(opts) / sizeof(option);
 	if (argc == 1) {
@@ -613,9 +4330,13 @@ int main(int argc, char **argv)
 	ret = process_args(argc, argv, opts, num_opts);
 	if (ret <= 0) return ret;
 
-	if (!do_main(docinfo_file, training_file, ignore_file,
-	             plsa_file, num_topics, max_iter, tol,
-	             top_words, test_file, top_topics))
+	/* A fixed seed repeats the same run */
+	if (o.seed > 0)
+		init_genrand((unsigned long) o.seed);
+	else
+		genrand_randomize();
+
+	if (!do_main(&o))
 		return -1;
 
 	return 0;
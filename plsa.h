@@ -4,23 +4,136 @@
 
 #include <stdio.h>
 #include "docinfo.h"
+#include "mapfile.h"
+#include "allreduce.h"
+#include "parallel.h"
+#include "topk.h"
+#include "random.h"
+
+/* Constants */
+#define PLSA_PARALLEL_REPLICATE   0
+#define PLSA_PARALLEL_PARTITION   1
+
+#define PLSA_MAGIC                0x41534C50 /* "PLSA" */
+#define PLSA_VERSION              4
+
+/* Default number of iterations between two full passes of the
+ * residual EM
+ */
+#define PLSA_RESIDUAL_INTERVAL    5
 
 /* Data structures and types */
-typedef
-struct plsa_topmost_st {
-	unsigned int idx;
-	double val;
-} plsa_topmost;
+typedef topk_item plsa_topmost;
 
 typedef
 struct plsa_st {
 	unsigned int num_words;
 	unsigned int num_documents;
 	unsigned int num_topics;
+	unsigned int num_threads;
+	int parallel_mode;
+
+	/* The threads of the steps, started by plsa_allocate_workers()
+	 * (NULL with a single thread)
+	 */
+	parallel_pool *pool;
+	int precision; /* KERNEL_DOUBLE or KERNEL_FLOAT */
+	int accelerate; /* extrapolate the EM with SQUAREM */
+	double prune_threshold;
+	unsigned int prune_top, prune_after;
+
+	/* Online EM: step size rho = (tau0 + t)^(-kappa) */
+	unsigned int batch_size, batch_iterations;
+	double kappa, tau0;
 	double likelihood, old_likelihood;
 	plsa_topmost *top;
-	double *dt, *tw;
-	double *dt2, *tw2;
+
+	/* dt[document * num_topics + topic], tw[word * num_topics + topic] */
+	void *dt, *tw;
+	void *dt2, *tw2;
+
+	/* If the topic-word tables are sparse, tw[tw_start[word] + i]
+	 * is the entry of the topic tw_topic[tw_start[word] + i].
+	 */
+	unsigned int *tw_start, *tw_topic;
+
+	/* The topics of the document-topic table below `dt_floor' are
+	 * dropped, and the row of each document is then gone over along
+	 * its topics dt_topic[dt_start[document]], ...,
+	 * dt_topic[dt_start[document + 1] - 1] (NULL if not known).
+	 */
+	double dt_floor;
+	size_t *dt_start;
+	unsigned int *dt_topic;
+
+	/* Residual EM: the documents whose row of `dt' moved less than
+	 * `residual' (in L1 norm) are only visited by the full passes,
+	 * one every `residual_interval' iterations. In between, their
+	 * contributions to `tw2' and to the likelihood are the ones of
+	 * the last full pass, kept in `tw_frozen' and `frozen'. The
+	 * documents doc_list[0], ..., doc_list[num_skipped - 1] are
+	 * skipped, and doc_weight[i] is the number of wordstats of the
+	 * documents before doc_list[i].
+	 */
+	double residual;
+	unsigned int residual_interval, residual_pass, num_skipped;
+	double *doc_residual;
+	unsigned int *doc_start, *doc_list, *doc_weight;
+	void *tw_frozen;
+	double frozen[2];
+
+	/* A topic whose column of `tw' moved less than `topic_tol' (in
+	 * L1 norm) in an iteration is frozen, and keeps its column until
+	 * all the topics are checked again. The topics topic_list[0],
+	 * ..., topic_list[num_free - 1] are still updated.
+	 */
+	double topic_tol;
+	unsigned int topic_pass, num_free;
+	unsigned int *topic_list;
+	double *topic_delta;
+	void *tw2_local;
+	double *partial, *sums;
+	unsigned int *order;
+	double *ratio;
+
+	/* The tables may point inside a mapped model file */
+	mapfile map;
+	int verify_checksums;
+
+	/* The processes that train the model together, each one on its
+	 * own shard of the documents, or NULL. The shard starts at the
+	 * document `shard_first' of the `shard_total' documents.
+	 */
+	allreduce *ar;
+	unsigned int shard_first, shard_total;
+
+	/* A checkpoint is written every `checkpoint_interval' iterations
+	 * and every `checkpoint_seconds' seconds (0 for never).
+	 */
+	unsigned int checkpoint_interval;
+	double checkpoint_seconds;
+
+	/* The number of iterations of a training saved by a checkpoint,
+	 * or 0 if the training is complete, and the state of the random
+	 * generator at that point.
+	 */
+	unsigned int iteration;
+	unsigned int rng_state[GENRAND_STATE_SIZE];
+
+	/* The position of an interrupted online training, whose
+	 * `iteration' counts the mini-batches: the pass, the mini-batches
+	 * of that pass already seen, and the sum of their likelihoods
+	 * and the total of their weights.
+	 */
+	unsigned int online_pass, online_batch;
+	double online_sum, online_weight;
+
+	/* Random restarts: `num_restarts' models are trained together
+	 * from different random starts, and the weaker half is dropped
+	 * every time the number of iterations reaches
+	 * `restart_iterations' times a power of two (0 for never).
+	 */
+	unsigned int num_restarts, restart_iterations;
 } plsa;
 
 /* Functions */
@@ -31,6 +144,26 @@ void plsa_cleanup(plsa *pl);
 int plsa_train(plsa *pl, const docinfo *doc, unsigned int num_topics,
                unsigned int max_iterations, double tol, int retrain_dt,
                const char *plsa_filename);
+int plsa_train_restarts(plsa *pl, const docinfo *doc,
+                        unsigned int num_topics,
+                        unsigned int max_iterations, double tol,
+                        const char *plsa_filename);
+int plsa_train_sweep(plsa *models, unsigned int num_models,
+                     const docinfo *doc, unsigned int max_iterations,
+                     double tol, const char *plsa_filename,
+                     unsigned int *iterations, double *times);
+int plsa_train_online(plsa *pl, docinfo *doc, const char *master_file,
+                      unsigned int num_topics, unsigned int max_passes,
+                      double tol, const char *plsa_filename);
+int plsa_fold_in(plsa *pl, const docinfo *doc, unsigned int max_iterations,
+                 double tol, double *likelihood, unsigned int *iterations);
+unsigned int plsa_top_topics(const plsa *pl, unsigned int document,
+                             plsa_topmost *top, unsigned int num);
+int plsa_top_words(const plsa *pl, unsigned int num, plsa_topmost *top,
+                   unsigned int *lengths);
+int plsa_top_documents(const plsa *pl, unsigned int first,
+                       unsigned int count, unsigned int num,
+                       plsa_topmost *top);
 int plsa_print_topics(plsa *pl, const docinfo *doc, unsigned top_words);
 int plsa_print_documents(plsa *pl, const docinfo *doc, unsigned top_topics);
 
@@ -38,9 +171,13 @@ int plsa_save(const plsa *pl, FILE *fp);
 int plsa_save_easy(const plsa *pl, const char *filename);
 int plsa_load(plsa *pl, FILE *fp);
 int plsa_load_easy(plsa *pl, const char *filename);
+int plsa_save_mapped(const plsa *pl, const char *filename);
 
 int plsa_build_cached(plsa *pl, const char *plsa_file, const docinfo *doc,
                       unsigned int num_topics, unsigned int max_iter,
                       double tol);
+int plsa_build_online(plsa *pl, const char *plsa_file, docinfo *doc,
+                      const char *master_file, unsigned int num_topics,
+                      unsigned int max_iter, double tol);
 
 #endif /* __PLSA_H */
@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "plsa_server.h"
+#include "transport.h"
+#include "utils.h"
+
+static volatile sig_atomic_t plsa_server_stop;
+
+static
+void plsa_server_signal(int sig)
+{
+	plsa_server_stop = sig;
+}
+
+void plsa_server_reset(plsa_server *srv)
+{
+	srv->pl = NULL;
+	srv->doc = NULL;
+	srv->listen_fd = -1;
+	srv->unix_path = NULL;
+	srv->max_iterations = 50;
+	srv->tol = 1e-4;
+	srv->top_topics = 0;
+	srv->max_batch = 256;
+	srv->clients = NULL;
+	srv->clients_capacity = 0;
+	srv->fds = NULL;
+	srv->requests = NULL;
+	srv->num_requests = 0;
+	srv->next_doc_id = 0;
+	srv->top = NULL;
+	srv->iterations = NULL;
+}
+
+int plsa_server_initialize(plsa_server *srv, plsa *pl, docinfo *doc)
+{
+	plsa_server_reset(srv);
+	srv->pl = pl;
+	srv->doc = doc;
+	return TRUE;
+}
+
+static
+void plsa_server_close_client(plsa_server *srv, unsigned int idx)
+{
+	plsa_client *client = &srv->clients[idx];
+
+	if (client->fd >= 0) close(client->fd);
+	client->fd = -1;
+	client->closing = FALSE;
+	client->input_length = 0;
+	client->output_length = 0;
+}
+
+void plsa_server_cleanup(plsa_server *srv)
+{
+	unsigned int i;
+
+	for (i = 0; i < srv->clients_capacity; i++) {
+		plsa_server_close_client(srv, i);
+		if (srv->clients[i].input) free(srv->clients[i].input);
+		if (srv->clients[i].output) free(srv->clients[i].output);
+	}
+	if (srv->listen_fd >= 0) close(srv->listen_fd);
+	if (srv->unix_path) {
+		unlink(srv->unix_path);
+		free(srv->unix_path);
+	}
+	if (srv->clients) free(srv->clients);
+	if (srv->fds) free(srv->fds);
+	if (srv->requests) free(srv->requests);
+	if (srv->top) free(srv->top);
+	if (srv->iterations) free(srv->iterations);
+	plsa_server_reset(srv);
+}
+
+static
+int plsa_server_nonblocking(int fd)
+{
+	int flags;
+
+	flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		error("could not make socket non-blocking: %s", strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Listens on `address', which is either "unix:PATH" for a local
+ * socket or "tcp:PORT" for a port on the loopback interface.
+ */
+int plsa_server_listen(plsa_server *srv, const char *address)
+{
+	srv->listen_fd = transport_listen(address, &srv->unix_path);
+	if (srv->listen_fd < 0)
+		return FALSE;
+
+	return plsa_server_nonblocking(srv->listen_fd);
+}
+
+static
+int plsa_server_reserve(char **buffer, unsigned int *capacity,
+                        unsigned int size)
+{
+	unsigned int new_capacity;
+	char *ptr;
+
+	if (size <= *capacity) return TRUE;
+	new_capacity = MAX(2 * *capacity, MAX(size, 256));
+	ptr = (char *) xrealloc(*buffer, new_capacity);
+	if (!ptr) return FALSE;
+
+	*buffer = ptr;
+	*capacity = new_capacity;
+	return TRUE;
+}
+
+static
+int plsa_server_write(plsa_client *client, const char *str)
+{
+	unsigned int len;
+
+	len = (unsigned int) strlen(str);
+	if (!plsa_server_reserve(&client->output, &client->output_capacity,
+	                         client->output_length + len))
+		return FALSE;
+	memcpy(&client->output[client->output_length], str, len);
+	client->output_length += len;
+	return TRUE;
+}
+
+static
+void plsa_server_flush(plsa_server *srv, unsigned int idx)
+{
+	plsa_client *client = &srv->clients[idx];
+	ssize_t ret;
+
+	while (client->fd >= 0 && client->output_length > 0) {
+		ret = send(client->fd, client->output, client->output_length,
+		           MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				plsa_server_close_client(srv, idx);
+			return;
+		}
+		client->output_length -= (unsigned int) ret;
+		memmove(client->output, &client->output[ret],
+		        client->output_length);
+	}
+}
+
+static
+int plsa_server_accept(plsa_server *srv)
+{
+	plsa_client *clients;
+	struct pollfd *fds;
+	unsigned int i, new_capacity;
+	int fd;
+
+	while (TRUE) {
+		fd = accept(srv->listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return TRUE;
+			error("could not accept connection: %s",
+			      strerror(errno));
+			return TRUE;
+		}
+		if (!plsa_server_nonblocking(fd)) {
+			close(fd);
+			continue;
+		}
+
+		for (i = 0; i < srv->clients_capacity; i++)
+			if (srv->clients[i].fd < 0) break;
+
+		if (i == srv->clients_capacity) {
+			new_capacity = MAX(2 * srv->clients_capacity, 16);
+			clients = (plsa_client *) xrealloc(srv->clients,
+			          new_capacity * sizeof(plsa_client));
+			if (!clients) goto error_accept;
+			srv->clients = clients;
+
+			fds = (struct pollfd *) xrealloc(srv->fds,
+			      (new_capacity + 1) * sizeof(struct pollfd));
+			if (!fds) goto error_accept;
+			srv->fds = fds;
+
+			for (; i < new_capacity; i++) {
+				clients[i].fd = -1;
+				clients[i].closing = FALSE;
+				clients[i].input = NULL;
+				clients[i].input_length = 0;
+				clients[i].input_capacity = 0;
+				clients[i].output = NULL;
+				clients[i].output_length = 0;
+				clients[i].output_capacity = 0;
+			}
+			i = srv->clients_capacity;
+			srv->clients_capacity = new_capacity;
+		}
+		srv->clients[i].fd = fd;
+	}
+
+error_accept:
+	close(fd);
+	return FALSE;
+}
+
+static
+unsigned int plsa_server_bucket(double latency)
+{
+	unsigned long us;
+	unsigned int e;
+
+	us = (latency > 0) ? (unsigned long) (latency * 1e6) : 0;
+	if (us < 8) return (unsigned int) us;
+
+	for (e = 0; (us >> e) >= 16; e++);
+	return MIN(8 * (e + 1) + (unsigned int) ((us >> e) - 8),
+	           PLSA_SERVER_HISTOGRAM_SIZE - 1);
+}
+
+/* Returns the upper bound (in microseconds) of the bucket `b'. */
+static
+double plsa_server_bucket_limit(unsigned int b)
+{
+	if (b < 8) return (double) (b + 1);
+	return ldexp((double) (9 + b % 8), (int) (b / 8 - 1));
+}
+
+static
+double plsa_server_percentile(const plsa_server *srv, double p)
+{
+	unsigned long count, total;
+	unsigned int b;
+
+	total = 0;
+	for (b = 0; b < PLSA_SERVER_HISTOGRAM_SIZE; b++)
+		total += srv->histogram[b];
+	if (total == 0) return 0;
+
+	count = 0;
+	for (b = 0; b < PLSA_SERVER_HISTOGRAM_SIZE; b++) {
+		count += srv->histogram[b];
+		if ((double) count >= p * (double) total)
+			break;
+	}
+	return MIN(plsa_server_bucket_limit(b), srv->max_latency * 1e6);
+}
+
+/* Folds in all the pending documents at once and answers the
+ * requests in the order they were received.
+ */
+static
+int plsa_server_process(plsa_server *srv)
+{
+	plsa_request *request;
+	plsa_client *client;
+	unsigned int i, k, num, iterations;
+	double likelihood, now, latency;
+	char buffer[64];
+
+	if (srv->num_requests == 0) return TRUE;
+
+	if (docinfo_num_documents(srv->doc) > 0) {
+		if (!plsa_fold_in(srv->pl, srv->doc, srv->max_iterations,
+		                  srv->tol, &likelihood, srv->iterations))
+			return FALSE;
+	}
+
+	now = get_time();
+	for (i = 0; i < srv->num_requests; i++) {
+		request = &srv->requests[i];
+		client = &srv->clients[request->client];
+
+		num = 0;
+		if (request->document) {
+			num = plsa_top_topics(srv->pl, request->document,
+			                      srv->top, srv->top_topics);
+			iterations = srv->iterations[request->document - 1];
+			srv->num_iterations += iterations;
+			srv->num_folded++;
+			srv->max_iterations_used = MAX(srv->max_iterations_used,
+			                               iterations);
+		}
+
+		if (client->fd >= 0) {
+			if (!plsa_server_write(client, "OK")) return FALSE;
+			for (k = 0; k < num; k++) {
+				sprintf(buffer, " %u:%.4f", srv->top[k].idx + 1,
+				        srv->top[k].val);
+				if (!plsa_server_write(client, buffer))
+					return FALSE;
+			}
+			if (!plsa_server_write(client, "\n")) return FALSE;
+		}
+
+		latency = now - request->arrival;
+		srv->histogram[plsa_server_bucket(latency)]++;
+		srv->max_latency = MAX(srv->max_latency, latency);
+	}
+
+	srv->num_documents += srv->num_requests;
+	srv->num_batches++;
+	srv->num_requests = 0;
+	return TRUE;
+}
+
+static
+int plsa_server_add_document(plsa_server *srv, unsigned int idx, char *line,
+                             double arrival)
+{
+	plsa_request *request;
+	unsigned int num_documents;
+	char *word;
+
+	if (srv->num_requests == srv->max_batch) {
+		if (!plsa_server_process(srv)) return FALSE;
+	}
+	if (srv->num_requests == 0)
+		docinfo_clear(srv->doc, TRUE);
+
+	num_documents = docinfo_num_documents(srv->doc);
+	srv->next_doc_id++;
+	while (*line) {
+		while (isspace((unsigned char) *line)) line++;
+		if (!*line) break;
+
+		word = line;
+		while (*line && !isspace((unsigned char) *line)) line++;
+		if (*line) *line++ = '\0';
+
+		/* Unknown words carry no information about the topics */
+		if (!hashtable_find(&srv->doc->ht, word, FALSE))
+			continue;
+		if (!docinfo_add(srv->doc, word, srv->next_doc_id, FALSE))
+			return FALSE;
+	}
+
+	request = &srv->requests[srv->num_requests++];
+	request->client = idx;
+	request->arrival = arrival;
+	request->document = 0;
+	if (docinfo_num_documents(srv->doc) > num_documents)
+		request->document = docinfo_num_documents(srv->doc);
+	return TRUE;
+}
+
+static
+int plsa_server_stats(plsa_server *srv, plsa_client *client)
+{
+	unsigned int i, num_clients;
+	double uptime;
+	char buffer[128];
+
+	num_clients = 0;
+	for (i = 0; i < srv->clients_capacity; i++)
+		if (srv->clients[i].fd >= 0) num_clients++;
+
+	uptime = get_time() - srv->start_time;
+	sprintf(buffer, "commands %lu\ndocuments %lu\nbatches %lu\n",
+	        srv->num_commands, srv->num_documents, srv->num_batches);
+	if (!plsa_server_write(client, buffer)) return FALSE;
+
+	sprintf(buffer, "errors %lu\nclients %u\nuptime %.3f\n",
+	        srv->num_errors, num_clients, uptime);
+	if (!plsa_server_write(client, buffer)) return FALSE;
+
+	sprintf(buffer, "documents_per_second %.2f\nmean_batch_size %.2f\n",
+	        (uptime > 0) ? (double) srv->num_documents / uptime : 0.0,
+	        (srv->num_batches > 0) ? (double) srv->num_documents
+	                                 / (double) srv->num_batches : 0.0);
+	if (!plsa_server_write(client, buffer)) return FALSE;
+
+	sprintf(buffer, "iterations_mean %.2f\niterations_max %u\n",
+	        (srv->num_folded > 0) ? (double) srv->num_iterations
+	                                / (double) srv->num_folded : 0.0,
+	        srv->max_iterations_used);
+	if (!plsa_server_write(client, buffer)) return FALSE;
+
+	sprintf(buffer, "latency_p50_us %.0f\nlatency_p90_us %.0f\n",
+	        plsa_server_percentile(srv, 0.50),
+	        plsa_server_percentile(srv, 0.90));
+	if (!plsa_server_write(client, buffer)) return FALSE;
+
+	sprintf(buffer, "latency_p99_us %.0f\nlatency_max_us %.0f\nEND\n",
+	        plsa_server_percentile(srv, 0.99), srv->max_latency * 1e6);
+	return plsa_server_write(client, buffer);
+}
+
+static
+int plsa_server_command(plsa_server *srv, unsigned int idx, char *line,
+                        double arrival)
+{
+	plsa_client *client = &srv->clients[idx];
+
+	srv->num_commands++;
+	if (strncmp(line, "DOC", 3) == 0 &&
+	    (line[3] == '\0' || isspace((unsigned char) line[3])))
+		return plsa_server_add_document(srv, idx, &line[3], arrival);
+
+	/* The other commands are answered after the pending documents */
+	if (!plsa_server_process(srv)) return FALSE;
+
+	if (strcmp(line, "STATS") == 0)
+		return plsa_server_stats(srv, client);
+
+	if (strcmp(line, "QUIT") == 0) {
+		client->closing = TRUE;
+		return TRUE;
+	}
+
+	srv->num_errors++;
+	return plsa_server_write(client, "ERR unknown command\n");
+}
+
+static
+int plsa_server_read(plsa_server *srv, unsigned int idx)
+{
+	plsa_client *client = &srv->clients[idx];
+	unsigned int start, end;
+	ssize_t ret;
+	double arrival;
+	int eof = FALSE;
+
+	while (TRUE) {
+		if (!plsa_server_reserve(&client->input,
+		                         &client->input_capacity,
+		                         client->input_length + 4096))
+			return FALSE;
+		ret = recv(client->fd, &client->input[client->input_length],
+		           client->input_capacity - client->input_length, 0);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				plsa_server_close_client(srv, idx);
+			break;
+		}
+		if (ret == 0) {
+			eof = TRUE;
+			break;
+		}
+		client->input_length += (unsigned int) ret;
+		if (client->input_length > PLSA_SERVER_MAX_LINE) break;
+	}
+
+	arrival = get_time();
+	start = 0;
+	for (end = 0; end < client->input_length; end++) {
+		if (client->input[end] != '\n') continue;
+
+		client->input[end] = '\0';
+		if (end > start && client->input[end - 1] == '\r')
+			client->input[end - 1] = '\0';
+		if (client->fd < 0 || client->closing) break;
+		if (!plsa_server_command(srv, idx, &client->input[start],
+		                         arrival))
+			return FALSE;
+		start = end + 1;
+	}
+	if (eof) client->closing = TRUE;
+
+	if (client->input_length - start > PLSA_SERVER_MAX_LINE) {
+		srv->num_errors++;
+		plsa_server_write(client, "ERR line too long\n");
+		client->closing = TRUE;
+		start = client->input_length;
+	}
+	client->input_length -= start;
+	memmove(client->input, &client->input[start], client->input_length);
+	return TRUE;
+}
+
+/* Serves requests until the process receives SIGINT or SIGTERM. */
+int plsa_server_run(plsa_server *srv)
+{
+	struct sigaction sa, old_int, old_term;
+	unsigned int i;
+	int ret = FALSE;
+
+	srv->top = (plsa_topmost *) xmalloc(srv->pl->num_topics
+	                                    * sizeof(plsa_topmost));
+	srv->requests = (plsa_request *) xmalloc(srv->max_batch
+	                                         * sizeof(plsa_request));
+	srv->iterations = (unsigned int *) xmalloc(srv->max_batch
+	                                           * sizeof(unsigned int));
+	srv->fds = (struct pollfd *) xmalloc(sizeof(struct pollfd));
+	if (!srv->top || !srv->requests || !srv->iterations || !srv->fds)
+		return FALSE;
+
+	if (srv->top_topics == 0 || srv->top_topics > srv->pl->num_topics)
+		srv->top_topics = srv->pl->num_topics;
+
+	srv->start_time = get_time();
+	srv->max_latency = 0;
+	srv->num_commands = srv->num_documents = 0;
+	srv->num_batches = srv->num_errors = 0;
+	srv->num_iterations = srv->num_folded = 0;
+	srv->max_iterations_used = 0;
+	memset(srv->histogram, 0, sizeof(srv->histogram));
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = &plsa_server_signal;
+	sigemptyset(&sa.sa_mask);
+	plsa_server_stop = 0;
+	sigaction(SIGINT, &sa, &old_int);
+	sigaction(SIGTERM, &sa, &old_term);
+
+	while (!plsa_server_stop) {
+		srv->fds[0].fd = srv->listen_fd;
+		srv->fds[0].events = POLLIN;
+		for (i = 0; i < srv->clients_capacity; i++) {
+			srv->fds[i + 1].fd = srv->clients[i].fd;
+			srv->fds[i + 1].events = POLLIN;
+			if (srv->clients[i].output_length > 0)
+				srv->fds[i + 1].events |= POLLOUT;
+			srv->fds[i + 1].revents = 0;
+		}
+
+		if (poll(srv->fds, srv->clients_capacity + 1, -1) < 0) {
+			if (errno == EINTR) continue;
+			error("poll failed: %s", strerror(errno));
+			goto error_run;
+		}
+
+		/* New clients are accepted after the current batch,
+		 * so that the slots of closed clients are not reused
+		 * while there are requests pending for them.
+		 */
+		for (i = 0; i < srv->clients_capacity; i++) {
+			if (srv->clients[i].fd < 0) continue;
+			if (srv->fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+				if (!plsa_server_read(srv, i))
+					goto error_run;
+			}
+		}
+
+		if (!plsa_server_process(srv))
+			goto error_run;
+
+		for (i = 0; i < srv->clients_capacity; i++) {
+			plsa_server_flush(srv, i);
+			if (srv->clients[i].closing &&
+			    srv->clients[i].output_length == 0)
+				plsa_server_close_client(srv, i);
+		}
+
+		if (srv->fds[0].revents & POLLIN) {
+			if (!plsa_server_accept(srv))
+				goto error_run;
+		}
+	}
+	ret = TRUE;
+
+error_run:
+	sigaction(SIGINT, &old_int, NULL);
+	sigaction(SIGTERM, &old_term, NULL);
+	return ret;
+}
+
+int plsa_server_run_easy(plsa *pl, docinfo *doc, const char *address,
+                         unsigned int max_iterations, double tol,
+                         unsigned int top_topics)
+{
+	plsa_server srv;
+
+	if (!plsa_server_initialize(&srv, pl, doc))
+		return FALSE;
+
+	srv.max_iterations = max_iterations;
+	srv.tol = tol;
+	srv.top_topics = top_topics;
+
+	if (!plsa_server_listen(&srv, address))
+		goto error_server;
+
+	printf("Serving on %s\n", address);
+	fflush(stdout);
+
+	if (!plsa_server_run(&srv))
+		goto error_server;
+
+	printf("Server stopped\n");
+	plsa_server_cleanup(&srv);
+	return TRUE;
+
+error_server:
+	plsa_server_cleanup(&srv);
+	return FALSE;
+}
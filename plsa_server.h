@@ -0,0 +1,76 @@
+#ifndef __PLSA_SERVER_H
+#define __PLSA_SERVER_H
+
+#include <poll.h>
+
+#include "plsa.h"
+#include "docinfo.h"
+
+/* Constants */
+#define PLSA_SERVER_HISTOGRAM_SIZE   256
+#define PLSA_SERVER_MAX_LINE         (1 << 20)
+
+/* Data structures and types */
+typedef
+struct plsa_client_st {
+	int fd;
+	int closing;
+	char *input;
+	unsigned int input_length, input_capacity;
+	char *output;
+	unsigned int output_length, output_capacity;
+} plsa_client;
+
+typedef
+struct plsa_request_st {
+	unsigned int client;
+	unsigned int document; /* document in the batch, or 0 if empty */
+	double arrival;
+} plsa_request;
+
+typedef
+struct plsa_server_st {
+	plsa *pl;
+	docinfo *doc;
+	int listen_fd;
+	char *unix_path;
+
+	unsigned int max_iterations;
+	double tol;
+	unsigned int top_topics;
+	unsigned int max_batch;
+
+	plsa_client *clients;
+	unsigned int clients_capacity;
+	struct pollfd *fds;
+
+	plsa_request *requests;
+	unsigned int num_requests;
+	unsigned int next_doc_id;
+	plsa_topmost *top;
+	unsigned int *iterations;
+
+	/* Statistics: latencies are counted in buckets of microseconds,
+	 * with 8 buckets for each power of two.
+	 */
+	double start_time, max_latency;
+	unsigned long num_commands, num_documents;
+	unsigned long num_batches, num_errors;
+	unsigned long num_iterations, num_folded;
+	unsigned int max_iterations_used;
+	unsigned long histogram[PLSA_SERVER_HISTOGRAM_SIZE];
+} plsa_server;
+
+/* Functions */
+void plsa_server_reset(plsa_server *srv);
+int plsa_server_initialize(plsa_server *srv, plsa *pl, docinfo *doc);
+void plsa_server_cleanup(plsa_server *srv);
+
+int plsa_server_listen(plsa_server *srv, const char *address);
+int plsa_server_run(plsa_server *srv);
+
+int plsa_server_run_easy(plsa *pl, docinfo *doc, const char *address,
+                         unsigned int max_iterations, double tol,
+                         unsigned int top_topics);
+
+#endif /* __PLSA_SERVER_H */
@@ -0,0 +1,65 @@
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+
+# The programs are built in the parent directory
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+def write_corpus(filename, num_docs, num_topics = 8, num_words = 2000,
+                 seed = 1):
+	"""Writes `num_docs' documents, each one drawn from two of
+	`num_topics' topics of 200 words, in the format of the training
+	files."""
+	rng = random.Random(seed)
+	topics = [[rng.randrange(num_words) for i in range(200)]
+	          for t in range(num_topics)]
+	with open(filename, "w") as f:
+		for doc in range(num_docs):
+			chosen = rng.sample(range(num_topics), 2)
+			words = []
+			for i in range(rng.randint(30, 200)):
+				if rng.random() < 0.9:
+					topic = topics[rng.choice(chosen)]
+					words.append("w%d" % rng.choice(topic))
+				else:
+					words.append("w%d" % rng.randrange(num_words))
+			f.write("%d\n\n" % (doc + 1))
+			for i in range(0, len(words), 12):
+				f.write(" ".join(words[i:i + 12]) + "\n")
+			f.write("----------------\n")
+
+def run(args, workdir):
+	"""Runs the program with `args' in `workdir' and returns its
+	output, failing if it fails."""
+	proc = subprocess.Popen(args, cwd = workdir, stdout = subprocess.PIPE,
+	                        stderr = subprocess.STDOUT)
+	out = proc.communicate()[0].decode("ascii", "replace")
+	if proc.returncode != 0:
+		fail("`%s' exited with %d:\n%s" % (" ".join(args),
+		                                   proc.returncode, out))
+	return out
+
+def read_file(filename):
+	with open(filename, "rb") as f:
+		return f.read()
+
+def fail(message):
+	sys.stderr.write("FAIL: %s\n" % message)
+	sys.exit(1)
+
+def check(condition, message):
+	if not condition:
+		fail(message)
+
+class Workdir(object):
+	"""A temporary directory, removed at the end of the run."""
+	def __enter__(self):
+		self.path = tempfile.mkdtemp(prefix = "plsa-smoke-")
+		return self.path
+
+	def __exit__(self, *exc):
+		shutil.rmtree(self.path, ignore_errors = True)
+		return False
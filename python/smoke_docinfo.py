@@ -0,0 +1,36 @@
+"""Smoke run of the DOCINFO: the file built from the same corpus must
+be the same whatever the number of threads that read it."""
+import argparse
+import os
+
+from smoke import ROOT, Workdir, check, read_file, run, write_corpus
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument("--plsa", default = os.path.join(ROOT, "plsa"),
+	                    help = "Name of the plsa program")
+	parser.add_argument("--threads", default = "1,2,3,4,7",
+	                    help = "Numbers of threads to compare")
+	parser.add_argument("--num_docs", type = int, default = 20000,
+	                    help = "Number of documents, enough for several "
+	                           "parts of a megabyte")
+	args = parser.parse_args()
+
+	with Workdir() as workdir:
+		write_corpus(os.path.join(workdir, "train.txt"), args.num_docs,
+		             num_words = 20000)
+		with open(os.path.join(workdir, "ignore.txt"), "w") as f:
+			f.write("\n".join("w%d" % i for i in range(0, 20000, 7)))
+
+		first = None
+		for threads in args.threads.split(","):
+			docinfo_file = "train.docinfo.%s" % threads
+			run([args.plsa, "-d", docinfo_file, "-t", "train.txt",
+			     "-i", "ignore.txt", "-q", "2", "-m", "0",
+			     "-j", threads], workdir)
+			data = read_file(os.path.join(workdir, docinfo_file))
+			if first is None:
+				first = (threads, data)
+			check(data == first[1], "the DOCINFO of %s threads differs "
+			      "from the one of %s" % (threads, first[0]))
+	print("docinfo: OK")
@@ -0,0 +1,84 @@
+"""Smoke run of the PLSA trained by several processes: with the same
+seed, a group over a Unix socket and over TCP must save the model of a
+single process, up to rounding."""
+import argparse
+import os
+import re
+import subprocess
+
+from smoke import ROOT, Workdir, check, fail, run, write_corpus
+
+def trace(out):
+	values = [float(x) for x in
+	          re.findall(r"Iteration \d+: likelihood = (\S+)", out)]
+	check(values, "no iterations in:\n" + out)
+	return values
+
+def run_group(args, workdir, num_processes, address):
+	"""Runs `num_processes' processes of `args' on `address', and returns
+	the output of the one of rank 0."""
+	procs = []
+	for rank in range(num_processes):
+		procs.append(subprocess.Popen(args + ["-P", str(num_processes),
+		                                      "-R", str(rank),
+		                                      "-A", address],
+		                              cwd = workdir,
+		                              stdout = subprocess.PIPE,
+		                              stderr = subprocess.STDOUT))
+	outs = [proc.communicate()[0].decode("ascii", "replace")
+	        for proc in procs]
+	for rank, proc in enumerate(procs):
+		if proc.returncode != 0:
+			fail("the process of rank %d on `%s' exited with %d:\n%s"
+			     % (rank, address, proc.returncode, outs[rank]))
+	return outs[0]
+
+def top_words(out):
+	"""The words of each topic printed by `-w', with their
+	probabilities."""
+	pairs = re.findall(r"^(w\d+): (\S+)$", out, re.M)
+	check(pairs, "no topics in:\n" + out)
+	return [word for word, prob in pairs], [float(p) for w, p in pairs]
+
+def compare(name, values, expected, tol):
+	check(len(values) == len(expected), "%s: %d values, not %d"
+	      % (name, len(values), len(expected)))
+	for i in range(len(values)):
+		check(abs(values[i] - expected[i]) <= tol * abs(expected[i]),
+		      "%s: %g, not %g at %d" % (name, values[i], expected[i], i))
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument("--plsa", default = os.path.join(ROOT, "plsa"),
+	                    help = "Name of the plsa program")
+	parser.add_argument("--num_processes", type = int, default = 2,
+	                    help = "Number of processes of the group")
+	parser.add_argument("--port", type = int, default = 47311,
+	                    help = "TCP port of the process of rank 0")
+	parser.add_argument("--seed", type = int, default = 1,
+	                    help = "Seed of the random numbers")
+	parser.add_argument("--tol", type = float, default = 1e-6,
+	                    help = "Relative tolerance of the rounding")
+	args = parser.parse_args()
+
+	with Workdir() as workdir:
+		write_corpus(os.path.join(workdir, "train.txt"), 2000)
+		train = [args.plsa, "-d", "train.docinfo", "-t", "train.txt",
+		         "-q", "8", "-m", "30", "-e", "0",
+		         "-w", "10", "-S", str(args.seed)]
+		# The DOCINFO is built once, before the groups share it
+		out = run(train + ["-p", "single.plsa"], workdir)
+		single = trace(out)
+		words, probs = top_words(out)
+
+		for name, address in [
+			("unix", "unix:" + os.path.join(workdir, "plsa.group")),
+			("tcp", "tcp:%d" % args.port)]:
+			out = run_group(train + ["-p", name + ".plsa"], workdir,
+			                args.num_processes, address)
+			compare(name + " likelihoods", trace(out), single, args.tol)
+			group_words, group_probs = top_words(out)
+			check(group_words == words, "the top words of the group "
+			      "on %s differ from the ones of a single process" % name)
+			compare(name + " probabilities", group_probs, probs, args.tol)
+	print("group: OK")
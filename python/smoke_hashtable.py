@@ -0,0 +1,123 @@
+"""Smoke run of the hashtable of the vocabulary. A large vocabulary
+grows the table many times and must be counted exactly; the DOCINFO
+loaded from its file must train as the one just built; and a vocabulary
+pruned by `-M' or `-W', which compacts the table, must train as the
+vocabulary of a corpus that never had the words dropped."""
+import argparse
+import os
+import random
+import re
+
+from smoke import ROOT, Workdir, check, run
+
+def write_words(filename, docs):
+	with open(filename, "w") as f:
+		for i, words in enumerate(docs):
+			f.write("%d\n\n" % (i + 1))
+			for j in range(0, len(words), 12):
+				f.write(" ".join(words[j:j + 12]) + "\n")
+			f.write("----------------\n")
+
+def draw_docs(rng, num_docs, num_words):
+	"""Draws the words of `num_docs' documents, with a long tail of rare
+	words, some of them long enough to grow the strings too."""
+	docs = []
+	for doc in range(num_docs):
+		words = []
+		for i in range(rng.randint(30, 200)):
+			word = int(num_words ** rng.random())
+			if word % 7 == 0:
+				words.append("w%d_%s" % (word, "x" * (word % 61)))
+			else:
+				words.append("w%d" % word)
+		docs.append(words)
+	return docs
+
+def results(out):
+	"""The lines of the training and of the folding in."""
+	lines = [line for line in out.split("\n")
+	         if re.match(r"^(Iteration \d+: likelihood|w\S+: |Likelihood)",
+	                     line)]
+	check(lines, "no results in:\n" + out)
+	return lines
+
+def number(out, name):
+	match = re.search(r"^%s: (\d+)$" % name, out, re.M)
+	check(match, "no `%s' in:\n%s" % (name, out))
+	return int(match.group(1))
+
+def keep(docs, kept):
+	return [[word for word in words if word in kept] for words in docs]
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument("--plsa", default = os.path.join(ROOT, "plsa"),
+	                    help = "Name of the plsa program")
+	parser.add_argument("--num_docs", type = int, default = 4000,
+	                    help = "Number of documents")
+	parser.add_argument("--num_words", type = int, default = 200000,
+	                    help = "Size of the vocabulary the words are "
+	                           "drawn from")
+	parser.add_argument("--seed", type = int, default = 1,
+	                    help = "Seed of the random numbers")
+	args = parser.parse_args()
+
+	rng = random.Random(args.seed)
+	docs = draw_docs(rng, args.num_docs, args.num_words)
+	counts = {}
+	for words in docs:
+		for word in words:
+			counts[word] = counts.get(word, 0) + 1
+
+	with Workdir() as workdir:
+		write_words(os.path.join(workdir, "train.txt"), docs)
+		write_words(os.path.join(workdir, "test.txt"),
+		            draw_docs(rng, 200, 2 * args.num_words))
+		train = ["-q", "4", "-m", "10", "-e", "0", "-w", "5",
+		         "-y", "test.txt", "-S", str(args.seed)]
+
+		# Growth: every word is counted once
+		out = run([args.plsa, "-d", "train.docinfo", "-t", "train.txt"]
+		          + train, workdir)
+		check(number(out, "Num different words") == len(counts),
+		      "%d different words, not %d"
+		      % (number(out, "Num different words"), len(counts)))
+		check(number(out, "Total word count") == sum(counts.values()),
+		      "%d words, not %d" % (number(out, "Total word count"),
+		                            sum(counts.values())))
+		built = results(out)
+
+		# The round trip through the DOCINFO file
+		out = run([args.plsa, "-d", "train.docinfo", "-t", "train.txt"]
+		          + train, workdir)
+		check("Loading DOCINFO" in out, "the DOCINFO was not loaded:\n"
+		      + out)
+		check(results(out) == built, "the DOCINFO loaded from its file "
+		      "does not train as the one built")
+
+		# Compaction, by the counts and by the most frequent words
+		ranked = sorted(counts.values(), reverse = True)
+		max_words = len(counts) // 10
+		while ranked[max_words - 1] == ranked[max_words]:
+			max_words -= 1
+		for name, option, kept in [
+			("min_count", ["-M", "2"],
+			 set(word for word in counts if counts[word] >= 2)),
+			("max_words", ["-W", str(max_words)],
+			 set(word for word in counts
+			     if counts[word] >= ranked[max_words - 1]))]:
+			out = run([args.plsa, "-d", "train.docinfo", "-t", "train.txt"]
+			          + option + train, workdir)
+			check("Pruned vocabulary: %d of %d words kept"
+			      % (len(kept), len(counts)) in out,
+			      "%s: wrong pruning:\n%s" % (name, out))
+			pruned = results(out)
+
+			write_words(os.path.join(workdir, name + ".txt"),
+			            keep(docs, kept))
+			out = run([args.plsa, "-d", name + ".docinfo",
+			           "-t", name + ".txt"] + train, workdir)
+			check(pruned == results(out), "%s: the pruned vocabulary "
+			      "does not train as the corpus without the words "
+			      "dropped" % name)
+	print("hashtable: OK")
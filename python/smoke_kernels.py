@@ -0,0 +1,74 @@
+"""Smoke run of the kernels of the PLSA: with the same seed, the
+likelihoods of each iteration with the SIMD kernels this CPU supports
+must be the ones of the scalar kernels, up to rounding."""
+import argparse
+import os
+import re
+import subprocess
+
+from smoke import ROOT, Workdir, check, fail, run, write_corpus
+
+def trace(out):
+	values = [float(x) for x in
+	          re.findall(r"Iteration \d+: likelihood = (\S+)", out)]
+	check(values, "no iterations in:\n" + out)
+	return values
+
+def run_kernels(args, workdir, kernels):
+	"""Returns the output of `args' with `kernels', or None if this CPU
+	does not support them."""
+	proc = subprocess.Popen(args + ["-k", kernels], cwd = workdir,
+	                        stdout = subprocess.PIPE,
+	                        stderr = subprocess.STDOUT)
+	out = proc.communicate()[0].decode("ascii", "replace")
+	if proc.returncode != 0:
+		if "not supported by this CPU" in out:
+			return None
+		fail("`-k %s' exited with %d:\n%s" % (kernels, proc.returncode,
+		                                      out))
+	return out
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument("--plsa", default = os.path.join(ROOT, "plsa"),
+	                    help = "Name of the plsa program")
+	parser.add_argument("--kernels", default = "sse2,avx2,avx512",
+	                    help = "Kernels to compare with the scalar ones")
+	parser.add_argument("--seed", type = int, default = 1,
+	                    help = "Seed of the random numbers")
+	parser.add_argument("--tol", type = float, default = 1e-6,
+	                    help = "Relative tolerance in double precision")
+	parser.add_argument("--float_tol", type = float, default = 1e-4,
+	                    help = "Relative tolerance in single precision")
+	args = parser.parse_args()
+
+	with Workdir() as workdir:
+		write_corpus(os.path.join(workdir, "train.txt"), 2000)
+		run([args.plsa, "-d", "train.docinfo", "-t", "train.txt",
+		     "-q", "2", "-m", "0"], workdir)
+
+		tested = []
+		for precision, tol in [("0", args.tol), ("1", args.float_tol)]:
+			train = [args.plsa, "-d", "train.docinfo", "-q", "8",
+			         "-m", "30", "-e", "0", "-f", precision,
+			         "-S", str(args.seed)]
+			scalar = trace(run_kernels(train, workdir, "scalar"))
+			for kernels in args.kernels.split(","):
+				out = run_kernels(train, workdir, kernels)
+				if out is None:
+					continue
+				check("Using %s kernels" % kernels in out,
+				      "`-k %s' did not use them:\n%s" % (kernels, out))
+				values = trace(out)
+				check(len(values) == len(scalar), "`-k %s -f %s' ran %d "
+				      "iterations, not %d" % (kernels, precision,
+				                              len(values), len(scalar)))
+				for i in range(len(values)):
+					check(abs(values[i] - scalar[i])
+					      <= tol * abs(scalar[i]),
+					      "`-k %s -f %s' found %g, not %g, at iteration %d"
+					      % (kernels, precision, values[i], scalar[i],
+					         i + 1))
+				if kernels not in tested:
+					tested.append(kernels)
+	print("kernels: OK (%s)" % ", ".join(tested or ["scalar only"]))
@@ -0,0 +1,47 @@
+"""Smoke run of the single precision: with the same seed, the likelihoods
+of each iteration of the PLSA and of the HMM with the tables in single
+precision (`-f 1') must be the ones in double precision, up to the
+rounding of the floats."""
+import argparse
+import os
+import re
+
+from smoke import ROOT, Workdir, check, run, write_corpus
+
+def trace(out):
+	values = [float(x) for x in
+	          re.findall(r"Iteration \d+: likelihood = (\S+)", out)]
+	check(values, "no iterations in:\n" + out)
+	return values
+
+def compare(name, args, workdir, tol):
+	double = trace(run(args + ["-f", "0"], workdir))
+	single = trace(run(args + ["-f", "1"], workdir))
+	check(len(single) == len(double), "%s: %d iterations in single "
+	      "precision, not %d" % (name, len(single), len(double)))
+	for i in range(len(double)):
+		check(abs(single[i] - double[i]) <= tol * abs(double[i]),
+		      "%s: %g in single precision, not %g, at iteration %d"
+		      % (name, single[i], double[i], i + 1))
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument("--plsa", default = os.path.join(ROOT, "plsa"),
+	                    help = "Name of the plsa program")
+	parser.add_argument("--hmm", default = os.path.join(ROOT, "hmm"),
+	                    help = "Name of the hmm program")
+	parser.add_argument("--seed", type = int, default = 1,
+	                    help = "Seed of the random numbers")
+	parser.add_argument("--tol", type = float, default = 1e-4,
+	                    help = "Relative tolerance of the likelihoods")
+	args = parser.parse_args()
+
+	with Workdir() as workdir:
+		write_corpus(os.path.join(workdir, "train.txt"), 500)
+		common = ["-d", "train.docinfo", "-t", "train.txt", "-e", "0",
+		          "-S", str(args.seed)]
+		compare("plsa", [args.plsa, "-q", "8", "-m", "30"] + common,
+		        workdir, args.tol)
+		compare("hmm", [args.hmm, "-q", "8", "-m", "15"] + common,
+		        workdir, args.tol)
+	print("precision: OK")
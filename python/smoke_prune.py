@@ -0,0 +1,87 @@
+"""Smoke run of the pruning of the topic-word table: with the same seed,
+the sparse training must find the likelihoods of the serial run whatever
+the number of threads and the parallel strategy, keep at most the
+entries asked for, and save a sparse model that loads the same from the
+plain and from the mapped format."""
+import argparse
+import os
+import re
+import shutil
+
+from smoke import ROOT, Workdir, check, run, write_corpus
+
+def trace(out):
+	lines = re.findall(r"Iteration \d+: likelihood = \S+", out)
+	check(lines, "no iterations in:\n" + out)
+	return lines
+
+def results(out):
+	"""The lines of the training and of the folding in."""
+	return [line for line in out.split("\n")
+	        if re.match(r"^(Iteration \d+: likelihood|w\S+: |Likelihood)",
+	                    line)]
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument("--plsa", default = os.path.join(ROOT, "plsa"),
+	                    help = "Name of the plsa program")
+	parser.add_argument("--num_topics", type = int, default = 8,
+	                    help = "Number of topics of the model")
+	parser.add_argument("--threads", default = "3",
+	                    help = "Numbers of threads to compare")
+	parser.add_argument("--seed", type = int, default = 1,
+	                    help = "Seed of the random numbers")
+	args = parser.parse_args()
+
+	with Workdir() as workdir:
+		write_corpus(os.path.join(workdir, "train.txt"), 2000,
+		             args.num_topics)
+		train = [args.plsa, "-d", "train.docinfo", "-t", "train.txt",
+		         "-q", str(args.num_topics), "-e", "0", "-x", "5",
+		         "-S", str(args.seed)]
+
+		for name, prune, top in [("threshold", ["-r", "0.001"], 0),
+		                         ("top", ["-u", "50"], 50),
+		                         ("both", ["-r", "0.0005", "-u", "100"],
+		                          100)]:
+			args_prune = train + prune + ["-m", "40"]
+			out = run(args_prune + ["-j", "1"], workdir)
+			serial = trace(out)
+
+			# Pruned after the iterations 5, 15, 25 and 35
+			kept = re.findall(r"Pruned topic-word table: (\d+) of (\d+) "
+			                  r"entries kept", out)
+			check(len(kept) == 4, "%s: pruned %d times, not 4:\n%s"
+			      % (name, len(kept), out))
+			for entries, total in kept:
+				check(int(entries) < int(total), "%s: nothing was "
+				      "pruned" % name)
+				num_words = int(total) // args.num_topics
+				if top > 0:
+					check(int(entries) <= top * args.num_topics
+					      + num_words, "%s: %s entries kept, more than "
+					      "%d per topic" % (name, entries, top))
+
+			for mode in ["0", "1"]:
+				for threads in args.threads.split(","):
+					lines = trace(run(args_prune + ["-j", threads,
+					                                "-s", mode], workdir))
+					check(lines == serial, "%s: -j %s -s %s differs from "
+					      "the serial run" % (name, threads, mode))
+
+		# The sparse model saved in both formats loads the same
+		run(train + ["-u", "50", "-m", "20", "-p", "sparse.plsa",
+		             "-v", "sparse.map"], workdir)
+		outs = []
+		for model in ["sparse.plsa", "sparse.map"]:
+			shutil.copy(os.path.join(workdir, model),
+			            os.path.join(workdir, "loaded." + model))
+			out = run([args.plsa, "-d", "train.docinfo",
+			           "-p", "loaded." + model, "-m", "5", "-e", "0",
+			           "-w", "5", "-y", "train.txt"], workdir)
+			check("Loading PLSA" in out, "`%s' was not loaded:\n%s"
+			      % (model, out))
+			outs.append(results(out))
+		check(outs[0] and outs[0] == outs[1], "the sparse model loads "
+		      "differently from the plain and from the mapped format")
+	print("prune: OK")
@@ -0,0 +1,111 @@
+"""Smoke run of the checkpoints of the PLSA: a training interrupted and
+resumed must save the same model as a training that was never
+interrupted. Both start from the same checkpoint, since the programs
+draw a new random start on each run."""
+import argparse
+import os
+import re
+import shutil
+import signal
+import subprocess
+import time
+
+from smoke import ROOT, Workdir, check, fail, read_file, run, write_corpus
+
+def interrupt(args, workdir, plsa_file, timeout):
+	"""Trains the model of `plsa_file' with a checkpoint after each
+	iteration (or mini-batch), and stops it with SIGTERM once a new
+	checkpoint was written. Returns the number of iterations it stopped
+	after."""
+	filename = os.path.join(workdir, plsa_file)
+	old = read_file(filename) if os.path.exists(filename) else None
+	proc = subprocess.Popen(args + ["-p", plsa_file, "-m", "1000000",
+	                                "-C", "1"],
+	                        cwd = workdir, stdout = subprocess.PIPE,
+	                        stderr = subprocess.STDOUT)
+	deadline = time.time() + timeout
+	while proc.poll() is None:
+		if os.path.exists(filename) and read_file(filename) != old:
+			proc.send_signal(signal.SIGTERM)
+			break
+		if time.time() > deadline:
+			proc.kill()
+			break
+		time.sleep(0.01)
+	out = proc.communicate()[0].decode("ascii", "replace")
+
+	match = re.search(r"Training interrupted after (\d+) "
+	                  r"(iterations|mini-batches)", out)
+	if not match:
+		fail("the training was not interrupted:\n" + out)
+	return int(match.group(1))
+
+def last_likelihood(out):
+	lines = re.findall(r"Iteration \d+: likelihood = \S+", out)
+	check(lines, "no iterations in:\n" + out)
+	return lines[-1]
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument("--plsa", default = os.path.join(ROOT, "plsa"),
+	                    help = "Name of the plsa program")
+	parser.add_argument("--num_topics", type = int, default = 8,
+	                    help = "Number of topics of the model")
+	parser.add_argument("--threads", type = int, default = 1,
+	                    help = "Number of threads")
+	parser.add_argument("--batch_size", type = int, default = 50,
+	                    help = "Documents per mini-batch of the online EM")
+	parser.add_argument("--seed", type = int, default = 1,
+	                    help = "Seed of the random numbers of the online EM")
+	parser.add_argument("--timeout", type = float, default = 60,
+	                    help = "Seconds to wait for a checkpoint")
+	args = parser.parse_args()
+
+	with Workdir() as workdir:
+		write_corpus(os.path.join(workdir, "train.txt"), 2000,
+		             args.num_topics)
+		train = [args.plsa, "-d", "train.docinfo", "-t", "train.txt",
+		         "-q", str(args.num_topics), "-e", "0",
+		         "-j", str(args.threads)]
+
+		# The common start, then a copy that will be interrupted again
+		first = interrupt(train, workdir, "straight.plsa", args.timeout)
+		shutil.copy(os.path.join(workdir, "straight.plsa"),
+		            os.path.join(workdir, "resumed.plsa"))
+		second = interrupt(train, workdir, "resumed.plsa", args.timeout)
+		check(second > first, "the second run stopped after %d "
+		      "iterations, not after %d" % (second, first))
+
+		max_iter = str(second + 10)
+		out = run(train + ["-p", "straight.plsa", "-m", max_iter],
+		          workdir)
+		check("Resuming the training after %d iterations" % first in out,
+		      "the first checkpoint was not resumed:\n" + out)
+		straight = last_likelihood(out)
+
+		out = run(train + ["-p", "resumed.plsa", "-m", max_iter], workdir)
+		check("Resuming the training after %d iterations" % second in out,
+		      "the second checkpoint was not resumed:\n" + out)
+		resumed = last_likelihood(out)
+
+		check(straight == resumed, "`%s' after the interruption, `%s' "
+		      "without it" % (resumed, straight))
+		check(read_file(os.path.join(workdir, "straight.plsa"))
+		      == read_file(os.path.join(workdir, "resumed.plsa")),
+		      "the models differ")
+
+		# The online EM, resumed in the middle of a pass, against the
+		# same seed never interrupted
+		online = train + ["-b", str(args.batch_size),
+		                  "-S", str(args.seed)]
+		run(online + ["-p", "straight.online", "-m", "3"], workdir)
+		batches = interrupt(online, workdir, "resumed.online",
+		                    args.timeout)
+		out = run(online + ["-p", "resumed.online", "-m", "3"], workdir)
+		check("Resuming the online training after %d mini-batches"
+		      % batches in out,
+		      "the online checkpoint was not resumed:\n" + out)
+		check(read_file(os.path.join(workdir, "straight.online"))
+		      == read_file(os.path.join(workdir, "resumed.online")),
+		      "the online models differ")
+	print("resume: OK")
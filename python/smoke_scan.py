@@ -0,0 +1,115 @@
+"""Smoke run of the SIMD scanners of the reader: the DOCINFO built with
+each kernel the CPU supports must be the one of the scalar scanner, for
+any number of threads. The corpus puts the separators, the tokens and
+the white space at every offset of the 16 and 32-byte blocks."""
+import argparse
+import os
+import random
+import subprocess
+
+from smoke import ROOT, Workdir, check, fail, read_file
+
+# The bytes of the white space, as the reader sees them
+SPACES = " \t\n\v\f\r"
+BLOCK = 32
+
+def write_scan_corpus(filename, num_docs, seed = 1):
+	"""Writes `num_docs' documents with random white space between the
+	tokens, words with dashes and bytes above 127 in them, and runs of
+	dashes that are too short to be separators. Returns the offsets of
+	the starts and of the ends of the separators."""
+	rng = random.Random(seed)
+	data = []
+	size = 0
+	starts = set()
+	ends = set()
+
+	def space():
+		return "".join(rng.choice(SPACES)
+		               for i in range(rng.choice([1, 1, 2, 3, 15, 16,
+		                                          17, 31, 32, 33])))
+
+	def word():
+		length = rng.choice([1, 2, 7, 15, 16, 17, 31, 32, 33])
+		return u"w" + u"".join(rng.choice(u"abc-\xe9")
+		                       for i in range(length - 1))
+
+	for doc in range(num_docs):
+		tokens = ["%d" % (doc + 1)]
+		for i in range(rng.randint(5, 60)):
+			choice = rng.random()
+			if choice < 0.05:
+				tokens.append("-" * rng.randint(1, 7))
+			elif choice < 0.1:
+				tokens.append("-" * rng.randint(8, 12) + "x")
+			else:
+				tokens.append(word())
+		for token in tokens:
+			text = token + space()
+			data.append(text)
+			size += len(text.encode("latin-1"))
+		separator = "-" * rng.choice([8, 15, 16, 17, 31, 32, 33])
+		starts.add(size % BLOCK)
+		ends.add((size + len(separator)) % BLOCK)
+		data.append(separator)
+		size += len(separator)
+		if doc + 1 < num_docs:
+			text = space()
+			data.append(text)
+			size += len(text)
+	# The last separator ends the file without white space after it
+	with open(filename, "wb") as f:
+		f.write(u"".join(data).encode("latin-1"))
+	return starts, ends
+
+def build(args, workdir, kernels, threads):
+	"""Builds the DOCINFO with `kernels' and returns it, or None if this
+	CPU does not support them."""
+	docinfo_file = "train.docinfo.%s.%s" % (kernels, threads)
+	proc = subprocess.Popen([args.plsa, "-d", docinfo_file,
+	                         "-t", "train.txt", "-q", "2", "-m", "0",
+	                         "-k", kernels, "-j", threads],
+	                        cwd = workdir, stdout = subprocess.PIPE,
+	                        stderr = subprocess.STDOUT)
+	out = proc.communicate()[0].decode("ascii", "replace")
+	if proc.returncode != 0:
+		if "not supported by this CPU" in out:
+			return None
+		fail("`-k %s -j %s' exited with %d:\n%s" % (kernels, threads,
+		                                            proc.returncode, out))
+	return read_file(os.path.join(workdir, docinfo_file))
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument("--plsa", default = os.path.join(ROOT, "plsa"),
+	                    help = "Name of the plsa program")
+	parser.add_argument("--kernels", default = "sse2,avx2,avx512",
+	                    help = "Kernels to compare with the scalar ones")
+	parser.add_argument("--threads", default = "1,3,4",
+	                    help = "Numbers of threads to compare")
+	parser.add_argument("--num_docs", type = int, default = 20000,
+	                    help = "Number of documents, enough for several "
+	                           "parts of a megabyte")
+	args = parser.parse_args()
+
+	with Workdir() as workdir:
+		starts, ends = write_scan_corpus(os.path.join(workdir,
+		                                              "train.txt"),
+		                                 args.num_docs)
+		check(len(starts) == BLOCK and len(ends) == BLOCK,
+		      "the separators miss offsets of the blocks")
+
+		scalar = build(args, workdir, "scalar", "1")
+		check(scalar is not None, "no scalar scanner")
+		tested = []
+		for kernels in ["scalar"] + args.kernels.split(","):
+			for threads in args.threads.split(","):
+				data = build(args, workdir, kernels, threads)
+				if data is None:
+					break
+				check(data == scalar, "the DOCINFO of `-k %s -j %s' "
+				      "differs from the one of the scalar scanner"
+				      % (kernels, threads))
+			else:
+				tested.append(kernels)
+	print("scan: OK (%s)" % ", ".join(tested))
@@ -0,0 +1,116 @@
+"""Smoke run of the PLSA server: trains a small model, serves it on a
+Unix socket and checks the replies to DOC, STATS and QUIT."""
+import argparse
+import os
+import signal
+import socket
+import subprocess
+import time
+
+from smoke import ROOT, Workdir, check, fail, run, write_corpus
+
+def connect(path, timeout):
+	deadline = time.time() + timeout
+	while True:
+		sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+		try:
+			sock.connect(path)
+			sock.settimeout(timeout)
+			return sock
+		except socket.error:
+			sock.close()
+			if time.time() > deadline:
+				fail("the server did not listen on `%s'" % path)
+			time.sleep(0.1)
+
+def read_line(f):
+	line = f.readline().decode("ascii")
+	check(line.endswith("\n"), "truncated reply `%s'" % line)
+	return line.rstrip("\n")
+
+def check_topics(reply, num_topics, top_topics):
+	fields = reply.split()
+	check(fields and fields[0] == "OK", "bad reply `%s'" % reply)
+	check(len(fields) == 1 + top_topics, "bad reply `%s'" % reply)
+	total = 0
+	for field in fields[1:]:
+		topic, prob = field.split(":")
+		check(1 <= int(topic) <= num_topics, "bad topic in `%s'" % reply)
+		check(0 <= float(prob) <= 1, "bad probability in `%s'" % reply)
+		total += float(prob)
+	check(total <= 1.001, "the probabilities of `%s' add up to more "
+	      "than one" % reply)
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument("--plsa", default = os.path.join(ROOT, "plsa"),
+	                    help = "Name of the plsa program")
+	parser.add_argument("--num_topics", type = int, default = 8,
+	                    help = "Number of topics of the model")
+	parser.add_argument("--top_topics", type = int, default = 3,
+	                    help = "Number of topics per reply")
+	parser.add_argument("--timeout", type = float, default = 30,
+	                    help = "Seconds to wait for the server")
+	args = parser.parse_args()
+
+	with Workdir() as workdir:
+		write_corpus(os.path.join(workdir, "train.txt"), 200,
+		             args.num_topics)
+		run([args.plsa, "-d", "train.docinfo", "-t", "train.txt",
+		     "-p", "train.plsa", "-q", str(args.num_topics),
+		     "-m", "50", "-e", "0.0001"], workdir)
+
+		path = os.path.join(workdir, "plsa.sock")
+		server = subprocess.Popen([args.plsa, "-d", "train.docinfo",
+		                           "-p", "train.plsa", "-m", "50",
+		                           "-e", "0.0001",
+		                           "-z", str(args.top_topics),
+		                           "-a", "unix:" + path],
+		                          cwd = workdir,
+		                          stdout = subprocess.PIPE,
+		                          stderr = subprocess.STDOUT)
+		try:
+			sock = connect(path, args.timeout)
+			f = sock.makefile("rwb")
+
+			with open(os.path.join(workdir, "train.txt")) as corpus:
+				docs = corpus.read().split("----------------\n")[:10]
+			for doc in docs:
+				words = doc.split()[1:]
+				f.write(("DOC " + " ".join(words) + "\n").encode("ascii"))
+			f.write(b"DOC unknown words only\nBOGUS\nSTATS\nQUIT\n")
+			f.flush()
+
+			for doc in docs:
+				check_topics(read_line(f), args.num_topics,
+				             args.top_topics)
+			reply = read_line(f)
+			check(reply == "OK", "a document of unknown words got "
+			      "`%s'" % reply)
+			reply = read_line(f)
+			check(reply == "ERR unknown command",
+			      "BOGUS got `%s'" % reply)
+
+			stats = {}
+			while True:
+				line = read_line(f)
+				if line == "END": break
+				key, value = line.split()
+				stats[key] = value
+			check(stats.get("documents") == str(len(docs) + 1),
+			      "STATS counted %s documents" % stats.get("documents"))
+			check(stats.get("commands") == str(len(docs) + 3),
+			      "STATS counted %s commands" % stats.get("commands"))
+			check(stats.get("errors") == "1",
+			      "STATS counted %s errors" % stats.get("errors"))
+			check(f.read() == b"", "QUIT did not close the connection")
+			sock.close()
+		finally:
+			if server.poll() is None:
+				server.send_signal(signal.SIGTERM)
+			out = server.communicate()[0].decode("ascii", "replace")
+
+		check(server.returncode == 0,
+		      "the server exited with %d:\n%s" % (server.returncode, out))
+		check("Server stopped" in out, "the server did not stop:\n" + out)
+	print("server: OK")
@@ -0,0 +1,41 @@
+"""Smoke run of the threads of the PLSA: with the same seed, the
+likelihoods of each iteration must be the ones of the serial run,
+whatever the number of threads and the parallel strategy."""
+import argparse
+import os
+import re
+
+from smoke import ROOT, Workdir, check, run, write_corpus
+
+def trace(out):
+	lines = re.findall(r"Iteration \d+: likelihood = \S+", out)
+	check(lines, "no iterations in:\n" + out)
+	return lines
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument("--plsa", default = os.path.join(ROOT, "plsa"),
+	                    help = "Name of the plsa program")
+	parser.add_argument("--threads", default = "2,4",
+	                    help = "Numbers of threads to compare")
+	parser.add_argument("--seed", type = int, default = 1,
+	                    help = "Seed of the random numbers")
+	args = parser.parse_args()
+
+	with Workdir() as workdir:
+		write_corpus(os.path.join(workdir, "train.txt"), 2000)
+		train = [args.plsa, "-d", "train.docinfo", "-t", "train.txt",
+		         "-q", "8", "-m", "30", "-e", "0",
+		         "-S", str(args.seed)]
+
+		serial = trace(run(train + ["-j", "1"], workdir))
+		for mode in ["0", "1"]:
+			for threads in args.threads.split(","):
+				lines = trace(run(train + ["-j", threads, "-s", mode],
+				                  workdir))
+				for i in range(max(len(serial), len(lines))):
+					check(i < len(lines) and i < len(serial)
+					      and lines[i] == serial[i],
+					      "-j %s -s %s differs from the serial run at "
+					      "iteration %d" % (threads, mode, i + 1))
+	print("threads: OK")
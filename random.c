@@ -202,3 +202,26 @@ void genrand_randomize(void)
 	seed = (unsigned long) mytime.tv_nsec;
 	init_genrand((unsigned long) seed);
 }
+
+/* Copies the state of the generator to `state', which has room for
+ * GENRAND_STATE_SIZE words. The words of mt[] have 32 bits.
+ */
+void genrand_get_state(unsigned int *state)
+{
+	int i;
+
+	if (mti == N + 1) init_genrand(5489UL);
+	for (i = 0; i < N; i++)
+		state[i] = (unsigned int) mt[i];
+	state[N] = (unsigned int) mti;
+}
+
+/* Restores the state saved by genrand_get_state() */
+void genrand_set_state(const unsigned int *state)
+{
+	int i;
+
+	for (i = 0; i < N; i++)
+		mt[i] = state[i];
+	mti = (state[N] <= N) ? (int) state[N] : N;
+}
@@ -1,5 +1,8 @@
 #ifndef __RANDOM_H
-#define __RANDON_H
+#define __RANDOM_H
+
+/* Number of words of the state of the generator */
+#define GENRAND_STATE_SIZE 625
 
 /* initializes mt[N] with a seed */
 void init_genrand(unsigned long s);
@@ -34,4 +37,8 @@ double genrand_gauss(void);
 /* Initializes the seed based on the current time */
 void genrand_randomize(void);
 
+/* Copies the state of the generator to `state', and back */
+void genrand_get_state(unsigned int *state);
+void genrand_set_state(const unsigned int *state);
+
 #endif /* __RANDOM_H */
@@ -1,18 +1,40 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "reader.h"
+#include "kernels.h"
 #include "utils.h"
 
 #define INITIAL_BUFFER_SIZE 8192
 
+/* The white space of isspace() in the "C" locale, as for the kernels */
+#define READER_IS_SPACE(c) ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+
 void reader_reset(reader *r)
 {
 	r->filename = NULL;
 	r->buffer = NULL;
-	r->fp = NULL;
+	r->fd = -1;
+	r->data = NULL;
+	r->length = 0;
+	r->pos = 0;
+	r->data_capacity = 0;
+	r->mapped = FALSE;
+	r->end = FALSE;
+	r->scan = NULL;
+	r->num_tokens = 0;
+	r->next_token = 0;
+	r->in_token = FALSE;
+	r->token_dashes = FALSE;
 }
 
 int reader_initialize(reader *r)
@@ -33,16 +55,46 @@ error_init:
 
 int reader_open(reader *r, const char *filename)
 {
+	struct stat st;
+	void *base;
+
 	r->filename = xstrdup(filename);
 	if (!r->filename) goto error_open;
 
-	r->fp = fopen(filename, "rb");
-	if (!r->fp) {
+	r->fd = open(filename, O_RDONLY);
+	if (r->fd < 0) {
 		error("could not open `%s' for reading", filename);
 		goto error_open;
 	}
 
 	r->eof = FALSE;
+	r->pos = 0;
+	r->length = 0;
+	r->end = FALSE;
+	r->scan = kernels_get(KERNEL_DOUBLE)->scan;
+	r->num_tokens = 0;
+	r->next_token = 0;
+	r->in_token = FALSE;
+	r->token_dashes = FALSE;
+	if (fstat(r->fd, &st) == 0 && S_ISREG(st.st_mode)
+	    && st.st_size > 0) {
+		base = mmap(NULL, (size_t) st.st_size, PROT_READ,
+		            MAP_PRIVATE, r->fd, 0);
+		if (base != MAP_FAILED) {
+			posix_madvise(base, (size_t) st.st_size,
+			              POSIX_MADV_SEQUENTIAL);
+			r->data = (char *) base;
+			r->length = (size_t) st.st_size;
+			r->data_capacity = r->length;
+			r->mapped = TRUE;
+			return TRUE;
+		}
+	}
+
+	/* Read by blocks */
+	r->data = (char *) xmalloc(READER_BLOCK_SIZE);
+	if (!r->data) goto error_open;
+	r->data_capacity = READER_BLOCK_SIZE;
 	return TRUE;
 
 error_open:
@@ -56,10 +108,43 @@ void reader_close(reader *r)
 		free(r->filename);
 		r->filename = NULL;
 	}
-	if (r->fp) {
-		fclose(r->fp);
-		r->fp = NULL;
+	if (r->data) {
+		if (r->mapped)
+			munmap(r->data, r->data_capacity);
+		else
+			free(r->data);
+		r->data = NULL;
+	}
+	if (r->fd >= 0) {
+		close(r->fd);
+		r->fd = -1;
 	}
+	r->length = 0;
+	r->pos = 0;
+	r->data_capacity = 0;
+	r->mapped = FALSE;
+	r->num_tokens = 0;
+	r->next_token = 0;
+	r->in_token = FALSE;
+}
+
+/* Restarts a mapped reader at data[start], and stops it at data[end]
+ * (or at the end of the file), as if the file held only these bytes.
+ * Returns FALSE if the file is not mapped.
+ */
+int reader_seek(reader *r, size_t start, size_t end)
+{
+	if (!r->mapped) return FALSE;
+
+	r->length = MIN(end, r->data_capacity);
+	r->pos = MIN(start, r->length);
+	r->eof = FALSE;
+	r->end = FALSE;
+	r->num_tokens = 0;
+	r->next_token = 0;
+	r->in_token = FALSE;
+	r->token_dashes = FALSE;
+	return TRUE;
 }
 
 void reader_cleanup(reader *r)
@@ -71,39 +156,223 @@ void reader_cleanup(reader *r)
 	}
 }
 
+/* Reads the next block of a file that is not mapped, keeping the
+ * bytes from data[*keep] on, which are moved to the start of the
+ * block (and `*keep' to zero). Returns the number of bytes read, zero
+ * at the end of the file, or -1 on errors.
+ */
 static
-int reader_putc(reader *r, char c)
+long reader_fill(reader *r, size_t *keep)
 {
-	if (r->buffer_length >= r->buffer_capacity) {
-		void *ptr = xrealloc(r->buffer, 2 * r->buffer_capacity);
-		if (!ptr) return FALSE;
-		r->buffer_capacity *= 2;
-		r->buffer = (char *) ptr;
+	ssize_t ret;
+	void *ptr;
+
+	if (r->mapped) return 0;
+
+	memmove(r->data, r->data + *keep, r->length - *keep);
+	r->length -= *keep;
+	r->pos -= *keep;
+	*keep = 0;
+
+	/* A token longer than the block */
+	if (r->length == r->data_capacity) {
+		ptr = xrealloc(r->data, 2 * r->data_capacity);
+		if (!ptr) return -1;
+		r->data = (char *) ptr;
+		r->data_capacity *= 2;
 	}
-	r->buffer[r->buffer_length++] = c;
-	return TRUE;
+
+	do {
+		ret = read(r->fd, r->data + r->length,
+		           r->data_capacity - r->length);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		error("could not read `%s': %s", r->filename,
+		      strerror(errno));
+		return -1;
+	}
+	r->length += (size_t) ret;
+	return (long) ret;
 }
 
-char *reader_read(reader *r)
+/* Mask of the bits first, ..., last - 1 */
+#define READER_BITS(first, last) \
+	((((last) >= KERNEL_SCAN_WIDTH) ? ~0U : ((1U << (last)) - 1)) \
+	 & (~0U << (first)))
+
+/* Classifies the `n' bytes (fewer than KERNEL_SCAN_WIDTH) at `p', as
+ * the `scan' kernels do. The bytes past them count as white space.
+ */
+static
+unsigned int reader_scan_tail(const char *p, unsigned int n,
+                              unsigned int *dashes)
 {
-	int c, started;
+	unsigned int i, spaces;
 
-	started = FALSE;
-	r->buffer_length = 0;
-	while (!r->eof) {
-		c = fgetc(r->fp);
-		if (c == EOF) {
-			r->eof = TRUE;
-			break;
+	spaces = ~0U << n;
+	*dashes = 0;
+	for (i = 0; i < n; i++) {
+		if (READER_IS_SPACE(p[i]))
+			spaces |= 1U << i;
+		else if (p[i] == '-')
+			*dashes |= 1U << i;
+	}
+	return spaces;
+}
+
+/* Finds the tokens of the KERNEL_SCAN_WIDTH bytes from data[pos] on,
+ * given their masks. Each change between white space and the other
+ * bytes either starts or ends a token.
+ */
+static
+void reader_split(reader *r, unsigned int spaces, unsigned int dashes)
+{
+	unsigned int i, first, changes, num_tokens;
+	reader_token *token;
+	int in_token;
+
+	/* The byte before counts as white space, unless a token is open */
+	in_token = r->in_token;
+	changes = spaces ^ ((spaces << 1) | ((in_token) ? 0 : 1));
+	num_tokens = r->num_tokens;
+	first = 0;
+	while (changes) {
+		i = (unsigned int) __builtin_ctz(changes);
+		changes &= changes - 1;
+		if (in_token) {
+			token = &r->tokens[num_tokens++];
+			token->start = r->open_start;
+			token->end = r->pos + i;
+			token->dashes = r->open_dashes
+			                && (~dashes & READER_BITS(first, i)) == 0;
+		} else {
+			r->open_start = r->pos + i;
+			r->open_dashes = TRUE;
+			first = i;
 		}
-		if (isspace(c)) {
-			if (started) break;
+		in_token = !in_token;
+	}
+	if (in_token) {
+		r->open_dashes = r->open_dashes
+		                 && (~dashes & READER_BITS(first,
+		                                           KERNEL_SCAN_WIDTH)) == 0;
+	}
+	r->in_token = in_token;
+	r->num_tokens = num_tokens;
+}
+
+/* Finds the tokens of the next bytes, until the batch is full. The
+ * blocks of the files that are not mapped are read when the batch is
+ * empty, as they move the data.
+ */
+static
+int reader_scan(reader *r)
+{
+	unsigned int spaces, dashes;
+	reader_token *token;
+	size_t keep;
+	long ret;
+
+	r->num_tokens = 0;
+	r->next_token = 0;
+	while (r->num_tokens + KERNEL_SCAN_WIDTH <= READER_BATCH) {
+		if (r->length - r->pos >= KERNEL_SCAN_WIDTH) {
+			spaces = r->scan(r->data + r->pos, &dashes);
+		} else if (!r->mapped && !r->end) {
+			if (r->num_tokens > 0) break;
+			keep = (r->in_token) ? r->open_start : r->pos;
+			ret = reader_fill(r, &keep);
+			if (ret < 0) return FALSE;
+			if (ret == 0) r->end = TRUE;
+			if (r->in_token) r->open_start = keep;
+			continue;
+		} else if (r->pos < r->length) {
+			spaces = reader_scan_tail(r->data + r->pos,
+			                          (unsigned int) (r->length
+			                                          - r->pos),
+			                          &dashes);
 		} else {
-			started = TRUE;
-			if (!reader_putc(r, (char) c))
-				return NULL;
+			/* The last token ends with the file */
+			if (r->in_token) {
+				token = &r->tokens[r->num_tokens++];
+				token->start = r->open_start;
+				token->end = r->length;
+				token->dashes = r->open_dashes;
+				r->in_token = FALSE;
+			}
+			r->end = TRUE;
+			break;
 		}
+
+		reader_split(r, spaces, dashes);
+		r->pos = MIN(r->pos + KERNEL_SCAN_WIDTH, r->length);
 	}
-	r->buffer[r->buffer_length] = '\0';
+	return TRUE;
+}
+
+/* Finds the next token, which is at `*token' and has `*length'
+ * characters (not followed by a null character). The token stays
+ * valid until the next call. At the end of the file, `*length' is
+ * zero. Returns FALSE on errors.
+ */
+int reader_next(reader *r, const char **token, unsigned int *length)
+{
+	const reader_token *next;
+
+	*token = NULL;
+	*length = 0;
+	r->token_dashes = FALSE;
+	while (r->next_token == r->num_tokens) {
+		if (r->eof) return TRUE;
+		if (r->end && r->pos >= r->length && !r->in_token) {
+			r->eof = TRUE;
+			return TRUE;
+		}
+		if (!reader_scan(r)) return FALSE;
+	}
+
+	next = &r->tokens[r->next_token++];
+	if (next->end - next->start > UINT_MAX) {
+		error("token too long in `%s'", r->filename);
+		return FALSE;
+	}
+	*token = r->data + next->start;
+	*length = (unsigned int) (next->end - next->start);
+	r->token_dashes = next->dashes;
+	return TRUE;
+}
+
+/* Copies a token to the buffer of the reader, followed by a null
+ * character. The copy stays valid until the next copy.
+ */
+char *reader_string(reader *r, const char *token, unsigned int length)
+{
+	unsigned int capacity;
+	void *ptr;
+
+	capacity = r->buffer_capacity;
+	while (length >= capacity) capacity *= 2;
+	if (capacity != r->buffer_capacity) {
+		ptr = xrealloc(r->buffer, capacity);
+		if (!ptr) return NULL;
+		r->buffer = (char *) ptr;
+		r->buffer_capacity = capacity;
+	}
+	if (length > 0) memcpy(r->buffer, token, length);
+	r->buffer[length] = '\0';
+	r->buffer_length = length;
 	return r->buffer;
 }
+
+/* Returns a copy of the next token, or the empty string at the end
+ * of the file.
+ */
+char *reader_read(reader *r)
+{
+	const char *token;
+	unsigned int length;
+
+	if (!reader_next(r, &token, &length))
+		return NULL;
+	return reader_string(r, token, length);
+}
@@ -1,18 +1,59 @@
-
 #ifndef __READER_H
 #define __READER_H
 
-#include <stdio.h>
+#include <stddef.h>
+
+/* Constants */
+
+/* Number of bytes read at a time from the files that are not mapped */
+#define READER_BLOCK_SIZE         (1 << 20)
+
+/* Number of tokens found at a time */
+#define READER_BATCH              256
 
 /* Data structures and types */
+
+/* The token data[start], ..., data[end - 1], which only has dashes
+ * if `dashes' is set.
+ */
+typedef
+struct reader_token_st {
+	size_t start, end;
+	int dashes;
+} reader_token;
+
+/* Splits a file in tokens separated by white space. A regular file is
+ * mapped in memory, and the tokens point inside the mapping. Other
+ * files (pipes, or files that cannot be mapped) are read by blocks of
+ * READER_BLOCK_SIZE bytes, and the tokens point inside the block. The
+ * bytes are classified KERNEL_SCAN_WIDTH at a time by the `scan'
+ * kernel, and the boundaries of the tokens are taken from the changes
+ * of class in the resulting masks, up to READER_BATCH tokens at a time.
+ */
 typedef
 struct reader_st {
 	char *filename;
-	char *buffer;
+	char *buffer; /* the token copied by reader_read() */
 	unsigned int buffer_capacity;
 	unsigned int buffer_length;
 	int eof;
-	FILE *fp;
+	int fd;
+
+	/* The bytes data[pos], ..., data[length - 1] are not scanned yet */
+	char *data;
+	size_t length, pos;
+	size_t data_capacity; /* of the block, or of the mapping */
+	int mapped, end;
+
+	unsigned int (*scan)(const char *p, unsigned int *dashes);
+	reader_token tokens[READER_BATCH];
+	unsigned int num_tokens, next_token;
+
+	/* The token that goes on past the bytes scanned, if `in_token' */
+	int in_token, open_dashes;
+	size_t open_start;
+
+	int token_dashes; /* the last token only has dashes */
 } reader;
 
 /* Functions */
@@ -20,7 +61,10 @@ void reader_reset(reader *r);
 int reader_initialize(reader *r);
 int reader_open(reader *r, const char *filename);
 void reader_close(reader *r);
+int reader_seek(reader *r, size_t start, size_t end);
 void reader_cleanup(reader *r);
+int reader_next(reader *r, const char **token, unsigned int *length);
+char *reader_string(reader *r, const char *token, unsigned int length);
 char *reader_read(reader *r);
 
 #endif /* __READER_H */
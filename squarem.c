@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "squarem.h"
+#include "kernels.h"
+#include "utils.h"
+
+/* The largest step grows by this factor whenever a step of that
+ * size is accepted, and shrinks by it after a rejection.
+ */
+#define SQUAREM_STEP_FACTOR 4
+
+void squarem_reset(squarem *sq)
+{
+	unsigned int i;
+
+	for (i = 0; i < SQUAREM_MAX_TABLES; i++) {
+		sq->lengths[i] = 0;
+		sq->saved0[i] = NULL;
+		sq->saved1[i] = NULL;
+	}
+	sq->precision = KERNEL_DOUBLE;
+	sq->num_tables = 0;
+	sq->phase = 0;
+}
+
+int squarem_initialize(squarem *sq, int precision, unsigned int num_tables)
+{
+	squarem_reset(sq);
+	if (num_tables > SQUAREM_MAX_TABLES) {
+		error("too many tables for SQUAREM");
+		return FALSE;
+	}
+	sq->precision = precision;
+	sq->num_tables = num_tables;
+	sq->alpha = -1;
+	sq->step_max = 1;
+	sq->num_accepted = 0;
+	sq->num_rejected = 0;
+	squarem_restart(sq);
+	return TRUE;
+}
+
+void squarem_cleanup(squarem *sq)
+{
+	unsigned int i;
+
+	for (i = 0; i < SQUAREM_MAX_TABLES; i++) {
+		if (sq->saved0[i]) free(sq->saved0[i]);
+		if (sq->saved1[i]) free(sq->saved1[i]);
+	}
+	squarem_reset(sq);
+}
+
+/* Starts a new cycle from the current parameters, for instance
+ * after the layout of the tables changed.
+ */
+void squarem_restart(squarem *sq)
+{
+	sq->phase = 0;
+}
+
+/* Returns TRUE if the tables hold extrapolated parameters that were
+ * not checked yet.
+ */
+int squarem_pending(const squarem *sq)
+{
+	return (sq->phase == 2);
+}
+
+static
+int squarem_allocate(squarem *sq, const size_t *lengths)
+{
+	unsigned int i;
+	size_t size;
+
+	for (i = 0; i < sq->num_tables; i++) {
+		if (sq->saved0[i] && sq->lengths[i] == lengths[i])
+			continue;
+
+		if (sq->saved0[i]) free(sq->saved0[i]);
+		if (sq->saved1[i]) free(sq->saved1[i]);
+		sq->saved1[i] = NULL;
+
+		size = MAX(lengths[i], 1) * KERNEL_SIZE(sq->precision);
+		sq->saved0[i] = xmalloc(size);
+		if (!sq->saved0[i]) return FALSE;
+
+		sq->saved1[i] = xmalloc(size);
+		if (!sq->saved1[i]) return FALSE;
+
+		sq->lengths[i] = lengths[i];
+	}
+	return TRUE;
+}
+
+/* Replaces t2 in `tables' by the extrapolated parameters, and keeps
+ * t2 in `saved1'. Entries extrapolated below zero keep their value
+ * of t2: a zero would never recover under the multiplicative updates
+ * of the EM.
+ */
+static
+void squarem_extrapolate(squarem *sq, void **tables)
+{
+	unsigned int i;
+	size_t k;
+	double t0, t1, t2, r, v, rr, vv, val;
+
+	rr = 0;
+	vv = 0;
+	for (i = 0; i < sq->num_tables; i++) {
+		for (k = 0; k < sq->lengths[i]; k++) {
+			t0 = KERNEL_LOAD(sq->precision, sq->saved0[i], k);
+			t1 = KERNEL_LOAD(sq->precision, sq->saved1[i], k);
+			t2 = KERNEL_LOAD(sq->precision, tables[i], k);
+			r = t1 - t0;
+			v = t2 - 2 * t1 + t0;
+			rr += r * r;
+			vv += v * v;
+		}
+	}
+
+	sq->alpha = (vv > 0) ? -sqrt(rr / vv) : -1;
+	sq->alpha = MAX(-sq->step_max, MIN(-1, sq->alpha));
+	for (i = 0; i < sq->num_tables; i++) {
+		for (k = 0; k < sq->lengths[i]; k++) {
+			t0 = KERNEL_LOAD(sq->precision, sq->saved0[i], k);
+			t1 = KERNEL_LOAD(sq->precision, sq->saved1[i], k);
+			t2 = KERNEL_LOAD(sq->precision, tables[i], k);
+			r = t1 - t0;
+			v = t2 - 2 * t1 + t0;
+			val = t0 - 2 * sq->alpha * r
+			      + sq->alpha * sq->alpha * v;
+			KERNEL_STORE(sq->precision, sq->saved1[i], k, t2);
+			KERNEL_STORE(sq->precision, tables[i], k,
+			             (val > 0) ? val : t2);
+		}
+	}
+}
+
+/* Advances the extrapolation after one iteration, which moved the
+ * parameters from `previous' to `tables' and reported `likelihood'
+ * for the parameters in `previous'. The outcome is stored in `status':
+ * if it is SQUAREM_EXTRAPOLATED, the tables were replaced by the
+ * extrapolated parameters and must be normalized by the caller; if it
+ * is SQUAREM_REJECTED, they were restored to the last iterate of the
+ * plain iteration.
+ */
+int squarem_update(squarem *sq, void **tables, void **previous,
+                   const size_t *lengths, double likelihood, int *status)
+{
+	unsigned int i;
+	size_t size;
+
+	*status = SQUAREM_NONE;
+	for (i = 0; i < sq->num_tables; i++) {
+		if (sq->phase > 0 && sq->lengths[i] != lengths[i])
+			squarem_restart(sq);
+	}
+
+	switch (sq->phase) {
+	case 0:
+		if (!squarem_allocate(sq, lengths))
+			return FALSE;
+		for (i = 0; i < sq->num_tables; i++) {
+			size = lengths[i] * KERNEL_SIZE(sq->precision);
+			memcpy(sq->saved0[i], previous[i], size);
+			memcpy(sq->saved1[i], tables[i], size);
+		}
+		sq->phase = 1;
+		break;
+
+	case 1:
+		sq->likelihood = likelihood;
+		squarem_extrapolate(sq, tables);
+		*status = SQUAREM_EXTRAPOLATED;
+		sq->phase = 2;
+		break;
+
+	default:
+		if (likelihood >= sq->likelihood) {
+			if (sq->alpha <= -sq->step_max)
+				sq->step_max *= SQUAREM_STEP_FACTOR;
+			sq->num_accepted++;
+			*status = SQUAREM_ACCEPTED;
+		} else {
+			for (i = 0; i < sq->num_tables; i++) {
+				size = lengths[i] * KERNEL_SIZE(sq->precision);
+				memcpy(tables[i], sq->saved1[i], size);
+			}
+			sq->step_max = MAX(1, sq->step_max
+			                      / SQUAREM_STEP_FACTOR);
+			sq->num_rejected++;
+			*status = SQUAREM_REJECTED;
+		}
+		sq->phase = 0;
+		break;
+	}
+	return TRUE;
+}
+
+/* Restores the last iterate of the plain iteration if the tables
+ * hold extrapolated parameters that were not checked.
+ */
+void squarem_finish(squarem *sq, void **tables)
+{
+	unsigned int i;
+
+	if (sq->phase == 2) {
+		for (i = 0; i < sq->num_tables; i++) {
+			memcpy(tables[i], sq->saved1[i], sq->lengths[i]
+			       * KERNEL_SIZE(sq->precision));
+		}
+	}
+	sq->phase = 0;
+}
+
+/* Ends the line of an iteration with the outcome of the update */
+void squarem_print_status(const squarem *sq, int status)
+{
+	switch (status) {
+	case SQUAREM_EXTRAPOLATED:
+		printf(" (extrapolated, alpha = %.3g)\n", sq->alpha);
+		break;
+	case SQUAREM_ACCEPTED:
+		printf(" (accepted)\n");
+		break;
+	case SQUAREM_REJECTED:
+		printf(" (rejected)\n");
+		break;
+	default:
+		printf("\n");
+		break;
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef __SQUAREM_H
+#define __SQUAREM_H
+
+#include <stddef.h>
+
+/* Constants */
+#define SQUAREM_MAX_TABLES        4
+
+/* Outcome of squarem_update() */
+#define SQUAREM_NONE              0
+#define SQUAREM_EXTRAPOLATED      1
+#define SQUAREM_ACCEPTED          2
+#define SQUAREM_REJECTED          3
+
+/* Data structures and types */
+
+/* Squared extrapolation (SQUAREM) of a fixed-point iteration such as
+ * the EM. From three consecutive iterates t0, t1 = F(t0), t2 = F(t1),
+ * with r = t1 - t0 and v = t2 - 2 t1 + t0, the parameters jump to
+ * t0 - 2 alpha r + alpha^2 v, where alpha = -|r| / |v|. The next
+ * iteration is accepted only if it does not decrease the likelihood,
+ * otherwise the parameters fall back to t2.
+ */
+typedef
+struct squarem_st {
+	int precision; /* KERNEL_DOUBLE or KERNEL_FLOAT */
+	unsigned int num_tables;
+	size_t lengths[SQUAREM_MAX_TABLES];
+
+	/* saved0 holds t0; saved1 holds t1, and t2 after extrapolating */
+	void *saved0[SQUAREM_MAX_TABLES];
+	void *saved1[SQUAREM_MAX_TABLES];
+
+	int phase;
+	double likelihood;
+	double alpha, step_max;
+	unsigned int num_accepted, num_rejected;
+} squarem;
+
+/* Functions */
+void squarem_reset(squarem *sq);
+int squarem_initialize(squarem *sq, int precision, unsigned int num_tables);
+void squarem_cleanup(squarem *sq);
+
+void squarem_restart(squarem *sq);
+int squarem_pending(const squarem *sq);
+int squarem_update(squarem *sq, void **tables, void **previous,
+                   const size_t *lengths, double likelihood, int *status);
+void squarem_finish(squarem *sq, void **tables);
+void squarem_print_status(const squarem *sq, int status);
+
+#endif /* __SQUAREM_H */
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "topk.h"
+#include "kernels.h"
+#include "utils.h"
+
+/* Checks whether `a' ranks below `b' */
+#define TOPK_BELOW(a, b) \
+	((a)->val < (b)->val || ((a)->val == (b)->val && (a)->idx > (b)->idx))
+
+/* Moves the item at `pos' down to its place in the heap */
+static
+void topk_sift_down(topk_item *heap, unsigned int length, unsigned int pos)
+{
+	unsigned int child;
+	topk_item item;
+
+	item = heap[pos];
+	while ((child = 2 * pos + 1) < length) {
+		if (child + 1 < length
+		    && TOPK_BELOW(&heap[child + 1], &heap[child]))
+			child++;
+		if (!TOPK_BELOW(&heap[child], &item))
+			break;
+		heap[pos] = heap[child];
+		pos = child;
+	}
+	heap[pos] = item;
+}
+
+void topk_push(topk_item *heap, unsigned int *length, unsigned int k,
+               unsigned int idx, double val)
+{
+	unsigned int pos, parent;
+	topk_item item;
+
+	item.idx = idx;
+	item.val = val;
+	if (*length == k) {
+		if (k == 0 || !TOPK_BELOW(&heap[0], &item))
+			return;
+		heap[0] = item;
+		topk_sift_down(heap, k, 0);
+		return;
+	}
+
+	pos = (*length)++;
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (!TOPK_BELOW(&item, &heap[parent]))
+			break;
+		heap[pos] = heap[parent];
+		pos = parent;
+	}
+	heap[pos] = item;
+}
+
+/* Pushes the `n' items of `items' in the heap */
+void topk_merge(topk_item *heap, unsigned int *length, unsigned int k,
+                const topk_item *items, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		topk_push(heap, length, k, items[i].idx, items[i].val);
+}
+
+/* Sorts the heap in decreasing order, in place */
+void topk_sort(topk_item *heap, unsigned int length)
+{
+	topk_item item;
+
+	while (length > 1) {
+		length--;
+		item = heap[0];
+		heap[0] = heap[length];
+		heap[length] = item;
+		topk_sift_down(heap, length, 0);
+	}
+}
+
+/* Stores the `k' largest of the `n' elements of type `type' of `row'
+ * in `top', in decreasing order, and returns their number.
+ */
+unsigned int topk_row(int type, const void *row, unsigned int n,
+                      unsigned int k, topk_item *top)
+{
+	unsigned int i, length;
+
+	length = 0;
+	k = MIN(k, n);
+	for (i = 0; i < n; i++)
+		topk_push(top, &length, k, i, KERNEL_LOAD(type, row, i));
+	topk_sort(top, length);
+	return length;
+}
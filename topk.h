@@ -0,0 +1,28 @@
+#ifndef __TOPK_H
+#define __TOPK_H
+
+#include <stddef.h>
+
+/* Data structures and types */
+typedef
+struct topk_item_st {
+	unsigned int idx;
+	double val;
+} topk_item;
+
+/* Functions */
+
+/* The `k' largest values seen so far are kept in a heap of at most
+ * `k' items, whose root is the smallest of them. Equal values are
+ * ordered by index, the smallest index first.
+ */
+void topk_push(topk_item *heap, unsigned int *length, unsigned int k,
+               unsigned int idx, double val);
+void topk_merge(topk_item *heap, unsigned int *length, unsigned int k,
+                const topk_item *items, unsigned int n);
+void topk_sort(topk_item *heap, unsigned int length);
+
+unsigned int topk_row(int type, const void *row, unsigned int n,
+                      unsigned int k, topk_item *top);
+
+#endif /* __TOPK_H */
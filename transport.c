@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "transport.h"
+#include "utils.h"
+
+static
+int transport_unix_address(const char *address, struct sockaddr_un *sun)
+{
+	if (strlen(address) == 0 || strlen(address) >= sizeof(sun->sun_path)) {
+		error("invalid socket path `%s'", address);
+		errno = EINVAL;
+		return FALSE;
+	}
+	memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	strcpy(sun->sun_path, address);
+	return TRUE;
+}
+
+static
+int transport_unix_listen(const char *address, char **unix_path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	if (!transport_unix_address(address, &sun))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	unlink(address);
+	if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	*unix_path = xstrdup(address);
+	if (!*unix_path) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static
+int transport_unix_connect(const char *address)
+{
+	struct sockaddr_un sun;
+	int fd, err;
+
+	if (!transport_unix_address(address, &sun))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	if (connect(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	return fd;
+}
+
+/* Parses "PORT", for the loopback interface, or "HOST:PORT", where
+ * HOST is an IPv4 address.
+ */
+static
+int transport_tcp_address(const char *address, struct sockaddr_in *sin)
+{
+	const char *port_str;
+	char host[64];
+	unsigned long port;
+	size_t len;
+	char *end;
+
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	port_str = strrchr(address, ':');
+	if (port_str) {
+		len = (size_t) (port_str - address);
+		if (len >= sizeof(host)) goto error_address;
+		memcpy(host, address, len);
+		host[len] = '\0';
+		if (inet_pton(AF_INET, host, &sin->sin_addr) != 1)
+			goto error_address;
+		port_str++;
+	} else {
+		port_str = address;
+	}
+
+	port = strtoul(port_str, &end, 10);
+	if (end == port_str || *end != '\0' || port > 65535)
+		goto error_address;
+	sin->sin_port = htons((unsigned short) port);
+	return TRUE;
+
+error_address:
+	error("invalid address `%s' (use PORT or HOST:PORT)", address);
+	errno = EINVAL;
+	return FALSE;
+}
+
+static
+int transport_tcp_listen(const char *address, char **unix_path)
+{
+	struct sockaddr_in sin;
+	int fd, one = 1;
+
+	*unix_path = NULL;
+	if (!transport_tcp_address(address, &sin))
+		return -1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *) &sin, sizeof(sin)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static
+int transport_tcp_connect(const char *address)
+{
+	struct sockaddr_in sin;
+	int fd, err, one = 1;
+
+	if (!transport_tcp_address(address, &sin))
+		return -1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	if (connect(fd, (struct sockaddr *) &sin, sizeof(sin)) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+static const transport_ops transports[] = {
+	{ "unix:", &transport_unix_listen, &transport_unix_connect },
+	{ "tcp:", &transport_tcp_listen, &transport_tcp_connect },
+};
+
+/* Returns the transport of `address', or NULL */
+const transport_ops *transport_find(const char *address)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(transports) / sizeof(transport_ops); i++) {
+		if (strncmp(address, transports[i].prefix,
+		            strlen(transports[i].prefix)) == 0)
+			return &transports[i];
+	}
+	error("invalid address `%s' (use unix:PATH or tcp:[HOST:]PORT)",
+	      address);
+	return NULL;
+}
+
+/* Listens on `address', which is either "unix:PATH" for a local
+ * socket or "tcp:[HOST:]PORT" (the loopback interface by default).
+ */
+int transport_listen(const char *address, char **unix_path)
+{
+	const transport_ops *ops;
+	int fd;
+
+	*unix_path = NULL;
+	ops = transport_find(address);
+	if (!ops) return -1;
+
+	fd = ops->listen(address + strlen(ops->prefix), unix_path);
+	if (fd < 0) goto error_listen;
+
+	if (listen(fd, 64) < 0) {
+		close(fd);
+		goto error_listen;
+	}
+	return fd;
+
+error_listen:
+	error("could not listen on `%s': %s", address, strerror(errno));
+	if (*unix_path) {
+		unlink(*unix_path);
+		free(*unix_path);
+		*unix_path = NULL;
+	}
+	return -1;
+}
+
+/* Connects to `address'. Errors are left to the caller, which may
+ * retry while the other end is starting.
+ */
+int transport_connect(const char *address)
+{
+	const transport_ops *ops;
+
+	ops = transport_find(address);
+	if (!ops) {
+		errno = EINVAL;
+		return -1;
+	}
+	return ops->connect(address + strlen(ops->prefix));
+}
+
+/* Sends the `size' bytes of `data' on a blocking socket. A peer that
+ * went away is reported as an error, not by SIGPIPE.
+ */
+int transport_send(int fd, const void *data, size_t size)
+{
+	const char *ptr = (const char *) data;
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = send(fd, ptr, size, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			error("could not send: %s", strerror(errno));
+			return FALSE;
+		}
+		ptr += ret;
+		size -= (size_t) ret;
+	}
+	return TRUE;
+}
+
+/* Receives exactly `size' bytes on a blocking socket */
+int transport_recv(int fd, void *data, size_t size)
+{
+	char *ptr = (char *) data;
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = recv(fd, ptr, size, 0);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			error("could not receive: %s", strerror(errno));
+			return FALSE;
+		}
+		if (ret == 0) {
+			error("connection closed by peer");
+			return FALSE;
+		}
+		ptr += ret;
+		size -= (size_t) ret;
+	}
+	return TRUE;
+}
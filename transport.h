@@ -0,0 +1,31 @@
+#ifndef __TRANSPORT_H
+#define __TRANSPORT_H
+
+#include <stddef.h>
+
+/* Data structures and types */
+
+/* A kind of stream socket, selected by the prefix of the address */
+typedef
+struct transport_ops_st {
+	const char *prefix;
+
+	/* Returns a listening socket, or -1. Sockets bound to a path
+	 * store a copy of the path in `unix_path', to be unlinked.
+	 */
+	int (*listen)(const char *address, char **unix_path);
+
+	/* Returns a connected socket, or -1 with errno set */
+	int (*connect)(const char *address);
+} transport_ops;
+
+/* Functions */
+const transport_ops *transport_find(const char *address);
+
+int transport_listen(const char *address, char **unix_path);
+int transport_connect(const char *address);
+
+int transport_send(int fd, const void *data, size_t size);
+int transport_recv(int fd, void *data, size_t size);
+
+#endif /* __TRANSPORT_H */
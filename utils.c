@@ -3,6 +3,9 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "utils.h"
 #include "random.h"
@@ -17,6 +20,15 @@ void error(const char *fmt, ...)
 	va_end(ap);
 }
 
+/* Returns the time in seconds from an arbitrary starting point */
+double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
 void *xmalloc(size_t size)
 {
 	void *ptr = malloc(size);
@@ -42,6 +54,56 @@ char *xstrdup(const char *str)
 	return s;
 }
 
+/* Opens a temporary file next to `filename' for writing. The file
+ * replaces `filename' only when atomic_fclose() commits it, so the
+ * previous contents survive a failure in the middle of the writing.
+ */
+FILE *atomic_fopen(const char *filename, char **temp_filename)
+{
+	FILE *fp;
+
+	*temp_filename = (char *) xmalloc(strlen(filename) + 5);
+	if (!*temp_filename) return NULL;
+	sprintf(*temp_filename, "%s.tmp", filename);
+
+	fp = fopen(*temp_filename, "wb");
+	if (!fp) {
+		error("could not open `%s' for writing", *temp_filename);
+		free(*temp_filename);
+		*temp_filename = NULL;
+	}
+	return fp;
+}
+
+/* Closes the file opened by atomic_fopen(). If `commit' is TRUE, the
+ * file is flushed to the disk and renamed to `filename', otherwise it
+ * is removed. Frees `temp_filename'.
+ */
+int atomic_fclose(FILE *fp, char *temp_filename, const char *filename,
+                  int commit)
+{
+	int ret = TRUE;
+
+	if (commit) {
+		if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+			ret = FALSE;
+	}
+	if (fclose(fp) != 0) ret = FALSE;
+
+	if (commit && ret) {
+		if (rename(temp_filename, filename) != 0)
+			ret = FALSE;
+	}
+	if (commit && !ret) {
+		error("could not write `%s': %s", filename,
+		      strerror(errno));
+	}
+
+	if (!commit || !ret) unlink(temp_filename);
+	free(temp_filename);
+	return (commit && ret);
+}
+
 static
 void swap_memory(void *ptr1, void *ptr2, size_t size)
 {
@@ -2,6 +2,7 @@
 #ifndef __UTILS_H
 #define __UTILS_H
 
+#include <stdio.h>
 #include <stddef.h>
 
 /* Useful macros */
@@ -17,10 +18,15 @@
 
 /* Functions */
 void error(const char *fmt, ...);
+double get_time(void);
 void *xmalloc(size_t size);
 void *xrealloc(void *ptr, size_t size);
 char *xstrdup(const char *str);
 
+FILE *atomic_fopen(const char *filename, char **temp_filename);
+int atomic_fclose(FILE *fp, char *temp_filename, const char *filename,
+                  int commit);
+
 void xsort(void *ptr, size_t nmemb, size_t size,
            int (*cmpfunc)(const void *, const void *, void *), void *arg);
 
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vocab.h"
+#include "utils.h"
+
+/* Number of bits of the ranks sorted by each pass of vocab_freeze() */
+#define RADIX_BITS                16
+
+/* A word of the vocabulary, as sorted by vocab_freeze() */
+typedef
+struct vocab_item_st {
+	unsigned int rank;
+	unsigned int id;
+	unsigned int count;
+	const char *str;
+} vocab_item;
+
+void vocab_reset(vocab *v)
+{
+	unsigned int i;
+
+	for (i = 0; i < VOCAB_NUM_SHARDS; i++)
+		hashtable_reset(&v->shards[i].ht);
+	v->num_shards = 0;
+	v->num_words = 0;
+}
+
+int vocab_initialize(vocab *v)
+{
+	vocab_shard *shard;
+
+	vocab_reset(v);
+	while (v->num_shards < VOCAB_NUM_SHARDS) {
+		shard = &v->shards[v->num_shards];
+		if (!hashtable_initialize(&shard->ht)) goto error_init;
+		if (pthread_mutex_init(&shard->mutex, NULL) != 0) {
+			error("could not create mutex");
+			hashtable_cleanup(&shard->ht);
+			goto error_init;
+		}
+		v->num_shards++;
+	}
+	return TRUE;
+
+error_init:
+	vocab_cleanup(v);
+	return FALSE;
+}
+
+void vocab_cleanup(vocab *v)
+{
+	unsigned int i;
+
+	for (i = 0; i < v->num_shards; i++) {
+		pthread_mutex_destroy(&v->shards[i].mutex);
+		hashtable_cleanup(&v->shards[i].ht);
+	}
+	vocab_reset(v);
+}
+
+/* Adds `count' occurrences of the word of `len' characters at `str',
+ * with the rank `rank'. Several threads may add words at the same
+ * time. Returns the id of the word (counting from one), or zero on
+ * errors.
+ */
+unsigned int vocab_add(vocab *v, const char *str, unsigned int len,
+                       unsigned int count, unsigned int rank)
+{
+	vocab_shard *shard;
+	hashtable_entry *entry;
+	unsigned int id, num_entries;
+
+	/* The tables of the shards take the low bits of the hash */
+	shard = &v->shards[(unsigned int) (hashtable_hash_n(str, len) >> 56)
+	                   % VOCAB_NUM_SHARDS];
+
+	pthread_mutex_lock(&shard->mutex);
+	num_entries = hashtable_num_entries(&shard->ht);
+	entry = hashtable_find_n(&shard->ht, str, len, TRUE);
+	id = 0;
+	if (entry) {
+		if (hashtable_num_entries(&shard->ht) > num_entries) {
+			entry->val.uintval = __sync_add_and_fetch(&v->num_words,
+			                                          1U);
+			entry->extra.uintval = rank;
+			entry->count = count;
+		} else {
+			entry->count += count - 1;
+			entry->extra.uintval = MIN(entry->extra.uintval, rank);
+		}
+		id = entry->val.uintval;
+	}
+	pthread_mutex_unlock(&shard->mutex);
+	return id;
+}
+
+unsigned int vocab_num_words(const vocab *v)
+{
+	return v->num_words;
+}
+
+/* Sorts the `n' items by rank, RADIX_BITS bits at a time, using
+ * `temp' to hold as many items.
+ */
+static
+void vocab_sort(vocab_item *items, vocab_item *temp, unsigned int n,
+                unsigned int *counts)
+{
+	unsigned int i, shift, pos, size, sum;
+	vocab_item *swap;
+
+	size = 1U << RADIX_BITS;
+	for (shift = 0; shift < 32; shift += RADIX_BITS) {
+		memset(counts, 0, size * sizeof(unsigned int));
+		for (i = 0; i < n; i++)
+			counts[(items[i].rank >> shift) & (size - 1)]++;
+
+		sum = 0;
+		for (i = 0; i < size; i++) {
+			pos = counts[i];
+			counts[i] = sum;
+			sum += pos;
+		}
+		for (i = 0; i < n; i++)
+			temp[counts[(items[i].rank >> shift) & (size - 1)]++]
+				= items[i];
+
+		swap = items;
+		items = temp;
+		temp = swap;
+	}
+}
+
+/* Adds the words to `ht' in the order of their ranks, with their
+ * counts, and stores in `map[id]' the index of the entry of each word
+ * in `ht'. `map' has vocab_num_words() + 1 elements. The words of
+ * different ranks come out in a single order. No words may be added
+ * at the same time.
+ */
+int vocab_freeze(const vocab *v, hashtable *ht, unsigned int *map)
+{
+	const vocab_shard *shard;
+	const hashtable_entry *entry;
+	hashtable_entry *other;
+	vocab_item *items, *item;
+	unsigned int i, e, n, *counts;
+
+	/* The items, then as many for the sort, then its counters */
+	items = (vocab_item *) xmalloc(2 * (v->num_words + 1)
+	                               * sizeof(vocab_item));
+	if (!items) return FALSE;
+	counts = (unsigned int *) xmalloc((1U << RADIX_BITS)
+	                                  * sizeof(unsigned int));
+	if (!counts) {
+		free(items);
+		return FALSE;
+	}
+
+	n = 0;
+	for (i = 0; i < v->num_shards; i++) {
+		shard = &v->shards[i];
+		for (e = 1; e <= hashtable_num_entries(&shard->ht); e++) {
+			entry = hashtable_get_entry(&shard->ht, e);
+			item = &items[n++];
+			item->rank = entry->extra.uintval;
+			item->id = entry->val.uintval;
+			item->count = entry->count;
+			item->str = hashtable_str(&shard->ht, entry);
+		}
+	}
+
+	/* An even number of passes leaves the items in place */
+	vocab_sort(items, &items[v->num_words + 1], n, counts);
+	free(counts);
+
+	map[0] = 0;
+	for (i = 0; i < n; i++) {
+		item = &items[i];
+		other = hashtable_find(ht, item->str, TRUE);
+		if (!other) {
+			free(items);
+			return FALSE;
+		}
+		other->count += item->count - 1;
+		map[item->id] = hashtable_get_entry_idx(ht, other);
+	}
+	free(items);
+	return TRUE;
+}
@@ -0,0 +1,49 @@
+#ifndef __VOCAB_H
+#define __VOCAB_H
+
+#include <pthread.h>
+#include "hashtable.h"
+
+/* Constants */
+
+/* Number of shards of a vocabulary, a power of two */
+#define VOCAB_NUM_SHARDS          64
+
+/* Data structures and types */
+
+/* The words of a vocabulary with some bits of hash, behind a lock of
+ * their own. The entries hold the id of their word in `val' and its
+ * rank in `extra'.
+ */
+typedef
+struct vocab_shard_st {
+	pthread_mutex_t mutex;
+	hashtable ht;
+} vocab_shard;
+
+/* A vocabulary to which several threads add words at the same time.
+ * The words are spread over the shards by their hash, so the threads
+ * only wait for each other when they add words of the same shard at
+ * the same time. Each new word takes the next id, and keeps the
+ * smallest rank it was added with. Once the threads are done, the
+ * vocabulary is frozen into a hashtable in the order of the ranks,
+ * which does not depend on the order the threads added the words in.
+ */
+typedef
+struct vocab_st {
+	vocab_shard shards[VOCAB_NUM_SHARDS];
+	unsigned int num_shards; /* the shards initialized */
+	unsigned int num_words; /* the last id, taken atomically */
+} vocab;
+
+/* Functions */
+void vocab_reset(vocab *v);
+int vocab_initialize(vocab *v);
+void vocab_cleanup(vocab *v);
+
+unsigned int vocab_add(vocab *v, const char *str, unsigned int len,
+                       unsigned int count, unsigned int rank);
+unsigned int vocab_num_words(const vocab *v);
+int vocab_freeze(const vocab *v, hashtable *ht, unsigned int *map);
+
+#endif /* __VOCAB_H */